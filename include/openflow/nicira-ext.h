@@ -117,6 +117,7 @@ enum nicira_type {
 
     NXT_SET_ASYNC_CONFIG = 19,  /* struct nx_async_config. */
     NXT_SET_CONTROLLER_ID = 20, /* struct nx_controller_id. */
+    NXT_FLOW_MOD_BATCH = 21,    /* struct nx_flow_mod_batch. */
 };
 
 /* Header for Nicira vendor stats request and reply messages. */
@@ -1951,6 +1952,35 @@ struct nx_controller_id {
 };
 OFP_ASSERT(sizeof(struct nx_controller_id) == 24);
 
+/* NXT_FLOW_MOD_BATCH.
+ *
+ * Applies a sequence of flow table modifications as a unit.  The header is
+ * followed by any number of complete OFPT_FLOW_MOD and NXT_FLOW_MOD messages,
+ * each with its own ofp_header, whose lengths must be multiples of 8 bytes.
+ * The flow_mods are interpreted in the flow format that is in effect on the
+ * connection, as if they had been sent separately, except that they may not
+ * refer to a buffered packet: their buffer_id must be UINT32_MAX.  The
+ * 'xid's of the flow_mods are ignored.
+ *
+ * The switch decodes every flow_mod in the batch before it applies any of
+ * them, so a batch that contains a malformed flow_mod changes nothing.  It
+ * then applies the flow_mods in order, without processing any other OpenFlow
+ * message in between, and revalidates the affected datapath flows only once,
+ * after the whole batch.  Sending many flow_mods as a few batches is
+ * therefore much faster than sending them one by one.
+ *
+ * If a flow_mod fails while it is being applied, for example because a flow
+ * table is full, then the switch does not apply the rest of the batch and
+ * sends an error reply that refers to the flow_mod that failed.  The
+ * flow_mods that precede it in the batch remain in effect.  Thus, a batch is
+ * atomic with respect to errors in its contents, but not with respect to
+ * errors that depend on the state of the flow tables. */
+struct nx_flow_mod_batch {
+    struct nicira_header nxh;
+    /* Followed by flow_mod messages. */
+};
+OFP_ASSERT(sizeof(struct nx_flow_mod_batch) == 16);
+
 /* Action structure for NXAST_CONTROLLER.
  *
  * This generalizes using OFPAT_OUTPUT to send a packet to OFPP_CONTROLLER.  In
@@ -27,6 +27,8 @@ lib_libopenvswitch_a_SOURCES = \
 	lib/cfm.h \
 	lib/classifier.c \
 	lib/classifier.h \
+	lib/cmap.c \
+	lib/cmap.h \
 	lib/command-line.c \
 	lib/command-line.h \
 	lib/compiler.h \
@@ -169,6 +171,8 @@ lib_libopenvswitch_a_SOURCES = \
 	lib/tag.h \
 	lib/timer.c \
 	lib/timer.h \
+	lib/timer-wheel.c \
+	lib/timer-wheel.h \
 	lib/timeval.c \
 	lib/timeval.h \
 	lib/type-props.h \
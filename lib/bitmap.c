@@ -79,13 +79,17 @@ bitmap_equal(const unsigned long *a, const unsigned long *b, size_t n)
 size_t
 bitmap_scan(const unsigned long int *bitmap, size_t start, size_t end)
 {
-    /* XXX slow */
-    size_t i;
+    size_t i = start;
 
-    for (i = start; i < end; i++) {
-        if (bitmap_is_set(bitmap, i)) {
-            break;
+    while (i < end) {
+        if (!(i % BITMAP_ULONG_BITS) && !*bitmap_unit__(bitmap, i)) {
+            /* Skip a whole unit of 0-bits at once. */
+            i += BITMAP_ULONG_BITS;
+        } else if (bitmap_is_set(bitmap, i)) {
+            return i;
+        } else {
+            i++;
         }
     }
-    return i;
+    return end;
 }
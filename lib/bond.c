@@ -41,12 +41,14 @@
 
 VLOG_DEFINE_THIS_MODULE(bond);
 
-/* Bit-mask for hashing a flow down to a bucket.
- * There are (BOND_MASK + 1) buckets. */
-#define BOND_MASK 0xff
+/* Number of bins in the per-slave hash load histogram reported by
+ * "bond/show".  Bin 0 counts hashes carrying less than 1 kB of load, bin i
+ * (for i > 0) counts hashes carrying [2**(i-1), 2**i) kB, and the last bin
+ * counts everything heavier. */
+#define BOND_HISTOGRAM_BINS 16
 
 /* A hash bucket for mapping a flow to a slave.
- * "struct bond" has an array of (BOND_MASK + 1) of these. */
+ * "struct bond" has an array of (hash_mask + 1) of these. */
 struct bond_entry {
     struct bond_slave *slave;   /* Assigned slave, NULL if unassigned. */
     uint64_t tx_bytes;          /* Count of bytes recently transmitted. */
@@ -98,8 +100,10 @@ struct bond {
     uint32_t basis;             /* Basis for flow hash function. */
 
     /* SLB specific bonding info. */
-    struct bond_entry *hash;     /* An array of (BOND_MASK + 1) elements. */
+    struct bond_entry *hash;     /* An array of (hash_mask + 1) elements. */
+    uint32_t hash_mask;          /* Number of elements in 'hash', minus 1. */
     int rebalance_interval;      /* Interval between rebalances, in ms. */
+    int rebalance_max_shifts;    /* Max hashes migrated per rebalance. */
     long long int next_rebalance; /* Next rebalancing time. */
     bool send_learning_packets;
 
@@ -133,7 +137,7 @@ static struct bond_entry *lookup_bond_entry(const struct bond *,
 static tag_type bond_get_active_slave_tag(const struct bond *);
 static struct bond_slave *choose_output_slave(const struct bond *,
                                               const struct flow *,
-                                              uint16_t vlan);
+                                              uint16_t vlan, tag_type *tags);
 static void bond_update_fake_slave_stats(struct bond *);
 
 /* Attempts to parse 's' as the name of a bond balancing mode.  If successful,
@@ -187,6 +191,7 @@ bond_create(const struct bond_settings *s)
     hmap_init(&bond->slaves);
     bond->no_slaves_tag = tag_create_random();
     bond->stb_tag = tag_create_random();
+    bond->hash_mask = BOND_DEFAULT_HASHES - 1;
     bond->next_fake_iface_update = LLONG_MAX;
 
     bond_reconfigure(bond, s);
@@ -251,6 +256,17 @@ bond_reconfigure(struct bond *bond, const struct bond_settings *s)
         bond->rebalance_interval = s->rebalance_interval;
         revalidate = true;
     }
+    bond->rebalance_max_shifts = s->rebalance_max_shifts;
+
+    assert(IS_POW2(s->n_hashes)
+           && s->n_hashes >= BOND_MIN_HASHES
+           && s->n_hashes <= BOND_MAX_HASHES);
+    if (bond->hash_mask != s->n_hashes - 1) {
+        bond->hash_mask = s->n_hashes - 1;
+        free(bond->hash);
+        bond->hash = NULL;
+        revalidate = true;
+    }
 
     if (bond->balance != s->balance) {
         bond->balance = s->balance;
@@ -368,7 +384,7 @@ bond_slave_unregister(struct bond *bond, const void *slave_)
     del_active = bond->active_slave == slave;
     if (bond->hash) {
         struct bond_entry *e;
-        for (e = bond->hash; e <= &bond->hash[BOND_MASK]; e++) {
+        for (e = bond->hash; e <= &bond->hash[bond->hash_mask]; e++) {
             if (e->slave == slave) {
                 e->slave = NULL;
             }
@@ -528,7 +544,7 @@ bond_compose_learning_packet(struct bond *bond,
 
     memset(&flow, 0, sizeof flow);
     memcpy(flow.dl_src, eth_src, ETH_ADDR_LEN);
-    slave = choose_output_slave(bond, &flow, vlan);
+    slave = choose_output_slave(bond, &flow, vlan, NULL);
 
     packet = ofpbuf_new(0);
     compose_rarp(packet, eth_src);
@@ -631,12 +647,15 @@ bond_check_admissibility(struct bond *bond, const void *slave_,
  * packet belongs to (so for an access port it will be the access port's VLAN).
  *
  * Adds a tag to '*tags' that associates the flow with the returned slave.
+ * For balanced bonds, also adds a tag that associates the flow with its hash
+ * bucket, so that migrating the bucket to another slave only revalidates the
+ * flows that hash to it.
  */
 void *
 bond_choose_output_slave(struct bond *bond, const struct flow *flow,
                          uint16_t vlan, tag_type *tags)
 {
-    struct bond_slave *slave = choose_output_slave(bond, flow, vlan);
+    struct bond_slave *slave = choose_output_slave(bond, flow, vlan, tags);
     if (slave) {
         *tags |= bond->balance == BM_STABLE ? bond->stb_tag : slave->tag;
         return slave->aux;
@@ -738,12 +757,16 @@ bond_shift_load(struct bond_entry *hash, struct bond_slave *to,
  * given that doing so must decrease the ratio of the load on the two slaves by
  * at least 0.1.  Returns NULL if there is no appropriate entry.
  *
- * The list of entries isn't sorted.  I don't know of a reason to prefer to
- * shift away small hashes or large hashes. */
+ * Among the candidates, prefers the entry whose load comes closest to half of
+ * the difference in load between 'from' and 'to', since moving that entry
+ * evens out the two slaves with a single migration.  Each migration
+ * revalidates the flows in the migrated hash, so fewer, better-chosen
+ * migrations mean less flow churn. */
 static struct bond_entry *
 choose_entry_to_migrate(const struct bond_slave *from, uint64_t to_tx_bytes)
 {
-    struct bond_entry *e;
+    struct bond_entry *e, *best;
+    uint64_t overload, ideal, best_error;
 
     if (list_is_short(&from->entries)) {
         /* 'from' carries no more than one MAC hash, so shifting load away from
@@ -751,25 +774,40 @@ choose_entry_to_migrate(const struct bond_slave *from, uint64_t to_tx_bytes)
         return NULL;
     }
 
+    overload = from->tx_bytes - to_tx_bytes;
+    ideal = overload / 2;
+
+    best = NULL;
+    best_error = UINT64_MAX;
     LIST_FOR_EACH (e, list_node, &from->entries) {
-        double old_ratio, new_ratio;
-        uint64_t delta;
+        uint64_t delta = e->tx_bytes;
+        uint64_t error;
+
+        if (delta >= overload) {
+            /* Would leave 'to' at least as loaded as 'from' was. */
+            continue;
+        }
 
-        if (to_tx_bytes == 0) {
-            /* Nothing on the new slave, move it. */
-            return e;
+        error = delta > ideal ? delta - ideal : ideal - delta;
+        if (error < best_error) {
+            best = e;
+            best_error = error;
         }
+    }
+
+    if (best && to_tx_bytes) {
+        uint64_t delta = best->tx_bytes;
+        double old_ratio, new_ratio;
 
-        delta = e->tx_bytes;
         old_ratio = (double)from->tx_bytes / to_tx_bytes;
         new_ratio = (double)(from->tx_bytes - delta) / (to_tx_bytes + delta);
-        if (old_ratio - new_ratio > 0.1) {
-            /* Would decrease the ratio, move it. */
-            return e;
+        if (old_ratio - new_ratio <= 0.1) {
+            /* Wouldn't decrease the ratio enough to be worth the churn. */
+            return NULL;
         }
     }
 
-    return NULL;
+    return best;
 }
 
 /* Inserts 'slave' into 'bals' so that descending order of 'tx_bytes' is
@@ -806,6 +844,7 @@ bond_rebalance(struct bond *bond, struct tag_set *tags)
     struct bond_slave *slave;
     struct bond_entry *e;
     struct list bals;
+    int n_shifts;
 
     if (!bond_is_balanced(bond) || time_msec() < bond->next_rebalance) {
         return;
@@ -818,7 +857,7 @@ bond_rebalance(struct bond *bond, struct tag_set *tags)
         slave->tx_bytes = 0;
         list_init(&slave->entries);
     }
-    for (e = &bond->hash[0]; e <= &bond->hash[BOND_MASK]; e++) {
+    for (e = &bond->hash[0]; e <= &bond->hash[bond->hash_mask]; e++) {
         if (e->slave && e->tx_bytes) {
             e->slave->tx_bytes += e->tx_bytes;
             list_push_back(&e->slave->entries, &e->list_node);
@@ -837,7 +876,12 @@ bond_rebalance(struct bond *bond, struct tag_set *tags)
     }
     log_bals(bond, &bals);
 
-    /* Shift load from the most-loaded slaves to the least-loaded slaves. */
+    /* Shift load from the most-loaded slaves to the least-loaded slaves.
+     *
+     * Migrating a hash revalidates every flow within it, so we limit the number
+     * of migrations in a single run.  Any remaining imbalance will be dealt
+     * with in the next run. */
+    n_shifts = 0;
     while (!list_is_short(&bals)) {
         struct bond_slave *from = bond_slave_from_bal_node(list_front(&bals));
         struct bond_slave *to = bond_slave_from_bal_node(list_back(&bals));
@@ -849,6 +893,11 @@ bond_rebalance(struct bond *bond, struct tag_set *tags)
              * to that of 'to' (the least-loaded slave), is less than ~3%, or
              * it is less than ~1Mbps.  No point in rebalancing. */
             break;
+        } else if (bond->rebalance_max_shifts
+                   && n_shifts >= bond->rebalance_max_shifts) {
+            VLOG_DBG("bond %s: migrated %d hashes, deferring further "
+                     "rebalancing to next run", bond->name, n_shifts);
+            break;
         }
 
         /* 'from' is carrying significantly more load than 'to', and that load
@@ -856,6 +905,7 @@ bond_rebalance(struct bond *bond, struct tag_set *tags)
         e = choose_entry_to_migrate(from, to->tx_bytes);
         if (e) {
             bond_shift_load(e, to, tags);
+            n_shifts++;
 
             /* Delete element from from->entries.
              *
@@ -877,7 +927,7 @@ bond_rebalance(struct bond *bond, struct tag_set *tags)
     /* Implement exponentially weighted moving average.  A weight of 1/2 causes
      * historical data to decay to <1% in 7 rebalancing runs.  1,000,000 bytes
      * take 20 rebalancing runs to decay to 0 and get deleted entirely. */
-    for (e = &bond->hash[0]; e <= &bond->hash[BOND_MASK]; e++) {
+    for (e = &bond->hash[0]; e <= &bond->hash[bond->hash_mask]; e++) {
         e->tx_bytes /= 2;
         if (!e->tx_bytes) {
             e->slave = NULL;
@@ -944,6 +994,16 @@ bond_unixctl_list(struct unixctl_conn *conn,
     ds_destroy(&ds);
 }
 
+/* Returns the bin in a "bond/show" hash load histogram for a hash that is
+ * carrying 'kb' kilobytes of load. */
+static int
+bond_histogram_bin(uint64_t kb)
+{
+    return (kb
+            ? MIN(log_2_floor(MIN(kb, UINT32_MAX)) + 1, BOND_HISTOGRAM_BINS - 1)
+            : 0);
+}
+
 static void
 bond_print_details(struct ds *ds, const struct bond *bond)
 {
@@ -962,6 +1022,7 @@ bond_print_details(struct ds *ds, const struct bond *bond)
     ds_put_format(ds, "downdelay: %d ms\n", bond->downdelay);
 
     if (bond_is_balanced(bond)) {
+        ds_put_format(ds, "hashes: %"PRIu32"\n", bond->hash_mask + 1);
         ds_put_format(ds, "next rebalance: %lld ms\n",
                       bond->next_rebalance - time_msec());
     }
@@ -988,7 +1049,10 @@ bond_print_details(struct ds *ds, const struct bond *bond)
     sorted_slaves = shash_sort(&slave_shash);
 
     for (i = 0; i < shash_count(&slave_shash); i++) {
+        unsigned int histogram[BOND_HISTOGRAM_BINS];
+        unsigned int n_hashes;
         struct bond_entry *be;
+        int j;
 
         slave = sorted_slaves[i]->data;
 
@@ -1012,18 +1076,41 @@ bond_print_details(struct ds *ds, const struct bond *bond)
         }
 
         /* Hashes. */
-        for (be = bond->hash; be <= &bond->hash[BOND_MASK]; be++) {
+        memset(histogram, 0, sizeof histogram);
+        n_hashes = 0;
+        for (be = bond->hash; be <= &bond->hash[bond->hash_mask]; be++) {
             int hash = be - bond->hash;
+            uint64_t kb = be->tx_bytes / 1024;
 
             if (be->slave != slave) {
                 continue;
             }
 
-            ds_put_format(ds, "\thash %d: %"PRIu64" kB load\n",
-                          hash, be->tx_bytes / 1024);
+            ds_put_format(ds, "\thash %d: %"PRIu64" kB load\n", hash, kb);
+            histogram[bond_histogram_bin(kb)]++;
+            n_hashes++;
 
             /* XXX How can we list the MACs assigned to hashes of SLB bonds? */
         }
+
+        /* Histogram of the load carried by the hashes on this slave. */
+        if (!n_hashes) {
+            continue;
+        }
+        ds_put_cstr(ds, "\thash load histogram:");
+        for (j = 0; j < BOND_HISTOGRAM_BINS; j++) {
+            if (!histogram[j]) {
+                continue;
+            } else if (!j) {
+                ds_put_format(ds, " <1kB:%u", histogram[j]);
+            } else if (j < BOND_HISTOGRAM_BINS - 1) {
+                ds_put_format(ds, " %u-%ukB:%u",
+                              1u << (j - 1), (1u << j) - 1, histogram[j]);
+            } else {
+                ds_put_format(ds, " >=%ukB:%u", 1u << (j - 1), histogram[j]);
+            }
+        }
+        ds_put_char(ds, '\n');
     }
     shash_destroy(&slave_shash);
     free(sorted_slaves);
@@ -1082,7 +1169,7 @@ bond_unixctl_migrate(struct unixctl_conn *conn,
     }
 
     if (strspn(hash_s, "0123456789") == strlen(hash_s)) {
-        hash = atoi(hash_s) & BOND_MASK;
+        hash = atoi(hash_s) & bond->hash_mask;
     } else {
         unixctl_command_reply_error(conn, "bad hash");
         return;
@@ -1194,7 +1281,7 @@ bond_unixctl_hash(struct unixctl_conn *conn, int argc, const char *argv[],
     const char *vlan_s = argc > 2 ? argv[2] : NULL;
     const char *basis_s = argc > 3 ? argv[3] : NULL;
     uint8_t mac[ETH_ADDR_LEN];
-    uint8_t hash;
+    unsigned int hash;
     char *hash_cstr;
     unsigned int vlan;
     uint32_t basis;
@@ -1219,7 +1306,7 @@ bond_unixctl_hash(struct unixctl_conn *conn, int argc, const char *argv[],
 
     if (sscanf(mac_s, ETH_ADDR_SCAN_FMT, ETH_ADDR_SCAN_ARGS(mac))
         == ETH_ADDR_SCAN_COUNT) {
-        hash = bond_hash_src(mac, vlan, basis) & BOND_MASK;
+        hash = bond_hash_src(mac, vlan, basis) & (BOND_MAX_HASHES - 1);
 
         hash_cstr = xasprintf("%u", hash);
         unixctl_command_reply(conn, hash_cstr);
@@ -1251,7 +1338,7 @@ static void
 bond_entry_reset(struct bond *bond)
 {
     if (bond->balance != BM_AB) {
-        size_t hash_len = (BOND_MASK + 1) * sizeof *bond->hash;
+        size_t hash_len = (bond->hash_mask + 1) * sizeof *bond->hash;
 
         if (!bond->hash) {
             bond->hash = xmalloc(hash_len);
@@ -1370,7 +1457,7 @@ static struct bond_entry *
 lookup_bond_entry(const struct bond *bond, const struct flow *flow,
                   uint16_t vlan)
 {
-    return &bond->hash[bond_hash(bond, flow, vlan) & BOND_MASK];
+    return &bond->hash[bond_hash(bond, flow, vlan) & bond->hash_mask];
 }
 
 /* This function uses Highest Random Weight hashing to choose an output slave.
@@ -1402,9 +1489,13 @@ choose_stb_slave(const struct bond *bond, uint32_t flow_hash)
     return best;
 }
 
+/* Returns the slave to which a packet with the given 'flow' and 'vlan' should
+ * be forwarded, or NULL if the packet should be dropped.  If 'tags' is
+ * nonnull and the choice depends on a hash bucket, adds the bucket's tag to
+ * '*tags'. */
 static struct bond_slave *
 choose_output_slave(const struct bond *bond, const struct flow *flow,
-                    uint16_t vlan)
+                    uint16_t vlan, tag_type *tags)
 {
     struct bond_entry *e;
 
@@ -1440,6 +1531,9 @@ choose_output_slave(const struct bond *bond, const struct flow *flow,
             }
             e->tag = tag_create_random();
         }
+        if (tags) {
+            *tags |= e->tag;
+        }
         return e->slave;
 
     default:
@@ -39,6 +39,12 @@ enum bond_mode {
 bool bond_mode_from_string(enum bond_mode *, const char *);
 const char *bond_mode_to_string(enum bond_mode);
 
+/* Bounds on the number of hash buckets into which balanced bonds hash
+ * flows. */
+#define BOND_MIN_HASHES 16
+#define BOND_MAX_HASHES 65536
+#define BOND_DEFAULT_HASHES 256
+
 /* Configuration for a bond as a whole. */
 struct bond_settings {
     char *name;                 /* Bond's name, for log messages. */
@@ -48,6 +54,11 @@ struct bond_settings {
     enum bond_mode balance;
     int rebalance_interval;     /* Milliseconds between rebalances.
                                    Zero to disable rebalancing. */
+    int rebalance_max_shifts;   /* Max hashes to migrate per rebalance.
+                                   Zero for no limit. */
+    unsigned int n_hashes;      /* Number of hash buckets, a power of 2
+                                   between BOND_MIN_HASHES and
+                                   BOND_MAX_HASHES. */
 
     /* Link status detection. */
     int up_delay;               /* ms before enabling an up slave. */
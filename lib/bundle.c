@@ -51,19 +51,24 @@ execute_ab(const struct nx_action_bundle *nab,
     return OFPP_NONE;
 }
 
-static uint16_t
-execute_hrw(const struct nx_action_bundle *nab, const struct flow *flow,
-            bool (*slave_enabled)(uint16_t ofp_port, void *aux), void *aux)
+/* Returns the index of the slave in 'nab' with the highest weight for
+ * 'flow_hash', considering only slaves for which 'slave_enabled' returns true
+ * and skipping the slave with index 'skip', or -1 if there is no such
+ * slave.  If 'slave_enabled' is null, considers every slave. */
+static int
+hrw_best_slave(const struct nx_action_bundle *nab, uint32_t flow_hash,
+               bool (*slave_enabled)(uint16_t ofp_port, void *aux), void *aux,
+               int skip)
 {
-    uint32_t flow_hash, best_hash;
+    uint32_t best_hash;
     int best, i;
 
-    flow_hash = flow_hash_fields(flow, ntohs(nab->fields), ntohs(nab->basis));
     best = -1;
     best_hash = 0;
-
     for (i = 0; i < ntohs(nab->n_slaves); i++) {
-        if (slave_enabled(bundle_get_slave(nab, i), aux)) {
+        if (i != skip
+            && (!slave_enabled
+                || slave_enabled(bundle_get_slave(nab, i), aux))) {
             uint32_t hash = hash_2words(i, flow_hash);
 
             if (best < 0 || hash > best_hash) {
@@ -72,13 +77,35 @@ execute_hrw(const struct nx_action_bundle *nab, const struct flow *flow,
             }
         }
     }
+    return best;
+}
+
+static uint16_t
+execute_hrw(const struct nx_action_bundle *nab, const struct flow *flow,
+            bool (*slave_enabled)(uint16_t ofp_port, void *aux), void *aux)
+{
+    uint32_t flow_hash;
+    int best;
+
+    flow_hash = flow_hash_fields(flow, ntohs(nab->fields), ntohs(nab->basis));
+
+    /* Usually every slave is enabled, so find the slave with the highest
+     * weight among all of them and then check only that slave.  Only if it is
+     * disabled is it necessary to check the others. */
+    best = hrw_best_slave(nab, flow_hash, NULL, NULL, -1);
+    if (best >= 0 && !slave_enabled(bundle_get_slave(nab, best), aux)) {
+        best = hrw_best_slave(nab, flow_hash, slave_enabled, aux, best);
+    }
 
     return best >= 0 ? bundle_get_slave(nab, best) : OFPP_NONE;
 }
 
 /* Executes 'nab' on 'flow'.  Uses 'slave_enabled' to determine if the slave
  * designated by 'ofp_port' is up.  Returns the chosen slave, or OFPP_NONE if
- * none of the slaves are acceptable. */
+ * none of the slaves are acceptable.
+ *
+ * 'slave_enabled' is called only for as many slaves as necessary to make the
+ * choice: if every slave is up, that is just once. */
 uint16_t
 bundle_execute(const struct nx_action_bundle *nab, const struct flow *flow,
                bool (*slave_enabled)(uint16_t ofp_port, void *aux), void *aux)
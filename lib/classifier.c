@@ -40,9 +40,6 @@ static struct cls_rule *find_equal(struct cls_table *, const struct flow *,
                                    uint32_t hash);
 static struct cls_rule *insert_rule(struct cls_table *, struct cls_rule *);
 
-static bool flow_equal_except(const struct flow *, const struct flow *,
-                                const struct flow_wildcards *);
-
 /* Iterates RULE over HEAD and all of the cls_rules on HEAD->list. */
 #define FOR_EACH_RULE_IN_LIST(RULE, HEAD)                               \
     for ((RULE) = (HEAD); (RULE) != NULL; (RULE) = next_rule_in_list(RULE))
@@ -452,6 +449,22 @@ cls_rule_equal(const struct cls_rule *a, const struct cls_rule *b)
             && flow_equal(&a->flow, &b->flow));
 }
 
+/* Returns true if 'rule' exactly matches 'criteria' or if 'rule' is more
+ * specific than 'criteria'.  That is, 'rule' matches 'criteria' in the same
+ * "loose" way that cls_cursor_init() describes.  Ignores priority. */
+bool
+cls_rule_is_loose_match(const struct cls_rule *rule,
+                        const struct cls_rule *criteria)
+{
+    struct flow masks;
+
+    if (flow_wildcards_has_extra(&rule->wc, &criteria->wc)) {
+        return false;
+    }
+    flow_wildcards_get_masks(&criteria->wc, &masks);
+    return flow_equal_in_masks(&rule->flow, &criteria->flow, &masks);
+}
+
 /* Returns a hash value for the flow, wildcards, and priority in 'rule',
  * starting from 'basis'. */
 uint32_t
@@ -872,7 +885,8 @@ classifier_find_rule_exactly(const struct classifier *cls,
         return NULL;
     }
 
-    head = find_equal(table, &target->flow, flow_hash(&target->flow, 0));
+    head = find_equal(table, &target->flow,
+                      flow_hash_in_minimask(&target->flow, &table->mask, 0));
     FOR_EACH_RULE_IN_LIST (rule, head) {
         if (target->priority >= rule->priority) {
             return target->priority == rule->priority ? rule : NULL;
@@ -888,19 +902,22 @@ bool
 classifier_rule_overlaps(const struct classifier *cls,
                          const struct cls_rule *target)
 {
+    struct flow target_masks;
     struct cls_table *table;
 
+    flow_wildcards_get_masks(&target->wc, &target_masks);
     HMAP_FOR_EACH (table, hmap_node, &cls->tables) {
-        struct flow_wildcards wc;
         struct cls_rule *head;
+        struct flow masks;
 
-        flow_wildcards_combine(&wc, &target->wc, &table->wc);
+        flow_masks_and(&masks, &target_masks, &table->masks);
         HMAP_FOR_EACH (head, hmap_node, &table->rules) {
             struct cls_rule *rule;
 
             FOR_EACH_RULE_IN_LIST (rule, head) {
                 if (rule->priority == target->priority
-                    && flow_equal_except(&target->flow, &rule->flow, &wc)) {
+                    && flow_equal_in_masks(&target->flow, &rule->flow,
+                                           &masks)) {
                     return true;
                 }
             }
@@ -913,20 +930,23 @@ classifier_rule_overlaps(const struct classifier *cls,
 /* Iteration. */
 
 static bool
-rule_matches(const struct cls_rule *rule, const struct cls_rule *target)
+rule_matches(const struct cls_rule *rule, const struct cls_cursor *cursor)
 {
-    return (!target
-            || flow_equal_except(&rule->flow, &target->flow, &target->wc));
+    return (!cursor->target
+            || flow_equal_in_masks(&rule->flow, &cursor->target->flow,
+                                   &cursor->target_masks));
 }
 
 static struct cls_rule *
-search_table(const struct cls_table *table, const struct cls_rule *target)
+search_table(const struct cls_table *table, const struct cls_cursor *cursor)
 {
+    const struct cls_rule *target = cursor->target;
+
     if (!target || !flow_wildcards_has_extra(&table->wc, &target->wc)) {
         struct cls_rule *rule;
 
         HMAP_FOR_EACH (rule, hmap_node, &table->rules) {
-            if (rule_matches(rule, target)) {
+            if (rule_matches(rule, cursor)) {
                 return rule;
             }
         }
@@ -974,6 +994,9 @@ cls_cursor_init(struct cls_cursor *cursor, const struct classifier *cls,
 {
     cursor->cls = cls;
     cursor->target = target;
+    if (target) {
+        flow_wildcards_get_masks(&target->wc, &cursor->target_masks);
+    }
 }
 
 /* Returns the first matching cls_rule in 'cursor''s iteration, or a null
@@ -984,7 +1007,7 @@ cls_cursor_first(struct cls_cursor *cursor)
     struct cls_table *table;
 
     HMAP_FOR_EACH (table, hmap_node, &cursor->cls->tables) {
-        struct cls_rule *rule = search_table(table, cursor->target);
+        struct cls_rule *rule = search_table(table, cursor);
         if (rule) {
             cursor->table = table;
             return rule;
@@ -1012,14 +1035,14 @@ cls_cursor_next(struct cls_cursor *cursor, struct cls_rule *rule)
      * that differ only in priority.) */
     rule = next;
     HMAP_FOR_EACH_CONTINUE (rule, hmap_node, &cursor->table->rules) {
-        if (rule_matches(rule, cursor->target)) {
+        if (rule_matches(rule, cursor)) {
             return rule;
         }
     }
 
     table = cursor->table;
     HMAP_FOR_EACH_CONTINUE (table, hmap_node, &cursor->cls->tables) {
-        rule = search_table(table, cursor->target);
+        rule = search_table(table, cursor);
         if (rule) {
             cursor->table = table;
             return rule;
@@ -1051,6 +1074,8 @@ insert_table(struct classifier *cls, const struct flow_wildcards *wc)
     table = xzalloc(sizeof *table);
     hmap_init(&table->rules);
     table->wc = *wc;
+    minimask_init(&table->mask, wc);
+    flow_wildcards_get_masks(wc, &table->masks);
     table->is_catchall = flow_wildcards_is_catchall(&table->wc);
     hmap_insert(&cls->tables, &table->hmap_node, flow_wildcards_hash(wc, 0));
 
@@ -1062,6 +1087,7 @@ destroy_table(struct classifier *cls, struct cls_table *table)
 {
     hmap_remove(&cls->tables, &table->hmap_node);
     hmap_destroy(&table->rules);
+    minimask_destroy(&table->mask);
     free(table);
 }
 
@@ -1075,13 +1101,10 @@ find_match(const struct cls_table *table, const struct flow *flow)
             return rule;
         }
     } else {
-        struct flow f;
+        uint32_t hash = flow_hash_in_minimask(flow, &table->mask, 0);
 
-        f = *flow;
-        flow_zero_wildcards(&f, &table->wc);
-        HMAP_FOR_EACH_WITH_HASH (rule, hmap_node, flow_hash(&f, 0),
-                                 &table->rules) {
-            if (flow_equal(&f, &rule->flow)) {
+        HMAP_FOR_EACH_WITH_HASH (rule, hmap_node, hash, &table->rules) {
+            if (flow_equal_in_masks(flow, &rule->flow, &table->masks)) {
                 return rule;
             }
         }
@@ -1108,7 +1131,7 @@ insert_rule(struct cls_table *table, struct cls_rule *new)
 {
     struct cls_rule *head;
 
-    new->hmap_node.hash = flow_hash(&new->flow, 0);
+    new->hmap_node.hash = flow_hash_in_minimask(&new->flow, &table->mask, 0);
 
     head = find_equal(table, &new->flow, new->hmap_node.hash);
     if (!head) {
@@ -1156,70 +1179,3 @@ next_rule_in_list(struct cls_rule *rule)
     struct cls_rule *next = next_rule_in_list__(rule);
     return next->priority < rule->priority ? next : NULL;
 }
-
-static bool
-ipv6_equal_except(const struct in6_addr *a, const struct in6_addr *b,
-                  const struct in6_addr *mask)
-{
-    int i;
-
-#ifdef s6_addr32
-    for (i=0; i<4; i++) {
-        if ((a->s6_addr32[i] ^ b->s6_addr32[i]) & mask->s6_addr32[i]) {
-            return false;
-        }
-    }
-#else
-    for (i=0; i<16; i++) {
-        if ((a->s6_addr[i] ^ b->s6_addr[i]) & mask->s6_addr[i]) {
-            return false;
-        }
-    }
-#endif
-
-    return true;
-}
-
-
-static bool
-flow_equal_except(const struct flow *a, const struct flow *b,
-                  const struct flow_wildcards *wildcards)
-{
-    const flow_wildcards_t wc = wildcards->wildcards;
-    int i;
-
-    BUILD_ASSERT_DECL(FLOW_WC_SEQ == 11);
-
-    for (i = 0; i < FLOW_N_REGS; i++) {
-        if ((a->regs[i] ^ b->regs[i]) & wildcards->reg_masks[i]) {
-            return false;
-        }
-    }
-
-    return (!((a->tun_id ^ b->tun_id) & wildcards->tun_id_mask)
-            && !((a->nw_src ^ b->nw_src) & wildcards->nw_src_mask)
-            && !((a->nw_dst ^ b->nw_dst) & wildcards->nw_dst_mask)
-            && (wc & FWW_IN_PORT || a->in_port == b->in_port)
-            && !((a->vlan_tci ^ b->vlan_tci) & wildcards->vlan_tci_mask)
-            && (wc & FWW_DL_TYPE || a->dl_type == b->dl_type)
-            && !((a->tp_src ^ b->tp_src) & wildcards->tp_src_mask)
-            && !((a->tp_dst ^ b->tp_dst) & wildcards->tp_dst_mask)
-            && eth_addr_equal_except(a->dl_src, b->dl_src,
-                                     wildcards->dl_src_mask)
-            && eth_addr_equal_except(a->dl_dst, b->dl_dst,
-                                     wildcards->dl_dst_mask)
-            && (wc & FWW_NW_PROTO || a->nw_proto == b->nw_proto)
-            && (wc & FWW_NW_TTL || a->nw_ttl == b->nw_ttl)
-            && (wc & FWW_NW_DSCP || !((a->nw_tos ^ b->nw_tos) & IP_DSCP_MASK))
-            && (wc & FWW_NW_ECN || !((a->nw_tos ^ b->nw_tos) & IP_ECN_MASK))
-            && !((a->nw_frag ^ b->nw_frag) & wildcards->nw_frag_mask)
-            && (wc & FWW_ARP_SHA || eth_addr_equals(a->arp_sha, b->arp_sha))
-            && (wc & FWW_ARP_THA || eth_addr_equals(a->arp_tha, b->arp_tha))
-            && (wc & FWW_IPV6_LABEL || a->ipv6_label == b->ipv6_label)
-            && ipv6_equal_except(&a->ipv6_src, &b->ipv6_src,
-                    &wildcards->ipv6_src_mask)
-            && ipv6_equal_except(&a->ipv6_dst, &b->ipv6_dst,
-                    &wildcards->ipv6_dst_mask)
-            && ipv6_equal_except(&a->nd_target, &b->nd_target,
-                                 &wildcards->nd_target_mask));
-}
@@ -47,6 +47,8 @@ struct cls_table {
     struct hmap_node hmap_node; /* Within struct classifier 'tables' hmap. */
     struct hmap rules;          /* Contains "struct cls_rule"s. */
     struct flow_wildcards wc;   /* Wildcards for fields. */
+    struct minimask mask;       /* 'wc' in compressed form, for hashing. */
+    struct flow masks;          /* 'wc' as bitmasks, for comparisons. */
     int n_table_rules;          /* Number of rules, including duplicates. */
     bool is_catchall;           /* True if this table wildcards every field. */
 };
@@ -141,6 +143,8 @@ void cls_rule_set_nd_target_masked(struct cls_rule *, const struct in6_addr *,
                                    const struct in6_addr *);
 
 bool cls_rule_equal(const struct cls_rule *, const struct cls_rule *);
+bool cls_rule_is_loose_match(const struct cls_rule *rule,
+                             const struct cls_rule *criteria);
 uint32_t cls_rule_hash(const struct cls_rule *, uint32_t basis);
 
 void cls_rule_format(const struct cls_rule *, struct ds *);
@@ -170,6 +174,7 @@ struct cls_cursor {
     const struct classifier *cls;
     const struct cls_table *table;
     const struct cls_rule *target;
+    struct flow target_masks;   /* 'target->wc' as bitmasks. */
 };
 
 void cls_cursor_init(struct cls_cursor *, const struct classifier *,
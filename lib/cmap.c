@@ -0,0 +1,508 @@
+/*
+ * Copyright (c) 2012 Nicira, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <config.h>
+#include "cmap.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "coverage.h"
+#include "random.h"
+#include "util.h"
+
+COVERAGE_DEFINE(cmap_expand);
+COVERAGE_DEFINE(cmap_shrink);
+
+/* Size of a bucket and the alignment of the bucket arrays. */
+#define CMAP_CACHE_LINE 64
+BUILD_ASSERT_DECL(sizeof(struct cmap_bucket) <= CMAP_CACHE_LINE);
+
+/* Maximum number of nodes in a table, as a percentage of its slots. */
+#define CMAP_MAX_LOAD 85
+
+/* Number of buckets that each insertion migrates out of the old table while
+ * the cmap is growing.  A new table has room for as many insertions as the
+ * old table has nodes, which is at least 4 times its number of buckets, so
+ * migration always completes before the new table needs to grow again. */
+#define CMAP_MIGRATE_STEP 2
+
+/* The buckets of an empty cmap.  Never modified, since an empty cmap has a
+ * 'max_n' of 0 and therefore grows before its first insertion. */
+static struct cmap_bucket cmap_empty_bucket;
+
+static void
+cmap_table_init_empty(struct cmap_table *t)
+{
+    t->buckets = &cmap_empty_bucket;
+    t->base = NULL;
+    t->mask = 0;
+    t->n = 0;
+    t->max_n = 0;
+}
+
+/* Initializes 't' as a table with no buckets, the state of a cmap's 'old'
+ * table when no migration is in progress. */
+static void
+cmap_table_init_absent(struct cmap_table *t)
+{
+    t->buckets = NULL;
+    t->base = NULL;
+    t->mask = 0;
+    t->n = 0;
+    t->max_n = 0;
+}
+
+/* Initializes 't' as an empty table with 'n_buckets' buckets, which must be a
+ * power of 2. */
+static void
+cmap_table_alloc(struct cmap_table *t, uint32_t n_buckets)
+{
+    size_t size = n_buckets * sizeof *t->buckets;
+
+    t->base = xmalloc(size + CMAP_CACHE_LINE - 1);
+    t->buckets = (struct cmap_bucket *) ROUND_UP((uintptr_t) t->base,
+                                                 CMAP_CACHE_LINE);
+    memset(t->buckets, 0, size);
+    t->mask = n_buckets - 1;
+    t->n = 0;
+    t->max_n = (size_t) n_buckets * CMAP_K * CMAP_MAX_LOAD / 100;
+}
+
+static uint32_t
+cmap_table_n_buckets(const struct cmap_table *t)
+{
+    return t->buckets ? t->mask + 1 : 0;
+}
+
+/* Inserts 'node', with the given 'hash', into 't', which must have a free
+ * slot. */
+static void
+cmap_table_insert(struct cmap_table *t, struct cmap_node *node, uint32_t hash)
+{
+    uint32_t idx;
+
+    for (idx = hash & t->mask; ; idx = (idx + 1) & t->mask) {
+        struct cmap_bucket *b = &t->buckets[idx];
+        size_t i;
+
+        for (i = 0; i < CMAP_K; i++) {
+            if (!b->nodes[i]) {
+                b->hashes[i] = hash;
+                b->nodes[i] = node;
+                t->n++;
+                return;
+            }
+        }
+        b->n_overflow++;
+    }
+}
+
+/* Searches 't' for a node with the given 'hash', following the probe sequence
+ * for 'hash' from slot '*slotp' in bucket '*idxp' onward.  If 'target' is
+ * nonnull, only 'target' itself matches.  On success, stores the position of
+ * the match in '*idxp' and '*slotp' and returns true.  Otherwise, returns
+ * false. */
+static bool
+cmap_table_scan(const struct cmap_table *t, uint32_t hash,
+                const struct cmap_node *target, uint32_t *idxp, size_t *slotp)
+{
+    uint32_t idx = *idxp;
+    size_t slot = *slotp;
+    uint32_t n;
+
+    if (!t->n) {
+        return false;
+    }
+
+    /* Every bucket might have a nonzero overflow count, so bound the probe
+     * sequence to a single pass over the table. */
+    for (n = t->mask + 1 - ((idx - hash) & t->mask); n > 0; n--) {
+        const struct cmap_bucket *b = &t->buckets[idx];
+
+        for (; slot < CMAP_K; slot++) {
+            if (b->hashes[slot] == hash && b->nodes[slot]
+                && (!target || b->nodes[slot] == target)) {
+                *idxp = idx;
+                *slotp = slot;
+                return true;
+            }
+        }
+        if (!b->n_overflow) {
+            break;
+        }
+        idx = (idx + 1) & t->mask;
+        slot = 0;
+    }
+    return false;
+}
+
+/* Finds 'node' in 'cmap'.  Returns the table that contains it and stores its
+ * position in that table into '*idxp' and '*slotp', or returns a null pointer
+ * if 'node' is not in 'cmap'. */
+static struct cmap_table *
+cmap_locate(const struct cmap *cmap_, const struct cmap_node *node,
+            uint32_t *idxp, size_t *slotp)
+{
+    struct cmap *cmap = (struct cmap *) cmap_;
+    uint32_t hash = node->hash;
+
+    *idxp = hash & cmap->old.mask;
+    *slotp = 0;
+    if (cmap_table_scan(&cmap->old, hash, node, idxp, slotp)) {
+        return &cmap->old;
+    }
+
+    *idxp = hash & cmap->cur.mask;
+    *slotp = 0;
+    if (cmap_table_scan(&cmap->cur, hash, node, idxp, slotp)) {
+        return &cmap->cur;
+    }
+
+    return NULL;
+}
+
+/* Moves up to 'n_buckets' buckets of nodes from 'cmap''s old table into its
+ * current table, and frees the old table once it is empty. */
+static void
+cmap_migrate(struct cmap *cmap, uint32_t n_buckets)
+{
+    struct cmap_table *old = &cmap->old;
+
+    if (!old->buckets) {
+        return;
+    }
+
+    /* The overflow counts in 'old' are left alone.  They can only become
+     * larger than necessary, which makes lookups that are still directed to
+     * 'old' probe further but never miss a node. */
+    for (; n_buckets > 0 && old->n; n_buckets--) {
+        struct cmap_bucket *b = &old->buckets[cmap->migrate_pos++];
+        size_t i;
+
+        for (i = 0; i < CMAP_K; i++) {
+            if (b->nodes[i]) {
+                cmap_table_insert(&cmap->cur, b->nodes[i], b->hashes[i]);
+                b->nodes[i] = NULL;
+                old->n--;
+            }
+        }
+    }
+
+    if (!old->n) {
+        free(old->base);
+        cmap_table_init_absent(old);
+        cmap->migrate_pos = 0;
+    }
+}
+
+/* Replaces 'cmap''s current table by one twice as large, finishing any
+ * migration already in progress and starting a new one. */
+static void
+cmap_expand(struct cmap *cmap)
+{
+    uint32_t n_buckets = cmap->cur.base ? (cmap->cur.mask + 1) * 2 : 1;
+
+    COVERAGE_INC(cmap_expand);
+    cmap_migrate(cmap, UINT32_MAX);
+    if (cmap->cur.base) {
+        cmap->old = cmap->cur;
+        cmap->migrate_pos = 0;
+    }
+    cmap_table_alloc(&cmap->cur, n_buckets);
+}
+
+/* Initializes 'cmap' as an empty cmap. */
+void
+cmap_init(struct cmap *cmap)
+{
+    cmap_table_init_empty(&cmap->cur);
+    cmap_table_init_absent(&cmap->old);
+    cmap->migrate_pos = 0;
+}
+
+/* Frees memory reserved by 'cmap'.  It is the client's responsibility to free
+ * the nodes themselves, if necessary. */
+void
+cmap_destroy(struct cmap *cmap)
+{
+    if (cmap) {
+        free(cmap->cur.base);
+        free(cmap->old.base);
+    }
+}
+
+/* Shrinks 'cmap''s storage to the smallest table that holds its current
+ * number of nodes, if that is smaller than its current table.  Unlike growth,
+ * shrinking rehashes every node at once. */
+void
+cmap_shrink(struct cmap *cmap)
+{
+    size_t n = cmap_count(cmap);
+    struct cmap_table new;
+    uint32_t n_buckets;
+    uint32_t idx;
+
+    if (!n) {
+        cmap_destroy(cmap);
+        cmap_init(cmap);
+        return;
+    }
+
+    for (n_buckets = 1; (size_t) n_buckets * CMAP_K * CMAP_MAX_LOAD / 100 < n;
+         n_buckets *= 2) {
+        continue;
+    }
+    if (n_buckets >= cmap->cur.mask + 1) {
+        return;
+    }
+
+    COVERAGE_INC(cmap_shrink);
+    cmap_table_alloc(&new, n_buckets);
+    for (idx = 0; idx < cmap_table_n_buckets(&cmap->old); idx++) {
+        const struct cmap_bucket *b = &cmap->old.buckets[idx];
+        size_t i;
+
+        for (i = 0; i < CMAP_K; i++) {
+            if (b->nodes[i]) {
+                cmap_table_insert(&new, b->nodes[i], b->hashes[i]);
+            }
+        }
+    }
+    for (idx = 0; idx <= cmap->cur.mask; idx++) {
+        const struct cmap_bucket *b = &cmap->cur.buckets[idx];
+        size_t i;
+
+        for (i = 0; i < CMAP_K; i++) {
+            if (b->nodes[i]) {
+                cmap_table_insert(&new, b->nodes[i], b->hashes[i]);
+            }
+        }
+    }
+    cmap_destroy(cmap);
+    cmap->cur = new;
+    cmap_table_init_absent(&cmap->old);
+    cmap->migrate_pos = 0;
+}
+
+/* Inserts 'node', with the given 'hash', into 'cmap'.  Grows 'cmap' if it is
+ * full, and otherwise advances any migration in progress. */
+void
+cmap_insert(struct cmap *cmap, struct cmap_node *node, uint32_t hash)
+{
+    node->hash = hash;
+    if (cmap_count(cmap) >= cmap->cur.max_n) {
+        cmap_expand(cmap);
+    } else {
+        cmap_migrate(cmap, CMAP_MIGRATE_STEP);
+    }
+    cmap_table_insert(&cmap->cur, node, hash);
+}
+
+/* Removes 'node' from 'cmap'.  Does not shrink the cmap. */
+void
+cmap_remove(struct cmap *cmap, struct cmap_node *node)
+{
+    struct cmap_table *t;
+    uint32_t idx, i;
+    size_t slot;
+
+    t = cmap_locate(cmap, node, &idx, &slot);
+    assert(t != NULL);
+
+    t->buckets[idx].nodes[slot] = NULL;
+    for (i = node->hash & t->mask; i != idx; i = (i + 1) & t->mask) {
+        t->buckets[i].n_overflow--;
+    }
+    t->n--;
+
+    if (t == &cmap->old && !t->n) {
+        cmap_migrate(cmap, 0);
+    }
+}
+
+/* Returns true if 'node' is in 'cmap', false otherwise. */
+bool
+cmap_contains(const struct cmap *cmap, const struct cmap_node *node)
+{
+    uint32_t idx;
+    size_t slot;
+
+    return cmap_locate(cmap, node, &idx, &slot) != NULL;
+}
+
+/* Slow path for cmap_first_with_hash(). */
+struct cmap_node *
+cmap_first_with_hash__(const struct cmap *cmap, uint32_t hash)
+{
+    uint32_t idx;
+    size_t slot;
+
+    idx = hash & cmap->old.mask;
+    slot = 0;
+    if (cmap_table_scan(&cmap->old, hash, NULL, &idx, &slot)) {
+        return cmap->old.buckets[idx].nodes[slot];
+    }
+
+    idx = hash & cmap->cur.mask;
+    slot = 0;
+    if (cmap_table_scan(&cmap->cur, hash, NULL, &idx, &slot)) {
+        return cmap->cur.buckets[idx].nodes[slot];
+    }
+
+    return NULL;
+}
+
+/* Returns the next node in 'cmap' after 'node' that has the same hash value
+ * as 'node', or a null pointer if no more nodes have that hash value. */
+struct cmap_node *
+cmap_next_with_hash(const struct cmap *cmap, const struct cmap_node *node)
+{
+    const struct cmap_table *t;
+    uint32_t hash = node->hash;
+    uint32_t idx;
+    size_t slot;
+
+    t = cmap_locate(cmap, node, &idx, &slot);
+    assert(t != NULL);
+
+    slot++;
+    if (cmap_table_scan(t, hash, NULL, &idx, &slot)) {
+        return t->buckets[idx].nodes[slot];
+    }
+
+    if (t == &cmap->old) {
+        idx = hash & cmap->cur.mask;
+        slot = 0;
+        if (cmap_table_scan(&cmap->cur, hash, NULL, &idx, &slot)) {
+            return cmap->cur.buckets[idx].nodes[slot];
+        }
+    }
+
+    return NULL;
+}
+
+/* Returns the first node in 'cmap' at or after slot 'slot' of bucket 'idx' in
+ * table 't', in iteration order: the old table, then the current one. */
+static struct cmap_node *
+cmap_next_position(const struct cmap *cmap, const struct cmap_table *t,
+                   uint32_t idx, size_t slot)
+{
+    for (;;) {
+        if (t->n) {
+            for (; idx <= t->mask; idx++, slot = 0) {
+                const struct cmap_bucket *b = &t->buckets[idx];
+
+                for (; slot < CMAP_K; slot++) {
+                    if (b->nodes[slot]) {
+                        return b->nodes[slot];
+                    }
+                }
+            }
+        }
+
+        if (t == &cmap->cur) {
+            return NULL;
+        }
+        t = &cmap->cur;
+        idx = 0;
+        slot = 0;
+    }
+}
+
+/* Returns the first node in 'cmap', in arbitrary order, or a null pointer if
+ * 'cmap' is empty. */
+struct cmap_node *
+cmap_first(const struct cmap *cmap)
+{
+    return cmap_next_position(cmap, &cmap->old, 0, 0);
+}
+
+/* Returns the next node in 'cmap' following 'node', in arbitrary order, or a
+ * null pointer if 'node' is the last node in 'cmap'.
+ *
+ * If the cmap has been modified since 'node' was returned by cmap_first() or
+ * cmap_next(), other than by removing nodes other than 'node', then the
+ * results are undefined. */
+struct cmap_node *
+cmap_next(const struct cmap *cmap, const struct cmap_node *node)
+{
+    const struct cmap_table *t;
+    uint32_t idx;
+    size_t slot;
+
+    t = cmap_locate(cmap, node, &idx, &slot);
+    assert(t != NULL);
+    return cmap_next_position(cmap, t, idx, slot + 1);
+}
+
+/* Returns the next node in 'cmap' in table order, or NULL if no nodes remain
+ * in 'cmap'.  Uses '*bucketp' and '*offsetp' to determine where to begin
+ * iteration, and stores new values to pass on the next iteration into them
+ * before returning.
+ *
+ * Before beginning iteration, store 0 into '*bucketp' and '*offsetp'. */
+struct cmap_node *
+cmap_at_position(const struct cmap *cmap,
+                 uint32_t *bucketp, uint32_t *offsetp)
+{
+    uint32_t n_old = cmap_table_n_buckets(&cmap->old);
+    uint32_t bucket = *bucketp;
+    size_t slot = *offsetp;
+
+    for (;;) {
+        const struct cmap_bucket *b;
+
+        if (bucket < n_old) {
+            b = &cmap->old.buckets[bucket];
+        } else if (bucket - n_old <= cmap->cur.mask) {
+            b = &cmap->cur.buckets[bucket - n_old];
+        } else {
+            break;
+        }
+
+        for (; slot < CMAP_K; slot++) {
+            if (b->nodes[slot]) {
+                *bucketp = bucket;
+                *offsetp = slot + 1;
+                return b->nodes[slot];
+            }
+        }
+        bucket++;
+        slot = 0;
+    }
+
+    *bucketp = 0;
+    *offsetp = 0;
+    return NULL;
+}
+
+/* Chooses and returns a randomly selected node from 'cmap', which must not be
+ * empty.  Nodes that follow runs of empty slots are more likely to be chosen,
+ * but any node in 'cmap' can be. */
+struct cmap_node *
+cmap_random_node(const struct cmap *cmap)
+{
+    uint32_t n_buckets = cmap_table_n_buckets(&cmap->old) + cmap->cur.mask + 1;
+    uint32_t bucket = random_range(n_buckets);
+    uint32_t offset = random_range(CMAP_K);
+    struct cmap_node *node;
+
+    node = cmap_at_position(cmap, &bucket, &offset);
+    if (!node) {
+        node = cmap_at_position(cmap, &bucket, &offset);
+    }
+    return node;
+}
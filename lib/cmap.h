@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2012 Nicira, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CMAP_H
+#define CMAP_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "util.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* Cache-line bucketed hash map.
+ *
+ * A cmap is an alternative to an hmap for large, lookup-heavy tables.  Like an
+ * hmap, it is intrusive: a client embeds a 'struct cmap_node' in each of its
+ * data structures.  Unlike an hmap, the table itself is an open-addressed
+ * array of 64-byte buckets, each of which holds several hash values and,
+ * alongside them, pointers to the corresponding nodes.  A lookup compares
+ * hash values within a single cache line and usually touches only the one
+ * node that matches, instead of chasing a chain of pointers through nodes that
+ * do not.
+ *
+ * Buckets are probed linearly.  Each bucket counts the nodes that overflowed
+ * past it while it was full, so a lookup stops at the first bucket that no
+ * node has overflowed, and removal needs neither tombstones nor moving other
+ * nodes.
+ *
+ * A cmap grows incrementally.  When it becomes too full it allocates a table
+ * twice as large and, from then on, each insertion migrates a few buckets from
+ * the old table into the new one.  Lookups search both tables until migration
+ * completes.  Only insertion migrates nodes, so lookup, iteration, and removal
+ * never move a node.
+ *
+ * Compared to an hmap:
+ *
+ *   - Removing a node during iteration requires CMAP_FOR_EACH_SAFE, even if
+ *     the node is not freed, because iteration locates its position from the
+ *     current node.
+ *
+ *   - Hash values are 32 bits wide.
+ */
+
+/* A cmap node, to be embedded inside the data structure being mapped. */
+struct cmap_node {
+    uint32_t hash;              /* Hash value. */
+};
+
+/* Returns the hash value embedded in 'node'. */
+static inline uint32_t
+cmap_node_hash(const struct cmap_node *node)
+{
+    return node->hash;
+}
+
+/* Number of nodes in a single bucket: as many as fit into a 64-byte cache
+ * line along with the overflow count.  This is 5 with 64-bit pointers and 7
+ * with 32-bit pointers. */
+#define CMAP_K ((64 - sizeof(uint32_t)) / (sizeof(uint32_t) + sizeof(void *)))
+
+/* A bucket.  Slot 'i' is in use if 'nodes[i]' is nonnull, in which case
+ * 'hashes[i]' is 'nodes[i]->hash'. */
+struct cmap_bucket {
+    uint32_t n_overflow;        /* Number of nodes that probed past here. */
+    uint32_t hashes[CMAP_K];
+    struct cmap_node *nodes[CMAP_K];
+};
+
+/* One array of buckets. */
+struct cmap_table {
+    struct cmap_bucket *buckets; /* 'mask' + 1 buckets, cache line aligned. */
+    void *base;                 /* Allocated block that contains 'buckets'. */
+    uint32_t mask;              /* Number of buckets, minus 1. */
+    size_t n;                   /* Number of nodes. */
+    size_t max_n;               /* Maximum 'n' before growing. */
+};
+
+/* A cache-line bucketed hash map. */
+struct cmap {
+    struct cmap_table cur;      /* Table for new insertions. */
+    struct cmap_table old;      /* Table being migrated into 'cur', if any. */
+    uint32_t migrate_pos;       /* Next bucket in 'old' to migrate. */
+};
+
+/* Initialization. */
+void cmap_init(struct cmap *);
+void cmap_destroy(struct cmap *);
+static inline size_t cmap_count(const struct cmap *);
+static inline bool cmap_is_empty(const struct cmap *);
+
+/* Adjusting capacity. */
+void cmap_shrink(struct cmap *);
+
+/* Insertion and deletion. */
+void cmap_insert(struct cmap *, struct cmap_node *, uint32_t hash);
+void cmap_remove(struct cmap *, struct cmap_node *);
+
+struct cmap_node *cmap_random_node(const struct cmap *);
+
+/* Search.
+ *
+ * CMAP_FOR_EACH_WITH_HASH iterates NODE over all of the nodes in CMAP that
+ * have hash value equal to HASH.  MEMBER must be the name of the 'struct
+ * cmap_node' member within NODE.
+ *
+ * The loop should not change NODE to point to a different node or insert or
+ * delete nodes in CMAP (unless it "break"s out of the loop to terminate
+ * iteration).
+ *
+ * HASH is only evaluated once.
+ */
+#define CMAP_FOR_EACH_WITH_HASH(NODE, MEMBER, HASH, CMAP)               \
+    for (ASSIGN_CONTAINER(NODE, cmap_first_with_hash(CMAP, HASH), MEMBER); \
+         &(NODE)->MEMBER != NULL;                                       \
+         ASSIGN_CONTAINER(NODE, cmap_next_with_hash(CMAP, &(NODE)->MEMBER), \
+                          MEMBER))
+
+static inline struct cmap_node *cmap_first_with_hash(const struct cmap *,
+                                                     uint32_t hash);
+struct cmap_node *cmap_next_with_hash(const struct cmap *,
+                                      const struct cmap_node *);
+
+bool cmap_contains(const struct cmap *, const struct cmap_node *);
+
+/* Iteration. */
+
+/* Iterates through every node in CMAP. */
+#define CMAP_FOR_EACH(NODE, MEMBER, CMAP)                               \
+    for (ASSIGN_CONTAINER(NODE, cmap_first(CMAP), MEMBER);              \
+         &(NODE)->MEMBER != NULL;                                       \
+         ASSIGN_CONTAINER(NODE, cmap_next(CMAP, &(NODE)->MEMBER), MEMBER))
+
+/* Safe when NODE may be removed from the cmap or freed. */
+#define CMAP_FOR_EACH_SAFE(NODE, NEXT, MEMBER, CMAP)                    \
+    for (ASSIGN_CONTAINER(NODE, cmap_first(CMAP), MEMBER);              \
+         (&(NODE)->MEMBER != NULL                                       \
+          ? ASSIGN_CONTAINER(NEXT, cmap_next(CMAP, &(NODE)->MEMBER), MEMBER) \
+          : 0);                                                         \
+         (NODE) = (NEXT))
+
+struct cmap_node *cmap_first(const struct cmap *);
+struct cmap_node *cmap_next(const struct cmap *, const struct cmap_node *);
+
+struct cmap_node *cmap_at_position(const struct cmap *,
+                                   uint32_t *bucket, uint32_t *offset);
+
+struct cmap_node *cmap_first_with_hash__(const struct cmap *, uint32_t hash);
+
+/* Returns the number of nodes currently in 'cmap'. */
+static inline size_t
+cmap_count(const struct cmap *cmap)
+{
+    return cmap->cur.n + cmap->old.n;
+}
+
+/* Returns true if 'cmap' currently contains no nodes, false otherwise. */
+static inline bool
+cmap_is_empty(const struct cmap *cmap)
+{
+    return !cmap_count(cmap);
+}
+
+/* Returns the first node in 'cmap' with the given 'hash', or a null pointer if
+ * no nodes have that hash value. */
+static inline struct cmap_node *
+cmap_first_with_hash(const struct cmap *cmap, uint32_t hash)
+{
+    /* Fast path: no migration in progress and the node is in its home
+     * bucket.  Comparing all of the bucket's hashes before looking at any
+     * node pointer avoids a hard-to-predict branch per slot. */
+    if (!cmap->old.n) {
+        const struct cmap_bucket *b = &cmap->cur.buckets[hash & cmap->cur.mask];
+        unsigned int map = 0;
+        size_t i;
+
+        for (i = 0; i < CMAP_K; i++) {
+            map |= (b->hashes[i] == hash) << i;
+        }
+        for (; map; map &= map - 1) {
+            struct cmap_node *node = b->nodes[raw_ctz(map)];
+            if (node) {
+                return node;
+            }
+        }
+        if (!b->n_overflow) {
+            return NULL;
+        }
+    }
+    return cmap_first_with_hash__(cmap, hash);
+}
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* cmap.h */
@@ -26,6 +26,7 @@
 #define ALWAYS_INLINE __attribute__((always_inline))
 #define WARN_UNUSED_RESULT __attribute__((__warn_unused_result__))
 #define SENTINEL(N) __attribute__((sentinel(N)))
+#define OVS_PREFETCH(ADDR) __builtin_prefetch(ADDR)
 #else
 #define NO_RETURN
 #define OVS_UNUSED
@@ -35,6 +36,7 @@
 #define ALWAYS_INLINE
 #define WARN_UNUSED_RESULT
 #define SENTINEL(N)
+#define OVS_PREFETCH(ADDR) ((void) (ADDR))
 #endif
 
 #endif /* compiler.h */
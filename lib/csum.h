@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2008, 2011 Nicira, Inc.
+ * Copyright (c) 2008, 2011, 2012 Nicira, Inc.
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -29,4 +29,17 @@ ovs_be16 csum_finish(uint32_t partial);
 ovs_be16 recalc_csum16(ovs_be16 old_csum, ovs_be16 old_u16, ovs_be16 new_u16);
 ovs_be16 recalc_csum32(ovs_be16 old_csum, ovs_be32 old_u32, ovs_be32 new_u32);
 
+/* Incremental checksum updates for several fields at once.
+ *
+ * Start with a 'delta' of 0, add the change to each modified field with
+ * csum_delta16(), csum_delta32(), or csum_delta128(), then apply the total to
+ * each checksum that covers those fields with recalc_csum_delta().  This
+ * folds each checksum once, instead of once per field.  A 'delta' can
+ * accumulate at least 32768 16-bit fields without overflow. */
+uint32_t csum_delta16(uint32_t delta, ovs_be16 old_u16, ovs_be16 new_u16);
+uint32_t csum_delta32(uint32_t delta, ovs_be32 old_u32, ovs_be32 new_u32);
+uint32_t csum_delta128(uint32_t delta, const ovs_be32 old_u32s[4],
+                       const ovs_be32 new_u32s[4]);
+ovs_be16 recalc_csum_delta(ovs_be16 old_csum, uint32_t delta);
+
 #endif /* csum.h */
@@ -38,7 +38,7 @@
 #include "dummy.h"
 #include "dynamic-string.h"
 #include "flow.h"
-#include "hmap.h"
+#include "cmap.h"
 #include "list.h"
 #include "netdev.h"
 #include "netlink.h"
@@ -83,7 +83,7 @@ struct dp_netdev {
     bool destroyed;
 
     struct dp_netdev_queue queues[N_QUEUES];
-    struct hmap flow_table;     /* Flow table. */
+    struct cmap flow_table;     /* Flow table. */
 
     /* Statistics. */
     long long int n_hit;        /* Number of flow table matches. */
@@ -104,10 +104,68 @@ struct dp_netdev_port {
     char *type;                 /* Port type as requested by user. */
 };
 
+/* Compiled actions.
+ *
+ * When a flow is added or modified, dp_netdev translates its Netlink actions
+ * into an array of operations whose arguments are already extracted and
+ * validated, so that executing the actions for a packet requires no attribute
+ * parsing.
+ *
+ * A flow matches exactly, so the L3 and L4 header fields of every packet that
+ * matches it are known in advance.  For rewrites of IPv4 and transport header
+ * fields, the changes to the IP, TCP, and UDP checksums are therefore also
+ * precomputed, as ones-complement sums of the old and new field values
+ * (see RFC 1624).  Rewrites whose old values are unknown, because no flow is
+ * available (as for dpif_execute()) or because an earlier "sample" action
+ * might or might not have changed them, fall back to recomputing each
+ * checksum change as the packet is processed. */
+enum dp_netdev_op_type {
+    DP_NETDEV_OP_OUTPUT,        /* Send to port 'u.port_no'. */
+    DP_NETDEV_OP_USERSPACE,     /* Send to userspace with 'u.userdata'. */
+    DP_NETDEV_OP_PUSH_VLAN,     /* Push an 802.1Q header with 'u.vlan_tci'. */
+    DP_NETDEV_OP_POP_VLAN,      /* Pop the outermost 802.1Q header. */
+    DP_NETDEV_OP_SET_ETH,       /* Rewrite Ethernet addresses per 'u.eth'. */
+    DP_NETDEV_OP_SET_IPV4,      /* Rewrite IPv4 header per 'u.ipv4'. */
+    DP_NETDEV_OP_SET_IPV6,      /* Rewrite IPv6 header per 'u.ipv6'. */
+    DP_NETDEV_OP_SET_TCP,       /* Rewrite TCP ports per 'u.ports'. */
+    DP_NETDEV_OP_SET_UDP,       /* Rewrite UDP ports per 'u.ports'. */
+    DP_NETDEV_OP_SAMPLE         /* Maybe skip the next 'u.sample.n_ops'. */
+};
+
+struct dp_netdev_op {
+    enum dp_netdev_op_type type;
+    union {
+        uint16_t port_no;
+        uint64_t userdata;
+        ovs_be16 vlan_tci;
+        struct ovs_key_ethernet eth;
+
+        struct {
+            struct ovs_key_ipv4 key;  /* New header field values. */
+            bool precomputed;         /* Are the deltas valid? */
+            uint32_t ip_delta;        /* Change to IP header checksum. */
+            uint32_t l4_delta;        /* Change to TCP or UDP checksum. */
+        } ipv4;
+
+        struct ovs_key_ipv6 ipv6;
+
+        struct {
+            ovs_be16 src, dst;        /* New port numbers. */
+            bool precomputed;         /* Is 'delta' valid? */
+            uint32_t delta;           /* Change to TCP or UDP checksum. */
+        } ports;
+
+        struct {
+            uint32_t probability;     /* Execute if random_uint32() < this. */
+            size_t n_ops;             /* Number of following ops to execute. */
+        } sample;
+    } u;
+};
+
 /* A flow in dp_netdev's 'flow_table'. */
 struct dp_netdev_flow {
-    struct hmap_node node;      /* Element in dp_netdev's 'flow_table'. */
-    struct flow key;
+    struct cmap_node node;      /* Element in dp_netdev's 'flow_table'. */
+    struct miniflow key;
 
     /* Statistics. */
     long long int used;         /* Last used time, in monotonic msecs. */
@@ -118,6 +176,8 @@ struct dp_netdev_flow {
     /* Actions. */
     struct nlattr *actions;
     size_t actions_len;
+    struct dp_netdev_op *ops;   /* 'actions' compiled. */
+    size_t n_ops;
 };
 
 /* Interface to netdev-based datapath. */
@@ -147,10 +207,12 @@ static int dpif_netdev_open(const struct dpif_class *, const char *name,
 static int dp_netdev_output_userspace(struct dp_netdev *, const struct ofpbuf *,
                                     int queue_no, const struct flow *,
                                     uint64_t arg);
-static void dp_netdev_execute_actions(struct dp_netdev *,
-                                      struct ofpbuf *, struct flow *,
-                                      const struct nlattr *actions,
-                                      size_t actions_len);
+static int dp_netdev_compile_actions(struct ofpbuf *ops, struct flow **keyp,
+                                     const struct nlattr *actions,
+                                     size_t actions_len);
+static void dp_netdev_execute_ops(struct dp_netdev *, struct ofpbuf *,
+                                  struct flow *, const struct dp_netdev_op *,
+                                  size_t n_ops);
 
 static struct dpif_netdev *
 dpif_netdev_cast(const struct dpif *dpif)
@@ -207,7 +269,7 @@ create_dp_netdev(const char *name, const struct dpif_class *class,
     for (i = 0; i < N_QUEUES; i++) {
         dp->queues[i].head = dp->queues[i].tail = 0;
     }
-    hmap_init(&dp->flow_table);
+    cmap_init(&dp->flow_table);
     list_init(&dp->port_list);
     error = do_add_port(dp, name, "internal", OVSP_LOCAL);
     if (error) {
@@ -277,7 +339,7 @@ dp_netdev_free(struct dp_netdev *dp)
         do_del_port(dp, port->port_no);
     }
     dp_netdev_purge_queues(dp);
-    hmap_destroy(&dp->flow_table);
+    cmap_destroy(&dp->flow_table);
     free(dp->name);
     free(dp);
 }
@@ -306,7 +368,7 @@ static int
 dpif_netdev_get_stats(const struct dpif *dpif, struct dpif_dp_stats *stats)
 {
     struct dp_netdev *dp = get_dp_netdev(dpif);
-    stats->n_flows = hmap_count(&dp->flow_table);
+    stats->n_flows = cmap_count(&dp->flow_table);
     stats->n_hit = dp->n_hit;
     stats->n_missed = dp->n_missed;
     stats->n_lost = dp->n_lost;
@@ -531,8 +593,10 @@ dpif_netdev_get_max_ports(const struct dpif *dpif OVS_UNUSED)
 static void
 dp_netdev_free_flow(struct dp_netdev *dp, struct dp_netdev_flow *flow)
 {
-    hmap_remove(&dp->flow_table, &flow->node);
+    cmap_remove(&dp->flow_table, &flow->node);
+    miniflow_destroy(&flow->key);
     free(flow->actions);
+    free(flow->ops);
     free(flow);
 }
 
@@ -541,7 +605,7 @@ dp_netdev_flow_flush(struct dp_netdev *dp)
 {
     struct dp_netdev_flow *flow, *next;
 
-    HMAP_FOR_EACH_SAFE (flow, next, node, &dp->flow_table) {
+    CMAP_FOR_EACH_SAFE (flow, next, node, &dp->flow_table) {
         dp_netdev_free_flow(dp, flow);
     }
 }
@@ -624,8 +688,8 @@ dp_netdev_lookup_flow(const struct dp_netdev *dp, const struct flow *key)
 {
     struct dp_netdev_flow *flow;
 
-    HMAP_FOR_EACH_WITH_HASH (flow, node, flow_hash(key, 0), &dp->flow_table) {
-        if (flow_equal(&flow->key, key)) {
+    CMAP_FOR_EACH_WITH_HASH (flow, node, flow_hash(key, 0), &dp->flow_table) {
+        if (miniflow_equal_flow(&flow->key, key)) {
             return flow;
         }
     }
@@ -703,9 +767,25 @@ dpif_netdev_flow_get(const struct dpif *dpif,
 }
 
 static int
-set_flow_actions(struct dp_netdev_flow *flow,
+set_flow_actions(struct dp_netdev_flow *flow, const struct flow *key,
                  const struct nlattr *actions, size_t actions_len)
 {
+    struct flow state = *key;
+    struct flow *statep = &state;
+    struct ofpbuf ops;
+    int error;
+
+    ofpbuf_init(&ops, 0);
+    error = dp_netdev_compile_actions(&ops, &statep, actions, actions_len);
+    if (error) {
+        ofpbuf_uninit(&ops);
+        return error;
+    }
+
+    free(flow->ops);
+    flow->n_ops = ops.size / sizeof *flow->ops;
+    flow->ops = ofpbuf_steal_data(&ops);
+
     flow->actions = xrealloc(flow->actions, actions_len);
     flow->actions_len = actions_len;
     memcpy(flow->actions, actions, actions_len);
@@ -721,15 +801,15 @@ add_flow(struct dpif *dpif, const struct flow *key,
     int error;
 
     flow = xzalloc(sizeof *flow);
-    flow->key = *key;
 
-    error = set_flow_actions(flow, actions, actions_len);
+    error = set_flow_actions(flow, key, actions, actions_len);
     if (error) {
         free(flow);
         return error;
     }
 
-    hmap_insert(&dp->flow_table, &flow->node, flow_hash(&flow->key, 0));
+    miniflow_init(&flow->key, key);
+    cmap_insert(&dp->flow_table, &flow->node, flow_hash(key, 0));
     return 0;
 }
 
@@ -758,7 +838,7 @@ dpif_netdev_flow_put(struct dpif *dpif, const struct dpif_flow_put *put)
     flow = dp_netdev_lookup_flow(dp, &key);
     if (!flow) {
         if (put->flags & DPIF_FP_CREATE) {
-            if (hmap_count(&dp->flow_table) < MAX_FLOWS) {
+            if (cmap_count(&dp->flow_table) < MAX_FLOWS) {
                 if (put->stats) {
                     memset(put->stats, 0, sizeof *put->stats);
                 }
@@ -771,7 +851,8 @@ dpif_netdev_flow_put(struct dpif *dpif, const struct dpif_flow_put *put)
         }
     } else {
         if (put->flags & DPIF_FP_MODIFY) {
-            int error = set_flow_actions(flow, put->actions, put->actions_len);
+            int error = set_flow_actions(flow, &key, put->actions,
+                                         put->actions_len);
             if (!error) {
                 if (put->stats) {
                     get_dpif_flow_stats(flow, put->stats);
@@ -841,9 +922,9 @@ dpif_netdev_flow_dump_next(const struct dpif *dpif, void *state_,
     struct dp_netdev_flow_state *state = state_;
     struct dp_netdev *dp = get_dp_netdev(dpif);
     struct dp_netdev_flow *flow;
-    struct hmap_node *node;
+    struct cmap_node *node;
 
-    node = hmap_at_position(&dp->flow_table, &state->bucket, &state->offset);
+    node = cmap_at_position(&dp->flow_table, &state->bucket, &state->offset);
     if (!node) {
         return EOF;
     }
@@ -852,9 +933,11 @@ dpif_netdev_flow_dump_next(const struct dpif *dpif, void *state_,
 
     if (key) {
         struct ofpbuf buf;
+        struct flow f;
 
+        miniflow_expand(&flow->key, &f);
         ofpbuf_use_stack(&buf, &state->keybuf, sizeof state->keybuf);
-        odp_flow_key_from_flow(&buf, &flow->key);
+        odp_flow_key_from_flow(&buf, &f);
 
         *key = buf.data;
         *key_len = buf.size;
@@ -890,7 +973,9 @@ static int
 dpif_netdev_execute(struct dpif *dpif, const struct dpif_execute *execute)
 {
     struct dp_netdev *dp = get_dp_netdev(dpif);
-    struct ofpbuf copy;
+    uint64_t ops_stub[1024 / 8];
+    struct ofpbuf copy, ops;
+    struct flow *no_key = NULL;
     struct flow key;
     int error;
 
@@ -908,8 +993,16 @@ dpif_netdev_execute(struct dpif *dpif, const struct dpif_execute *execute)
     error = dpif_netdev_flow_from_nlattrs(execute->key, execute->key_len,
                                           &key);
     if (!error) {
-        dp_netdev_execute_actions(dp, &copy, &key,
-                                  execute->actions, execute->actions_len);
+        /* The packet need not match 'key' in every header field, so don't
+         * let the compiler assume that it does. */
+        ofpbuf_use_stub(&ops, ops_stub, sizeof ops_stub);
+        error = dp_netdev_compile_actions(&ops, &no_key, execute->actions,
+                                          execute->actions_len);
+        if (!error) {
+            dp_netdev_execute_ops(dp, &copy, &key, ops.data,
+                                  ops.size / sizeof(struct dp_netdev_op));
+        }
+        ofpbuf_uninit(&ops);
     }
 
     ofpbuf_uninit(&copy);
@@ -1006,8 +1099,7 @@ dp_netdev_port_input(struct dp_netdev *dp, struct dp_netdev_port *port,
     flow = dp_netdev_lookup_flow(dp, &key);
     if (flow) {
         dp_netdev_flow_used(flow, &key, packet);
-        dp_netdev_execute_actions(dp, packet, &key,
-                                  flow->actions, flow->actions_len);
+        dp_netdev_execute_ops(dp, packet, &key, flow->ops, flow->n_ops);
         dp->n_hit++;
     } else {
         dp->n_missed++;
@@ -1106,23 +1198,173 @@ dp_netdev_output_userspace(struct dp_netdev *dp, const struct ofpbuf *packet,
     return 0;
 }
 
-static void
-dp_netdev_sample(struct dp_netdev *dp,
-                 struct ofpbuf *packet, struct flow *key,
-                 const struct nlattr *action)
+/* Returns true if 'key' is for an IPv4 or IPv6 packet with transport protocol
+ * 'proto'. */
+static bool
+dp_netdev_key_is_l4(const struct flow *key, uint8_t proto)
+{
+    return ((key->dl_type == htons(ETH_TYPE_IP)
+             || key->dl_type == htons(ETH_TYPE_IPV6))
+            && key->nw_proto == proto);
+}
+
+static struct dp_netdev_op *
+dp_netdev_put_op(struct ofpbuf *ops, enum dp_netdev_op_type type)
+{
+    struct dp_netdev_op *op = ofpbuf_put_zeros(ops, sizeof *op);
+    op->type = type;
+    return op;
+}
+
+static int
+dp_netdev_compile_set(struct ofpbuf *ops, struct flow *key,
+                      const struct nlattr *a)
+{
+    size_t len = nl_attr_get_size(a);
+    const struct ovs_key_ipv4 *ipv4_key;
+    const struct ovs_key_tcp *tcp_key;
+    const struct ovs_key_udp *udp_key;
+    enum ovs_key_attr type = nl_attr_type(a);
+    struct dp_netdev_op *op;
+
+    switch (type) {
+    case OVS_KEY_ATTR_TUN_ID:
+    case OVS_KEY_ATTR_PRIORITY:
+        /* not implemented */
+        return 0;
+
+    case OVS_KEY_ATTR_ETHERNET:
+        if (len != sizeof op->u.eth) {
+            return EINVAL;
+        }
+        op = dp_netdev_put_op(ops, DP_NETDEV_OP_SET_ETH);
+        memcpy(&op->u.eth, nl_attr_get(a), sizeof op->u.eth);
+        return 0;
+
+    case OVS_KEY_ATTR_IPV4:
+        if (len != sizeof *ipv4_key) {
+            return EINVAL;
+        }
+        ipv4_key = nl_attr_get(a);
+        op = dp_netdev_put_op(ops, DP_NETDEV_OP_SET_IPV4);
+        op->u.ipv4.key = *ipv4_key;
+        if (key && key->dl_type == htons(ETH_TYPE_IP)) {
+            uint32_t addr_delta, ip_delta;
+
+            /* The addresses are also part of the TCP and UDP checksums'
+             * pseudo-header. */
+            addr_delta = csum_delta32(0, key->nw_src, ipv4_key->ipv4_src);
+            addr_delta = csum_delta32(addr_delta, key->nw_dst,
+                                      ipv4_key->ipv4_dst);
+            ip_delta = csum_delta16(addr_delta, htons(key->nw_tos),
+                                    htons(ipv4_key->ipv4_tos));
+            ip_delta = csum_delta16(ip_delta, htons(key->nw_ttl << 8),
+                                    htons(ipv4_key->ipv4_ttl << 8));
+
+            op->u.ipv4.precomputed = true;
+            op->u.ipv4.ip_delta = ip_delta;
+            op->u.ipv4.l4_delta = addr_delta;
+
+            key->nw_src = ipv4_key->ipv4_src;
+            key->nw_dst = ipv4_key->ipv4_dst;
+            key->nw_tos = ipv4_key->ipv4_tos;
+            key->nw_ttl = ipv4_key->ipv4_ttl;
+        }
+        return 0;
+
+    case OVS_KEY_ATTR_IPV6:
+        if (len != sizeof op->u.ipv6) {
+            return EINVAL;
+        }
+        op = dp_netdev_put_op(ops, DP_NETDEV_OP_SET_IPV6);
+        memcpy(&op->u.ipv6, nl_attr_get(a), sizeof op->u.ipv6);
+        if (key) {
+            memcpy(&key->ipv6_src, op->u.ipv6.ipv6_src, sizeof key->ipv6_src);
+            memcpy(&key->ipv6_dst, op->u.ipv6.ipv6_dst, sizeof key->ipv6_dst);
+            key->ipv6_label = op->u.ipv6.ipv6_label;
+            key->nw_tos = op->u.ipv6.ipv6_tclass;
+            key->nw_ttl = op->u.ipv6.ipv6_hlimit;
+        }
+        return 0;
+
+    case OVS_KEY_ATTR_TCP:
+        if (len != sizeof *tcp_key) {
+            return EINVAL;
+        }
+        tcp_key = nl_attr_get(a);
+        op = dp_netdev_put_op(ops, DP_NETDEV_OP_SET_TCP);
+        op->u.ports.src = tcp_key->tcp_src;
+        op->u.ports.dst = tcp_key->tcp_dst;
+        if (key && dp_netdev_key_is_l4(key, IPPROTO_TCP)) {
+            op->u.ports.precomputed = true;
+            op->u.ports.delta = csum_delta16(0, key->tp_src,
+                                             tcp_key->tcp_src);
+            op->u.ports.delta = csum_delta16(op->u.ports.delta, key->tp_dst,
+                                             tcp_key->tcp_dst);
+            key->tp_src = tcp_key->tcp_src;
+            key->tp_dst = tcp_key->tcp_dst;
+        }
+        return 0;
+
+    case OVS_KEY_ATTR_UDP:
+        if (len != sizeof *udp_key) {
+            return EINVAL;
+        }
+        udp_key = nl_attr_get(a);
+        op = dp_netdev_put_op(ops, DP_NETDEV_OP_SET_UDP);
+        op->u.ports.src = udp_key->udp_src;
+        op->u.ports.dst = udp_key->udp_dst;
+        if (key && dp_netdev_key_is_l4(key, IPPROTO_UDP)) {
+            op->u.ports.precomputed = true;
+            op->u.ports.delta = csum_delta16(0, key->tp_src,
+                                             udp_key->udp_src);
+            op->u.ports.delta = csum_delta16(op->u.ports.delta, key->tp_dst,
+                                             udp_key->udp_dst);
+            key->tp_src = udp_key->udp_src;
+            key->tp_dst = udp_key->udp_dst;
+        }
+        return 0;
+
+    case OVS_KEY_ATTR_UNSPEC:
+    case OVS_KEY_ATTR_ENCAP:
+    case OVS_KEY_ATTR_ETHERTYPE:
+    case OVS_KEY_ATTR_IN_PORT:
+    case OVS_KEY_ATTR_VLAN:
+    case OVS_KEY_ATTR_ICMP:
+    case OVS_KEY_ATTR_ICMPV6:
+    case OVS_KEY_ATTR_ARP:
+    case OVS_KEY_ATTR_ND:
+    case __OVS_KEY_ATTR_MAX:
+    default:
+        return EINVAL;
+    }
+}
+
+/* Compiles OVS_ACTION_ATTR_SAMPLE action 'action' into 'ops'.  If the sampled
+ * actions modify any header field that '*keyp' tracks, or lose track of one
+ * themselves in a nested sample, sets '*keyp' to NULL, because whether they
+ * take effect is only known as each packet is processed. */
+static int
+dp_netdev_compile_sample(struct ofpbuf *ops, struct flow **keyp,
+                         const struct nlattr *action)
 {
     const struct nlattr *subactions = NULL;
+    uint32_t probability = 0;
     const struct nlattr *a;
-    size_t left;
+    struct flow sub_key, *sub_keyp;
+    struct dp_netdev_op *op;
+    size_t ofs, left;
+    int error;
 
-    NL_NESTED_FOR_EACH_UNSAFE (a, left, action) {
+    NL_NESTED_FOR_EACH (a, left, action) {
         int type = nl_attr_type(a);
 
         switch ((enum ovs_sample_attr) type) {
         case OVS_SAMPLE_ATTR_PROBABILITY:
-            if (random_uint32() >= nl_attr_get_u32(a)) {
-                return;
+            if (nl_attr_get_size(a) != sizeof probability) {
+                return EINVAL;
             }
+            probability = nl_attr_get_u32(a);
             break;
 
         case OVS_SAMPLE_ATTR_ACTIONS:
@@ -1132,119 +1374,237 @@ dp_netdev_sample(struct dp_netdev *dp,
         case OVS_SAMPLE_ATTR_UNSPEC:
         case __OVS_SAMPLE_ATTR_MAX:
         default:
-            NOT_REACHED();
+            return EINVAL;
         }
     }
+    if (left || !subactions) {
+        return EINVAL;
+    }
 
-    dp_netdev_execute_actions(dp, packet, key, nl_attr_get(subactions),
-                              nl_attr_get_size(subactions));
+    ofs = ops->size;
+    dp_netdev_put_op(ops, DP_NETDEV_OP_SAMPLE);
+    if (*keyp) {
+        sub_key = **keyp;
+        sub_keyp = &sub_key;
+    } else {
+        sub_keyp = NULL;
+    }
+    error = dp_netdev_compile_actions(ops, &sub_keyp,
+                                      nl_attr_get(subactions),
+                                      nl_attr_get_size(subactions));
+    if (error) {
+        return error;
+    }
+    if (*keyp && (!sub_keyp || !flow_equal(&sub_key, *keyp))) {
+        *keyp = NULL;
+    }
+
+    op = (struct dp_netdev_op *) ((char *) ops->data + ofs);
+    op->u.sample.probability = probability;
+    op->u.sample.n_ops = (ops->size - ofs) / sizeof *op - 1;
+    return 0;
 }
 
-static void
-dp_netdev_action_userspace(struct dp_netdev *dp,
-                          struct ofpbuf *packet, struct flow *key,
-                          const struct nlattr *a)
+/* Compiles the 'actions_len' bytes of Netlink actions in 'actions' into
+ * operations appended to 'ops'.
+ *
+ * If '*keyp' is nonnull, it must be the flow that every packet to which the
+ * operations will be applied matches exactly, which allows checksum updates
+ * to be precomputed.  The L3 and L4 fields of '**keyp' are updated as the
+ * actions modify them.  If a sample action makes those fields unknown,
+ * '*keyp' is set to NULL, so that the caller does not go on trusting them.
+ *
+ * Returns 0 if successful, otherwise EINVAL if 'actions' are malformed. */
+static int
+dp_netdev_compile_actions(struct ofpbuf *ops, struct flow **keyp,
+                          const struct nlattr *actions, size_t actions_len)
 {
-    const struct nlattr *userdata_attr;
-    uint64_t userdata;
+    const struct nlattr *a;
+    size_t left;
+
+    NL_ATTR_FOR_EACH (a, left, actions, actions_len) {
+        const struct ovs_action_push_vlan *vlan;
+        const struct nlattr *userdata;
+        size_t len = nl_attr_get_size(a);
+        int type = nl_attr_type(a);
+        struct dp_netdev_op *op;
+        int error;
+
+        switch ((enum ovs_action_attr) type) {
+        case OVS_ACTION_ATTR_OUTPUT:
+            if (len != sizeof(uint32_t) || nl_attr_get_u32(a) >= MAX_PORTS) {
+                return EINVAL;
+            }
+            op = dp_netdev_put_op(ops, DP_NETDEV_OP_OUTPUT);
+            op->u.port_no = nl_attr_get_u32(a);
+            break;
+
+        case OVS_ACTION_ATTR_USERSPACE:
+            userdata = nl_attr_find_nested(a, OVS_USERSPACE_ATTR_USERDATA);
+            if (userdata && nl_attr_get_size(userdata) != sizeof(uint64_t)) {
+                return EINVAL;
+            }
+            op = dp_netdev_put_op(ops, DP_NETDEV_OP_USERSPACE);
+            op->u.userdata = userdata ? nl_attr_get_u64(userdata) : 0;
+            break;
+
+        case OVS_ACTION_ATTR_PUSH_VLAN:
+            if (len != sizeof *vlan) {
+                return EINVAL;
+            }
+            vlan = nl_attr_get(a);
+            op = dp_netdev_put_op(ops, DP_NETDEV_OP_PUSH_VLAN);
+            op->u.vlan_tci = vlan->vlan_tci;
+            break;
+
+        case OVS_ACTION_ATTR_POP_VLAN:
+            if (len) {
+                return EINVAL;
+            }
+            dp_netdev_put_op(ops, DP_NETDEV_OP_POP_VLAN);
+            break;
 
-    userdata_attr = nl_attr_find_nested(a, OVS_USERSPACE_ATTR_USERDATA);
-    userdata = userdata_attr ? nl_attr_get_u64(userdata_attr) : 0;
-    dp_netdev_output_userspace(dp, packet, DPIF_UC_ACTION, key, userdata);
+        case OVS_ACTION_ATTR_SET:
+            if (len < NLA_HDRLEN
+                || ((const struct nlattr *) nl_attr_get(a))->nla_len > len) {
+                return EINVAL;
+            }
+            error = dp_netdev_compile_set(ops, *keyp, nl_attr_get(a));
+            if (error) {
+                return error;
+            }
+            break;
+
+        case OVS_ACTION_ATTR_SAMPLE:
+            error = dp_netdev_compile_sample(ops, keyp, a);
+            if (error) {
+                return error;
+            }
+            break;
+
+        case OVS_ACTION_ATTR_UNSPEC:
+        case __OVS_ACTION_ATTR_MAX:
+        default:
+            return EINVAL;
+        }
+    }
+    return left ? EINVAL : 0;
 }
 
 static void
-execute_set_action(struct ofpbuf *packet, const struct nlattr *a)
+dp_netdev_set_ipv4(struct ofpbuf *packet, const struct dp_netdev_op *op)
 {
-    enum ovs_key_attr type = nl_attr_type(a);
-    const struct ovs_key_ipv4 *ipv4_key;
-    const struct ovs_key_tcp *tcp_key;
-    const struct ovs_key_udp *udp_key;
+    const struct ovs_key_ipv4 *ipv4_key = &op->u.ipv4.key;
+    struct ip_header *nh = packet->l3;
 
-    switch (type) {
-    case OVS_KEY_ATTR_TUN_ID:
-    case OVS_KEY_ATTR_PRIORITY:
-    case OVS_KEY_ATTR_IPV6:
-        /* not implemented */
-        break;
-
-    case OVS_KEY_ATTR_ETHERNET:
-        dp_netdev_set_dl(packet,
-                   nl_attr_get_unspec(a, sizeof(struct ovs_key_ethernet)));
-        break;
-
-    case OVS_KEY_ATTR_IPV4:
-        ipv4_key = nl_attr_get_unspec(a, sizeof(struct ovs_key_ipv4));
+    if (!op->u.ipv4.precomputed || !packet->l4) {
         packet_set_ipv4(packet, ipv4_key->ipv4_src, ipv4_key->ipv4_dst,
                         ipv4_key->ipv4_tos, ipv4_key->ipv4_ttl);
-        break;
+        return;
+    }
 
-    case OVS_KEY_ATTR_TCP:
-        tcp_key = nl_attr_get_unspec(a, sizeof(struct ovs_key_tcp));
-        packet_set_tcp_port(packet, tcp_key->tcp_src, tcp_key->tcp_dst);
-        break;
-
-     case OVS_KEY_ATTR_UDP:
-        udp_key = nl_attr_get_unspec(a, sizeof(struct ovs_key_udp));
-        packet_set_udp_port(packet, udp_key->udp_src, udp_key->udp_dst);
-        break;
-
-     case OVS_KEY_ATTR_UNSPEC:
-     case OVS_KEY_ATTR_ENCAP:
-     case OVS_KEY_ATTR_ETHERTYPE:
-     case OVS_KEY_ATTR_IN_PORT:
-     case OVS_KEY_ATTR_VLAN:
-     case OVS_KEY_ATTR_ICMP:
-     case OVS_KEY_ATTR_ICMPV6:
-     case OVS_KEY_ATTR_ARP:
-     case OVS_KEY_ATTR_ND:
-     case __OVS_KEY_ATTR_MAX:
-     default:
-        NOT_REACHED();
+    packet_update_l4_csum(packet, nh->ip_proto, op->u.ipv4.l4_delta);
+    nh->ip_csum = recalc_csum_delta(nh->ip_csum, op->u.ipv4.ip_delta);
+    nh->ip_src = ipv4_key->ipv4_src;
+    nh->ip_dst = ipv4_key->ipv4_dst;
+    nh->ip_tos = ipv4_key->ipv4_tos;
+    nh->ip_ttl = ipv4_key->ipv4_ttl;
+}
+
+static void
+dp_netdev_set_tcp(struct ofpbuf *packet, const struct dp_netdev_op *op)
+{
+    struct tcp_header *th = packet->l4;
+
+    if (!op->u.ports.precomputed || !packet->l7) {
+        packet_set_tcp_port(packet, op->u.ports.src, op->u.ports.dst);
+        return;
     }
+
+    th->tcp_csum = recalc_csum_delta(th->tcp_csum, op->u.ports.delta);
+    th->tcp_src = op->u.ports.src;
+    th->tcp_dst = op->u.ports.dst;
 }
 
 static void
-dp_netdev_execute_actions(struct dp_netdev *dp,
-                          struct ofpbuf *packet, struct flow *key,
-                          const struct nlattr *actions,
-                          size_t actions_len)
+dp_netdev_set_udp(struct ofpbuf *packet, const struct dp_netdev_op *op)
 {
-    const struct nlattr *a;
-    unsigned int left;
+    struct udp_header *uh = packet->l4;
 
-    NL_ATTR_FOR_EACH_UNSAFE (a, left, actions, actions_len) {
-        const struct ovs_action_push_vlan *vlan;
-        int type = nl_attr_type(a);
+    if (!op->u.ports.precomputed || !packet->l7) {
+        packet_set_udp_port(packet, op->u.ports.src, op->u.ports.dst);
+        return;
+    }
 
-        switch ((enum ovs_action_attr) type) {
-        case OVS_ACTION_ATTR_OUTPUT:
-            dp_netdev_output_port(dp, packet, nl_attr_get_u32(a));
+    if (uh->udp_csum && op->u.ports.delta) {
+        uh->udp_csum = recalc_csum_delta(uh->udp_csum, op->u.ports.delta);
+        if (!uh->udp_csum) {
+            uh->udp_csum = htons(0xffff);
+        }
+    }
+    uh->udp_src = op->u.ports.src;
+    uh->udp_dst = op->u.ports.dst;
+}
+
+/* Executes the 'n_ops' compiled operations in 'ops' on 'packet', whose flow
+ * is 'key'. */
+static void
+dp_netdev_execute_ops(struct dp_netdev *dp, struct ofpbuf *packet,
+                      struct flow *key, const struct dp_netdev_op *ops,
+                      size_t n_ops)
+{
+    const struct dp_netdev_op *end = &ops[n_ops];
+    const struct dp_netdev_op *op;
+
+    for (op = ops; op < end; op++) {
+        switch (op->type) {
+        case DP_NETDEV_OP_OUTPUT:
+            dp_netdev_output_port(dp, packet, op->u.port_no);
             break;
 
-        case OVS_ACTION_ATTR_USERSPACE:
-            dp_netdev_action_userspace(dp, packet, key, a);
+        case DP_NETDEV_OP_USERSPACE:
+            dp_netdev_output_userspace(dp, packet, DPIF_UC_ACTION, key,
+                                       op->u.userdata);
             break;
 
-        case OVS_ACTION_ATTR_PUSH_VLAN:
-            vlan = nl_attr_get(a);
-            eth_push_vlan(packet, vlan->vlan_tci);
+        case DP_NETDEV_OP_PUSH_VLAN:
+            eth_push_vlan(packet, op->u.vlan_tci);
             break;
 
-        case OVS_ACTION_ATTR_POP_VLAN:
+        case DP_NETDEV_OP_POP_VLAN:
             eth_pop_vlan(packet);
             break;
 
-        case OVS_ACTION_ATTR_SET:
-            execute_set_action(packet, nl_attr_get(a));
+        case DP_NETDEV_OP_SET_ETH:
+            dp_netdev_set_dl(packet, &op->u.eth);
             break;
 
-        case OVS_ACTION_ATTR_SAMPLE:
-            dp_netdev_sample(dp, packet, key, a);
+        case DP_NETDEV_OP_SET_IPV4:
+            dp_netdev_set_ipv4(packet, op);
             break;
 
-        case OVS_ACTION_ATTR_UNSPEC:
-        case __OVS_ACTION_ATTR_MAX:
+        case DP_NETDEV_OP_SET_IPV6:
+            packet_set_ipv6(packet, op->u.ipv6.ipv6_proto,
+                            op->u.ipv6.ipv6_src, op->u.ipv6.ipv6_dst,
+                            op->u.ipv6.ipv6_tclass, op->u.ipv6.ipv6_label,
+                            op->u.ipv6.ipv6_hlimit);
+            break;
+
+        case DP_NETDEV_OP_SET_TCP:
+            dp_netdev_set_tcp(packet, op);
+            break;
+
+        case DP_NETDEV_OP_SET_UDP:
+            dp_netdev_set_udp(packet, op);
+            break;
+
+        case DP_NETDEV_OP_SAMPLE:
+            if (random_uint32() >= op->u.sample.probability) {
+                op += op->u.sample.n_ops;
+            }
+            break;
+
+        default:
             NOT_REACHED();
         }
     }
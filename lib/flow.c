@@ -24,6 +24,9 @@
 #include <netinet/ip6.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "byte-order.h"
 #include "coverage.h"
 #include "dynamic-string.h"
@@ -37,87 +40,92 @@
 VLOG_DEFINE_THIS_MODULE(flow);
 
 COVERAGE_DEFINE(flow_extract);
+COVERAGE_DEFINE(miniflow_malloc);
 
-static struct arp_eth_header *
-pull_arp(struct ofpbuf *packet)
+/* Packet parsing.
+ *
+ * The parsing functions below work on a cursor into the packet: '*datap'
+ * points to the next unparsed byte and '*sizep' is the number of bytes that
+ * remain.  Each header's length is checked once, after which its fields are
+ * read directly, so that extracting a flow does not go through the
+ * per-call assertions of ofpbuf_pull(). */
+
+/* Returns '*datap' and advances '*datap' and '*sizep' past 'n' bytes.  The
+ * caller must already have checked that at least 'n' bytes remain. */
+static inline const void *
+data_pull(const uint8_t **datap, size_t *sizep, size_t n)
 {
-    return ofpbuf_try_pull(packet, ARP_ETH_HEADER_LEN);
+    const uint8_t *data = *datap;
+
+    *datap += n;
+    *sizep -= n;
+    return data;
 }
 
-static struct ip_header *
-pull_ip(struct ofpbuf *packet)
+/* Returns '*datap' and advances '*datap' and '*sizep' past 'n' bytes, if at
+ * least 'n' bytes remain.  Otherwise, returns NULL without advancing. */
+static inline const void *
+data_try_pull(const uint8_t **datap, size_t *sizep, size_t n)
 {
-    if (packet->size >= IP_HEADER_LEN) {
-        struct ip_header *ip = packet->data;
-        int ip_len = IP_IHL(ip->ip_ihl_ver) * 4;
-        if (ip_len >= IP_HEADER_LEN && packet->size >= ip_len) {
-            return ofpbuf_pull(packet, ip_len);
-        }
-    }
-    return NULL;
+    return *sizep >= n ? data_pull(datap, sizep, n) : NULL;
 }
 
-static struct tcp_header *
-pull_tcp(struct ofpbuf *packet)
+static const struct ip_header *
+pull_ip(const uint8_t **datap, size_t *sizep)
 {
-    if (packet->size >= TCP_HEADER_LEN) {
-        struct tcp_header *tcp = packet->data;
-        int tcp_len = TCP_OFFSET(tcp->tcp_ctl) * 4;
-        if (tcp_len >= TCP_HEADER_LEN && packet->size >= tcp_len) {
-            return ofpbuf_pull(packet, tcp_len);
+    if (*sizep >= IP_HEADER_LEN) {
+        const struct ip_header *ip = (const struct ip_header *) *datap;
+        size_t ip_len = IP_IHL(ip->ip_ihl_ver) * 4;
+        if (ip_len >= IP_HEADER_LEN && *sizep >= ip_len) {
+            return data_pull(datap, sizep, ip_len);
         }
     }
     return NULL;
 }
 
-static struct udp_header *
-pull_udp(struct ofpbuf *packet)
-{
-    return ofpbuf_try_pull(packet, UDP_HEADER_LEN);
-}
-
-static struct icmp_header *
-pull_icmp(struct ofpbuf *packet)
-{
-    return ofpbuf_try_pull(packet, ICMP_HEADER_LEN);
-}
-
-static struct icmp6_hdr *
-pull_icmpv6(struct ofpbuf *packet)
+static const struct tcp_header *
+pull_tcp(const uint8_t **datap, size_t *sizep)
 {
-    return ofpbuf_try_pull(packet, sizeof(struct icmp6_hdr));
+    if (*sizep >= TCP_HEADER_LEN) {
+        const struct tcp_header *tcp = (const struct tcp_header *) *datap;
+        size_t tcp_len = TCP_OFFSET(tcp->tcp_ctl) * 4;
+        if (tcp_len >= TCP_HEADER_LEN && *sizep >= tcp_len) {
+            return data_pull(datap, sizep, tcp_len);
+        }
+    }
+    return NULL;
 }
 
 static void
-parse_vlan(struct ofpbuf *b, struct flow *flow)
+parse_vlan(const uint8_t **datap, size_t *sizep, struct flow *flow)
 {
     struct qtag_prefix {
         ovs_be16 eth_type;      /* ETH_TYPE_VLAN */
         ovs_be16 tci;
     };
 
-    if (b->size >= sizeof(struct qtag_prefix) + sizeof(ovs_be16)) {
-        struct qtag_prefix *qp = ofpbuf_pull(b, sizeof *qp);
+    if (*sizep >= sizeof(struct qtag_prefix) + sizeof(ovs_be16)) {
+        const struct qtag_prefix *qp = data_pull(datap, sizep, sizeof *qp);
         flow->vlan_tci = qp->tci | htons(VLAN_CFI);
     }
 }
 
 static ovs_be16
-parse_ethertype(struct ofpbuf *b)
+parse_ethertype(const uint8_t **datap, size_t *sizep)
 {
-    struct llc_snap_header *llc;
+    const struct llc_snap_header *llc;
     ovs_be16 proto;
 
-    proto = *(ovs_be16 *) ofpbuf_pull(b, sizeof proto);
+    proto = *(const ovs_be16 *) data_pull(datap, sizep, sizeof proto);
     if (ntohs(proto) >= ETH_TYPE_MIN) {
         return proto;
     }
 
-    if (b->size < sizeof *llc) {
+    if (*sizep < sizeof *llc) {
         return htons(FLOW_DL_TYPE_NONE);
     }
 
-    llc = b->data;
+    llc = (const struct llc_snap_header *) *datap;
     if (llc->llc.llc_dsap != LLC_DSAP_SNAP
         || llc->llc.llc_ssap != LLC_SSAP_SNAP
         || llc->llc.llc_cntl != LLC_CNTL_SNAP
@@ -126,18 +134,18 @@ parse_ethertype(struct ofpbuf *b)
         return htons(FLOW_DL_TYPE_NONE);
     }
 
-    ofpbuf_pull(b, sizeof *llc);
+    data_pull(datap, sizep, sizeof *llc);
     return llc->snap.snap_type;
 }
 
 static int
-parse_ipv6(struct ofpbuf *packet, struct flow *flow)
+parse_ipv6(const uint8_t **datap, size_t *sizep, struct flow *flow)
 {
     const struct ip6_hdr *nh;
     ovs_be32 tc_flow;
     int nexthdr;
 
-    nh = ofpbuf_try_pull(packet, sizeof *nh);
+    nh = data_try_pull(datap, sizep, sizeof *nh);
     if (!nh) {
         return EINVAL;
     }
@@ -170,7 +178,7 @@ parse_ipv6(struct ofpbuf *packet, struct flow *flow)
          * accesses within the extension header are within those first 8
          * bytes. All extension headers are required to be at least 8
          * bytes. */
-        if (packet->size < 8) {
+        if (*sizep < 8) {
             return EINVAL;
         }
 
@@ -179,9 +187,9 @@ parse_ipv6(struct ofpbuf *packet, struct flow *flow)
                 || (nexthdr == IPPROTO_DSTOPTS)) {
             /* These headers, while different, have the fields we care about
              * in the same location and with the same interpretation. */
-            const struct ip6_ext *ext_hdr = (struct ip6_ext *)packet->data;
+            const struct ip6_ext *ext_hdr = (const struct ip6_ext *) *datap;
             nexthdr = ext_hdr->ip6e_nxt;
-            if (!ofpbuf_try_pull(packet, (ext_hdr->ip6e_len + 1) * 8)) {
+            if (!data_try_pull(datap, sizep, (ext_hdr->ip6e_len + 1) * 8)) {
                 return EINVAL;
             }
         } else if (nexthdr == IPPROTO_AH) {
@@ -189,18 +197,17 @@ parse_ipv6(struct ofpbuf *packet, struct flow *flow)
              * we care about are in the same location as the generic
              * option header--only the header length is calculated
              * differently. */
-            const struct ip6_ext *ext_hdr = (struct ip6_ext *)packet->data;
+            const struct ip6_ext *ext_hdr = (const struct ip6_ext *) *datap;
             nexthdr = ext_hdr->ip6e_nxt;
-            if (!ofpbuf_try_pull(packet, (ext_hdr->ip6e_len + 2) * 4)) {
+            if (!data_try_pull(datap, sizep, (ext_hdr->ip6e_len + 2) * 4)) {
                return EINVAL;
             }
         } else if (nexthdr == IPPROTO_FRAGMENT) {
-            const struct ip6_frag *frag_hdr = (struct ip6_frag *)packet->data;
+            const struct ip6_frag *frag_hdr;
 
+            frag_hdr = (const struct ip6_frag *) *datap;
             nexthdr = frag_hdr->ip6f_nxt;
-            if (!ofpbuf_try_pull(packet, sizeof *frag_hdr)) {
-                return EINVAL;
-            }
+            data_pull(datap, sizep, sizeof *frag_hdr);
 
             /* We only process the first fragment. */
             if (frag_hdr->ip6f_offlg != htons(0)) {
@@ -220,31 +227,34 @@ parse_ipv6(struct ofpbuf *packet, struct flow *flow)
 }
 
 static void
-parse_tcp(struct ofpbuf *packet, struct ofpbuf *b, struct flow *flow)
+parse_tcp(struct ofpbuf *packet, const uint8_t **datap, size_t *sizep,
+          struct flow *flow)
 {
-    const struct tcp_header *tcp = pull_tcp(b);
+    const struct tcp_header *tcp = pull_tcp(datap, sizep);
     if (tcp) {
         flow->tp_src = tcp->tcp_src;
         flow->tp_dst = tcp->tcp_dst;
-        packet->l7 = b->data;
+        packet->l7 = (void *) *datap;
     }
 }
 
 static void
-parse_udp(struct ofpbuf *packet, struct ofpbuf *b, struct flow *flow)
+parse_udp(struct ofpbuf *packet, const uint8_t **datap, size_t *sizep,
+          struct flow *flow)
 {
-    const struct udp_header *udp = pull_udp(b);
+    const struct udp_header *udp = data_try_pull(datap, sizep,
+                                                 UDP_HEADER_LEN);
     if (udp) {
         flow->tp_src = udp->udp_src;
         flow->tp_dst = udp->udp_dst;
-        packet->l7 = b->data;
+        packet->l7 = (void *) *datap;
     }
 }
 
 static bool
-parse_icmpv6(struct ofpbuf *b, struct flow *flow)
+parse_icmpv6(const uint8_t **datap, size_t *sizep, struct flow *flow)
 {
-    const struct icmp6_hdr *icmp = pull_icmpv6(b);
+    const struct icmp6_hdr *icmp = data_try_pull(datap, sizep, sizeof *icmp);
 
     if (!icmp) {
         return false;
@@ -260,19 +270,21 @@ parse_icmpv6(struct ofpbuf *b, struct flow *flow)
          icmp->icmp6_type == ND_NEIGHBOR_ADVERT)) {
         const struct in6_addr *nd_target;
 
-        nd_target = ofpbuf_try_pull(b, sizeof *nd_target);
+        nd_target = data_try_pull(datap, sizep, sizeof *nd_target);
         if (!nd_target) {
             return false;
         }
         flow->nd_target = *nd_target;
 
-        while (b->size >= 8) {
+        while (*sizep >= 8) {
             /* The minimum size of an option is 8 bytes, which also is
              * the size of Ethernet link-layer options. */
-            const struct nd_opt_hdr *nd_opt = b->data;
-            int opt_len = nd_opt->nd_opt_len * 8;
+            const struct nd_opt_hdr *nd_opt;
+            size_t opt_len;
 
-            if (!opt_len || opt_len > b->size) {
+            nd_opt = (const struct nd_opt_hdr *) *datap;
+            opt_len = nd_opt->nd_opt_len * 8;
+            if (!opt_len || opt_len > *sizep) {
                 goto invalid;
             }
 
@@ -295,9 +307,7 @@ parse_icmpv6(struct ofpbuf *b, struct flow *flow)
                 }
             }
 
-            if (!ofpbuf_try_pull(b, opt_len)) {
-                goto invalid;
-            }
+            data_pull(datap, sizep, opt_len);
         }
     }
 
@@ -333,8 +343,32 @@ void
 flow_extract(struct ofpbuf *packet, uint32_t skb_priority, ovs_be64 tun_id,
              uint16_t ofp_in_port, struct flow *flow)
 {
-    struct ofpbuf b = *packet;
-    struct eth_header *eth;
+    flow_extract_depth(packet, skb_priority, tun_id, ofp_in_port,
+                       FLOW_PARSE_L4, flow);
+}
+
+/* Like flow_extract(), but parses 'packet' no deeper than 'depth':
+ *
+ *    - FLOW_PARSE_L2 extracts only the Ethernet addresses, VLAN TCI, and
+ *      Ethernet type, and sets packet->l2 and packet->l3.
+ *
+ *    - FLOW_PARSE_L3 also extracts the IPv4, IPv6, or ARP header fields, and
+ *      sets packet->l4 for IPv4 and IPv6.
+ *
+ *    - FLOW_PARSE_L4 is the same as flow_extract().
+ *
+ * Fields and header pointers beyond 'depth' are zero or NULL, exactly as if
+ * the packet had been truncated just past the last header parsed.  This is
+ * useful for consumers that only look at, for example, Ethernet addresses
+ * and VLANs. */
+void
+flow_extract_depth(struct ofpbuf *packet, uint32_t skb_priority,
+                   ovs_be64 tun_id, uint16_t ofp_in_port,
+                   enum flow_parse_depth depth, struct flow *flow)
+{
+    const uint8_t *data = packet->data;
+    size_t size = packet->size;
+    const struct eth_header *eth;
 
     COVERAGE_INC(flow_extract);
 
@@ -343,33 +377,35 @@ flow_extract(struct ofpbuf *packet, uint32_t skb_priority, ovs_be64 tun_id,
     flow->in_port = ofp_in_port;
     flow->skb_priority = skb_priority;
 
-    packet->l2 = b.data;
+    packet->l2 = packet->data;
     packet->l3 = NULL;
     packet->l4 = NULL;
     packet->l7 = NULL;
 
-    if (b.size < sizeof *eth) {
+    if (size < sizeof *eth) {
         return;
     }
 
     /* Link layer. */
-    eth = b.data;
+    eth = data_pull(&data, &size, ETH_ADDR_LEN * 2);
     memcpy(flow->dl_src, eth->eth_src, ETH_ADDR_LEN);
     memcpy(flow->dl_dst, eth->eth_dst, ETH_ADDR_LEN);
 
     /* dl_type, vlan_tci. */
-    ofpbuf_pull(&b, ETH_ADDR_LEN * 2);
     if (eth->eth_type == htons(ETH_TYPE_VLAN)) {
-        parse_vlan(&b, flow);
+        parse_vlan(&data, &size, flow);
+    }
+    flow->dl_type = parse_ethertype(&data, &size);
+    packet->l3 = (void *) data;
+    if (depth < FLOW_PARSE_L3) {
+        return;
     }
-    flow->dl_type = parse_ethertype(&b);
 
     /* Network layer. */
-    packet->l3 = b.data;
     if (flow->dl_type == htons(ETH_TYPE_IP)) {
-        const struct ip_header *nh = pull_ip(&b);
+        const struct ip_header *nh = pull_ip(&data, &size);
         if (nh) {
-            packet->l4 = b.data;
+            packet->l4 = (void *) data;
 
             flow->nw_src = get_unaligned_be32(&nh->ip_src);
             flow->nw_dst = get_unaligned_be32(&nh->ip_dst);
@@ -384,38 +420,47 @@ flow_extract(struct ofpbuf *packet, uint32_t skb_priority, ovs_be64 tun_id,
             }
             flow->nw_ttl = nh->ip_ttl;
 
-            if (!(nh->ip_frag_off & htons(IP_FRAG_OFF_MASK))) {
+            if (depth >= FLOW_PARSE_L4
+                && !(nh->ip_frag_off & htons(IP_FRAG_OFF_MASK))) {
                 if (flow->nw_proto == IPPROTO_TCP) {
-                    parse_tcp(packet, &b, flow);
+                    parse_tcp(packet, &data, &size, flow);
                 } else if (flow->nw_proto == IPPROTO_UDP) {
-                    parse_udp(packet, &b, flow);
+                    parse_udp(packet, &data, &size, flow);
                 } else if (flow->nw_proto == IPPROTO_ICMP) {
-                    const struct icmp_header *icmp = pull_icmp(&b);
+                    const struct icmp_header *icmp;
+
+                    icmp = data_try_pull(&data, &size, ICMP_HEADER_LEN);
                     if (icmp) {
                         flow->tp_src = htons(icmp->icmp_type);
                         flow->tp_dst = htons(icmp->icmp_code);
-                        packet->l7 = b.data;
+                        packet->l7 = (void *) data;
                     }
                 }
             }
         }
     } else if (flow->dl_type == htons(ETH_TYPE_IPV6)) {
-        if (parse_ipv6(&b, flow)) {
+        if (parse_ipv6(&data, &size, flow)) {
+            return;
+        }
+
+        packet->l4 = (void *) data;
+        if (depth < FLOW_PARSE_L4) {
             return;
         }
 
-        packet->l4 = b.data;
         if (flow->nw_proto == IPPROTO_TCP) {
-            parse_tcp(packet, &b, flow);
+            parse_tcp(packet, &data, &size, flow);
         } else if (flow->nw_proto == IPPROTO_UDP) {
-            parse_udp(packet, &b, flow);
+            parse_udp(packet, &data, &size, flow);
         } else if (flow->nw_proto == IPPROTO_ICMPV6) {
-            if (parse_icmpv6(&b, flow)) {
-                packet->l7 = b.data;
+            if (parse_icmpv6(&data, &size, flow)) {
+                packet->l7 = (void *) data;
             }
         }
     } else if (flow->dl_type == htons(ETH_TYPE_ARP)) {
-        const struct arp_eth_header *arp = pull_arp(&b);
+        const struct arp_eth_header *arp;
+
+        arp = data_try_pull(&data, &size, ARP_ETH_HEADER_LEN);
         if (arp && arp->ar_hrd == htons(1)
             && arp->ar_pro == htons(ETH_TYPE_IP)
             && arp->ar_hln == ETH_ADDR_LEN
@@ -881,7 +926,7 @@ flow_hash_symmetric_l4(const struct flow *flow, uint32_t basis)
             fields.tp_port = flow->tp_src ^ flow->tp_dst;
         }
     }
-    return hash_bytes(&fields, sizeof fields, basis);
+    return hash_bytes_lookup3(&fields, sizeof fields, basis);
 }
 
 /* Hashes the portions of 'flow' designated by 'fields'. */
@@ -892,7 +937,7 @@ flow_hash_fields(const struct flow *flow, enum nx_hash_fields fields,
     switch (fields) {
 
     case NX_HASH_FIELDS_ETH_SRC:
-        return hash_bytes(flow->dl_src, sizeof flow->dl_src, basis);
+        return hash_bytes_lookup3(flow->dl_src, sizeof flow->dl_src, basis);
 
     case NX_HASH_FIELDS_SYMMETRIC_L4:
         return flow_hash_symmetric_l4(flow, basis);
@@ -1041,3 +1086,350 @@ flow_compose(struct ofpbuf *b, const struct flow *flow)
         }
     }
 }
+
+/* Stores in 'masks' a "struct flow" that has a 1-bit in each bit that
+ * 'wildcards' treats as significant and a 0-bit in each bit that it
+ * wildcards, so that flow_zero_wildcards(flow, wildcards) is equivalent to
+ * ANDing 'flow' with 'masks'. */
+void
+flow_wildcards_get_masks(const struct flow_wildcards *wildcards,
+                         struct flow *masks)
+{
+    memset(masks, 0xff, sizeof *masks);
+    flow_zero_wildcards(masks, wildcards);
+    memset(masks->reserved, 0, sizeof masks->reserved);
+}
+
+/* Stores the bitwise AND of 'a' and 'b' in 'dst'.  When 'a' and 'b' are masks
+ * obtained from flow_wildcards_get_masks(), this yields the masks for the
+ * combination of their wildcards, as flow_wildcards_combine() does. */
+void
+flow_masks_and(struct flow *dst, const struct flow *a, const struct flow *b)
+{
+    const uint64_t *a_64 = (const uint64_t *) a;
+    const uint64_t *b_64 = (const uint64_t *) b;
+    uint64_t *dst_64 = (uint64_t *) dst;
+    size_t i;
+
+    for (i = 0; i < sizeof(struct flow) / sizeof(uint64_t); i++) {
+        dst_64[i] = a_64[i] & b_64[i];
+    }
+}
+
+/* Stores the bitwise OR of 'a' and 'b' in 'dst'.  When 'a' and 'b' are masks
+ * obtained from flow_wildcards_get_masks(), this yields masks in which a bit
+ * is significant if it is significant in either 'a' or 'b'. */
+void
+flow_masks_or(struct flow *dst, const struct flow *a, const struct flow *b)
+{
+    const uint64_t *a_64 = (const uint64_t *) a;
+    const uint64_t *b_64 = (const uint64_t *) b;
+    uint64_t *dst_64 = (uint64_t *) dst;
+    size_t i;
+
+    for (i = 0; i < sizeof(struct flow) / sizeof(uint64_t); i++) {
+        dst_64[i] = a_64[i] | b_64[i];
+    }
+}
+
+/* Returns true if 'a' and 'b' have the same values in every bit that has a
+ * 1-bit in 'masks', which is typically obtained from
+ * flow_wildcards_get_masks(), false otherwise.
+ *
+ * This examines every word of the flows without branching, so it is faster
+ * than comparing field by field or than flow_equal_in_minimask() unless
+ * 'masks' is very sparse.
+ *
+ * The SSE2 version is chosen at compile time only.  Every x86-64 build gets
+ * it, because SSE2 is part of the x86-64 baseline; 32-bit x86 builds get it
+ * only with -msse2.  There is no run-time CPU check and no wider (e.g. AVX2)
+ * version: struct flow is only nine 128-bit words long, so wider vectors
+ * would save little. */
+bool
+flow_equal_in_masks(const struct flow *a, const struct flow *b,
+                    const struct flow *masks)
+{
+#ifdef __SSE2__
+    const __m128i *a_128 = (const __m128i *) a;
+    const __m128i *b_128 = (const __m128i *) b;
+    const __m128i *m_128 = (const __m128i *) masks;
+    __m128i diff = _mm_setzero_si128();
+    size_t i;
+
+    BUILD_ASSERT_DECL(sizeof(struct flow) % sizeof(__m128i) == 0);
+    for (i = 0; i < sizeof(struct flow) / sizeof(__m128i); i++) {
+        __m128i x = _mm_xor_si128(_mm_loadu_si128(&a_128[i]),
+                                  _mm_loadu_si128(&b_128[i]));
+        diff = _mm_or_si128(diff,
+                            _mm_and_si128(x, _mm_loadu_si128(&m_128[i])));
+    }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128()))
+           == 0xffff;
+#else
+    const uint64_t *a_64 = (const uint64_t *) a;
+    const uint64_t *b_64 = (const uint64_t *) b;
+    const uint64_t *m_64 = (const uint64_t *) masks;
+    uint64_t diff = 0;
+    size_t i;
+
+    BUILD_ASSERT_DECL(sizeof(struct flow) % sizeof(uint64_t) == 0);
+    for (i = 0; i < sizeof(struct flow) / sizeof(uint64_t); i++) {
+        diff |= (a_64[i] ^ b_64[i]) & m_64[i];
+    }
+    return !diff;
+#endif
+}
+
+/* Compressed flow. */
+
+static int
+miniflow_n_values__(const uint32_t map[MINI_N_MAPS])
+{
+    int n, i;
+
+    n = 0;
+    for (i = 0; i < MINI_N_MAPS; i++) {
+        n += popcount(map[i]);
+    }
+    return n;
+}
+
+static uint32_t *
+miniflow_alloc_values(struct miniflow *flow, int n)
+{
+    if (n <= MINI_N_INLINE) {
+        return flow->inline_values;
+    } else {
+        COVERAGE_INC(miniflow_malloc);
+        return xmalloc(n * sizeof *flow->values);
+    }
+}
+
+/* Initializes 'dst' as a copy of 'src'.  The caller must eventually free 'dst'
+ * with miniflow_destroy(). */
+void
+miniflow_init(struct miniflow *dst, const struct flow *src)
+{
+    const uint32_t *src_u32 = (const uint32_t *) src;
+    unsigned int ofs;
+    int n;
+
+    /* Initialize dst->map, counting the number of nonzero elements. */
+    n = 0;
+    memset(dst->map, 0, sizeof dst->map);
+    for (ofs = 0; ofs < FLOW_U32S; ofs++) {
+        if (src_u32[ofs]) {
+            dst->map[ofs / 32] |= 1u << (ofs % 32);
+            n++;
+        }
+    }
+
+    /* Initialize dst->values. */
+    dst->values = miniflow_alloc_values(dst, n);
+    n = 0;
+    for (ofs = 0; ofs < FLOW_U32S; ofs++) {
+        if (src_u32[ofs]) {
+            dst->values[n++] = src_u32[ofs];
+        }
+    }
+}
+
+/* Initializes 'dst' as a copy of 'src'.  The caller must eventually free 'dst'
+ * with miniflow_destroy(). */
+void
+miniflow_clone(struct miniflow *dst, const struct miniflow *src)
+{
+    int n = miniflow_n_values(src);
+    memcpy(dst->map, src->map, sizeof dst->map);
+    dst->values = miniflow_alloc_values(dst, n);
+    memcpy(dst->values, src->values, n * sizeof *dst->values);
+}
+
+/* Frees any memory owned by 'flow'.  Does not free the storage in which
+ * 'flow' itself resides; the caller is responsible for that. */
+void
+miniflow_destroy(struct miniflow *flow)
+{
+    if (flow->values != flow->inline_values) {
+        free(flow->values);
+    }
+}
+
+/* Initializes 'dst' as a copy of 'src'. */
+void
+miniflow_expand(const struct miniflow *src, struct flow *dst)
+{
+    uint32_t *dst_u32 = (uint32_t *) dst;
+    const uint32_t *p = src->values;
+    int i;
+
+    memset(dst_u32, 0, sizeof *dst);
+    for (i = 0; i < MINI_N_MAPS; i++) {
+        uint32_t map;
+
+        for (map = src->map[i]; map; map &= map - 1) {
+            dst_u32[i * 32 + raw_ctz(map)] = *p++;
+        }
+    }
+}
+
+/* Returns the number of nonzero 32-bit words in 'flow', which is also the
+ * number of elements in its 'values' array. */
+int
+miniflow_n_values(const struct miniflow *flow)
+{
+    return miniflow_n_values__(flow->map);
+}
+
+/* Returns the uint32_t that would be at byte offset '4 * u32_ofs' if 'flow'
+ * were expanded into a "struct flow". */
+uint32_t
+miniflow_get(const struct miniflow *flow, unsigned int u32_ofs)
+{
+    uint32_t bit = 1u << (u32_ofs % 32);
+    const uint32_t *p;
+    unsigned int i;
+
+    if (!(flow->map[u32_ofs / 32] & bit)) {
+        return 0;
+    }
+
+    p = flow->values;
+    for (i = 0; i < u32_ofs / 32; i++) {
+        p += popcount(flow->map[i]);
+    }
+    return p[popcount(flow->map[i] & (bit - 1))];
+}
+
+/* Returns true if 'a' and 'b' are the same flow, false otherwise.  */
+bool
+miniflow_equal(const struct miniflow *a, const struct miniflow *b)
+{
+    return (!memcmp(a->map, b->map, sizeof a->map)
+            && !memcmp(a->values, b->values,
+                       miniflow_n_values(a) * sizeof *a->values));
+}
+
+/* Returns true if 'a' is the same flow as 'b', false otherwise.  */
+bool
+miniflow_equal_flow(const struct miniflow *a, const struct flow *b)
+{
+    const uint32_t *b_u32 = (const uint32_t *) b;
+    const uint32_t *p = a->values;
+    unsigned int ofs;
+
+    for (ofs = 0; ofs < FLOW_U32S; ofs++) {
+        uint32_t value = (a->map[ofs / 32] & (1u << (ofs % 32))) ? *p++ : 0;
+        if (b_u32[ofs] != value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Returns a hash value for 'flow', given 'basis'. */
+uint32_t
+miniflow_hash(const struct miniflow *flow, uint32_t basis)
+{
+    BUILD_ASSERT_DECL(sizeof flow->map == MINI_N_MAPS * sizeof(uint32_t));
+    return hash_words(flow->values, miniflow_n_values(flow),
+                      hash_words(flow->map, MINI_N_MAPS, basis));
+}
+
+/* Initializes 'mask' as a copy of 'wc'.  The caller must eventually free
+ * 'mask' with minimask_destroy(). */
+void
+minimask_init(struct minimask *mask, const struct flow_wildcards *wc)
+{
+    struct flow masks;
+
+    flow_wildcards_get_masks(wc, &masks);
+    miniflow_init(&mask->masks, &masks);
+}
+
+/* Initializes 'dst' as a copy of 'src'.  The caller must eventually free 'dst'
+ * with minimask_destroy(). */
+void
+minimask_clone(struct minimask *dst, const struct minimask *src)
+{
+    miniflow_clone(&dst->masks, &src->masks);
+}
+
+/* Frees any memory owned by 'mask'.  Does not free the storage in which
+ * 'mask' itself resides; the caller is responsible for that. */
+void
+minimask_destroy(struct minimask *mask)
+{
+    miniflow_destroy(&mask->masks);
+}
+
+/* Stores in 'masks' the "struct flow" form of 'mask'. */
+void
+minimask_expand(const struct minimask *mask, struct flow *masks)
+{
+    miniflow_expand(&mask->masks, masks);
+}
+
+/* Returns true if 'a' and 'b' are the same flow mask, false otherwise.  */
+bool
+minimask_equal(const struct minimask *a, const struct minimask *b)
+{
+    return miniflow_equal(&a->masks, &b->masks);
+}
+
+/* Returns a hash value for 'mask', given 'basis'. */
+uint32_t
+minimask_hash(const struct minimask *mask, uint32_t basis)
+{
+    return miniflow_hash(&mask->masks, basis);
+}
+
+/* Returns a hash value for the bits of 'flow' that are significant in 'mask',
+ * given 'basis'.  Only the 32-bit words of 'flow' for which 'mask' has a
+ * nonzero word are examined.
+ *
+ * The result is the same as hash_words() applied to the masked words. */
+uint32_t
+flow_hash_in_minimask(const struct flow *flow, const struct minimask *mask,
+                      uint32_t basis)
+{
+    const uint32_t *flow_u32 = (const uint32_t *) flow;
+    const uint32_t *p = mask->masks.values;
+    uint32_t words[FLOW_U32S];
+    int i, n;
+
+    n = 0;
+    for (i = 0; i < MINI_N_MAPS; i++) {
+        uint32_t map;
+
+        for (map = mask->masks.map[i]; map; map &= map - 1) {
+            words[n++] = flow_u32[i * 32 + raw_ctz(map)] & *p++;
+        }
+    }
+    return hash_words(words, n, basis);
+}
+
+/* Returns true if 'a' and 'b' have the same values in every bit that is
+ * significant in 'mask', false otherwise. */
+bool
+flow_equal_in_minimask(const struct flow *a, const struct flow *b,
+                       const struct minimask *mask)
+{
+    const uint32_t *a_u32 = (const uint32_t *) a;
+    const uint32_t *b_u32 = (const uint32_t *) b;
+    const uint32_t *p = mask->masks.values;
+    int i;
+
+    for (i = 0; i < MINI_N_MAPS; i++) {
+        uint32_t map;
+
+        for (map = mask->masks.map[i]; map; map &= map - 1) {
+            int ofs = i * 32 + raw_ctz(map);
+
+            if ((a_u32[ofs] ^ b_u32[ofs]) & *p++) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
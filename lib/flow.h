@@ -101,8 +101,18 @@ BUILD_ASSERT_DECL(sizeof(struct flow) == FLOW_SIG_SIZE + FLOW_PAD_SIZE);
 /* Remember to update FLOW_WC_SEQ when changing 'struct flow'. */
 BUILD_ASSERT_DECL(FLOW_SIG_SIZE == 142 && FLOW_WC_SEQ == 11);
 
+/* How far into a packet flow_extract_depth() parses. */
+enum flow_parse_depth {
+    FLOW_PARSE_L2,              /* Ethernet addresses, VLAN, Ethertype. */
+    FLOW_PARSE_L3,              /* Also IPv4, IPv6, or ARP header. */
+    FLOW_PARSE_L4               /* Also TCP, UDP, ICMP, or ICMPv6 header. */
+};
+
 void flow_extract(struct ofpbuf *, uint32_t priority, ovs_be64 tun_id,
                   uint16_t in_port, struct flow *);
+void flow_extract_depth(struct ofpbuf *, uint32_t priority, ovs_be64 tun_id,
+                        uint16_t in_port, enum flow_parse_depth,
+                        struct flow *);
 void flow_zero_wildcards(struct flow *, const struct flow_wildcards *);
 void flow_get_metadata(const struct flow *, struct flow_metadata *);
 
@@ -215,4 +225,92 @@ uint32_t flow_hash_fields(const struct flow *, enum nx_hash_fields,
 const char *flow_hash_fields_to_str(enum nx_hash_fields);
 bool flow_hash_fields_valid(enum nx_hash_fields);
 
+void flow_wildcards_get_masks(const struct flow_wildcards *,
+                              struct flow *masks);
+void flow_masks_and(struct flow *dst, const struct flow *a,
+                    const struct flow *b);
+void flow_masks_or(struct flow *dst, const struct flow *a,
+                   const struct flow *b);
+bool flow_equal_in_masks(const struct flow *a, const struct flow *b,
+                         const struct flow *masks);
+
+/* Compressed flow. */
+
+#define FLOW_U32S (sizeof(struct flow) / 4)
+#define MINI_N_MAPS DIV_ROUND_UP(FLOW_U32S, 32)
+#define MINI_N_INLINE (sizeof(void *) == 4 ? 13 : 12)
+
+/* A sparse representation of a "struct flow".
+ *
+ * A "struct flow" is fairly large and tends to be mostly zeros.  A sparse
+ * representation has two advantages.  First, it saves memory.  Second, it
+ * saves time when the goal is to iterate over only the nonzero parts of the
+ * struct.
+ *
+ * The 'map' member holds one bit for each uint32_t in a "struct flow".  Each
+ * 0-bit indicates that the corresponding uint32_t is zero, each 1-bit that it
+ * is nonzero.
+ *
+ * 'values' points to the start of an array that has one element for each
+ * 1-bit in 'map'.  The least-numbered 1-bit is in values[0], the next 1-bit is
+ * in values[1], and so on.
+ *
+ * 'values' may point to a few different locations:
+ *
+ *     - If 'map' has MINI_N_INLINE or fewer 1-bits, it may point to
+ *       'inline_values'.  One hopes that this is the common case.
+ *
+ *     - If 'map' has more than MINI_N_INLINE 1-bits, it may point to memory
+ *       allocated with malloc().
+ *
+ * The implementation maintains and depends on the invariant that every value
+ * in 'values' is nonzero; that is, wherever a 1-bit appears in 'map', the
+ * corresponding element of 'values' must be nonzero.
+ *
+ * A miniflow may not be copied with a simple assignment, because 'values' may
+ * point into the miniflow itself.  Use miniflow_clone() instead. */
+struct miniflow {
+    uint32_t map[MINI_N_MAPS];
+    uint32_t *values;
+    uint32_t inline_values[MINI_N_INLINE];
+};
+BUILD_ASSERT_DECL(sizeof(struct miniflow) == 64);
+
+void miniflow_init(struct miniflow *, const struct flow *);
+void miniflow_clone(struct miniflow *, const struct miniflow *);
+void miniflow_destroy(struct miniflow *);
+
+void miniflow_expand(const struct miniflow *, struct flow *);
+int miniflow_n_values(const struct miniflow *);
+
+uint32_t miniflow_get(const struct miniflow *, unsigned int u32_ofs);
+
+bool miniflow_equal(const struct miniflow *a, const struct miniflow *b);
+bool miniflow_equal_flow(const struct miniflow *, const struct flow *);
+uint32_t miniflow_hash(const struct miniflow *, uint32_t basis);
+
+/* Compressed flow wildcards. */
+
+/* A sparse representation of a "struct flow_wildcards", as the "struct flow"
+ * that flow_wildcards_get_masks() produces from it.
+ *
+ * See the large comment on struct miniflow for details. */
+struct minimask {
+    struct miniflow masks;
+};
+
+void minimask_init(struct minimask *, const struct flow_wildcards *);
+void minimask_clone(struct minimask *, const struct minimask *);
+void minimask_destroy(struct minimask *);
+
+void minimask_expand(const struct minimask *, struct flow *masks);
+
+bool minimask_equal(const struct minimask *a, const struct minimask *b);
+uint32_t minimask_hash(const struct minimask *, uint32_t basis);
+
+uint32_t flow_hash_in_minimask(const struct flow *, const struct minimask *,
+                               uint32_t basis);
+bool flow_equal_in_minimask(const struct flow *a, const struct flow *b,
+                            const struct minimask *);
+
 #endif /* flow.h */
@@ -18,62 +18,317 @@
 #include <string.h>
 #include "unaligned.h"
 
+/* hash_words() and hash_bytes() feed their input through CRC32-C (the
+ * Castagnoli CRC that the SSE4.2 "crc32" instruction computes), 8 bytes at a
+ * time, and then pass the CRC, the length, and the basis through a finalizer
+ * that spreads every bit of each of them across all of the output bits.
+ *
+ * When the CPU has the "crc32" instruction, it is used; otherwise, a
+ * table-driven implementation computes exactly the same CRC.  Either way, the
+ * hash of a given input is the same, so hash values, and therefore hash table
+ * iteration orders, do not depend on the machine that runs the code. */
+
+#if defined __SSE4_2__
+#define HASH_CRC32_INSN 2       /* Always available. */
+#elif (defined __x86_64__ || defined __i386__) && __GNUC__ >= 5
+#define HASH_CRC32_INSN 1       /* Available if the CPU supports it. */
+#else
+#define HASH_CRC32_INSN 0       /* Not available. */
+#endif
+
+/* Reflected form of the CRC32-C polynomial. */
+#define CRC32C_POLY 0x82f63b78
+
+/* crc32c_table[k][i] is the CRC of byte 'i' followed by 'k' zero bytes. */
+static uint32_t crc32c_table[4][256];
+
+static void
+crc32c_init_table(void)
+{
+    int i, k;
+
+    for (i = 0; i < 256; i++) {
+        uint32_t crc = i;
+
+        for (k = 0; k < 8; k++) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[0][i] = crc;
+    }
+    for (i = 0; i < 256; i++) {
+        for (k = 1; k < 4; k++) {
+            uint32_t prev = crc32c_table[k - 1][i];
+            crc32c_table[k][i] = (prev >> 8) ^ crc32c_table[0][prev & 0xff];
+        }
+    }
+}
+
+/* Returns the CRC32-C of 'crc' extended by the 4 bytes of 'data', in
+ * little-endian byte order, like the SSE4.2 "crc32l" instruction. */
+static inline uint32_t
+crc32c_u32_sw(uint32_t crc, uint32_t data)
+{
+    crc ^= data;
+    return (crc32c_table[3][crc & 0xff]
+            ^ crc32c_table[2][(crc >> 8) & 0xff]
+            ^ crc32c_table[1][(crc >> 16) & 0xff]
+            ^ crc32c_table[0][crc >> 24]);
+}
+
+/* Like crc32c_u32_sw() for 8 bytes of 'data', like "crc32q". */
+static inline uint32_t
+crc32c_u64_sw(uint32_t crc, uint64_t data)
+{
+    return crc32c_u32_sw(crc32c_u32_sw(crc, data), data >> 32);
+}
+
+/* Returns 'hash' with every bit spread across all of the output bits.  This
+ * is a bijection found by Chris Wellons's "hash prospector", with lower bias
+ * than MurmurHash3's finalizer, and it maps 0 to 0. */
+static inline uint32_t
+hash_crc_mix(uint32_t hash)
+{
+    hash ^= hash >> 16;
+    hash *= 0x21f0aaad;
+    hash ^= hash >> 15;
+    hash *= 0xd35a2d97;
+    hash ^= hash >> 15;
+    return hash;
+}
+
+/* Returns the final hash value for a CRC of 'n_bytes' bytes of input, with
+ * the given 'basis'.
+ *
+ * The CRC is linear, so on its own a change in one input bit flips a fixed
+ * pattern of output bits.  The final mix makes every output bit depend on
+ * every input bit.
+ *
+ * The basis is not used as the CRC's initial value, where it would only XOR a
+ * linear function of itself into the CRC.  Instead, it goes through the mix on
+ * its own before it is combined with the CRC, and then through the final mix
+ * with the CRC.  A basis of 0 leaves the result the same as hashing the CRC
+ * alone. */
+static inline uint32_t
+hash_crc_finish(uint32_t crc, size_t n_bytes, uint32_t basis)
+{
+    return hash_crc_mix(crc ^ n_bytes ^ hash_crc_mix(basis));
+}
+
+/* Loads the 1 to 7 bytes at 'p' into the low-order bytes of a 64-bit word, in
+ * the same order as get_unaligned_u64() would. */
+static inline uint64_t
+hash_load_tail(const uint8_t *p, size_t n)
+{
+    uint64_t tmp = 0;
+
+    memcpy(&tmp, p, n);
+    return tmp;
+}
+
+/* Table-driven implementations. */
+
+static uint32_t
+hash_words_sw(const uint32_t *p, size_t n, uint32_t basis)
+{
+    uint32_t crc = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        crc = crc32c_u32_sw(crc, p[i]);
+    }
+    return hash_crc_finish(crc, n * 4, basis);
+}
+
+static uint32_t
+hash_bytes_sw(const void *p_, size_t n, uint32_t basis)
+{
+    const uint8_t *p = p_;
+    uint32_t crc = 0;
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        crc = crc32c_u64_sw(crc, get_unaligned_u64((const uint64_t *) (p + i)));
+    }
+    if (i < n) {
+        crc = crc32c_u64_sw(crc, hash_load_tail(p + i, n - i));
+    }
+    return hash_crc_finish(crc, n, basis);
+}
+
+/* Implementations that use the SSE4.2 "crc32" instruction. */
+
+#if HASH_CRC32_INSN
+#if HASH_CRC32_INSN == 1
+#define HASH_TARGET_SSE42 __attribute__((target("sse4.2")))
+#else
+#define HASH_TARGET_SSE42
+#endif
+
+static inline uint32_t HASH_TARGET_SSE42
+crc32c_u64_insn(uint32_t crc, uint64_t data)
+{
+#ifdef __x86_64__
+    return __builtin_ia32_crc32di(crc, data);
+#else
+    return __builtin_ia32_crc32si(__builtin_ia32_crc32si(crc, data),
+                                  data >> 32);
+#endif
+}
+
+static uint32_t HASH_TARGET_SSE42
+hash_words_insn(const uint32_t *p, size_t n, uint32_t basis)
+{
+    uint32_t crc = 0;
+    size_t i;
+
+    for (i = 0; i + 2 <= n; i += 2) {
+        crc = crc32c_u64_insn(crc, p[i] | ((uint64_t) p[i + 1] << 32));
+    }
+    if (i < n) {
+        crc = __builtin_ia32_crc32si(crc, p[i]);
+    }
+    return hash_crc_finish(crc, n * 4, basis);
+}
+
+static uint32_t HASH_TARGET_SSE42
+hash_bytes_insn(const void *p_, size_t n, uint32_t basis)
+{
+    const uint8_t *p = p_;
+    uint32_t crc = 0;
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        crc = crc32c_u64_insn(crc,
+                              get_unaligned_u64((const uint64_t *) (p + i)));
+    }
+    if (i < n) {
+        crc = crc32c_u64_insn(crc, hash_load_tail(p + i, n - i));
+    }
+    return hash_crc_finish(crc, n, basis);
+}
+#endif  /* HASH_CRC32_INSN */
+
+/* Returns true if hash_words() and hash_bytes() use the "crc32" instruction,
+ * false if they use the table-driven implementation. */
+bool
+hash_has_crc32_insn(void)
+{
+#if HASH_CRC32_INSN == 2
+    return true;
+#elif HASH_CRC32_INSN == 1
+    static int has_insn = -1;
+
+    if (has_insn < 0) {
+        __builtin_cpu_init();
+        has_insn = __builtin_cpu_supports("sse4.2") != 0;
+        if (!has_insn) {
+            crc32c_init_table();
+        }
+    }
+    return has_insn;
+#else
+    static bool inited;
+
+    if (!inited) {
+        crc32c_init_table();
+        inited = true;
+    }
+    return false;
+#endif
+}
+
+#if HASH_CRC32_INSN == 2
+#define hash_words_impl hash_words_insn
+#define hash_bytes_impl hash_bytes_insn
+#else
+/* The implementations of hash_words() and hash_bytes() that this CPU supports.
+ * Until the first call, these point to functions that make the choice, so
+ * that the CPU is checked only once. */
+static uint32_t hash_words_select(const uint32_t *, size_t, uint32_t);
+static uint32_t hash_bytes_select(const void *, size_t, uint32_t);
+static uint32_t (*hash_words_impl)(const uint32_t *, size_t, uint32_t)
+    = hash_words_select;
+static uint32_t (*hash_bytes_impl)(const void *, size_t, uint32_t)
+    = hash_bytes_select;
+
+static void
+hash_select_impl(void)
+{
+#if HASH_CRC32_INSN
+    if (hash_has_crc32_insn()) {
+        hash_words_impl = hash_words_insn;
+        hash_bytes_impl = hash_bytes_insn;
+        return;
+    }
+#else
+    hash_has_crc32_insn();
+#endif
+    hash_words_impl = hash_words_sw;
+    hash_bytes_impl = hash_bytes_sw;
+}
+
+static uint32_t
+hash_words_select(const uint32_t *p, size_t n, uint32_t basis)
+{
+    hash_select_impl();
+    return hash_words_impl(p, n, basis);
+}
+
+static uint32_t
+hash_bytes_select(const void *p, size_t n, uint32_t basis)
+{
+    hash_select_impl();
+    return hash_bytes_impl(p, n, basis);
+}
+#endif
+
 /* Returns the hash of the 'n' 32-bit words at 'p', starting from 'basis'.
  * 'p' must be properly aligned. */
 uint32_t
 hash_words(const uint32_t *p, size_t n, uint32_t basis)
 {
-    uint32_t a, b, c;
-
-    a = b = c = 0xdeadbeef + (((uint32_t) n) << 2) + basis;
+    return hash_words_impl(p, n, basis);
+}
 
-    while (n > 3) {
-        a += p[0];
-        b += p[1];
-        c += p[2];
-        hash_mix(&a, &b, &c);
-        n -= 3;
-        p += 3;
-    }
-
-    switch (n) {
-    case 3:
-        c += p[2];
-        /* fall through */
-    case 2:
-        b += p[1];
-        /* fall through */
-    case 1:
-        a += p[0];
-        hash_final(&a, &b, &c);
-        /* fall through */
-    case 0:
-        break;
-    }
-    return c;
+/* Returns the hash of the 'n' bytes at 'p', starting from 'basis'. */
+uint32_t
+hash_bytes(const void *p, size_t n, uint32_t basis)
+{
+    return hash_bytes_impl(p, n, basis);
 }
 
-/* Returns the hash of 'a', 'b', and 'c'. */
+/* Same as hash_words(), but always uses the table-driven implementation.  For
+ * testing and benchmarking. */
 uint32_t
-hash_3words(uint32_t a, uint32_t b, uint32_t c)
+hash_words_portable(const uint32_t *p, size_t n, uint32_t basis)
 {
-    a += 0xdeadbeef;
-    b += 0xdeadbeef;
-    c += 0xdeadbeef;
-    hash_final(&a, &b, &c);
-    return c;
+    if (!crc32c_table[0][1]) {
+        crc32c_init_table();
+    }
+    return hash_words_sw(p, n, basis);
 }
 
-/* Returns the hash of 'a' and 'b'. */
+/* Same as hash_bytes(), but always uses the table-driven implementation.  For
+ * testing and benchmarking. */
 uint32_t
-hash_2words(uint32_t a, uint32_t b)
+hash_bytes_portable(const void *p, size_t n, uint32_t basis)
 {
-    return hash_3words(a, b, 0);
+    if (!crc32c_table[0][1]) {
+        crc32c_init_table();
+    }
+    return hash_bytes_sw(p, n, basis);
 }
 
-/* Returns the hash of the 'n' bytes at 'p', starting from 'basis'. */
+/* Returns the hash of the 'n' bytes at 'p', starting from 'basis', computed
+ * with Bob Jenkins's lookup3, which hash_bytes() used before it switched to
+ * CRC32-C.
+ *
+ * Some hash values are visible outside Open vSwitch, e.g. the ones that
+ * choose links for the "bundle" and "multipath" actions, on which
+ * controllers and existing flows depend.  Those use this function, so that
+ * their values do not change from one release to the next. */
 uint32_t
-hash_bytes(const void *p_, size_t n, uint32_t basis)
+hash_bytes_lookup3(const void *p_, size_t n, uint32_t basis)
 {
     const uint8_t *p = p_;
     uint32_t a, b, c;
@@ -102,3 +357,21 @@ hash_bytes(const void *p_, size_t n, uint32_t basis)
 
     return c;
 }
+
+/* Returns the hash of 'a', 'b', and 'c'. */
+uint32_t
+hash_3words(uint32_t a, uint32_t b, uint32_t c)
+{
+    a += 0xdeadbeef;
+    b += 0xdeadbeef;
+    c += 0xdeadbeef;
+    hash_final(&a, &b, &c);
+    return c;
+}
+
+/* Returns the hash of 'a' and 'b'. */
+uint32_t
+hash_2words(uint32_t a, uint32_t b)
+{
+    return hash_3words(a, b, 0);
+}
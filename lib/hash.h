@@ -62,6 +62,11 @@ uint32_t hash_words(const uint32_t *, size_t n_word, uint32_t basis);
 uint32_t hash_2words(uint32_t, uint32_t);
 uint32_t hash_3words(uint32_t, uint32_t, uint32_t);
 uint32_t hash_bytes(const void *, size_t n_bytes, uint32_t basis);
+uint32_t hash_bytes_lookup3(const void *, size_t n_bytes, uint32_t basis);
+
+uint32_t hash_words_portable(const uint32_t *, size_t n_word, uint32_t basis);
+uint32_t hash_bytes_portable(const void *, size_t n_bytes, uint32_t basis);
+bool hash_has_crc32_insn(void);
 
 static inline uint32_t hash_string(const char *s, uint32_t basis)
 {
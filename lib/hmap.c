@@ -27,6 +27,39 @@ COVERAGE_DEFINE(hmap_pathological);
 COVERAGE_DEFINE(hmap_expand);
 COVERAGE_DEFINE(hmap_shrink);
 COVERAGE_DEFINE(hmap_reserve);
+COVERAGE_DEFINE(hmap_migrate);
+
+/* Expansions of hash maps with at least this many nodes are incremental.
+ * Rehashing a smaller map all at once is cheap enough. */
+#define HMAP_INCREMENTAL_MIN 4096
+
+/* Number of old buckets that each hmap_insert() migrates while an incremental
+ * expansion is in progress.  An expansion doubles the number of buckets, so
+ * the next expansion is at least twice as many insertions away as there are
+ * old buckets, and so the migration always finishes first. */
+#define HMAP_MIGRATE_STEP 2
+
+/* Returns the number of buckets in 'hmap', counting the old buckets of an
+ * incremental expansion in progress. */
+static size_t
+hmap_n_buckets__(const struct hmap *hmap)
+{
+    return (hmap->old_buckets ? hmap->old_mask + 1 : 0) + hmap->mask + 1;
+}
+
+/* Returns bucket 'idx' of 'hmap', in iteration order: the old buckets of an
+ * incremental expansion in progress, if any, then the current buckets. */
+static struct hmap_node **
+hmap_bucket_at__(const struct hmap *hmap, size_t idx)
+{
+    if (hmap->old_buckets) {
+        if (idx <= hmap->old_mask) {
+            return &hmap->old_buckets[idx];
+        }
+        idx -= hmap->old_mask + 1;
+    }
+    return &hmap->buckets[idx];
+}
 
 /* Initializes 'hmap' as an empty hash table. */
 void
@@ -36,6 +69,9 @@ hmap_init(struct hmap *hmap)
     hmap->one = NULL;
     hmap->mask = 0;
     hmap->n = 0;
+    hmap->old_buckets = NULL;
+    hmap->old_mask = 0;
+    hmap->migrate_pos = 0;
 }
 
 /* Frees memory reserved by 'hmap'.  It is the client's responsibility to free
@@ -43,8 +79,11 @@ hmap_init(struct hmap *hmap)
 void
 hmap_destroy(struct hmap *hmap)
 {
-    if (hmap && hmap->buckets != &hmap->one) {
-        free(hmap->buckets);
+    if (hmap) {
+        if (hmap->buckets != &hmap->one) {
+            free(hmap->buckets);
+        }
+        free(hmap->old_buckets);
     }
 }
 
@@ -62,6 +101,12 @@ hmap_clear(struct hmap *hmap)
         hmap->n = 0;
         memset(hmap->buckets, 0, (hmap->mask + 1) * sizeof *hmap->buckets);
     }
+    if (hmap->old_buckets) {
+        free(hmap->old_buckets);
+        hmap->old_buckets = NULL;
+        hmap->old_mask = 0;
+        hmap->migrate_pos = 0;
+    }
 }
 
 /* Exchanges hash maps 'a' and 'b'. */
@@ -85,6 +130,65 @@ hmap_moved(struct hmap *hmap)
     }
 }
 
+/* Moves the nodes in up to 'n_buckets' of 'hmap''s old buckets into its
+ * current buckets, and frees the old buckets once all of them have been
+ * migrated. */
+static void
+migrate(struct hmap *hmap, size_t n_buckets)
+{
+    if (!hmap->old_buckets) {
+        return;
+    }
+
+    for (; n_buckets > 0 && hmap->migrate_pos <= hmap->old_mask;
+         n_buckets--) {
+        struct hmap_node *node, *next;
+
+        for (node = hmap->old_buckets[hmap->migrate_pos]; node; node = next) {
+            struct hmap_node **bucket = &hmap->buckets[node->hash
+                                                       & hmap->mask];
+            next = node->next;
+            node->next = *bucket;
+            *bucket = node;
+        }
+        hmap->old_buckets[hmap->migrate_pos++] = NULL;
+    }
+
+    if (hmap->migrate_pos > hmap->old_mask) {
+        free(hmap->old_buckets);
+        hmap->old_buckets = NULL;
+        hmap->old_mask = 0;
+        hmap->migrate_pos = 0;
+    }
+}
+
+/* Advances an incremental expansion of 'hmap' that is in progress.  Called
+ * by hmap_insert(); there is no need to call it directly. */
+void
+hmap_migrate__(struct hmap *hmap)
+{
+    migrate(hmap, HMAP_MIGRATE_STEP);
+}
+
+/* Begins an incremental resize of 'hmap' to 'new_mask', which must be
+ * nonzero, keeping the current buckets as the old buckets to migrate. */
+static void
+resize_incremental(struct hmap *hmap, size_t new_mask)
+{
+    COVERAGE_INC(hmap_migrate);
+    migrate(hmap, SIZE_MAX);
+
+    hmap->old_buckets = hmap->buckets;
+    hmap->old_mask = hmap->mask;
+    hmap->migrate_pos = 0;
+
+    /* xcalloc() of a large block typically maps fresh zeroed pages without
+     * touching them, so that this does not take time proportional to the
+     * size of the map either. */
+    hmap->buckets = xcalloc(new_mask + 1, sizeof *hmap->buckets);
+    hmap->mask = new_mask;
+}
+
 static void
 resize(struct hmap *hmap, size_t new_mask)
 {
@@ -94,6 +198,8 @@ resize(struct hmap *hmap, size_t new_mask)
     assert(!(new_mask & (new_mask + 1)));
     assert(new_mask != SIZE_MAX);
 
+    migrate(hmap, SIZE_MAX);
+
     hmap_init(&tmp);
     if (new_mask) {
         tmp.buckets = xmalloc(sizeof *tmp.buckets * (new_mask + 1));
@@ -138,14 +244,21 @@ calc_mask(size_t capacity)
     return mask;
 }
 
-/* Expands 'hmap', if necessary, to optimize the performance of searches. */
+/* Expands 'hmap', if necessary, to optimize the performance of searches.
+ *
+ * If 'hmap' is large, this only allocates the new buckets, and subsequent
+ * calls to hmap_insert() gradually migrate nodes into them. */
 void
 hmap_expand(struct hmap *hmap)
 {
     size_t new_mask = calc_mask(hmap->n);
     if (new_mask > hmap->mask) {
         COVERAGE_INC(hmap_expand);
-        resize(hmap, new_mask);
+        if (hmap->n >= HMAP_INCREMENTAL_MIN && hmap->mask) {
+            resize_incremental(hmap, new_mask);
+        } else {
+            resize(hmap, new_mask);
+        }
     }
 }
 
@@ -179,7 +292,7 @@ void
 hmap_node_moved(struct hmap *hmap,
                 struct hmap_node *old_node, struct hmap_node *node)
 {
-    struct hmap_node **bucket = &hmap->buckets[node->hash & hmap->mask];
+    struct hmap_node **bucket = hmap_bucket__(hmap, node->hash);
     while (*bucket != old_node) {
         bucket = &(*bucket)->next;
     }
@@ -194,12 +307,13 @@ hmap_node_moved(struct hmap *hmap,
 struct hmap_node *
 hmap_random_node(const struct hmap *hmap)
 {
+    size_t n_buckets = hmap_n_buckets__(hmap);
     struct hmap_node *bucket, *node;
     size_t n, i;
 
     /* Choose a random non-empty bucket. */
     for (i = random_uint32(); ; i++) {
-        bucket = hmap->buckets[i & hmap->mask];
+        bucket = *hmap_bucket_at__(hmap, i % n_buckets);
         if (bucket) {
             break;
         }
@@ -237,18 +351,18 @@ hmap_at_position(const struct hmap *hmap,
     size_t b_idx;
 
     offset = *offsetp;
-    for (b_idx = *bucketp; b_idx <= hmap->mask; b_idx++) {
+    for (b_idx = *bucketp; b_idx < hmap_n_buckets__(hmap); b_idx++) {
         struct hmap_node *node;
         size_t n_idx;
 
-        for (n_idx = 0, node = hmap->buckets[b_idx]; node != NULL;
+        for (n_idx = 0, node = *hmap_bucket_at__(hmap, b_idx); node != NULL;
              n_idx++, node = node->next) {
             if (n_idx == offset) {
                 if (node->next) {
-                    *bucketp = node->hash & hmap->mask;
+                    *bucketp = b_idx;
                     *offsetp = offset + 1;
                 } else {
-                    *bucketp = (node->hash & hmap->mask) + 1;
+                    *bucketp = b_idx + 1;
                     *offsetp = 0;
                 }
                 return node;
@@ -56,16 +56,30 @@ hmap_node_nullify(struct hmap_node *node)
     node->next = HMAP_NODE_NULL;
 }
 
-/* A hash map. */
+/* A hash map.
+ *
+ * When a large hash map expands, it does not rehash all of its nodes at once.
+ * Instead, it keeps its previous bucket array as 'old_buckets' and each
+ * subsequent hmap_insert() migrates a few of the old buckets into the new
+ * array.  Old buckets numbered below 'migrate_pos' have been migrated, so a
+ * node with hash value 'hash' is in 'old_buckets[hash & old_mask]' if that
+ * index is at least 'migrate_pos' and in 'buckets[hash & mask]' otherwise.
+ * Thus, a search still examines only a single bucket. */
 struct hmap {
     struct hmap_node **buckets; /* Must point to 'one' iff 'mask' == 0. */
     struct hmap_node *one;
     size_t mask;
     size_t n;
+
+    /* Incremental rehashing.  'old_buckets' is nonnull only while a
+     * migration is in progress. */
+    struct hmap_node **old_buckets;
+    size_t old_mask;
+    size_t migrate_pos;         /* First old bucket not yet migrated. */
 };
 
 /* Initializer for an empty hash map. */
-#define HMAP_INITIALIZER(HMAP) { &(HMAP)->one, NULL, 0, 0 }
+#define HMAP_INITIALIZER(HMAP) { &(HMAP)->one, NULL, 0, 0, NULL, 0, 0 }
 
 /* Initialization. */
 void hmap_init(struct hmap *);
@@ -80,6 +94,7 @@ static inline bool hmap_is_empty(const struct hmap *);
 void hmap_expand(struct hmap *);
 void hmap_shrink(struct hmap *);
 void hmap_reserve(struct hmap *, size_t capacity);
+void hmap_migrate__(struct hmap *);
 
 /* Insertion and deletion. */
 static inline void hmap_insert_fast(struct hmap *,
@@ -169,6 +184,17 @@ hmap_count(const struct hmap *hmap)
     return hmap->n;
 }
 
+/* Returns the bucket in 'hmap' that contains, or would contain, nodes with the
+ * given 'hash'. */
+static inline struct hmap_node **
+hmap_bucket__(const struct hmap *hmap, size_t hash)
+{
+    if (hmap->old_buckets && (hash & hmap->old_mask) >= hmap->migrate_pos) {
+        return &hmap->old_buckets[hash & hmap->old_mask];
+    }
+    return &hmap->buckets[hash & hmap->mask];
+}
+
 /* Returns the maximum number of nodes that 'hmap' may hold before it should be
  * rehashed. */
 static inline size_t
@@ -190,7 +216,7 @@ hmap_is_empty(const struct hmap *hmap)
 static inline void
 hmap_insert_fast(struct hmap *hmap, struct hmap_node *node, size_t hash)
 {
-    struct hmap_node **bucket = &hmap->buckets[hash & hmap->mask];
+    struct hmap_node **bucket = hmap_bucket__(hmap, hash);
     node->hash = hash;
     node->next = *bucket;
     *bucket = node;
@@ -198,13 +224,16 @@ hmap_insert_fast(struct hmap *hmap, struct hmap_node *node, size_t hash)
 }
 
 /* Inserts 'node', with the given 'hash', into 'hmap', and expands 'hmap' if
- * necessary to optimize search performance. */
+ * necessary to optimize search performance.  If an incremental expansion is
+ * in progress, advances it. */
 static inline void
 hmap_insert(struct hmap *hmap, struct hmap_node *node, size_t hash)
 {
     hmap_insert_fast(hmap, node, hash);
     if (hmap->n / 2 > hmap->mask) {
         hmap_expand(hmap);
+    } else if (hmap->old_buckets) {
+        hmap_migrate__(hmap);
     }
 }
 
@@ -213,7 +242,7 @@ hmap_insert(struct hmap *hmap, struct hmap_node *node, size_t hash)
 static inline void
 hmap_remove(struct hmap *hmap, struct hmap_node *node)
 {
-    struct hmap_node **bucket = &hmap->buckets[node->hash & hmap->mask];
+    struct hmap_node **bucket = hmap_bucket__(hmap, node->hash);
     while (*bucket != node) {
         bucket = &(*bucket)->next;
     }
@@ -232,7 +261,7 @@ static inline void
 hmap_replace(struct hmap *hmap,
              const struct hmap_node *old_node, struct hmap_node *new_node)
 {
-    struct hmap_node **bucket = &hmap->buckets[old_node->hash & hmap->mask];
+    struct hmap_node **bucket = hmap_bucket__(hmap, old_node->hash);
     while (*bucket != old_node) {
         bucket = &(*bucket)->next;
     }
@@ -255,7 +284,7 @@ hmap_next_with_hash__(const struct hmap_node *node, size_t hash)
 static inline struct hmap_node *
 hmap_first_with_hash(const struct hmap *hmap, size_t hash)
 {
-    return hmap_next_with_hash__(hmap->buckets[hash & hmap->mask], hash);
+    return hmap_next_with_hash__(*hmap_bucket__(hmap, hash), hash);
 }
 
 /* Returns the first node in 'hmap' in the bucket in which the given 'hash'
@@ -263,7 +292,7 @@ hmap_first_with_hash(const struct hmap *hmap, size_t hash)
 static inline struct hmap_node *
 hmap_first_in_bucket(const struct hmap *hmap, size_t hash)
 {
-    return hmap->buckets[hash & hmap->mask];
+    return *hmap_bucket__(hmap, hash);
 }
 
 /* Returns the next node in the same bucket as 'node', or a null pointer if
@@ -294,10 +323,23 @@ hmap_next_with_hash(const struct hmap_node *node)
     return hmap_next_with_hash__(node->next, node->hash);
 }
 
+/* Iteration visits the buckets in 'hmap->old_buckets', if any, followed by
+ * those in 'hmap->buckets'.  Returns the first node in bucket 'start' or later
+ * in that order. */
 static inline struct hmap_node *
 hmap_next__(const struct hmap *hmap, size_t start)
 {
     size_t i;
+
+    if (hmap->old_buckets) {
+        for (i = start; i <= hmap->old_mask; i++) {
+            struct hmap_node *node = hmap->old_buckets[i];
+            if (node) {
+                return node;
+            }
+        }
+        start = start > hmap->old_mask ? start - (hmap->old_mask + 1) : 0;
+    }
     for (i = start; i <= hmap->mask; i++) {
         struct hmap_node *node = hmap->buckets[i];
         if (node) {
@@ -307,6 +349,20 @@ hmap_next__(const struct hmap *hmap, size_t start)
     return NULL;
 }
 
+/* Returns the position, in iteration order, of the bucket that follows the
+ * one that contains nodes with the given 'hash'. */
+static inline size_t
+hmap_next_bucket__(const struct hmap *hmap, size_t hash)
+{
+    if (hmap->old_buckets) {
+        size_t old_idx = hash & hmap->old_mask;
+        return (old_idx >= hmap->migrate_pos
+                ? old_idx + 1
+                : hmap->old_mask + 1 + (hash & hmap->mask) + 1);
+    }
+    return (hash & hmap->mask) + 1;
+}
+
 /* Returns the first node in 'hmap', in arbitrary order, or a null pointer if
  * 'hmap' is empty. */
 static inline struct hmap_node *
@@ -327,7 +383,7 @@ hmap_next(const struct hmap *hmap, const struct hmap_node *node)
 {
     return (node->next
             ? node->next
-            : hmap_next__(hmap, (node->hash & hmap->mask) + 1));
+            : hmap_next__(hmap, hmap_next_bucket__(hmap, node->hash)));
 }
 
 #ifdef  __cplusplus
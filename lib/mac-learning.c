@@ -55,11 +55,15 @@ mac_table_hash(const struct mac_learning *ml, const uint8_t mac[ETH_ADDR_LEN],
     return hash_3words(mac1, mac2 | (vlan << 16), ml->secret);
 }
 
-static struct mac_entry *
-mac_entry_from_lru_node(struct list *list)
-{
-    return CONTAINER_OF(list, struct mac_entry, lru_node);
-}
+/* Values for the 'state' member of struct mac_entry. */
+enum {
+    MAC_SLOT_EMPTY = 0,         /* Never used since last rehash. */
+    MAC_SLOT_USED,              /* Holds a MAC learning entry. */
+    MAC_SLOT_DELETED            /* Used to hold an entry ("tombstone"). */
+};
+
+/* Minimum number of slots in a mac_learning's 'table'. */
+#define MAC_TABLE_MIN 16
 
 /* Returns a tag that represents that 'mac' is on an unknown port in 'vlan'.
  * (When we learn where 'mac' is in 'vlan', this allows flows that were
@@ -75,29 +79,147 @@ static struct mac_entry *
 mac_entry_lookup(const struct mac_learning *ml,
                  const uint8_t mac[ETH_ADDR_LEN], uint16_t vlan)
 {
-    struct mac_entry *e;
+    uint32_t hash = mac_table_hash(ml, mac, vlan);
+    size_t i;
+
+    for (i = hash & ml->mask; ; i = (i + 1) & ml->mask) {
+        struct mac_entry *e = &ml->table[i];
 
-    HMAP_FOR_EACH_WITH_HASH (e, hmap_node, mac_table_hash(ml, mac, vlan),
-                             &ml->table) {
-        if (e->vlan == vlan && eth_addr_equals(e->mac, mac)) {
+        if (e->state == MAC_SLOT_EMPTY) {
+            return NULL;
+        } else if (e->state == MAC_SLOT_USED && e->hash == hash
+                   && e->vlan == vlan && eth_addr_equals(e->mac, mac)) {
             return e;
         }
     }
-    return NULL;
 }
 
-/* If the LRU list is not empty, stores the least-recently-used entry in '*e'
- * and returns true.  Otherwise, if the LRU list is empty, stores NULL in '*e'
- * and return false. */
-static bool
-get_lru(struct mac_learning *ml, struct mac_entry **e)
+/* Returns the slot in 'ml''s table into which a new entry with the given
+ * 'hash' may be placed.  The table must have at least one free slot. */
+static struct mac_entry *
+mac_table_find_free(struct mac_learning *ml, uint32_t hash)
 {
-    if (!list_is_empty(&ml->lrus)) {
-        *e = mac_entry_from_lru_node(ml->lrus.next);
-        return true;
-    } else {
-        *e = NULL;
-        return false;
+    size_t i;
+
+    for (i = hash & ml->mask; ; i = (i + 1) & ml->mask) {
+        struct mac_entry *e = &ml->table[i];
+
+        if (e->state != MAC_SLOT_USED) {
+            return e;
+        }
+    }
+}
+
+static void
+mac_wheel_insert(struct mac_learning *ml, struct mac_entry *e)
+{
+    size_t idx = e->expires & (MAC_WHEEL_SLOTS - 1);
+
+    list_push_back(&ml->wheel[idx], &e->wheel_node);
+    bitmap_set1(ml->wheel_map, idx);
+}
+
+static void
+mac_wheel_remove(struct mac_learning *ml, struct mac_entry *e)
+{
+    size_t idx = e->expires & (MAC_WHEEL_SLOTS - 1);
+
+    list_remove(&e->wheel_node);
+    if (list_is_empty(&ml->wheel[idx])) {
+        bitmap_set0(ml->wheel_map, idx);
+    }
+}
+
+/* Returns the offset, relative to the timer wheel slot for 'ml->wheel_time',
+ * of the first nonempty timer wheel slot at offset 'ofs' or later, or
+ * MAC_WHEEL_SLOTS if there is none. */
+static size_t
+mac_wheel_scan(const struct mac_learning *ml, size_t ofs)
+{
+    size_t base = ml->wheel_time & (MAC_WHEEL_SLOTS - 1);
+    size_t start = base + ofs;
+    size_t idx;
+
+    if (start < MAC_WHEEL_SLOTS) {
+        idx = bitmap_scan(ml->wheel_map, start, MAC_WHEEL_SLOTS);
+        if (idx < MAC_WHEEL_SLOTS) {
+            return idx - base;
+        }
+        start = MAC_WHEEL_SLOTS;
+    }
+    idx = bitmap_scan(ml->wheel_map, start - MAC_WHEEL_SLOTS, base);
+    return idx < base ? idx + MAC_WHEEL_SLOTS - base : MAC_WHEEL_SLOTS;
+}
+
+/* Returns the first entry in the timer wheel slot at offset 'ofs' relative to
+ * the slot for 'ml->wheel_time', which must be nonempty. */
+static struct mac_entry *
+mac_wheel_front(const struct mac_learning *ml, size_t ofs)
+{
+    size_t idx = (ml->wheel_time + ofs) & (MAC_WHEEL_SLOTS - 1);
+
+    return CONTAINER_OF(list_front(&ml->wheel[idx]), struct mac_entry,
+                        wheel_node);
+}
+
+/* Replaces 'ml''s table by one with 'n_slots' slots, which must be a power
+ * of 2, and reinserts all of 'ml''s entries into it, dropping tombstones.
+ * The timer wheel order of entries is preserved. */
+static void
+mac_table_resize(struct mac_learning *ml, size_t n_slots)
+{
+    struct mac_entry *old_table = ml->table;
+    size_t i;
+
+    ml->table = xcalloc(n_slots, sizeof *ml->table);
+    ml->mask = n_slots - 1;
+    ml->n_deleted = 0;
+
+    for (i = 0; i < MAC_WHEEL_SLOTS; i++) {
+        struct list *slot = &ml->wheel[i];
+        struct list old;
+
+        if (list_is_empty(slot)) {
+            continue;
+        }
+
+        list_init(&old);
+        list_splice(&old, slot->next, slot);
+        while (!list_is_empty(&old)) {
+            struct mac_entry *src, *dst;
+
+            src = CONTAINER_OF(list_pop_front(&old), struct mac_entry,
+                               wheel_node);
+            dst = mac_table_find_free(ml, src->hash);
+            *dst = *src;
+            list_push_back(slot, &dst->wheel_node);
+        }
+    }
+    free(old_table);
+}
+
+/* Returns the number of table slots that 'ml' should have to hold 'n'
+ * entries. */
+static size_t
+mac_table_size_for(size_t n)
+{
+    size_t n_slots = MAC_TABLE_MIN;
+
+    while (n_slots / 2 < n) {
+        n_slots *= 2;
+    }
+    return n_slots;
+}
+
+/* Makes sure that 'ml' has room to add one more entry without exceeding a
+ * 3/4 load factor (counting tombstones). */
+static void
+mac_table_reserve(struct mac_learning *ml)
+{
+    size_t n_slots = ml->mask + 1;
+
+    if ((ml->n + ml->n_deleted + 1) * 4 > n_slots * 3) {
+        mac_table_resize(ml, mac_table_size_for(ml->n + 1));
     }
 }
 
@@ -110,15 +232,25 @@ normalize_idle_time(unsigned int idle_time)
 }
 
 /* Creates and returns a new MAC learning table with an initial MAC aging
- * timeout of 'idle_time' seconds. */
+ * timeout of 'idle_time' seconds and a maximum of MAC_DEFAULT_MAX
+ * entries. */
 struct mac_learning *
 mac_learning_create(unsigned int idle_time)
 {
     struct mac_learning *ml;
+    size_t i;
 
     ml = xmalloc(sizeof *ml);
-    list_init(&ml->lrus);
-    hmap_init(&ml->table);
+    ml->table = xcalloc(MAC_TABLE_MIN, sizeof *ml->table);
+    ml->mask = MAC_TABLE_MIN - 1;
+    ml->n = 0;
+    ml->n_deleted = 0;
+    ml->max_entries = MAC_DEFAULT_MAX;
+    for (i = 0; i < MAC_WHEEL_SLOTS; i++) {
+        list_init(&ml->wheel[i]);
+    }
+    ml->wheel_map = bitmap_allocate(MAC_WHEEL_SLOTS);
+    ml->wheel_time = time_now();
     ml->secret = random_uint32();
     ml->flood_vlans = NULL;
     ml->idle_time = normalize_idle_time(idle_time);
@@ -130,14 +262,8 @@ void
 mac_learning_destroy(struct mac_learning *ml)
 {
     if (ml) {
-        struct mac_entry *e, *next;
-
-        HMAP_FOR_EACH_SAFE (e, next, hmap_node, &ml->table) {
-            hmap_remove(&ml->table, &e->hmap_node);
-            free(e);
-        }
-        hmap_destroy(&ml->table);
-
+        free(ml->table);
+        bitmap_free(ml->wheel_map);
         bitmap_free(ml->flood_vlans);
         free(ml);
     }
@@ -165,17 +291,45 @@ mac_learning_set_idle_time(struct mac_learning *ml, unsigned int idle_time)
 {
     idle_time = normalize_idle_time(idle_time);
     if (idle_time != ml->idle_time) {
-        struct mac_entry *e;
+        struct list entries;
+        size_t ofs;
         int delta;
 
+        /* Pull all the entries off the timer wheel, in order. */
+        list_init(&entries);
+        for (ofs = mac_wheel_scan(ml, 0); ofs < MAC_WHEEL_SLOTS;
+             ofs = mac_wheel_scan(ml, ofs + 1)) {
+            size_t idx = (ml->wheel_time + ofs) & (MAC_WHEEL_SLOTS - 1);
+            struct list *slot = &ml->wheel[idx];
+
+            list_splice(&entries, slot->next, slot);
+            bitmap_set0(ml->wheel_map, idx);
+        }
+
+        /* Put them back, shifted by the change in idle time. */
         delta = (int) idle_time - (int) ml->idle_time;
-        LIST_FOR_EACH (e, lru_node, &ml->lrus) {
+        if (delta < 0) {
+            ml->wheel_time += delta;
+        }
+        while (!list_is_empty(&entries)) {
+            struct mac_entry *e = CONTAINER_OF(list_pop_front(&entries),
+                                               struct mac_entry, wheel_node);
             e->expires += delta;
+            mac_wheel_insert(ml, e);
         }
         ml->idle_time = idle_time;
     }
 }
 
+/* Changes the maximum number of entries in 'ml' to 'max_entries'.  If 'ml'
+ * currently has more entries than that, the least recently used ones will be
+ * expired by the next call to mac_learning_run(). */
+void
+mac_learning_set_max_entries(struct mac_learning *ml, size_t max_entries)
+{
+    ml->max_entries = MAX(max_entries, 1);
+}
+
 static bool
 is_learning_vlan(const struct mac_learning *ml, uint16_t vlan)
 {
@@ -212,24 +366,29 @@ mac_learning_insert(struct mac_learning *ml,
     if (!e) {
         uint32_t hash = mac_table_hash(ml, src_mac, vlan);
 
-        if (hmap_count(&ml->table) >= MAC_MAX) {
-            get_lru(ml, &e);
-            mac_learning_expire(ml, e);
+        while (ml->n >= ml->max_entries) {
+            mac_learning_expire(ml, mac_learning_first(ml));
         }
 
-        e = xmalloc(sizeof *e);
-        hmap_insert(&ml->table, &e->hmap_node, hash);
+        mac_table_reserve(ml);
+        e = mac_table_find_free(ml, hash);
+        if (e->state == MAC_SLOT_DELETED) {
+            ml->n_deleted--;
+        }
+        e->state = MAC_SLOT_USED;
+        e->hash = hash;
         memcpy(e->mac, src_mac, ETH_ADDR_LEN);
         e->vlan = vlan;
         e->tag = 0;
         e->grat_arp_lock = TIME_MIN;
+        ml->n++;
     } else {
-        list_remove(&e->lru_node);
+        mac_wheel_remove(ml, e);
     }
 
     /* Mark 'e' as recently used. */
-    list_push_back(&ml->lrus, &e->lru_node);
     e->expires = time_now() + ml->idle_time;
+    mac_wheel_insert(ml, e);
 
     return e;
 }
@@ -281,13 +440,31 @@ mac_learning_lookup(const struct mac_learning *ml,
     }
 }
 
-/* Expires 'e' from the 'ml' hash table. */
+/* Expires 'e' from the 'ml' hash table.  This does not move any other entry
+ * within 'ml'. */
 void
 mac_learning_expire(struct mac_learning *ml, struct mac_entry *e)
 {
-    hmap_remove(&ml->table, &e->hmap_node);
-    list_remove(&e->lru_node);
-    free(e);
+    size_t i = e - ml->table;
+
+    mac_wheel_remove(ml, e);
+    ml->n--;
+
+    /* If the next slot is empty, then no probe sequence passes through 'e',
+     * so 'e' and any tombstones that immediately precede it can be marked
+     * empty instead of deleted. */
+    if (ml->table[(i + 1) & ml->mask].state == MAC_SLOT_EMPTY) {
+        e->state = MAC_SLOT_EMPTY;
+        for (i = (i - 1) & ml->mask;
+             ml->table[i].state == MAC_SLOT_DELETED;
+             i = (i - 1) & ml->mask) {
+            ml->table[i].state = MAC_SLOT_EMPTY;
+            ml->n_deleted--;
+        }
+    } else {
+        e->state = MAC_SLOT_DELETED;
+        ml->n_deleted++;
+    }
 }
 
 /* Expires all the mac-learning entries in 'ml'.  If not NULL, the tags in 'ml'
@@ -297,22 +474,54 @@ mac_learning_expire(struct mac_learning *ml, struct mac_entry *e)
 void
 mac_learning_flush(struct mac_learning *ml, struct tag_set *tags)
 {
-    struct mac_entry *e;
-    while (get_lru(ml, &e)){
+    struct mac_entry *e, *next;
+
+    MAC_LEARNING_FOR_EACH_SAFE (e, next, ml) {
         if (tags) {
             tag_set_add(tags, e->tag);
         }
         mac_learning_expire(ml, e);
     }
-    hmap_shrink(&ml->table);
+    if (ml->mask + 1 > MAC_TABLE_MIN) {
+        mac_table_resize(ml, MAC_TABLE_MIN);
+    }
 }
 
 void
 mac_learning_run(struct mac_learning *ml, struct tag_set *set)
 {
+    time_t now = time_now();
     struct mac_entry *e;
-    while (get_lru(ml, &e) && time_now() >= e->expires) {
-        COVERAGE_INC(mac_learning_expired);
+
+    /* Expire entries from each timer wheel slot up to the current time.
+     * A slot can also hold entries that expire a multiple of MAC_WHEEL_SLOTS
+     * seconds later, if mac_learning_run() was not called for a long time,
+     * so check each entry's expiration time. */
+    if (now >= ml->wheel_time) {
+        size_t n_slots = MIN(now - ml->wheel_time + 1, MAC_WHEEL_SLOTS);
+        size_t ofs;
+
+        for (ofs = mac_wheel_scan(ml, 0); ofs < n_slots;
+             ofs = mac_wheel_scan(ml, ofs + 1)) {
+            size_t idx = (ml->wheel_time + ofs) & (MAC_WHEEL_SLOTS - 1);
+            struct mac_entry *next;
+
+            LIST_FOR_EACH_SAFE (e, next, wheel_node, &ml->wheel[idx]) {
+                if (now >= e->expires) {
+                    COVERAGE_INC(mac_learning_expired);
+                    if (set) {
+                        tag_set_add(set, e->tag);
+                    }
+                    mac_learning_expire(ml, e);
+                }
+            }
+        }
+        ml->wheel_time = now + 1;
+    }
+
+    /* Enforce the maximum number of entries, if it was reduced. */
+    while (ml->n > ml->max_entries) {
+        e = mac_learning_first(ml);
         if (set) {
             tag_set_add(set, e->tag);
         }
@@ -323,8 +532,44 @@ mac_learning_run(struct mac_learning *ml, struct tag_set *set)
 void
 mac_learning_wait(struct mac_learning *ml)
 {
-    if (!list_is_empty(&ml->lrus)) {
-        struct mac_entry *e = mac_entry_from_lru_node(ml->lrus.next);
-        poll_timer_wait_until(e->expires * 1000LL);
+    size_t ofs = mac_wheel_scan(ml, 0);
+
+    if (ml->n > ml->max_entries) {
+        poll_immediate_wake();
+    } else if (ofs < MAC_WHEEL_SLOTS) {
+        poll_timer_wait_until((ml->wheel_time + ofs) * 1000LL);
     }
 }
+
+/* Returns the least recently used entry in 'ml', or NULL if 'ml' is empty. */
+struct mac_entry *
+mac_learning_first(const struct mac_learning *ml)
+{
+    size_t ofs = mac_wheel_scan(ml, 0);
+
+    return ofs < MAC_WHEEL_SLOTS ? mac_wheel_front(ml, ofs) : NULL;
+}
+
+/* Returns the entry in 'ml' that was used least recently after 'e', or NULL
+ * if 'e' is the most recently used entry. */
+struct mac_entry *
+mac_learning_next(const struct mac_learning *ml, const struct mac_entry *e)
+{
+    size_t idx = e->expires & (MAC_WHEEL_SLOTS - 1);
+    size_t ofs;
+
+    if (e->wheel_node.next != &ml->wheel[idx]) {
+        return CONTAINER_OF(e->wheel_node.next, struct mac_entry, wheel_node);
+    }
+
+    ofs = (idx - ml->wheel_time) & (MAC_WHEEL_SLOTS - 1);
+    ofs = mac_wheel_scan(ml, ofs + 1);
+    return ofs < MAC_WHEEL_SLOTS ? mac_wheel_front(ml, ofs) : NULL;
+}
+
+/* Returns the number of entries in 'ml'. */
+size_t
+mac_learning_count(const struct mac_learning *ml)
+{
+    return ml->n;
+}
@@ -18,7 +18,6 @@
 #define MAC_LEARNING_H 1
 
 #include <time.h>
-#include "hmap.h"
 #include "list.h"
 #include "packets.h"
 #include "tag.h"
@@ -26,7 +25,8 @@
 
 struct mac_learning;
 
-#define MAC_MAX 2048
+/* Default maximum number of entries in a MAC learning table. */
+#define MAC_DEFAULT_MAX 2048
 
 /* Time, in seconds, before expiring a mac_entry due to inactivity. */
 #define MAC_ENTRY_DEFAULT_IDLE_TIME 300
@@ -35,15 +35,21 @@ struct mac_learning;
  * relearning based on a reflection from a bond slave. */
 #define MAC_GRAT_ARP_LOCK_TIME 5
 
-/* A MAC learning table entry. */
+/* A MAC learning table entry.
+ *
+ * Entries are stored inline in the mac_learning's open-addressed table, so a
+ * pointer to an entry remains valid only until the next call to
+ * mac_learning_insert() or mac_learning_flush() on the table, or until the
+ * entry is expired. */
 struct mac_entry {
-    struct hmap_node hmap_node; /* Node in a mac_learning hmap. */
-    struct list lru_node;       /* Element in 'lrus' list. */
+    struct list wheel_node;     /* Element in a mac_learning 'wheel' slot. */
     time_t expires;             /* Expiration time. */
     time_t grat_arp_lock;       /* Gratuitous ARP lock expiration time. */
     uint8_t mac[ETH_ADDR_LEN];  /* Known MAC address. */
     uint16_t vlan;              /* VLAN tag. */
+    uint32_t hash;              /* Hash of 'mac' and 'vlan'. */
     tag_type tag;               /* Tag for this learning entry. */
+    int state;                  /* MAC_SLOT_* (for internal use). */
 
     /* Learned port. */
     union {
@@ -75,11 +81,33 @@ static inline bool mac_entry_is_grat_arp_locked(const struct mac_entry *mac)
     return time_now() < mac->grat_arp_lock;
 }
 
-/* MAC learning table. */
+/* Number of one-second slots in a mac_learning's aging timer wheel.  This
+ * must be a power of 2 greater than the maximum idle time. */
+#define MAC_WHEEL_SLOTS 4096
+
+/* MAC learning table.
+ *
+ * The table is an open-addressed hash table of inline mac_entry structures
+ * with linear probing, so that a lookup usually touches only one or two
+ * cache lines.  Aging uses a timer wheel with one slot per second: each
+ * entry is on the list for the slot of its expiration time, which keeps
+ * entries in least-recently-used order without a global LRU list and allows
+ * mac_learning_run() to visit only the entries that are due.
+ *
+ * mac_learning_lookup() and mac_learning_may_learn() do not modify the
+ * table, so any number of lookups may proceed without interference as long
+ * as no other function is modifying the table at the same time. */
 struct mac_learning {
-    struct hmap table;          /* Learning table. */
-    struct list lrus;           /* In-use entries, least recently used at the
-                                   front, most recently used at the back. */
+    struct mac_entry *table;    /* Open-addressed table, 'mask' + 1 slots. */
+    size_t mask;                /* Number of slots in 'table', minus 1. */
+    size_t n;                   /* Number of entries in use. */
+    size_t n_deleted;           /* Number of deleted ("tombstone") slots. */
+    size_t max_entries;         /* Maximum value for 'n'. */
+
+    struct list wheel[MAC_WHEEL_SLOTS]; /* Entries by expiration time. */
+    unsigned long *wheel_map;   /* 1-bit for each nonempty 'wheel' slot. */
+    time_t wheel_time;          /* Earliest time not yet expired by run. */
+
     uint32_t secret;            /* Secret for randomizing hash table. */
     unsigned long *flood_vlans; /* Bitmap of learning disabled VLANs. */
     unsigned int idle_time;     /* Max age before deleting an entry. */
@@ -96,6 +124,7 @@ void mac_learning_wait(struct mac_learning *);
 bool mac_learning_set_flood_vlans(struct mac_learning *,
                                   const unsigned long *bitmap);
 void mac_learning_set_idle_time(struct mac_learning *, unsigned int idle_time);
+void mac_learning_set_max_entries(struct mac_learning *, size_t max_entries);
 
 /* Learning. */
 bool mac_learning_may_learn(const struct mac_learning *,
@@ -115,4 +144,23 @@ struct mac_entry *mac_learning_lookup(const struct mac_learning *,
 void mac_learning_expire(struct mac_learning *, struct mac_entry *);
 void mac_learning_flush(struct mac_learning *, struct tag_set *);
 
+/* Iteration.
+ *
+ * Visits each entry in 'ML' in least-recently-used order, that is, in order
+ * of increasing expiration time.  MAC_LEARNING_FOR_EACH_SAFE allows the loop
+ * body to expire the current entry (but not to insert new ones). */
+#define MAC_LEARNING_FOR_EACH(E, ML)                                    \
+    for ((E) = mac_learning_first(ML); (E);                             \
+         (E) = mac_learning_next(ML, E))
+
+#define MAC_LEARNING_FOR_EACH_SAFE(E, NEXT, ML)                         \
+    for ((E) = mac_learning_first(ML);                                  \
+         (E) ? ((NEXT) = mac_learning_next(ML, E), 1) : 0;              \
+         (E) = (NEXT))
+
+struct mac_entry *mac_learning_first(const struct mac_learning *);
+struct mac_entry *mac_learning_next(const struct mac_learning *,
+                                    const struct mac_entry *);
+size_t mac_learning_count(const struct mac_learning *);
+
 #endif /* mac-learning.h */
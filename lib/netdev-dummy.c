@@ -27,6 +27,7 @@
 #include "ofp-print.h"
 #include "ofpbuf.h"
 #include "packets.h"
+#include "pcap.h"
 #include "poll-loop.h"
 #include "shash.h"
 #include "sset.h"
@@ -43,6 +44,9 @@ struct netdev_dev_dummy {
     enum netdev_flags flags;
     unsigned int change_seq;
 
+    char *tx_pcap_name;         /* Name of 'tx_pcap', if nonnull. */
+    FILE *tx_pcap;              /* Transmitted packets are written here. */
+
     struct list devs;           /* List of child "netdev_dummy"s. */
 };
 
@@ -116,9 +120,55 @@ netdev_dummy_destroy(struct netdev_dev *netdev_dev_)
 
     shash_find_and_delete(&dummy_netdev_devs,
                           netdev_dev_get_name(netdev_dev_));
+    if (netdev_dev->tx_pcap) {
+        fclose(netdev_dev->tx_pcap);
+    }
+    free(netdev_dev->tx_pcap_name);
     free(netdev_dev);
 }
 
+static int
+netdev_dummy_get_config(struct netdev_dev *netdev_dev_, struct shash *args)
+{
+    struct netdev_dev_dummy *netdev_dev = netdev_dev_dummy_cast(netdev_dev_);
+
+    if (netdev_dev->tx_pcap_name) {
+        shash_add(args, "pcap", xstrdup(netdev_dev->tx_pcap_name));
+    }
+    return 0;
+}
+
+/* Supports a single option, "pcap", that names a file to which every packet
+ * transmitted on the device is written in pcap format. */
+static int
+netdev_dummy_set_config(struct netdev_dev *netdev_dev_,
+                        const struct shash *args)
+{
+    struct netdev_dev_dummy *netdev_dev = netdev_dev_dummy_cast(netdev_dev_);
+    const char *pcap = shash_find_data(args, "pcap");
+
+    if (pcap && netdev_dev->tx_pcap_name
+        && !strcmp(pcap, netdev_dev->tx_pcap_name)) {
+        return 0;
+    }
+
+    if (netdev_dev->tx_pcap) {
+        fclose(netdev_dev->tx_pcap);
+        netdev_dev->tx_pcap = NULL;
+    }
+    free(netdev_dev->tx_pcap_name);
+    netdev_dev->tx_pcap_name = NULL;
+
+    if (pcap) {
+        netdev_dev->tx_pcap = pcap_open(pcap, "wb");
+        if (!netdev_dev->tx_pcap) {
+            return EINVAL;
+        }
+        netdev_dev->tx_pcap_name = xstrdup(pcap);
+    }
+    return 0;
+}
+
 static int
 netdev_dummy_open(struct netdev_dev *netdev_dev_, struct netdev **netdevp)
 {
@@ -192,6 +242,22 @@ netdev_dummy_drain(struct netdev *netdev_)
     return 0;
 }
 
+static int
+netdev_dummy_send(struct netdev *netdev, const void *buffer, size_t size)
+{
+    struct netdev_dev_dummy *dev =
+        netdev_dev_dummy_cast(netdev_get_dev(netdev));
+
+    if (dev->tx_pcap) {
+        struct ofpbuf packet;
+
+        ofpbuf_use_const(&packet, buffer, size);
+        pcap_write(dev->tx_pcap, &packet);
+        fflush(dev->tx_pcap);
+    }
+    return 0;
+}
+
 static int
 netdev_dummy_set_etheraddr(struct netdev *netdev,
                            const uint8_t mac[ETH_ADDR_LEN])
@@ -307,8 +373,8 @@ static const struct netdev_class dummy_class = {
 
     netdev_dummy_create,
     netdev_dummy_destroy,
-    NULL,                       /* get_config */
-    NULL,                       /* set_config */
+    netdev_dummy_get_config,
+    netdev_dummy_set_config,
 
     netdev_dummy_open,
     netdev_dummy_close,
@@ -318,7 +384,7 @@ static const struct netdev_class dummy_class = {
     netdev_dummy_recv_wait,
     netdev_dummy_drain,
 
-    NULL,                       /* send */
+    netdev_dummy_send,
     NULL,                       /* send_wait */
 
     netdev_dummy_set_etheraddr,
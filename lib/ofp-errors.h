@@ -129,6 +129,10 @@ enum ofperr {
      * valid. */
     OFPERR_NXBRC_BAD_REASON,
 
+    /* NX1.0+(1,517).  A message within an NXT_FLOW_MOD_BATCH is not a
+     * flow_mod, or it is a flow_mod that refers to a buffered packet. */
+    OFPERR_NXBRC_BAD_BATCH_MSG,
+
 /* ## ---------------- ## */
 /* ## OFPET_BAD_ACTION ## */
 /* ## ---------------- ## */
@@ -321,6 +325,11 @@ enum ofperr {
      * extension is enabled. */
     OFPERR_NXFMFC_BAD_TABLE_ID,
 
+    /* NX1.0(3,258), NX1.1(5,258).  A flow_mod within an NXT_FLOW_MOD_BATCH
+     * affects a flow on which an earlier flow_mod in the same batch still has
+     * an operation in progress. */
+    OFPERR_NXFMFC_BATCH_CONFLICT,
+
 /* ## ---------------------- ## */
 /* ## OFPET_GROUP_MOD_FAILED ## */
 /* ## ---------------------- ## */
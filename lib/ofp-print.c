@@ -49,6 +49,9 @@
 
 static void ofp_print_queue_name(struct ds *string, uint32_t port);
 static void ofp_print_error(struct ds *, enum ofperr);
+static void ofp_to_string__(const struct ofp_header *,
+                            const struct ofputil_msg_type *, struct ds *,
+                            int verbosity);
 
 
 /* Returns a string that represents the contents of the Ethernet frame in the
@@ -1595,6 +1598,35 @@ ofp_print_nxt_set_controller_id(struct ds *string,
     ds_put_format(string, " id=%"PRIu16, ntohs(nci->controller_id));
 }
 
+static void
+ofp_print_nxt_flow_mod_batch(struct ds *string,
+                             const struct nx_flow_mod_batch *nfmb,
+                             int verbosity)
+{
+    struct ofpbuf b;
+
+    ofpbuf_use_const(&b, nfmb, ntohs(nfmb->nxh.header.length));
+    ofpbuf_pull(&b, sizeof *nfmb);
+    while (b.size > 0) {
+        const struct ofputil_msg_type *type;
+        const struct ofp_header *oh;
+        enum ofperr error;
+
+        if (ds_last(string) != '\n') {
+            ds_put_char(string, '\n');
+        }
+        ds_put_cstr(string, " ");
+
+        error = ofputil_pull_flow_mod_from_batch(&b, &oh);
+        if (error) {
+            ofp_print_error(string, error);
+            return;
+        }
+        ofputil_decode_msg_type(oh, &type);
+        ofp_to_string__(oh, type, string, verbosity);
+    }
+}
+
 static void
 ofp_to_string__(const struct ofp_header *oh,
                 const struct ofputil_msg_type *type, struct ds *string,
@@ -1774,6 +1806,10 @@ ofp_to_string__(const struct ofp_header *oh,
         ofp_print_nxt_set_controller_id(string, msg);
         break;
 
+    case OFPUTIL_NXT_FLOW_MOD_BATCH:
+        ofp_print_nxt_flow_mod_batch(string, msg, verbosity);
+        break;
+
     case OFPUTIL_NXT_SET_ASYNC_CONFIG:
         ofp_print_nxt_set_async_config(string, msg);
         break;
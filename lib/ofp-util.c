@@ -677,6 +677,10 @@ ofputil_decode_vendor(const struct ofp_header *oh, size_t length,
         { OFPUTIL_NXT_SET_CONTROLLER_ID, OFP10_VERSION,
           NXT_SET_CONTROLLER_ID, "NXT_SET_CONTROLLER_ID",
           sizeof(struct nx_controller_id), 0 },
+
+        { OFPUTIL_NXT_FLOW_MOD_BATCH, OFP10_VERSION,
+          NXT_FLOW_MOD_BATCH, "NXT_FLOW_MOD_BATCH",
+          sizeof(struct nx_flow_mod_batch), 8 },
     };
 
     static const struct ofputil_msg_category nxt_category = {
@@ -1825,6 +1829,70 @@ ofputil_flow_mod_usable_protocols(const struct ofputil_flow_mod *fms,
     return usable_protocols;
 }
 
+/* Appends 'flow_mod', an OFPT_FLOW_MOD or NXT_FLOW_MOD message, to the last
+ * NXT_FLOW_MOD_BATCH message in 'batches', a list of "struct ofpbuf"s.  If
+ * 'batches' is empty, or if the last batch has no room for 'flow_mod', first
+ * appends a new, empty batch to 'batches'.  Keeps the length in each batch's
+ * header up-to-date.
+ *
+ * Destroys 'flow_mod'. */
+void
+ofputil_append_flow_mod_to_batch(struct list *batches,
+                                 struct ofpbuf *flow_mod)
+{
+    struct ofpbuf *batch;
+
+    batch = (list_is_empty(batches) ? NULL
+             : ofpbuf_from_list(list_back(batches)));
+    if (!batch || batch->size + flow_mod->size > UINT16_MAX) {
+        make_nxmsg(sizeof(struct nx_flow_mod_batch), NXT_FLOW_MOD_BATCH,
+                   &batch);
+        list_push_back(batches, &batch->list_node);
+    }
+    ofpbuf_put(batch, flow_mod->data, flow_mod->size);
+    update_openflow_length(batch);
+    ofpbuf_delete(flow_mod);
+}
+
+/* Pulls the next message from 'b', which must hold the unprocessed remainder
+ * of the body of an NXT_FLOW_MOD_BATCH message, and stores a pointer to it in
+ * '*ohp'.  Returns 0 if successful, in which case '*ohp' is an OFPT_FLOW_MOD
+ * or NXT_FLOW_MOD message that ofputil_decode_flow_mod() can decode.
+ * Otherwise, returns an OpenFlow error code. */
+enum ofperr
+ofputil_pull_flow_mod_from_batch(struct ofpbuf *b,
+                                 const struct ofp_header **ohp)
+{
+    const struct ofputil_msg_type *type;
+    const struct ofp_header *oh;
+    enum ofputil_msg_code code;
+    enum ofperr error;
+    size_t length;
+
+    oh = b->size >= sizeof *oh ? b->data : NULL;
+    length = oh ? ntohs(oh->length) : 0;
+    if (length < sizeof *oh || length > b->size || length % 8) {
+        VLOG_WARN_RL(&bad_ofmsg_rl, "NXT_FLOW_MOD_BATCH contains message "
+                     "with bad length %zu (%zu bytes left)", length, b->size);
+        return OFPERR_OFPBRC_BAD_LEN;
+    }
+
+    error = ofputil_decode_msg_type(oh, &type);
+    if (error) {
+        return error;
+    }
+    code = ofputil_msg_type_code(type);
+    if (code != OFPUTIL_OFPT_FLOW_MOD && code != OFPUTIL_NXT_FLOW_MOD) {
+        VLOG_WARN_RL(&bad_ofmsg_rl, "NXT_FLOW_MOD_BATCH contains %s",
+                     ofputil_msg_type_name(type));
+        return OFPERR_NXBRC_BAD_BATCH_MSG;
+    }
+
+    ofpbuf_pull(b, length);
+    *ohp = oh;
+    return 0;
+}
+
 static enum ofperr
 ofputil_decode_ofpst_flow_request(struct ofputil_flow_stats_request *fsr,
                                   const struct ofp_header *oh,
@@ -4002,16 +4070,26 @@ ofputil_put_action(enum ofputil_action_code code, struct ofpbuf *buf)
 /* Returns true if 'action' outputs to 'port', false otherwise. */
 bool
 action_outputs_to_port(const union ofp_action *action, ovs_be16 port)
+{
+    uint16_t out_port = action_output_port(action);
+
+    return out_port != OFPP_NONE && htons(out_port) == port;
+}
+
+/* Returns the port to which 'action' outputs, or OFPP_NONE if 'action' is not
+ * an action that outputs to a port. */
+uint16_t
+action_output_port(const union ofp_action *action)
 {
     switch (ofputil_decode_action(action)) {
     case OFPUTIL_OFPAT10_OUTPUT:
-        return action->output.port == port;
+        return ntohs(action->output.port);
     case OFPUTIL_OFPAT10_ENQUEUE:
-        return ((const struct ofp_action_enqueue *) action)->port == port;
+        return ntohs(((const struct ofp_action_enqueue *) action)->port);
     case OFPUTIL_NXAST_CONTROLLER:
-        return port == htons(OFPP_CONTROLLER);
+        return OFPP_CONTROLLER;
     default:
-        return false;
+        return OFPP_NONE;
     }
 }
 
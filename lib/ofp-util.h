@@ -85,6 +85,7 @@ enum ofputil_msg_code {
     OFPUTIL_NXT_FLOW_AGE,
     OFPUTIL_NXT_SET_ASYNC_CONFIG,
     OFPUTIL_NXT_SET_CONTROLLER_ID,
+    OFPUTIL_NXT_FLOW_MOD_BATCH,
 
     /* NXST_* stat requests. */
     OFPUTIL_NXST_FLOW_REQUEST,
@@ -249,6 +250,12 @@ struct ofpbuf *ofputil_encode_flow_mod(const struct ofputil_flow_mod *,
 enum ofputil_protocol ofputil_flow_mod_usable_protocols(
     const struct ofputil_flow_mod *fms, size_t n_fms);
 
+/* NXT_FLOW_MOD_BATCH extension. */
+void ofputil_append_flow_mod_to_batch(struct list *batches,
+                                      struct ofpbuf *flow_mod);
+enum ofperr ofputil_pull_flow_mod_from_batch(struct ofpbuf *,
+                                             const struct ofp_header **);
+
 /* Flow stats or aggregate stats request, independent of protocol. */
 struct ofputil_flow_stats_request {
     bool aggregate;             /* Aggregate results? */
@@ -678,6 +685,7 @@ ofputil_action_is_valid(const union ofp_action *a, size_t n_actions)
 enum ofperr validate_actions(const union ofp_action *, size_t n_actions,
                              const struct flow *, int max_ports);
 bool action_outputs_to_port(const union ofp_action *, ovs_be16 port);
+uint16_t action_output_port(const union ofp_action *);
 
 enum ofperr ofputil_pull_actions(struct ofpbuf *, unsigned int actions_len,
                                  union ofp_action **, size_t *);
@@ -20,8 +20,108 @@
 #include <stdlib.h>
 #include <string.h>
 #include "dynamic-string.h"
+#include "simap.h"
 #include "util.h"
 
+/* Pool of buffer memory.
+ *
+ * ofpbuf_init() and ofpbuf_new() take memory for buffer data from a pool of
+ * blocks in power-of-2 size classes from OFPBUF_POOL_MIN bytes to
+ * OFPBUF_POOL_MAX bytes, and ofpbuf_uninit() returns it there, so that the
+ * steady stream of short-lived OpenFlow messages, Netlink requests, and packet
+ * copies mostly avoids malloc() and free().  Each class caches at most
+ * OFPBUF_POOL_CLASS_BYTES bytes of free blocks; beyond that, blocks are freed.
+ * Similarly, ofpbuf_delete() caches up to OFPBUF_POOL_MAX_HEADERS "struct
+ * ofpbuf"s for reuse by ofpbuf_new().
+ *
+ * Every block is an ordinary malloc()'d block at least as large as its size
+ * class, so the data in a pool-backed buffer may still be released with
+ * free(), e.g. after ofpbuf_get_uninit_pointer() or ofpbuf_steal_data().  It
+ * then simply does not return to the pool.
+ *
+ * Open vSwitch is single-threaded, so a single cache serves the process. */
+#define OFPBUF_POOL_MIN_SHIFT 8
+#define OFPBUF_POOL_MAX_SHIFT 16
+#define OFPBUF_POOL_MIN (1u << OFPBUF_POOL_MIN_SHIFT)
+#define OFPBUF_POOL_MAX (1u << OFPBUF_POOL_MAX_SHIFT)
+#define OFPBUF_POOL_N_CLASSES (OFPBUF_POOL_MAX_SHIFT - OFPBUF_POOL_MIN_SHIFT + 1)
+#define OFPBUF_POOL_CLASS_BYTES (256 * 1024)
+#define OFPBUF_POOL_MAX_HEADERS 1024
+
+/* A free block in a size class. */
+struct ofpbuf_pool_block {
+    struct ofpbuf_pool_block *next;
+};
+
+struct ofpbuf_pool_class {
+    struct ofpbuf_pool_block *blocks; /* Free blocks. */
+    size_t n_blocks;                  /* Number of blocks in 'blocks'. */
+    unsigned long long int n_hits;    /* Allocations served from 'blocks'. */
+    unsigned long long int n_misses;  /* Allocations that called malloc(). */
+};
+
+static struct ofpbuf_pool_class pool_classes[OFPBUF_POOL_N_CLASSES];
+
+/* Cached "struct ofpbuf"s, linked through their 'private_p' members. */
+static struct ofpbuf *pool_headers;
+static size_t n_pool_headers;
+
+/* Returns the index of the smallest size class that holds 'size' bytes, which
+ * must be between 1 and OFPBUF_POOL_MAX, inclusive. */
+static int
+pool_class_index(size_t size)
+{
+    return (size <= OFPBUF_POOL_MIN
+            ? 0
+            : log_2_ceil(size) - OFPBUF_POOL_MIN_SHIFT);
+}
+
+/* Returns a block of at least 'size' bytes, where 'size' is between 1 and
+ * OFPBUF_POOL_MAX, inclusive, and stores the block's actual usable size into
+ * '*allocated'. */
+static void *
+pool_alloc(size_t size, size_t *allocated)
+{
+    int idx = pool_class_index(size);
+    struct ofpbuf_pool_class *class = &pool_classes[idx];
+
+    *allocated = OFPBUF_POOL_MIN << idx;
+    if (class->blocks) {
+        struct ofpbuf_pool_block *block = class->blocks;
+
+        class->blocks = block->next;
+        class->n_blocks--;
+        class->n_hits++;
+        return block;
+    } else {
+        class->n_misses++;
+        return xmalloc(*allocated);
+    }
+}
+
+/* Returns 'base', a block of 'allocated' bytes obtained from pool_alloc(), to
+ * the pool.  Does nothing if 'base' is null. */
+static void
+pool_free(void *base, size_t allocated)
+{
+    struct ofpbuf_pool_class *class;
+
+    if (!base) {
+        return;
+    }
+
+    class = &pool_classes[pool_class_index(allocated)];
+    if (class->n_blocks < OFPBUF_POOL_CLASS_BYTES / allocated) {
+        struct ofpbuf_pool_block *block = base;
+
+        block->next = class->blocks;
+        class->blocks = block;
+        class->n_blocks++;
+    } else {
+        free(base);
+    }
+}
+
 static void
 ofpbuf_use__(struct ofpbuf *b, void *base, size_t allocated,
              enum ofpbuf_source source)
@@ -99,20 +199,34 @@ ofpbuf_use_const(struct ofpbuf *b, const void *data, size_t size)
     b->size = size;
 }
 
-/* Initializes 'b' as an empty ofpbuf with an initial capacity of 'size'
- * bytes. */
+/* Initializes 'b' as an empty ofpbuf with an initial capacity of at least
+ * 'size' bytes.  The memory comes from the ofpbuf pool if 'size' is small
+ * enough. */
 void
 ofpbuf_init(struct ofpbuf *b, size_t size)
 {
-    ofpbuf_use(b, size ? xmalloc(size) : NULL, size);
+    if (!size) {
+        ofpbuf_use__(b, NULL, 0, OFPBUF_POOL);
+    } else if (size <= OFPBUF_POOL_MAX) {
+        size_t allocated;
+        void *base = pool_alloc(size, &allocated);
+
+        ofpbuf_use__(b, base, allocated, OFPBUF_POOL);
+    } else {
+        ofpbuf_use(b, xmalloc(size), size);
+    }
 }
 
 /* Frees memory that 'b' points to. */
 void
 ofpbuf_uninit(struct ofpbuf *b)
 {
-    if (b && b->source == OFPBUF_MALLOC) {
-        free(b->base);
+    if (b) {
+        if (b->source == OFPBUF_MALLOC) {
+            free(b->base);
+        } else if (b->source == OFPBUF_POOL) {
+            pool_free(b->base, b->allocated);
+        }
     }
 }
 
@@ -122,7 +236,9 @@ ofpbuf_uninit(struct ofpbuf *b)
 void *
 ofpbuf_get_uninit_pointer(struct ofpbuf *b)
 {
-    return b && b->source == OFPBUF_MALLOC ? b->base : NULL;
+    return (b && (b->source == OFPBUF_MALLOC || b->source == OFPBUF_POOL)
+            ? b->base
+            : NULL);
 }
 
 /* Frees memory that 'b' points to and allocates a new ofpbuf */
@@ -138,7 +254,15 @@ ofpbuf_reinit(struct ofpbuf *b, size_t size)
 struct ofpbuf *
 ofpbuf_new(size_t size)
 {
-    struct ofpbuf *b = xmalloc(sizeof *b);
+    struct ofpbuf *b;
+
+    if (pool_headers) {
+        b = pool_headers;
+        pool_headers = b->private_p;
+        n_pool_headers--;
+    } else {
+        b = xmalloc(sizeof *b);
+    }
     ofpbuf_init(b, size);
     return b;
 }
@@ -215,7 +339,13 @@ ofpbuf_delete(struct ofpbuf *b)
 {
     if (b) {
         ofpbuf_uninit(b);
-        free(b);
+        if (n_pool_headers < OFPBUF_POOL_MAX_HEADERS) {
+            b->private_p = pool_headers;
+            pool_headers = b;
+            n_pool_headers++;
+        } else {
+            free(b);
+        }
     }
 }
 
@@ -252,11 +382,13 @@ ofpbuf_copy__(struct ofpbuf *b, uint8_t *new_base,
            copy_headroom + b->size + copy_tailroom);
 }
 
-/* Reallocates 'b' so that it has exactly 'new_headroom' and 'new_tailroom'
- * bytes of headroom and tailroom, respectively. */
+/* Reallocates 'b' so that it has exactly 'new_headroom' bytes of headroom and
+ * at least 'new_tailroom' bytes of tailroom.  (A buffer whose memory comes from
+ * the pool gets all of the tailroom in its size class.) */
 static void
 ofpbuf_resize__(struct ofpbuf *b, size_t new_headroom, size_t new_tailroom)
 {
+    enum ofpbuf_source new_source;
     void *new_base, *new_data;
     size_t new_allocated;
 
@@ -277,9 +409,19 @@ ofpbuf_resize__(struct ofpbuf *b, size_t new_headroom, size_t new_tailroom)
         NOT_REACHED();
 
     case OFPBUF_STUB:
-        b->source = OFPBUF_MALLOC;
-        new_base = xmalloc(new_allocated);
+    case OFPBUF_POOL:
+        if (new_allocated && new_allocated <= OFPBUF_POOL_MAX) {
+            new_base = pool_alloc(new_allocated, &new_allocated);
+            new_source = OFPBUF_POOL;
+        } else {
+            new_base = xmalloc(new_allocated);
+            new_source = OFPBUF_MALLOC;
+        }
         ofpbuf_copy__(b, new_base, new_headroom, new_tailroom);
+        if (b->source == OFPBUF_POOL) {
+            pool_free(b->base, b->allocated);
+        }
+        b->source = new_source;
         break;
 
     default:
@@ -331,16 +473,24 @@ ofpbuf_prealloc_headroom(struct ofpbuf *b, size_t size)
 }
 
 /* Trims the size of 'b' to fit its actual content, reducing its tailroom to
- * 0.  Its headroom, if any, is preserved.
+ * 0 (or, for a buffer whose memory comes from the pool, to the remainder of the
+ * smallest size class that fits).  Its headroom, if any, is preserved.
  *
  * Buffers not obtained from malloc() are not resized, since that wouldn't save
- * any memory. */
+ * any memory, and neither are buffers from the pool whose content already
+ * needs a block of the size class they have. */
 void
 ofpbuf_trim(struct ofpbuf *b)
 {
-    if (b->source == OFPBUF_MALLOC
-        && (ofpbuf_headroom(b) || ofpbuf_tailroom(b))) {
-        ofpbuf_resize__(b, 0, 0);
+    if (b->source == OFPBUF_MALLOC) {
+        if (ofpbuf_headroom(b) || ofpbuf_tailroom(b)) {
+            ofpbuf_resize__(b, 0, 0);
+        }
+    } else if (b->source == OFPBUF_POOL) {
+        if (!b->size
+            || pool_class_index(b->size) < pool_class_index(b->allocated)) {
+            ofpbuf_resize__(b, 0, 0);
+        }
     }
 }
 
@@ -528,13 +678,12 @@ void *
 ofpbuf_steal_data(struct ofpbuf *b)
 {
     void *p;
-    if (b->source == OFPBUF_MALLOC && b->data == b->base) {
+    if ((b->source == OFPBUF_MALLOC || b->source == OFPBUF_POOL)
+        && b->data == b->base) {
         p = b->data;
     } else {
         p = xmemdup(b->data, b->size);
-        if (b->source == OFPBUF_MALLOC) {
-            free(b->base);
-        }
+        ofpbuf_uninit(b);
     }
     b->base = b->data = NULL;
     return p;
@@ -567,3 +716,29 @@ ofpbuf_list_delete(struct list *list)
         ofpbuf_delete(b);
     }
 }
+
+/* Adds statistics for the ofpbuf pool into 'usage', for use with
+ * memory_report(). */
+void
+ofpbuf_get_memory_usage(struct simap *usage)
+{
+    unsigned long long int n_hits, n_misses;
+    size_t cached;
+    int i;
+
+    n_hits = n_misses = 0;
+    cached = 0;
+    for (i = 0; i < OFPBUF_POOL_N_CLASSES; i++) {
+        const struct ofpbuf_pool_class *class = &pool_classes[i];
+
+        n_hits += class->n_hits;
+        n_misses += class->n_misses;
+        cached += class->n_blocks * (OFPBUF_POOL_MIN << i);
+    }
+
+    simap_increase(usage, "ofpbuf-pool-kB", cached / 1024);
+    if (n_hits + n_misses) {
+        simap_increase(usage, "ofpbuf-pool-hit-pct",
+                       n_hits * 100 / (n_hits + n_misses));
+    }
+}
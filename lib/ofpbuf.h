@@ -26,10 +26,13 @@
 extern "C" {
 #endif
 
+struct simap;
+
 enum ofpbuf_source {
     OFPBUF_MALLOC,              /* Obtained via malloc(). */
     OFPBUF_STACK,               /* Un-movable stack space or static buffer. */
-    OFPBUF_STUB                 /* Starts on stack, may expand into heap. */
+    OFPBUF_STUB,                /* Starts on stack, may expand into heap. */
+    OFPBUF_POOL                 /* Obtained from the ofpbuf pool. */
 };
 
 /* Buffer for holding arbitrary data.  An ofpbuf is automatically reallocated
@@ -110,6 +113,8 @@ static inline struct ofpbuf *ofpbuf_from_list(const struct list *list)
 }
 void ofpbuf_list_delete(struct list *);
 
+void ofpbuf_get_memory_usage(struct simap *);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -20,12 +20,14 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/ip6.h>
 #include <stdlib.h>
 #include "byte-order.h"
 #include "csum.h"
 #include "flow.h"
 #include "dynamic-string.h"
 #include "ofpbuf.h"
+#include "unaligned.h"
 
 const struct in6_addr in6addr_exact = IN6ADDR_EXACT_INIT;
 
@@ -436,27 +438,36 @@ eth_compose(struct ofpbuf *b, const uint8_t eth_dst[ETH_ADDR_LEN],
     return data;
 }
 
-static void
-packet_set_ipv4_addr(struct ofpbuf *packet, ovs_be32 *addr, ovs_be32 new_addr)
+/* Applies 'delta', a change to the IPv4 or IPv6 addresses in 'packet''s
+ * pseudo-header accumulated with csum_delta32() or csum_delta128(), to the
+ * checksum of 'packet''s transport header, if it is a 'proto' header that
+ * includes the pseudo-header in its checksum.  'packet' must have correctly
+ * populated l[47] markers. */
+void
+packet_update_l4_csum(struct ofpbuf *packet, uint8_t proto, uint32_t delta)
 {
-    struct ip_header *nh = packet->l3;
+    if (!delta || !packet->l7) {
+        return;
+    }
 
-    if (nh->ip_proto == IPPROTO_TCP && packet->l7) {
+    if (proto == IPPROTO_TCP) {
         struct tcp_header *th = packet->l4;
 
-        th->tcp_csum = recalc_csum32(th->tcp_csum, *addr, new_addr);
-    } else if (nh->ip_proto == IPPROTO_UDP && packet->l7) {
+        th->tcp_csum = recalc_csum_delta(th->tcp_csum, delta);
+    } else if (proto == IPPROTO_UDP) {
         struct udp_header *uh = packet->l4;
 
         if (uh->udp_csum) {
-            uh->udp_csum = recalc_csum32(uh->udp_csum, *addr, new_addr);
+            uh->udp_csum = recalc_csum_delta(uh->udp_csum, delta);
             if (!uh->udp_csum) {
                 uh->udp_csum = htons(0xffff);
             }
         }
+    } else if (proto == IPPROTO_ICMPV6) {
+        struct icmp_header *icmp = packet->l4;
+
+        icmp->icmp_csum = recalc_csum_delta(icmp->icmp_csum, delta);
     }
-    nh->ip_csum = recalc_csum32(nh->ip_csum, *addr, new_addr);
-    *addr = new_addr;
 }
 
 /* Modifies the IPv4 header fields of 'packet' to be consistent with 'src',
@@ -468,39 +479,73 @@ packet_set_ipv4(struct ofpbuf *packet, ovs_be32 src, ovs_be32 dst,
                 uint8_t tos, uint8_t ttl)
 {
     struct ip_header *nh = packet->l3;
+    uint32_t addr_delta, delta;
 
-    if (nh->ip_src != src) {
-        packet_set_ipv4_addr(packet, &nh->ip_src, src);
-    }
-
-    if (nh->ip_dst != dst) {
-        packet_set_ipv4_addr(packet, &nh->ip_dst, dst);
-    }
+    addr_delta = csum_delta32(0, nh->ip_src, src);
+    addr_delta = csum_delta32(addr_delta, nh->ip_dst, dst);
+    packet_update_l4_csum(packet, nh->ip_proto, addr_delta);
 
-    if (nh->ip_tos != tos) {
-        uint8_t *field = &nh->ip_tos;
+    delta = csum_delta16(addr_delta, htons((uint16_t) nh->ip_tos),
+                         htons((uint16_t) tos));
+    delta = csum_delta16(delta, htons(nh->ip_ttl << 8), htons(ttl << 8));
+    nh->ip_csum = recalc_csum_delta(nh->ip_csum, delta);
 
-        nh->ip_csum = recalc_csum16(nh->ip_csum, htons((uint16_t) *field),
-                                    htons((uint16_t) tos));
-        *field = tos;
-    }
-
-    if (nh->ip_ttl != ttl) {
-        uint8_t *field = &nh->ip_ttl;
+    nh->ip_src = src;
+    nh->ip_dst = dst;
+    nh->ip_tos = tos;
+    nh->ip_ttl = ttl;
+}
 
-        nh->ip_csum = recalc_csum16(nh->ip_csum, htons(*field << 8),
-                                    htons(ttl << 8));
-        *field = ttl;
-    }
+/* Modifies the IPv6 header fields of 'packet' to be consistent with 'src',
+ * 'dst', traffic class 'tc', flow label 'fl' (in the low 20 bits), and hop
+ * limit 'hlimit'.  The addresses are part of the pseudo-header that TCP, UDP,
+ * and ICMPv6 checksums cover, so if 'proto', the transport protocol that
+ * follows any extension headers, is one of those, updates the transport
+ * checksum too.  (A routing header, which changes the destination address in
+ * the pseudo-header, is not taken into account.)  'packet' must contain a
+ * valid IPv6 packet with correctly populated l[347] markers. */
+void
+packet_set_ipv6(struct ofpbuf *packet, uint8_t proto, const ovs_be32 src[4],
+                const ovs_be32 dst[4], uint8_t tc, ovs_be32 fl,
+                uint8_t hlimit)
+{
+    struct ip6_hdr *nh = packet->l3;
+    ovs_be32 old_addr[4];
+    ovs_be32 old_flow;
+    uint32_t delta;
+
+    memcpy(old_addr, &nh->ip6_src, sizeof old_addr);
+    delta = csum_delta128(0, old_addr, src);
+    memcpy(old_addr, &nh->ip6_dst, sizeof old_addr);
+    delta = csum_delta128(delta, old_addr, dst);
+    packet_update_l4_csum(packet, proto, delta);
+
+    memcpy(&nh->ip6_src, src, sizeof nh->ip6_src);
+    memcpy(&nh->ip6_dst, dst, sizeof nh->ip6_dst);
+
+    old_flow = get_unaligned_be32((ovs_be32 *) &nh->ip6_flow);
+    put_unaligned_be32((ovs_be32 *) &nh->ip6_flow,
+                       ((old_flow & htonl(~0x0fffffff))
+                        | htonl(tc << 20)
+                        | (fl & htonl(IPV6_LABEL_MASK))));
+    nh->ip6_hlim = hlimit;
 }
 
+/* Sets '*src' and '*dst' to 'new_src' and 'new_dst', updating '*csum', if it
+ * is nonnull, for both changes at once. */
 static void
-packet_set_port(ovs_be16 *port, ovs_be16 new_port, ovs_be16 *csum)
+packet_set_ports(ovs_be16 *src, ovs_be16 *dst, ovs_be16 new_src,
+                 ovs_be16 new_dst, ovs_be16 *csum)
 {
-    if (*port != new_port) {
-        *csum = recalc_csum16(*csum, *port, new_port);
-        *port = new_port;
+    if (csum) {
+        uint32_t delta;
+
+        delta = csum_delta16(0, *src, new_src);
+        delta = csum_delta16(delta, *dst, new_dst);
+        *csum = recalc_csum_delta(*csum, delta);
     }
+    *src = new_src;
+    *dst = new_dst;
 }
 
 /* Sets the TCP source and destination port ('src' and 'dst' respectively) of
@@ -511,8 +556,7 @@ packet_set_tcp_port(struct ofpbuf *packet, ovs_be16 src, ovs_be16 dst)
 {
     struct tcp_header *th = packet->l4;
 
-    packet_set_port(&th->tcp_src, src, &th->tcp_csum);
-    packet_set_port(&th->tcp_dst, dst, &th->tcp_csum);
+    packet_set_ports(&th->tcp_src, &th->tcp_dst, src, dst, &th->tcp_csum);
 }
 
 /* Sets the UDP source and destination port ('src' and 'dst' respectively) of
@@ -524,15 +568,12 @@ packet_set_udp_port(struct ofpbuf *packet, ovs_be16 src, ovs_be16 dst)
     struct udp_header *uh = packet->l4;
 
     if (uh->udp_csum) {
-        packet_set_port(&uh->udp_src, src, &uh->udp_csum);
-        packet_set_port(&uh->udp_dst, dst, &uh->udp_csum);
-
+        packet_set_ports(&uh->udp_src, &uh->udp_dst, src, dst, &uh->udp_csum);
         if (!uh->udp_csum) {
             uh->udp_csum = htons(0xffff);
         }
     } else {
-        uh->udp_src = src;
-        uh->udp_dst = dst;
+        packet_set_ports(&uh->udp_src, &uh->udp_dst, src, dst, NULL);
     }
 }
 
@@ -60,7 +60,7 @@ pcap_open(const char *file_name, const char *mode)
     }
 
     if (mode[0] == 'r') {
-        if (!pcap_read_header(file)) {
+        if (pcap_read_header(file)) {
             fclose(file);
             return NULL;
         }
@@ -116,8 +116,10 @@ pcap_read(FILE *file, struct ofpbuf **bufp)
     /* Read header. */
     if (fread(&prh, sizeof prh, 1, file) != 1) {
         int error = ferror(file) ? errno : EOF;
-        VLOG_WARN("failed to read pcap record header: %s",
-                  ovs_retval_to_string(error));
+        if (error != EOF) {
+            VLOG_WARN("failed to read pcap record header: %s",
+                      ovs_retval_to_string(error));
+        }
         return error;
     }
 
@@ -581,7 +581,7 @@ rconn_send(struct rconn *rc, struct ofpbuf *b,
         copy_to_monitor(rc, b);
         b->private_p = counter;
         if (counter) {
-            rconn_packet_counter_inc(counter);
+            rconn_packet_counter_inc(counter, b->size);
         }
         list_push_back(&rc->txq, &b->list_node);
 
@@ -868,6 +868,7 @@ rconn_packet_counter_create(void)
 {
     struct rconn_packet_counter *c = xmalloc(sizeof *c);
     c->n = 0;
+    c->n_bytes = 0;
     c->ref_cnt = 1;
     return c;
 }
@@ -884,15 +885,19 @@ rconn_packet_counter_destroy(struct rconn_packet_counter *c)
 }
 
 void
-rconn_packet_counter_inc(struct rconn_packet_counter *c)
+rconn_packet_counter_inc(struct rconn_packet_counter *c, unsigned int n_bytes)
 {
     c->n++;
+    c->n_bytes += n_bytes;
 }
 
 void
-rconn_packet_counter_dec(struct rconn_packet_counter *c)
+rconn_packet_counter_dec(struct rconn_packet_counter *c, unsigned int n_bytes)
 {
     assert(c->n > 0);
+    assert(c->n_bytes >= n_bytes);
+
+    c->n_bytes -= n_bytes;
     if (!--c->n && !c->ref_cnt) {
         free(c);
     }
@@ -922,6 +927,7 @@ try_send(struct rconn *rc)
 {
     struct ofpbuf *msg = ofpbuf_from_list(rc->txq.next);
     struct rconn_packet_counter *counter = msg->private_p;
+    size_t n_bytes = msg->size;
     int retval;
 
     /* Eagerly remove 'msg' from the txq.  We can't remove it from the list
@@ -941,7 +947,7 @@ try_send(struct rconn *rc)
     COVERAGE_INC(rconn_sent);
     rc->packets_sent++;
     if (counter) {
-        rconn_packet_counter_dec(counter);
+        rconn_packet_counter_dec(counter, n_bytes);
     }
     return 0;
 }
@@ -1021,7 +1027,7 @@ flush_queue(struct rconn *rc)
         struct ofpbuf *b = ofpbuf_from_list(list_pop_front(&rc->txq));
         struct rconn_packet_counter *counter = b->private_p;
         if (counter) {
-            rconn_packet_counter_dec(counter);
+            rconn_packet_counter_dec(counter, b->size);
         }
         COVERAGE_INC(rconn_discarded);
         ofpbuf_delete(b);
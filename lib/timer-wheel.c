@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2012 Nicira, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <config.h>
+#include "timer-wheel.h"
+#include "util.h"
+
+#define TW_MASK (TW_SLOTS - 1)
+
+/* Initializes 'tw' as an empty timer wheel whose next tick to process is
+ * 'now'. */
+void
+timer_wheel_init(struct timer_wheel *tw, long long int now)
+{
+    int level, slot;
+
+    for (level = 0; level < TW_LEVELS; level++) {
+        for (slot = 0; slot < TW_SLOTS; slot++) {
+            list_init(&tw->slots[level][slot]);
+        }
+    }
+    list_init(&tw->overflow);
+    tw->next = now;
+    tw->n = 0;
+}
+
+/* Puts 'node' into the slot appropriate for its deadline, without updating
+ * 'tw->n'. */
+static void
+timer_wheel_place(struct timer_wheel *tw, struct timer_wheel_node *node)
+{
+    long long int when = MAX(node->when, tw->next);
+    long long int delta = when - tw->next;
+    int level;
+
+    for (level = 0; level < TW_LEVELS; level++) {
+        if (delta < 1LL << (TW_BITS * (level + 1))) {
+            int slot = (when >> (TW_BITS * level)) & TW_MASK;
+            list_push_back(&tw->slots[level][slot], &node->list_node);
+            return;
+        }
+    }
+    list_push_back(&tw->overflow, &node->list_node);
+}
+
+/* Inserts 'node' into 'tw' with deadline 'when', in ticks.  A deadline that
+ * has already passed becomes due at the next tick that 'tw' processes. */
+void
+timer_wheel_insert(struct timer_wheel *tw, struct timer_wheel_node *node,
+                   long long int when)
+{
+    node->when = when;
+    timer_wheel_place(tw, node);
+    tw->n++;
+}
+
+/* Removes 'node' from 'tw'.  'node' must be in 'tw', that is, it must not
+ * have been passed to the caller by timer_wheel_advance(). */
+void
+timer_wheel_remove(struct timer_wheel *tw, struct timer_wheel_node *node)
+{
+    list_remove(&node->list_node);
+    tw->n--;
+}
+
+/* Redistributes all of the nodes in 'list', which belongs to 'tw', according
+ * to their deadlines. */
+static void
+timer_wheel_cascade(struct timer_wheel *tw, struct list *list)
+{
+    struct list nodes;
+
+    if (list_is_empty(list)) {
+        return;
+    }
+
+    list_init(&nodes);
+    list_splice(&nodes, list->next, list);
+    while (!list_is_empty(&nodes)) {
+        struct timer_wheel_node *node;
+
+        node = CONTAINER_OF(list_pop_front(&nodes),
+                            struct timer_wheel_node, list_node);
+        timer_wheel_place(tw, node);
+    }
+}
+
+/* Processes each tick in 'tw' up to and including 'now', removing each node
+ * whose deadline is at or before 'now' and appending it to 'expired' through
+ * its 'list_node'. */
+void
+timer_wheel_advance(struct timer_wheel *tw, long long int now,
+                    struct list *expired)
+{
+    while (tw->next <= now) {
+        long long int tick = tw->next;
+        struct list *slot;
+        int level;
+
+        if (!tw->n) {
+            tw->next = now + 1;
+            break;
+        }
+
+        /* At each boundary of a higher level slot, move that slot's nodes
+         * down to lower levels. */
+        for (level = 1; level < TW_LEVELS; level++) {
+            long long int index = tick >> (TW_BITS * level);
+
+            if ((index << (TW_BITS * level)) != tick) {
+                break;
+            }
+            timer_wheel_cascade(tw, &tw->slots[level][index & TW_MASK]);
+        }
+        if (level == TW_LEVELS && !(tick & ((1LL << (TW_BITS * level)) - 1))) {
+            timer_wheel_cascade(tw, &tw->overflow);
+        }
+
+        slot = &tw->slots[0][tick & TW_MASK];
+        while (!list_is_empty(slot)) {
+            list_push_back(expired, list_pop_front(slot));
+            tw->n--;
+        }
+        tw->next++;
+    }
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2012 Nicira, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "list.h"
+
+/* Hierarchical timing wheel.
+ *
+ * A timer wheel tracks a large number of deadlines, each an integer number of
+ * "ticks" (whose length is up to the client), and reports the ones that have
+ * passed.  Insertion and removal take O(1) time and advancing the wheel takes
+ * time proportional to the number of ticks that have passed plus the number
+ * of deadlines that fall due, regardless of the number of deadlines that do
+ * not.
+ *
+ * The wheel has TW_LEVELS levels of TW_SLOTS slots each.  A deadline less than
+ * TW_SLOTS ticks away goes in a level 0 slot, one less than TW_SLOTS**2 ticks
+ * away in a level 1 slot, and so on.  As time passes, the deadlines in a
+ * higher level slot are redistributed to lower levels.  Deadlines too far
+ * away for the highest level wait on an overflow list. */
+
+#define TW_BITS 6
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_LEVELS 3
+
+/* A timer wheel node, to be embedded inside the data structure that has a
+ * deadline. */
+struct timer_wheel_node {
+    struct list list_node;      /* In a slot or in the caller's list. */
+    long long int when;         /* Deadline, in ticks. */
+};
+
+struct timer_wheel {
+    struct list slots[TW_LEVELS][TW_SLOTS];
+    struct list overflow;       /* Deadlines beyond the highest level. */
+    long long int next;         /* Next tick to process. */
+    size_t n;                   /* Number of nodes in the wheel. */
+};
+
+void timer_wheel_init(struct timer_wheel *, long long int now);
+
+void timer_wheel_insert(struct timer_wheel *, struct timer_wheel_node *,
+                        long long int when);
+void timer_wheel_remove(struct timer_wheel *, struct timer_wheel_node *);
+
+void timer_wheel_advance(struct timer_wheel *, long long int now,
+                         struct list *expired);
+
+/* Returns the number of nodes in 'tw'. */
+static inline size_t
+timer_wheel_count(const struct timer_wheel *tw)
+{
+    return tw->n;
+}
+
+/* Returns true if 'tw' contains no nodes. */
+static inline bool
+timer_wheel_is_empty(const struct timer_wheel *tw)
+{
+    return !tw->n;
+}
+
+#endif /* timer-wheel.h */
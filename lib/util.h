@@ -220,6 +220,19 @@ void ignore(bool x OVS_UNUSED);
 int log_2_floor(uint32_t);
 int log_2_ceil(uint32_t);
 int ctz(uint32_t);
+int popcount(uint32_t);
+
+/* Returns the number of trailing 0-bits in 'n'.  Undefined if 'n' == 0.
+ * Unlike ctz(), this is inline, for use in inner loops. */
+#if __GNUC__ >= 4
+static inline int
+raw_ctz(uint32_t n)
+{
+    return __builtin_ctz(n);
+}
+#else
+#define raw_ctz(N) ctz(N)
+#endif
 
 bool is_all_zeros(const uint8_t *, size_t);
 bool is_all_ones(const uint8_t *, size_t);
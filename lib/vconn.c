@@ -712,34 +712,44 @@ vconn_transact(struct vconn *vconn, struct ofpbuf *request,
     return error ? error : vconn_recv_xid(vconn, send_xid, replyp);
 }
 
-/* Sends 'request' followed by a barrier request to 'vconn', then blocks until
- * it receives a reply to the barrier.  If successful, stores the reply to
- * 'request' in '*replyp', if one was received, and otherwise NULL, then
- * returns 0.  Otherwise returns a positive errno value, or EOF, and sets
+/* Maximum number of requests that vconn_transact_multiple_noreply() sends
+ * ahead of each barrier request. */
+#define VCONN_TRANSACT_WINDOW 1024
+
+/* Sends the first 'n' requests in 'requests' to 'vconn', removing them from
+ * the list, followed by a barrier request, then blocks until it receives a
+ * reply to the barrier.  If successful, stores the first reply received to
+ * any of the requests in '*replyp', if one was received, and otherwise NULL,
+ * then returns 0.  Otherwise returns a positive errno value, or EOF, and sets
  * '*replyp' to null.
  *
- * This function is useful for sending an OpenFlow request that doesn't
- * ordinarily include a reply but might report an error in special
- * circumstances.
- *
- * 'request' is always destroyed, regardless of the return value. */
-int
-vconn_transact_noreply(struct vconn *vconn, struct ofpbuf *request,
-                       struct ofpbuf **replyp)
+ * The 'n' requests are always destroyed, regardless of the return value. */
+static int
+vconn_transact_noreply__(struct vconn *vconn, struct list *requests, size_t n,
+                         struct ofpbuf **replyp)
 {
-    ovs_be32 request_xid;
+    ovs_be32 *xids;
     ovs_be32 barrier_xid;
     struct ofpbuf *barrier;
+    size_t i;
     int error;
 
     *replyp = NULL;
 
-    /* Send request. */
-    request_xid = ((struct ofp_header *) request->data)->xid;
-    error = vconn_send_block(vconn, request);
-    if (error) {
-        ofpbuf_delete(request);
-        return error;
+    /* Send requests. */
+    xids = xmalloc(n * sizeof *xids);
+    for (i = 0; i < n; i++) {
+        struct ofpbuf *request = ofpbuf_from_list(list_pop_front(requests));
+
+        xids[i] = ((struct ofp_header *) request->data)->xid;
+        error = vconn_send_block(vconn, request);
+        if (error) {
+            ofpbuf_delete(request);
+            for (i++; i < n; i++) {
+                ofpbuf_delete(ofpbuf_from_list(list_pop_front(requests)));
+            }
+            goto exit;
+        }
     }
 
     /* Send barrier. */
@@ -748,65 +758,110 @@ vconn_transact_noreply(struct vconn *vconn, struct ofpbuf *request,
     error = vconn_send_block(vconn, barrier);
     if (error) {
         ofpbuf_delete(barrier);
-        return error;
+        goto exit;
     }
 
     for (;;) {
         struct ofpbuf *msg;
         ovs_be32 msg_xid;
-        int error;
 
         error = vconn_recv_block(vconn, &msg);
         if (error) {
             ofpbuf_delete(*replyp);
             *replyp = NULL;
-            return error;
+            goto exit;
         }
 
         msg_xid = ((struct ofp_header *) msg->data)->xid;
-        if (msg_xid == request_xid) {
-            if (*replyp) {
+        if (msg_xid == barrier_xid) {
+            ofpbuf_delete(msg);
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            if (msg_xid == xids[i]) {
+                break;
+            }
+        }
+        if (i >= n) {
+            VLOG_DBG_RL(&bad_ofmsg_rl, "%s: reply with xid %08"PRIx32
+                        " != expected %08"PRIx32" or barrier %08"PRIx32,
+                        vconn->name, ntohl(msg_xid),
+                        ntohl(xids[0]), ntohl(barrier_xid));
+            ofpbuf_delete(msg);
+        } else if (*replyp) {
+            /* Only the first reply is reported. */
+            if (msg_xid == ((struct ofp_header *) (*replyp)->data)->xid) {
                 VLOG_WARN_RL(&bad_ofmsg_rl, "%s: duplicate replies with "
                              "xid %08"PRIx32, vconn->name, ntohl(msg_xid));
-                ofpbuf_delete(*replyp);
             }
-            *replyp = msg;
-        } else {
             ofpbuf_delete(msg);
-            if (msg_xid == barrier_xid) {
-                return 0;
-            } else {
-                VLOG_DBG_RL(&bad_ofmsg_rl, "%s: reply with xid %08"PRIx32
-                            " != expected %08"PRIx32" or %08"PRIx32,
-                            vconn->name, ntohl(msg_xid),
-                            ntohl(request_xid), ntohl(barrier_xid));
-            }
+        } else {
+            *replyp = msg;
         }
     }
+
+exit:
+    free(xids);
+    return error;
+}
+
+/* Sends 'request' followed by a barrier request to 'vconn', then blocks until
+ * it receives a reply to the barrier.  If successful, stores the reply to
+ * 'request' in '*replyp', if one was received, and otherwise NULL, then
+ * returns 0.  Otherwise returns a positive errno value, or EOF, and sets
+ * '*replyp' to null.
+ *
+ * This function is useful for sending an OpenFlow request that doesn't
+ * ordinarily include a reply but might report an error in special
+ * circumstances.
+ *
+ * 'request' is always destroyed, regardless of the return value. */
+int
+vconn_transact_noreply(struct vconn *vconn, struct ofpbuf *request,
+                       struct ofpbuf **replyp)
+{
+    struct list requests;
+
+    list_init(&requests);
+    list_push_back(&requests, &request->list_node);
+    return vconn_transact_noreply__(vconn, &requests, 1, replyp);
 }
 
-/* vconn_transact_noreply() for a list of "struct ofpbuf"s, sent one by one.
+/* vconn_transact_noreply() for a list of "struct ofpbuf"s.
+ *
+ * Rather than waiting for a barrier reply after each request, this sends up
+ * to VCONN_TRANSACT_WINDOW requests back-to-back followed by one barrier
+ * request, so that a long list of requests costs a round trip per window
+ * instead of per request.  If any request in a window fails, this stops after
+ * that window and stores the first error reply in '*replyp', so requests that
+ * follow the failed one within its window may still have taken effect.
+ *
  * All of the requests on 'requests' are always destroyed, regardless of the
  * return value. */
 int
 vconn_transact_multiple_noreply(struct vconn *vconn, struct list *requests,
                                 struct ofpbuf **replyp)
 {
-    struct ofpbuf *request, *next;
-
-    LIST_FOR_EACH_SAFE (request, next, list_node, requests) {
+    *replyp = NULL;
+    while (!list_is_empty(requests)) {
+        struct list *node;
+        size_t n;
         int error;
 
-        list_remove(&request->list_node);
+        n = 0;
+        for (node = requests->next; node != requests; node = node->next) {
+            if (++n >= VCONN_TRANSACT_WINDOW) {
+                break;
+            }
+        }
 
-        error = vconn_transact_noreply(vconn, request, replyp);
+        error = vconn_transact_noreply__(vconn, requests, n, replyp);
         if (error || *replyp) {
             ofpbuf_list_delete(requests);
             return error;
         }
     }
-
-    *replyp = NULL;
     return 0;
 }
 
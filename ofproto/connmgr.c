@@ -22,6 +22,7 @@
 #include <stdlib.h>
 
 #include "coverage.h"
+#include "dynamic-string.h"
 #include "fail-open.h"
 #include "in-band.h"
 #include "odp-util.h"
@@ -42,6 +43,47 @@
 VLOG_DEFINE_THIS_MODULE(connmgr);
 static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(1, 5);
 
+COVERAGE_DEFINE(ofconn_packet_in_dropped);
+
+/* Priority classes for messages sent on an ofconn, highest priority first.
+ * Messages within a class are sent in order, but a message in a higher
+ * priority class may be sent ahead of messages queued earlier in lower
+ * priority classes. */
+enum ofconn_queue_class {
+    OFCONN_Q_ECHO,              /* Echo replies. */
+    OFCONN_Q_REPLY,             /* Other replies, including barrier replies. */
+    OFCONN_Q_ASYNC,             /* Asynchronous messages, e.g. packet-ins. */
+    OFCONN_N_QUEUES
+};
+
+/* Messages of one class waiting to be passed to an ofconn's rconn. */
+struct ofconn_queue {
+    struct list msgs;           /* Contains "struct ofpbuf"s. */
+    unsigned int n_bytes;       /* Total size of the messages in 'msgs'. */
+    struct rconn_packet_counter *counter; /* Passed to 'rconn', not yet sent. */
+
+    /* Statistics, which persist from one connection to the next. */
+    unsigned long long int n_sent;    /* Messages passed to 'rconn'. */
+    unsigned long long int n_dropped; /* Messages dropped for lack of room. */
+};
+
+/* Maximum number of bytes that an ofconn passes along to its rconn before
+ * waiting for the rconn to send some of them.  Messages beyond this stay in
+ * the ofconn's queues, where higher priority messages can pass them. */
+#define OFCONN_TXQ_WINDOW (64 * 1024)
+
+/* Maximum number of bytes of replies queued on an ofconn before the connmgr
+ * stops accepting new OpenFlow requests on it. */
+#define OFCONN_REPLY_MAX_BYTES (1024 * 1024)
+
+/* Maximum number of bytes of asynchronous messages queued on an ofconn
+ * before the connmgr starts dropping packet-ins. */
+#define OFCONN_ASYNC_MAX_BYTES (256 * 1024)
+
+/* Maximum number of bytes of OpenFlow requests held behind a postponed
+ * request on an ofconn before the connmgr stops reading from it. */
+#define OFCONN_BLOCKED_MAX_BYTES (1024 * 1024)
+
 /* An OpenFlow connection. */
 struct ofconn {
 /* Configuration that persists from one connection to the next. */
@@ -64,23 +106,24 @@ struct ofconn {
 
     /* Asynchronous flow table operation support. */
     struct list opgroups;       /* Contains pending "ofopgroups", if any. */
-    struct ofpbuf *blocked;     /* Postponed OpenFlow message, if any. */
+    struct list blocked;        /* Postponed message and those behind it. */
+    size_t n_blocked_bytes;     /* Total size of the messages in 'blocked'. */
     bool retry;                 /* True if 'blocked' is ready to try again. */
 
+    /* Statistics requests whose replies are still being produced. */
+    struct list dumps;          /* Contains in-progress "flow_dumps", if any. */
+
+    /* Output queues.  OFCONN_REPLY_MAX_BYTES and OFCONN_ASYNC_MAX_BYTES limit
+     * the size of the OFCONN_Q_REPLY and OFCONN_Q_ASYNC queues, counting
+     * messages that have been passed to 'rconn' but not yet sent. */
+    struct ofconn_queue queues[OFCONN_N_QUEUES];
+
     /* OFPT_PACKET_IN related data. */
-    struct rconn_packet_counter *packet_in_counter; /* # queued on 'rconn'. */
-#define N_SCHEDULERS 2
-    struct pinsched *schedulers[N_SCHEDULERS];
+    struct pinsched *pinsched;     /* Packet-in scheduler, if rate limited. */
     struct pktbuf *pktbuf;         /* OpenFlow packet buffers. */
     int miss_send_len;             /* Bytes to send of buffered packets. */
     uint16_t controller_id;     /* Connection controller ID. */
 
-    /* Number of OpenFlow messages queued on 'rconn' as replies to OpenFlow
-     * requests, and the maximum number before we stop reading OpenFlow
-     * requests.  */
-#define OFCONN_REPLY_MAX 100
-    struct rconn_packet_counter *reply_counter;
-
     /* Asynchronous message configuration in each possible roles.
      *
      * A 1-bit enables sending an asynchronous message for one possible reason
@@ -105,10 +148,16 @@ static void ofconn_wait(struct ofconn *, bool handling_openflow);
 static const char *ofconn_get_target(const struct ofconn *);
 static char *ofconn_make_name(const struct connmgr *, const char *target);
 
-static void ofconn_set_rate_limit(struct ofconn *, int rate, int burst);
+static void ofconn_set_rate_limit(struct ofconn *, int rate, int burst,
+                                  int queue_depth,
+                                  const struct pinsched_weight *, size_t n);
 
-static void ofconn_send(const struct ofconn *, struct ofpbuf *,
-                        struct rconn_packet_counter *);
+static void ofconn_send(struct ofconn *, struct ofpbuf *,
+                        enum ofconn_queue_class);
+static unsigned int ofconn_queue_n_bytes(const struct ofconn *,
+                                         enum ofconn_queue_class);
+static bool ofconn_may_push(const struct ofconn *);
+static void ofconn_push_queues(struct ofconn *);
 
 static void do_send_packet_in(struct ofpbuf *, void *ofconn_);
 
@@ -122,6 +171,9 @@ struct ofservice {
     int probe_interval;         /* Max idle time before probing, in seconds. */
     int rate_limit;             /* Max packet-in rate in packets per second. */
     int burst_limit;            /* Limit on accumulating packet credits. */
+    int packet_in_queue_depth;  /* Max packets queued per packet-in class. */
+    struct pinsched_weight *pin_weights; /* Weights for packet-in classes. */
+    size_t n_pin_weights;
     bool enable_async_msgs;     /* Initially enable async messages? */
     uint8_t dscp;               /* DSCP Value for controller connection */
 };
@@ -242,8 +294,10 @@ connmgr_destroy(struct connmgr *mgr)
  * the message is considered to be fully processed.  If 'handle_openflow'
  * returns false, the message is considered not to have been processed at all;
  * it will be stored and re-presented to 'handle_openflow' following the next
- * call to connmgr_retry().  'handle_openflow' must not modify or free the
- * message.
+ * call to connmgr_retry().  Messages received on the same connection in the
+ * meantime are stored behind it, in order, except that echo requests are
+ * passed along at once, so that the connection stays alive.
+ * 'handle_openflow' must not modify or free the message.
  *
  * If 'handle_openflow' is NULL, no OpenFlow messages will be processed and
  * other activities that could affect the flow table (in-band processing,
@@ -291,7 +345,10 @@ connmgr_run(struct connmgr *mgr,
             ofconn = ofconn_create(mgr, rconn, OFCONN_SERVICE,
                                    ofservice->enable_async_msgs);
             ofconn_set_rate_limit(ofconn, ofservice->rate_limit,
-                                  ofservice->burst_limit);
+                                  ofservice->burst_limit,
+                                  ofservice->packet_in_queue_depth,
+                                  ofservice->pin_weights,
+                                  ofservice->n_pin_weights);
         } else if (retval != EAGAIN) {
             VLOG_WARN_RL(&rl, "accept failed (%s)", strerror(retval));
         }
@@ -354,15 +411,41 @@ connmgr_get_memory_usage(const struct connmgr *mgr, struct simap *usage)
         ofconns++;
 
         packets += rconn_count_txqlen(ofconn->rconn);
-        for (i = 0; i < N_SCHEDULERS; i++) {
-            packets += pinsched_count_txqlen(ofconn->schedulers[i]);
+        for (i = 0; i < OFCONN_N_QUEUES; i++) {
+            packets += list_size(&ofconn->queues[i].msgs);
         }
+        packets += pinsched_count_txqlen(ofconn->pinsched);
         packets += pktbuf_count_packets(ofconn->pktbuf);
     }
     simap_increase(usage, "ofconns", ofconns);
     simap_increase(usage, "packets", packets);
 }
 
+/* Appends to 'ds' a description of the packet-in scheduler and the packet
+ * buffers of each OpenFlow connection in 'mgr' that has either one. */
+void
+connmgr_format_packet_in_stats(const struct connmgr *mgr, struct ds *ds)
+{
+    const struct ofconn *ofconn;
+
+    LIST_FOR_EACH (ofconn, node, &mgr->all_conns) {
+        if (!ofconn->pinsched && !ofconn->pktbuf) {
+            continue;
+        }
+
+        ds_put_format(ds, "%s: ", rconn_get_name(ofconn->rconn));
+        if (ofconn->pinsched) {
+            pinsched_format_stats(ofconn->pinsched, ds);
+        } else {
+            ds_put_cstr(ds, "not rate limited\n");
+        }
+        if (ofconn->pktbuf) {
+            ds_put_cstr(ds, "  buffers: ");
+            pktbuf_format_stats(ofconn->pktbuf, ds);
+        }
+    }
+}
+
 /* Returns the ofproto that owns 'ofconn''s connmgr. */
 struct ofproto *
 ofconn_get_ofproto(const struct ofconn *ofconn)
@@ -452,6 +535,19 @@ connmgr_get_controller_info(struct connmgr *mgr, struct shash *info)
                 cinfo->pairs.values[cinfo->pairs.n++]
                     = xasprintf("%ld", (long int) (now - last_disconnect));
             }
+
+            cinfo->pairs.keys[cinfo->pairs.n] = "queued_bytes";
+            cinfo->pairs.values[cinfo->pairs.n++]
+                = xasprintf("%u", (ofconn_queue_n_bytes(ofconn, OFCONN_Q_ECHO)
+                                   + ofconn_queue_n_bytes(ofconn,
+                                                          OFCONN_Q_REPLY)
+                                   + ofconn_queue_n_bytes(ofconn,
+                                                          OFCONN_Q_ASYNC)));
+
+            cinfo->pairs.keys[cinfo->pairs.n] = "dropped_packet_ins";
+            cinfo->pairs.values[cinfo->pairs.n++]
+                = xasprintf("%llu",
+                            ofconn->queues[OFCONN_Q_ASYNC].n_dropped);
         }
     }
 }
@@ -601,7 +697,7 @@ add_controller(struct connmgr *mgr, const char *target, uint8_t dscp)
     struct ofconn *ofconn;
 
     ofconn = ofconn_create(mgr, rconn_create(5, 8, dscp), OFCONN_PRIMARY, true);
-    ofconn->pktbuf = pktbuf_create();
+    ofconn->pktbuf = pktbuf_create(PKTBUF_DEFAULT_CNT);
     rconn_connect(ofconn->rconn, target, name);
     hmap_insert(&mgr->controllers, &ofconn->hmap_node, hash_string(target, 0));
 
@@ -894,19 +990,27 @@ ofconn_set_async_config(struct ofconn *ofconn,
 }
 
 /* Sends 'msg' on 'ofconn', accounting it as a reply.  (If there is a
- * sufficient number of OpenFlow replies in-flight on a single ofconn, then the
- * connmgr will stop accepting new OpenFlow requests on that ofconn until the
- * controller has accepted some of the replies.) */
+ * sufficient number of bytes of OpenFlow replies in-flight on a single ofconn,
+ * then the connmgr will stop accepting new OpenFlow requests on that ofconn
+ * until the controller has accepted some of the replies.)
+ *
+ * Echo replies are sent ahead of any other queued messages and do not count
+ * toward that limit, so that a backlog does not make the controller think
+ * that the switch is dead. */
 void
-ofconn_send_reply(const struct ofconn *ofconn, struct ofpbuf *msg)
+ofconn_send_reply(struct ofconn *ofconn, struct ofpbuf *msg)
 {
-    ofconn_send(ofconn, msg, ofconn->reply_counter);
+    const struct ofp_header *oh = msg->data;
+
+    ofconn_send(ofconn, msg, (oh->type == OFPT_ECHO_REPLY
+                              ? OFCONN_Q_ECHO
+                              : OFCONN_Q_REPLY));
 }
 
 /* Sends each of the messages in list 'replies' on 'ofconn' in order,
  * accounting them as replies. */
 void
-ofconn_send_replies(const struct ofconn *ofconn, struct list *replies)
+ofconn_send_replies(struct ofconn *ofconn, struct list *replies)
 {
     struct ofpbuf *reply, *next;
 
@@ -916,10 +1020,19 @@ ofconn_send_replies(const struct ofconn *ofconn, struct list *replies)
     }
 }
 
+/* Returns true if 'ofconn' has room to queue more replies to a request whose
+ * replies are produced a few at a time, that is, if fewer than
+ * OFCONN_TXQ_WINDOW bytes of replies are waiting to be sent on it. */
+bool
+ofconn_has_reply_room(const struct ofconn *ofconn)
+{
+    return ofconn_queue_n_bytes(ofconn, OFCONN_Q_REPLY) < OFCONN_TXQ_WINDOW;
+}
+
 /* Sends 'error' on 'ofconn', as a reply to 'request'.  Only at most the
  * first 64 bytes of 'request' are used. */
 void
-ofconn_send_error(const struct ofconn *ofconn,
+ofconn_send_error(struct ofconn *ofconn,
                   const struct ofp_header *request, enum ofperr error)
 {
     struct ofpbuf *reply;
@@ -948,6 +1061,14 @@ ofconn_send_error(const struct ofconn *ofconn,
     }
 }
 
+/* Returns the number of packets that 'ofconn' can buffer, for reporting to the
+ * controller. */
+int
+ofconn_get_n_buffers(const struct ofconn *ofconn)
+{
+    return pktbuf_capacity(ofconn->pktbuf);
+}
+
 /* Same as pktbuf_retrieve(), using the pktbuf owned by 'ofconn'. */
 enum ofperr
 ofconn_pktbuf_retrieve(struct ofconn *ofconn, uint32_t id,
@@ -978,6 +1099,24 @@ ofconn_add_opgroup(struct ofconn *ofconn, struct list *ofconn_node)
     list_push_back(&ofconn->opgroups, ofconn_node);
 }
 
+/* Returns true if 'ofconn' has any statistics requests in progress. */
+bool
+ofconn_has_pending_dumps(const struct ofconn *ofconn)
+{
+    return !list_is_empty(&ofconn->dumps);
+}
+
+/* Adds 'ofconn_node' to 'ofconn''s list of statistics requests in progress.
+ *
+ * If 'ofconn' is destroyed or its connection drops, then 'ofconn' will remove
+ * 'ofconn_node' from the list and re-initialize it with list_init(), as with
+ * ofconn_add_opgroup(). */
+void
+ofconn_add_dump(struct ofconn *ofconn, struct list *ofconn_node)
+{
+    list_push_back(&ofconn->dumps, ofconn_node);
+}
+
 /* Private ofconn functions. */
 
 static const char *
@@ -991,6 +1130,7 @@ ofconn_create(struct connmgr *mgr, struct rconn *rconn, enum ofconn_type type,
               bool enable_async_msgs)
 {
     struct ofconn *ofconn;
+    int i;
 
     ofconn = xzalloc(sizeof *ofconn);
     ofconn->connmgr = mgr;
@@ -1000,6 +1140,11 @@ ofconn_create(struct connmgr *mgr, struct rconn *rconn, enum ofconn_type type,
     ofconn->enable_async_msgs = enable_async_msgs;
 
     list_init(&ofconn->opgroups);
+    list_init(&ofconn->dumps);
+    list_init(&ofconn->blocked);
+    for (i = 0; i < OFCONN_N_QUEUES; i++) {
+        list_init(&ofconn->queues[i].msgs);
+    }
 
     ofconn_flush(ofconn);
 
@@ -1022,36 +1167,36 @@ ofconn_flush(struct ofconn *ofconn)
      * in the usual way, but any errors that they run into will not be reported
      * on any OpenFlow channel.)
      *
-     * Also discard any blocked operation on 'ofconn'. */
+     * Also discard any blocked operations on 'ofconn'. */
     while (!list_is_empty(&ofconn->opgroups)) {
         list_init(list_pop_front(&ofconn->opgroups));
     }
-    ofpbuf_delete(ofconn->blocked);
-    ofconn->blocked = NULL;
 
-    rconn_packet_counter_destroy(ofconn->packet_in_counter);
-    ofconn->packet_in_counter = rconn_packet_counter_create();
-    for (i = 0; i < N_SCHEDULERS; i++) {
-        if (ofconn->schedulers[i]) {
-            int rate, burst;
+    /* Likewise, disassociate 'ofconn' from statistics requests that are still
+     * in progress, so that their owners stop producing replies for them. */
+    while (!list_is_empty(&ofconn->dumps)) {
+        list_init(list_pop_front(&ofconn->dumps));
+    }
+    ofpbuf_list_delete(&ofconn->blocked);
+    ofconn->n_blocked_bytes = 0;
 
-            pinsched_get_limits(ofconn->schedulers[i], &rate, &burst);
-            pinsched_destroy(ofconn->schedulers[i]);
-            ofconn->schedulers[i] = pinsched_create(rate, burst);
-        }
+    for (i = 0; i < OFCONN_N_QUEUES; i++) {
+        struct ofconn_queue *q = &ofconn->queues[i];
+
+        ofpbuf_list_delete(&q->msgs);
+        q->n_bytes = 0;
+        rconn_packet_counter_destroy(q->counter);
+        q->counter = rconn_packet_counter_create();
     }
+    pinsched_flush(ofconn->pinsched);
     if (ofconn->pktbuf) {
-        pktbuf_destroy(ofconn->pktbuf);
-        ofconn->pktbuf = pktbuf_create();
+        pktbuf_flush(ofconn->pktbuf);
     }
     ofconn->miss_send_len = (ofconn->type == OFCONN_PRIMARY
                              ? OFP_DEFAULT_MISS_SEND_LEN
                              : 0);
     ofconn->controller_id = 0;
 
-    rconn_packet_counter_destroy(ofconn->reply_counter);
-    ofconn->reply_counter = rconn_packet_counter_create();
-
     if (ofconn->enable_async_msgs) {
         uint32_t *master = ofconn->master_async_config;
         uint32_t *slave = ofconn->slave_async_config;
@@ -1084,6 +1229,8 @@ ofconn_flush(struct ofconn *ofconn)
 static void
 ofconn_destroy(struct ofconn *ofconn)
 {
+    int i;
+
     ofconn_flush(ofconn);
 
     if (ofconn->type == OFCONN_PRIMARY) {
@@ -1092,8 +1239,10 @@ ofconn_destroy(struct ofconn *ofconn)
 
     list_remove(&ofconn->node);
     rconn_destroy(ofconn->rconn);
-    rconn_packet_counter_destroy(ofconn->packet_in_counter);
-    rconn_packet_counter_destroy(ofconn->reply_counter);
+    for (i = 0; i < OFCONN_N_QUEUES; i++) {
+        rconn_packet_counter_destroy(ofconn->queues[i].counter);
+    }
+    pinsched_destroy(ofconn->pinsched);
     pktbuf_destroy(ofconn->pktbuf);
     free(ofconn);
 }
@@ -1113,7 +1262,16 @@ ofconn_reconfigure(struct ofconn *ofconn, const struct ofproto_controller *c)
     probe_interval = c->probe_interval ? MAX(c->probe_interval, 5) : 0;
     rconn_set_probe_interval(ofconn->rconn, probe_interval);
 
-    ofconn_set_rate_limit(ofconn, c->rate_limit, c->burst_limit);
+    ofconn_set_rate_limit(ofconn, c->rate_limit, c->burst_limit,
+                          c->packet_in_queue_depth,
+                          c->pin_weights, c->n_pin_weights);
+
+    if (ofconn->pktbuf) {
+        pktbuf_set_capacity(ofconn->pktbuf,
+                            (c->n_packet_buffers
+                             ? c->n_packet_buffers
+                             : PKTBUF_DEFAULT_CNT));
+    }
 }
 
 /* Returns true if it makes sense for 'ofconn' to receive and process OpenFlow
@@ -1121,8 +1279,31 @@ ofconn_reconfigure(struct ofconn *ofconn, const struct ofproto_controller *c)
 static bool
 ofconn_may_recv(const struct ofconn *ofconn)
 {
-    int count = rconn_packet_counter_read (ofconn->reply_counter);
-    return (!ofconn->blocked || ofconn->retry) && count < OFCONN_REPLY_MAX;
+    return ((list_is_empty(&ofconn->blocked)
+             || ofconn->retry
+             || ofconn->n_blocked_bytes < OFCONN_BLOCKED_MAX_BYTES)
+            && (ofconn_queue_n_bytes(ofconn, OFCONN_Q_REPLY)
+                < OFCONN_REPLY_MAX_BYTES));
+}
+
+/* Appends 'of_msg' to the messages postponed on 'ofconn'. */
+static void
+ofconn_block(struct ofconn *ofconn, struct ofpbuf *of_msg)
+{
+    list_push_back(&ofconn->blocked, &of_msg->list_node);
+    ofconn->n_blocked_bytes += of_msg->size;
+}
+
+/* Returns true if 'of_msg' should be processed at once even though earlier
+ * messages on its connection have been postponed.  An echo request has no
+ * effect on the switch's state, and a connection whose echo requests go
+ * unanswered is likely to be dropped by the controller. */
+static bool
+ofconn_may_bypass(const struct ofpbuf *of_msg)
+{
+    const struct ofp_header *oh = of_msg->data;
+
+    return oh->type == OFPT_ECHO_REQUEST;
 }
 
 static void
@@ -1132,20 +1313,33 @@ ofconn_run(struct ofconn *ofconn,
     struct connmgr *mgr = ofconn->connmgr;
     size_t i;
 
-    for (i = 0; i < N_SCHEDULERS; i++) {
-        pinsched_run(ofconn->schedulers[i], do_send_packet_in, ofconn);
+    pinsched_run(ofconn->pinsched, do_send_packet_in, ofconn);
+    if (ofconn->pktbuf) {
+        pktbuf_run(ofconn->pktbuf);
     }
 
     rconn_run(ofconn->rconn);
+    ofconn_push_queues(ofconn);
 
     if (handle_openflow) {
         /* Limit the number of iterations to avoid starving other tasks. */
         for (i = 0; i < 50 && ofconn_may_recv(ofconn); i++) {
             struct ofpbuf *of_msg;
 
-            of_msg = (ofconn->blocked
-                      ? ofconn->blocked
-                      : rconn_recv(ofconn->rconn));
+            if (!list_is_empty(&ofconn->blocked) && ofconn->retry) {
+                /* Retry the oldest postponed message. */
+                of_msg = ofpbuf_from_list(list_front(&ofconn->blocked));
+                if (handle_openflow(ofconn, of_msg)) {
+                    list_remove(&of_msg->list_node);
+                    ofconn->n_blocked_bytes -= of_msg->size;
+                    ofpbuf_delete(of_msg);
+                } else {
+                    ofconn->retry = false;
+                }
+                continue;
+            }
+
+            of_msg = rconn_recv(ofconn->rconn);
             if (!of_msg) {
                 break;
             }
@@ -1153,11 +1347,13 @@ ofconn_run(struct ofconn *ofconn,
                 fail_open_maybe_recover(mgr->fail_open);
             }
 
-            if (handle_openflow(ofconn, of_msg)) {
+            if (!list_is_empty(&ofconn->blocked)
+                && !ofconn_may_bypass(of_msg)) {
+                ofconn_block(ofconn, of_msg);
+            } else if (handle_openflow(ofconn, of_msg)) {
                 ofpbuf_delete(of_msg);
-                ofconn->blocked = NULL;
             } else {
-                ofconn->blocked = of_msg;
+                ofconn_block(ofconn, of_msg);
                 ofconn->retry = false;
             }
         }
@@ -1173,14 +1369,21 @@ ofconn_run(struct ofconn *ofconn,
 static void
 ofconn_wait(struct ofconn *ofconn, bool handling_openflow)
 {
-    int i;
-
-    for (i = 0; i < N_SCHEDULERS; i++) {
-        pinsched_wait(ofconn->schedulers[i]);
+    pinsched_wait(ofconn->pinsched);
+    if (ofconn->pktbuf) {
+        pktbuf_wait(ofconn->pktbuf);
     }
     rconn_run_wait(ofconn->rconn);
+    if (ofconn_may_push(ofconn)) {
+        poll_immediate_wake();
+    }
     if (handling_openflow && ofconn_may_recv(ofconn)) {
-        rconn_recv_wait(ofconn->rconn);
+        if (!list_is_empty(&ofconn->blocked) && ofconn->retry) {
+            /* connmgr_retry() was called for the blocked messages. */
+            poll_immediate_wake();
+        } else {
+            rconn_recv_wait(ofconn->rconn);
+        }
     }
 }
 
@@ -1234,37 +1437,101 @@ ofconn_make_name(const struct connmgr *mgr, const char *target)
 }
 
 static void
-ofconn_set_rate_limit(struct ofconn *ofconn, int rate, int burst)
+ofconn_set_rate_limit(struct ofconn *ofconn, int rate, int burst,
+                      int queue_depth,
+                      const struct pinsched_weight *weights, size_t n_weights)
 {
+    if (rate > 0) {
+        if (!ofconn->pinsched) {
+            ofconn->pinsched = pinsched_create(rate, burst);
+        } else {
+            pinsched_set_limits(ofconn->pinsched, rate, burst);
+        }
+        pinsched_set_queue_depth(ofconn->pinsched, queue_depth);
+        pinsched_set_weights(ofconn->pinsched, weights, n_weights);
+    } else {
+        pinsched_destroy(ofconn->pinsched);
+        ofconn->pinsched = NULL;
+    }
+}
+
+/* Returns the number of bytes in messages of the given 'class' queued on
+ * 'ofconn', including those passed to its rconn but not yet sent. */
+static unsigned int
+ofconn_queue_n_bytes(const struct ofconn *ofconn,
+                     enum ofconn_queue_class class)
+{
+    const struct ofconn_queue *q = &ofconn->queues[class];
+
+    return q->n_bytes + rconn_packet_counter_n_bytes(q->counter);
+}
+
+/* Returns the highest priority nonempty queue in 'ofconn', or NULL if all of
+ * them are empty or if 'ofconn''s rconn already has OFCONN_TXQ_WINDOW bytes
+ * queued. */
+static struct ofconn_queue *
+ofconn_next_queue(const struct ofconn *ofconn)
+{
+    const struct ofconn_queue *next = NULL;
+    unsigned int in_flight = 0;
     int i;
 
-    for (i = 0; i < N_SCHEDULERS; i++) {
-        struct pinsched **s = &ofconn->schedulers[i];
+    for (i = 0; i < OFCONN_N_QUEUES; i++) {
+        const struct ofconn_queue *q = &ofconn->queues[i];
 
-        if (rate > 0) {
-            if (!*s) {
-                *s = pinsched_create(rate, burst);
-            } else {
-                pinsched_set_limits(*s, rate, burst);
-            }
-        } else {
-            pinsched_destroy(*s);
-            *s = NULL;
+        in_flight += rconn_packet_counter_n_bytes(q->counter);
+        if (!next && !list_is_empty(&q->msgs)) {
+            next = q;
         }
     }
+    return (in_flight < OFCONN_TXQ_WINDOW
+            ? (struct ofconn_queue *) next
+            : NULL);
 }
 
+/* Returns true if 'ofconn' has queued messages that it can pass to its rconn
+ * now. */
+static bool
+ofconn_may_push(const struct ofconn *ofconn)
+{
+    return ofconn_next_queue(ofconn) != NULL;
+}
+
+/* Passes messages from 'ofconn''s queues to its rconn, in priority order,
+ * until the queues are empty or the rconn has a backlog of at least
+ * OFCONN_TXQ_WINDOW bytes. */
 static void
-ofconn_send(const struct ofconn *ofconn, struct ofpbuf *msg,
-            struct rconn_packet_counter *counter)
+ofconn_push_queues(struct ofconn *ofconn)
 {
+    struct ofconn_queue *q;
+
+    while ((q = ofconn_next_queue(ofconn)) != NULL) {
+        struct ofpbuf *msg = ofpbuf_from_list(list_pop_front(&q->msgs));
+
+        q->n_bytes -= msg->size;
+        q->n_sent++;
+        rconn_send(ofconn->rconn, msg, q->counter);
+    }
+}
+
+/* Queues 'msg' for sending on 'ofconn' in priority 'class' and passes as many
+ * queued messages as possible to 'ofconn''s rconn. */
+static void
+ofconn_send(struct ofconn *ofconn, struct ofpbuf *msg,
+            enum ofconn_queue_class class)
+{
+    struct ofconn_queue *q = &ofconn->queues[class];
+
     update_openflow_length(msg);
-    rconn_send(ofconn->rconn, msg, counter);
+    list_push_back(&q->msgs, &msg->list_node);
+    q->n_bytes += msg->size;
+    ofconn_push_queues(ofconn);
 }
 
 /* Sending asynchronous messages. */
 
-static void schedule_packet_in(struct ofconn *, struct ofputil_packet_in);
+static void schedule_packet_in(struct ofconn *, struct ofputil_packet_in,
+                               struct pktbuf_data **);
 
 /* Sends an OFPT_PORT_STATUS message with 'opp' and 'reason' to appropriate
  * controllers managed by 'mgr'. */
@@ -1283,7 +1550,7 @@ connmgr_send_port_status(struct connmgr *mgr,
             struct ofpbuf *msg;
 
             msg = ofputil_encode_port_status(&ps, ofconn->protocol);
-            ofconn_send(ofconn, msg, NULL);
+            ofconn_send(ofconn, msg, OFCONN_Q_ASYNC);
         }
     }
 }
@@ -1319,14 +1586,16 @@ void
 connmgr_send_packet_in(struct connmgr *mgr,
                        const struct ofputil_packet_in *pin)
 {
+    struct pktbuf_data *data = NULL;
     struct ofconn *ofconn;
 
     LIST_FOR_EACH (ofconn, node, &mgr->all_conns) {
         if (ofconn_receives_async_msg(ofconn, OAM_PACKET_IN, pin->reason)
             && ofconn->controller_id == pin->controller_id) {
-            schedule_packet_in(ofconn, *pin);
+            schedule_packet_in(ofconn, *pin, &data);
         }
     }
+    pktbuf_data_unref(data);
 }
 
 /* pinsched callback for sending 'ofp_packet_in' on 'ofconn'. */
@@ -1335,14 +1604,26 @@ do_send_packet_in(struct ofpbuf *ofp_packet_in, void *ofconn_)
 {
     struct ofconn *ofconn = ofconn_;
 
-    rconn_send_with_limit(ofconn->rconn, ofp_packet_in,
-                          ofconn->packet_in_counter, 100);
+    if (ofconn_queue_n_bytes(ofconn, OFCONN_Q_ASYNC) + ofp_packet_in->size
+        > OFCONN_ASYNC_MAX_BYTES) {
+        COVERAGE_INC(ofconn_packet_in_dropped);
+        ofconn->queues[OFCONN_Q_ASYNC].n_dropped++;
+        ofpbuf_delete(ofp_packet_in);
+    } else {
+        ofconn_send(ofconn, ofp_packet_in, OFCONN_Q_ASYNC);
+    }
 }
 
 /* Takes 'pin', composes an OpenFlow packet-in message from it, and passes it
- * to 'ofconn''s packet scheduler for sending. */
+ * to 'ofconn''s packet scheduler for sending.
+ *
+ * If the packet needs to be buffered, it is buffered as '*datap', which is
+ * first created if it is null, so that every connection sent the same
+ * packet-in shares a single copy of the packet.  The caller must eventually
+ * release '*datap' with pktbuf_data_unref(). */
 static void
-schedule_packet_in(struct ofconn *ofconn, struct ofputil_packet_in pin)
+schedule_packet_in(struct ofconn *ofconn, struct ofputil_packet_in pin,
+                   struct pktbuf_data **datap)
 {
     struct connmgr *mgr = ofconn->connmgr;
 
@@ -1356,8 +1637,10 @@ schedule_packet_in(struct ofconn *ofconn, struct ofputil_packet_in pin)
     } else if (!ofconn->pktbuf) {
         pin.buffer_id = UINT32_MAX;
     } else {
-        pin.buffer_id = pktbuf_save(ofconn->pktbuf, pin.packet, pin.packet_len,
-                                    pin.fmd.in_port);
+        if (!*datap) {
+            *datap = pktbuf_data_create(pin.packet, pin.packet_len);
+        }
+        pin.buffer_id = pktbuf_save(ofconn->pktbuf, *datap, pin.fmd.in_port);
     }
 
     /* Figure out how much of the packet to send. */
@@ -1374,8 +1657,7 @@ schedule_packet_in(struct ofconn *ofconn, struct ofputil_packet_in pin)
     /* Make OFPT_PACKET_IN and hand over to packet scheduler.  It might
      * immediately call into do_send_packet_in() or it might buffer it for a
      * while (until a later call to pinsched_run()). */
-    pinsched_send(ofconn->schedulers[pin.reason == OFPR_NO_MATCH ? 0 : 1],
-                  pin.fmd.in_port,
+    pinsched_send(ofconn->pinsched, pin.fmd.in_port, pin.table_id, pin.reason,
                   ofputil_encode_packet_in(&pin, ofconn->packet_in_format),
                   do_send_packet_in, ofconn);
 }
@@ -1608,6 +1890,7 @@ ofservice_destroy(struct connmgr *mgr, struct ofservice *ofservice)
 {
     hmap_remove(&mgr->services, &ofservice->node);
     pvconn_close(ofservice->pvconn);
+    free(ofservice->pin_weights);
     free(ofservice);
 }
 
@@ -1618,6 +1901,14 @@ ofservice_reconfigure(struct ofservice *ofservice,
     ofservice->probe_interval = c->probe_interval;
     ofservice->rate_limit = c->rate_limit;
     ofservice->burst_limit = c->burst_limit;
+    ofservice->packet_in_queue_depth = c->packet_in_queue_depth;
+    free(ofservice->pin_weights);
+    ofservice->pin_weights = (c->n_pin_weights
+                              ? xmemdup(c->pin_weights,
+                                        c->n_pin_weights
+                                        * sizeof *c->pin_weights)
+                              : NULL);
+    ofservice->n_pin_weights = c->n_pin_weights;
     ofservice->enable_async_msgs = c->enable_async_msgs;
     ofservice->dscp = c->dscp;
 }
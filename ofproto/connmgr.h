@@ -30,6 +30,7 @@ struct ofopgroup;
 struct ofputil_flow_removed;
 struct ofputil_packet_in;
 struct ofputil_phy_port;
+struct ds;
 struct simap;
 struct sset;
 
@@ -72,6 +73,7 @@ void connmgr_run(struct connmgr *,
 void connmgr_wait(struct connmgr *, bool handling_openflow);
 
 void connmgr_get_memory_usage(const struct connmgr *, struct simap *usage);
+void connmgr_format_packet_in_stats(const struct connmgr *, struct ds *);
 
 struct ofproto *ofconn_get_ofproto(const struct ofconn *);
 
@@ -113,19 +115,25 @@ void ofconn_set_async_config(struct ofconn *,
                              const uint32_t master_masks[OAM_N_TYPES],
                              const uint32_t slave_masks[OAM_N_TYPES]);
 
-void ofconn_send_reply(const struct ofconn *, struct ofpbuf *);
-void ofconn_send_replies(const struct ofconn *, struct list *);
-void ofconn_send_error(const struct ofconn *, const struct ofp_header *request,
+void ofconn_send_reply(struct ofconn *, struct ofpbuf *);
+void ofconn_send_replies(struct ofconn *, struct list *);
+void ofconn_send_error(struct ofconn *, const struct ofp_header *request,
                        enum ofperr);
 
+int ofconn_get_n_buffers(const struct ofconn *);
 enum ofperr ofconn_pktbuf_retrieve(struct ofconn *, uint32_t id,
                                    struct ofpbuf **bufferp, uint16_t *in_port);
 
+bool ofconn_has_reply_room(const struct ofconn *);
+
 bool ofconn_has_pending_opgroups(const struct ofconn *);
 void ofconn_add_opgroup(struct ofconn *, struct list *);
 void ofconn_remove_opgroup(struct ofconn *, struct list *,
                            const struct ofp_header *request, int error);
 
+bool ofconn_has_pending_dumps(const struct ofconn *);
+void ofconn_add_dump(struct ofconn *, struct list *);
+
 /* Sending asynchronous messages. */
 void connmgr_send_port_status(struct connmgr *,
                               const struct ofputil_phy_port *, uint8_t reason);
@@ -27,6 +27,7 @@
 #include "connmgr.h"
 #include "coverage.h"
 #include "cfm.h"
+#include "cmap.h"
 #include "dpif.h"
 #include "dynamic-string.h"
 #include "fail-open.h"
@@ -58,6 +59,11 @@ VLOG_DEFINE_THIS_MODULE(ofproto_dpif);
 
 COVERAGE_DEFINE(ofproto_dpif_ctlr_action);
 COVERAGE_DEFINE(ofproto_dpif_expired);
+COVERAGE_DEFINE(ofproto_dpif_learn_coalesced);
+COVERAGE_DEFINE(ofproto_dpif_learn_refreshed);
+COVERAGE_DEFINE(ofproto_dpif_lookup_cache_hit);
+COVERAGE_DEFINE(ofproto_dpif_lookup_cache_miss);
+COVERAGE_DEFINE(ofproto_dpif_xlate_memo_hit);
 COVERAGE_DEFINE(ofproto_dpif_xlate);
 COVERAGE_DEFINE(facet_changed_rule);
 COVERAGE_DEFINE(facet_invalidated);
@@ -276,6 +282,18 @@ struct action_xlate_ctx {
     uint16_t user_cookie_offset;/* Used for user_action_cookie fixup. */
     bool exit;                  /* No further actions should be processed. */
     struct flow orig_flow;      /* Copy of original flow. */
+
+    /* Results of the most recent lookups by xlate_table_action().  The flow
+     * tables do not change during translation, so a lookup into the same
+     * table with the same flow must yield the same rule. */
+#define XLATE_MEMO_SIZE 4
+    struct {
+        struct flow flow;       /* Flow looked up, with its input port. */
+        struct rule_dpif *rule; /* The lookup's result, possibly NULL. */
+        uint8_t table_id;       /* Table in which 'flow' was looked up. */
+    } memo[XLATE_MEMO_SIZE];
+    int n_memo;                 /* Number of valid elements in 'memo'. */
+    int next_memo;              /* Next element of 'memo' to replace. */
 };
 
 static void action_xlate_ctx_init(struct action_xlate_ctx *,
@@ -326,15 +344,17 @@ static const char *subfacet_path_to_string(enum subfacet_path);
  * See also the large comment on struct facet. */
 struct subfacet {
     /* Owners. */
-    struct hmap_node hmap_node; /* In struct ofproto_dpif 'subfacets' list. */
+    struct cmap_node cmap_node; /* In struct ofproto_dpif 'subfacets' cmap. */
     struct list list_node;      /* In struct facet's 'facets' list. */
     struct facet *facet;        /* Owning facet. */
 
     /* Key.
      *
-     * To save memory in the common case, 'key' is NULL if 'key_fitness' is
-     * ODP_FIT_PERFECT, that is, odp_flow_key_from_flow() can accurately
-     * regenerate the ODP flow key from ->facet->flow. */
+     * 'key' is the ODP flow key exactly as the datapath reported it in the
+     * upcall that created the subfacet, so that installing, reinstalling,
+     * and deleting the datapath flow never has to serialize ->facet->flow
+     * again with odp_flow_key_from_flow().  'cmap_node.hash' is
+     * odp_flow_key_hash() of 'key'. */
     enum odp_key_fitness key_fitness;
     struct nlattr *key;
     int key_len;
@@ -362,13 +382,12 @@ struct subfacet {
 
 static struct subfacet *subfacet_create(struct facet *, enum odp_key_fitness,
                                         const struct nlattr *key,
-                                        size_t key_len, ovs_be16 initial_tci);
+                                        size_t key_len, uint32_t key_hash,
+                                        ovs_be16 initial_tci);
 static struct subfacet *subfacet_find(struct ofproto_dpif *,
                                       const struct nlattr *key, size_t key_len);
 static void subfacet_destroy(struct subfacet *);
 static void subfacet_destroy__(struct subfacet *);
-static void subfacet_get_key(struct subfacet *, struct odputil_keybuf *,
-                             struct ofpbuf *key);
 static void subfacet_reset_dp_stats(struct subfacet *,
                                     struct dpif_flow_stats *);
 static void subfacet_update_time(struct subfacet *, long long int used);
@@ -400,7 +419,7 @@ static enum subfacet_path subfacet_want_path(enum slow_path_reason);
  * one subfacet or it will never expire, leaking memory. */
 struct facet {
     /* Owners. */
-    struct hmap_node hmap_node;  /* In owning ofproto's 'facets' hmap. */
+    struct cmap_node cmap_node;  /* In owning ofproto's 'facets' cmap. */
     struct list list_node;       /* In owning rule's 'facets' list. */
     struct rule_dpif *rule;      /* Owning rule. */
 
@@ -472,6 +491,19 @@ static void facet_update_time(struct facet *, long long int used);
 static void facet_reset_counters(struct facet *);
 static void facet_push_stats(struct facet *);
 static void facet_learn(struct facet *);
+
+/* A flow_mod generated by a "learn" action, waiting to be executed by
+ * learned_flows_flush(). */
+struct learned_flow {
+    struct hmap_node hmap_node; /* In ofproto_dpif's "learned_flows". */
+    struct list list_node;      /* In ofproto_dpif's "learned_list". */
+    struct ofputil_flow_mod fm;
+};
+
+static void learned_flow_queue(struct ofproto_dpif *,
+                               const struct ofputil_flow_mod *, uint32_t hash);
+static void learned_flows_flush(struct ofproto_dpif *);
+static void learned_flows_clear(struct ofproto_dpif *);
 static void facet_account(struct facet *);
 
 static bool facet_is_controller_flow(struct facet *);
@@ -553,7 +585,7 @@ struct dpif_completion {
 };
 
 /* Extra information about a classifier table.
- * Currently used just for optimized flow revalidation. */
+ * Used for optimized flow revalidation and for caching lookups. */
 struct table_dpif {
     /* If either of these is nonnull, then this table has a form that allows
      * flows to be tagged to avoid revalidating most flows for the most common
@@ -561,8 +593,32 @@ struct table_dpif {
     struct cls_table *catchall_table; /* Table that wildcards all fields. */
     struct cls_table *other_table;    /* Table with any other wildcard set. */
     uint32_t basis;                   /* Keeps each table's tags separate. */
+
+    /* Cache of the results of classifier lookups into this table, used only
+     * when the classifier has more than one cls_table and so a lookup has to
+     * search more than one hash table.  Each entry is keyed on a flow with
+     * all the bits that no rule in the table examines zeroed, so that one
+     * entry serves every flow that the table cannot tell apart.  The cache
+     * is flushed whenever the table changes. */
+    struct hmap lookup_cache;   /* Contains "struct lookup_cache_entry"s. */
+    struct flow lookup_masks;   /* Bits significant to any rule in table. */
+    bool lookup_masks_valid;    /* False if 'lookup_masks' must be updated. */
+};
+
+/* An entry in a table_dpif's 'lookup_cache'. */
+struct lookup_cache_entry {
+    struct hmap_node hmap_node; /* In table_dpif's 'lookup_cache'. */
+    struct flow flow;           /* Flow masked with table's 'lookup_masks'. */
+    struct rule_dpif *rule;     /* Result of the lookup, possibly NULL. */
 };
 
+/* Maximum number of entries in a table_dpif's 'lookup_cache'.  The cache is
+ * flushed when it grows bigger than this. */
+#define LOOKUP_CACHE_MAX 4096
+
+static void lookup_cache_flush(struct table_dpif *);
+static void rule_flush_lookup_cache(const struct rule_dpif *);
+
 struct ofproto_dpif {
     struct hmap_node all_ofproto_dpifs_node; /* In 'all_ofproto_dpifs'. */
     struct ofproto up;
@@ -588,9 +644,15 @@ struct ofproto_dpif {
     /* Expiration. */
     struct timer next_expiration;
 
+    /* Flows generated by "learn" actions, to be executed together by
+     * learned_flows_flush().  The hmap is indexed on a hash of each flow's
+     * table and match, the list is in the order that they were learned. */
+    struct hmap learned_flows;  /* Contains "struct learned_flow"s. */
+    struct list learned_list;   /* Contains "struct learned_flow"s. */
+
     /* Facets. */
-    struct hmap facets;
-    struct hmap subfacets;
+    struct cmap facets;
+    struct cmap subfacets;
     struct governor *governor;
 
     /* Revalidation. */
@@ -747,8 +809,8 @@ construct(struct ofproto *ofproto_)
 
     timer_set_duration(&ofproto->next_expiration, 1000);
 
-    hmap_init(&ofproto->facets);
-    hmap_init(&ofproto->subfacets);
+    cmap_init(&ofproto->facets);
+    cmap_init(&ofproto->subfacets);
     ofproto->governor = NULL;
 
     for (i = 0; i < N_TABLES; i++) {
@@ -757,12 +819,17 @@ construct(struct ofproto *ofproto_)
         table->catchall_table = NULL;
         table->other_table = NULL;
         table->basis = random_uint32();
+        hmap_init(&table->lookup_cache);
+        table->lookup_masks_valid = false;
     }
     ofproto->need_revalidate = false;
     tag_set_init(&ofproto->revalidate_set);
 
     list_init(&ofproto->completions);
 
+    hmap_init(&ofproto->learned_flows);
+    list_init(&ofproto->learned_list);
+
     ofproto_dpif_unixctl_init();
 
     ofproto->has_mirrors = false;
@@ -866,6 +933,8 @@ destruct(struct ofproto *ofproto_)
 
     hmap_remove(&all_ofproto_dpifs, &ofproto->all_ofproto_dpifs_node);
     complete_operations(ofproto);
+    learned_flows_clear(ofproto);
+    hmap_destroy(&ofproto->learned_flows);
 
     OFPROTO_FOR_EACH_TABLE (table, &ofproto->up) {
         struct cls_cursor cursor;
@@ -876,6 +945,11 @@ destruct(struct ofproto *ofproto_)
         }
     }
 
+    for (i = 0; i < N_TABLES; i++) {
+        lookup_cache_flush(&ofproto->tables[i]);
+        hmap_destroy(&ofproto->tables[i].lookup_cache);
+    }
+
     for (i = 0; i < MAX_MIRRORS; i++) {
         mirror_destroy(ofproto->mirrors[i]);
     }
@@ -885,8 +959,8 @@ destruct(struct ofproto *ofproto_)
     hmap_destroy(&ofproto->bundles);
     mac_learning_destroy(ofproto->ml);
 
-    hmap_destroy(&ofproto->facets);
-    hmap_destroy(&ofproto->subfacets);
+    cmap_destroy(&ofproto->facets);
+    cmap_destroy(&ofproto->subfacets);
     governor_destroy(ofproto->governor);
 
     hmap_destroy(&ofproto->vlandev_map);
@@ -943,6 +1017,7 @@ run(struct ofproto *ofproto_)
         int delay = expire(ofproto);
         timer_set_duration(&ofproto->next_expiration, delay);
     }
+    learned_flows_flush(ofproto);
 
     if (ofproto->netflow) {
         if (netflow_run(ofproto->netflow)) {
@@ -974,7 +1049,7 @@ run(struct ofproto *ofproto_)
         tag_set_init(&ofproto->revalidate_set);
         ofproto->need_revalidate = false;
 
-        HMAP_FOR_EACH (facet, hmap_node, &ofproto->facets) {
+        CMAP_FOR_EACH (facet, cmap_node, &ofproto->facets) {
             if (revalidate_all
                 || tag_set_intersects(&revalidate_set, facet->tags)) {
                 facet_revalidate(facet);
@@ -983,11 +1058,11 @@ run(struct ofproto *ofproto_)
     }
 
     /* Check the consistency of a random facet, to aid debugging. */
-    if (!hmap_is_empty(&ofproto->facets) && !ofproto->need_revalidate) {
+    if (!cmap_is_empty(&ofproto->facets) && !ofproto->need_revalidate) {
         struct facet *facet;
 
-        facet = CONTAINER_OF(hmap_random_node(&ofproto->facets),
-                             struct facet, hmap_node);
+        facet = CONTAINER_OF(cmap_random_node(&ofproto->facets),
+                             struct facet, cmap_node);
         if (!tag_set_intersects(&ofproto->revalidate_set, facet->tags)) {
             if (!facet_check_consistency(facet)) {
                 ofproto->need_revalidate = true;
@@ -1005,7 +1080,7 @@ run(struct ofproto *ofproto_)
          *
          * For hysteresis, the number of subfacets to drop the governor is
          * smaller than the number needed to trigger its creation. */
-        n_subfacets = hmap_count(&ofproto->subfacets);
+        n_subfacets = cmap_count(&ofproto->subfacets);
         if (n_subfacets * 4 < ofproto->up.flow_eviction_threshold
             && governor_is_idle(ofproto->governor)) {
             governor_destroy(ofproto->governor);
@@ -1026,6 +1101,12 @@ wait(struct ofproto *ofproto_)
     if (!clogged && !list_is_empty(&ofproto->completions)) {
         poll_immediate_wake();
     }
+    if (!hmap_is_empty(&ofproto->learned_flows)
+        && list_is_empty(&ofproto->up.pending)) {
+        /* Otherwise, learned_flows_flush() has to wait for the pending
+         * operations to complete. */
+        poll_immediate_wake();
+    }
 
     dpif_wait(ofproto->dpif);
     dpif_recv_wait(ofproto->dpif);
@@ -1063,8 +1144,8 @@ get_memory_usage(const struct ofproto *ofproto_, struct simap *usage)
 {
     const struct ofproto_dpif *ofproto = ofproto_dpif_cast(ofproto_);
 
-    simap_increase(usage, "facets", hmap_count(&ofproto->facets));
-    simap_increase(usage, "subfacets", hmap_count(&ofproto->subfacets));
+    simap_increase(usage, "facets", cmap_count(&ofproto->facets));
+    simap_increase(usage, "subfacets", cmap_count(&ofproto->subfacets));
 }
 
 static void
@@ -1073,7 +1154,7 @@ flush(struct ofproto *ofproto_)
     struct ofproto_dpif *ofproto = ofproto_dpif_cast(ofproto_);
     struct facet *facet, *next_facet;
 
-    HMAP_FOR_EACH_SAFE (facet, next_facet, hmap_node, &ofproto->facets) {
+    CMAP_FOR_EACH_SAFE (facet, next_facet, cmap_node, &ofproto->facets) {
         /* Mark the facet as not installed so that facet_remove() doesn't
          * bother trying to uninstall it.  There is no point in uninstalling it
          * individually since we are about to blow away all the facets with
@@ -1641,7 +1722,7 @@ bundle_flush_macs(struct ofbundle *bundle, bool all_ofprotos)
     struct mac_entry *mac, *next_mac;
 
     ofproto->need_revalidate = true;
-    LIST_FOR_EACH_SAFE (mac, next_mac, lru_node, &ml->lrus) {
+    MAC_LEARNING_FOR_EACH_SAFE (mac, next_mac, ml) {
         if (mac->port.p == bundle) {
             if (all_ofprotos) {
                 struct ofproto_dpif *o;
@@ -2041,7 +2122,7 @@ bundle_send_learning_packets(struct ofbundle *bundle)
     struct mac_entry *e;
 
     error = n_packets = n_errors = 0;
-    LIST_FOR_EACH (e, lru_node, &ofproto->ml->lrus) {
+    MAC_LEARNING_FOR_EACH (e, ofproto->ml) {
         if (e->port.p != bundle) {
             struct ofpbuf *learning_packet;
             struct ofport_dpif *port;
@@ -2373,6 +2454,13 @@ set_mac_idle_time(struct ofproto *ofproto_, unsigned int idle_time)
     struct ofproto_dpif *ofproto = ofproto_dpif_cast(ofproto_);
     mac_learning_set_idle_time(ofproto->ml, idle_time);
 }
+
+static void
+set_mac_table_size(struct ofproto *ofproto_, size_t mac_table_size)
+{
+    struct ofproto_dpif *ofproto = ofproto_dpif_cast(ofproto_);
+    mac_learning_set_max_entries(ofproto->ml, mac_table_size);
+}
 
 /* Ports. */
 
@@ -2641,6 +2729,7 @@ struct flow_miss {
     enum odp_key_fitness key_fitness;
     const struct nlattr *key;
     size_t key_len;
+    uint32_t key_hash;          /* odp_flow_key_hash(key, key_len). */
     ovs_be16 initial_tci;
     struct list packets;
     enum dpif_upcall_type upcall_type;
@@ -2789,7 +2878,7 @@ flow_miss_should_make_facet(struct ofproto_dpif *ofproto,
     if (!ofproto->governor) {
         size_t n_subfacets;
 
-        n_subfacets = hmap_count(&ofproto->subfacets);
+        n_subfacets = cmap_count(&ofproto->subfacets);
         if (n_subfacets * 2 <= ofproto->up.flow_eviction_threshold) {
             return true;
         }
@@ -2859,7 +2948,7 @@ handle_flow_miss_with_facet(struct flow_miss *miss, struct facet *facet,
 
     subfacet = subfacet_create(facet,
                                miss->key_fitness, miss->key, miss->key_len,
-                               miss->initial_tci);
+                               miss->key_hash, miss->initial_tci);
 
     LIST_FOR_EACH (packet, list_node, &miss->packets) {
         struct flow_miss_op *op = &ops[*n_ops];
@@ -3053,6 +3142,7 @@ handle_miss_upcalls(struct ofproto_dpif *ofproto, struct dpif_upcall *upcalls,
             hmap_insert(&todo, &miss->hmap_node, hash);
             miss->key = upcall->key;
             miss->key_len = upcall->key_len;
+            miss->key_hash = odp_flow_key_hash(upcall->key, upcall->key_len);
             miss->upcall_type = upcall->type;
             list_init(&miss->packets);
 
@@ -3206,6 +3296,9 @@ handle_upcalls(struct ofproto_dpif *ofproto, unsigned int max_batch)
         ofpbuf_uninit(&miss_bufs[i]);
     }
 
+    /* Install the flows learned by the whole batch together. */
+    learned_flows_flush(ofproto);
+
     return n_processed;
 }
 
@@ -3226,7 +3319,7 @@ static int
 expire(struct ofproto_dpif *ofproto)
 {
     struct rule_dpif *rule, *next_rule;
-    struct oftable *table;
+    struct list expired;
     int dp_max_idle;
 
     /* Update stats for each flow in the datapath. */
@@ -3237,13 +3330,10 @@ expire(struct ofproto_dpif *ofproto)
     expire_subfacets(ofproto, dp_max_idle);
 
     /* Expire OpenFlow flows whose idle_timeout or hard_timeout has passed. */
-    OFPROTO_FOR_EACH_TABLE (table, &ofproto->up) {
-        struct cls_cursor cursor;
-
-        cls_cursor_init(&cursor, &table->cls, NULL);
-        CLS_CURSOR_FOR_EACH_SAFE (rule, next_rule, up.cr, &cursor) {
-            rule_expire(rule);
-        }
+    list_init(&expired);
+    ofproto_collect_expired_rules(&ofproto->up, &expired);
+    LIST_FOR_EACH_SAFE (rule, next_rule, up.ofproto_node, &expired) {
+        rule_expire(rule);
     }
 
     /* All outstanding data in existing flows has been accounted, so it's a
@@ -3403,14 +3493,14 @@ subfacet_max_idle(const struct ofproto_dpif *ofproto)
     long long int now;
     int i;
 
-    total = hmap_count(&ofproto->subfacets);
+    total = cmap_count(&ofproto->subfacets);
     if (total <= ofproto->up.flow_eviction_threshold) {
         return N_BUCKETS * BUCKET_WIDTH;
     }
 
     /* Build histogram. */
     now = time_msec();
-    HMAP_FOR_EACH (subfacet, hmap_node, &ofproto->subfacets) {
+    CMAP_FOR_EACH (subfacet, cmap_node, &ofproto->subfacets) {
         long long int idle = now - subfacet->used;
         int bucket = (idle <= 0 ? 0
                       : idle >= BUCKET_WIDTH * N_BUCKETS ? N_BUCKETS - 1
@@ -3450,18 +3540,15 @@ enum { EXPIRE_MAX_BATCH = 50 };
 static void
 expire_batch(struct ofproto_dpif *ofproto, struct subfacet **subfacets, int n)
 {
-    struct odputil_keybuf keybufs[EXPIRE_MAX_BATCH];
     struct dpif_op ops[EXPIRE_MAX_BATCH];
     struct dpif_op *opsp[EXPIRE_MAX_BATCH];
-    struct ofpbuf keys[EXPIRE_MAX_BATCH];
     struct dpif_flow_stats stats[EXPIRE_MAX_BATCH];
     int i;
 
     for (i = 0; i < n; i++) {
         ops[i].type = DPIF_OP_FLOW_DEL;
-        subfacet_get_key(subfacets[i], &keybufs[i], &keys[i]);
-        ops[i].u.flow_del.key = keys[i].data;
-        ops[i].u.flow_del.key_len = keys[i].size;
+        ops[i].u.flow_del.key = subfacets[i]->key;
+        ops[i].u.flow_del.key_len = subfacets[i]->key_len;
         ops[i].u.flow_del.stats = &stats[i];
         opsp[i] = &ops[i];
     }
@@ -3489,7 +3576,7 @@ expire_subfacets(struct ofproto_dpif *ofproto, int dp_max_idle)
     int n_batch;
 
     n_batch = 0;
-    HMAP_FOR_EACH_SAFE (subfacet, next_subfacet, hmap_node,
+    CMAP_FOR_EACH_SAFE (subfacet, next_subfacet, cmap_node,
                         &ofproto->subfacets) {
         long long int cutoff;
 
@@ -3567,7 +3654,7 @@ facet_create(struct rule_dpif *rule, const struct flow *flow, uint32_t hash)
 
     facet = xzalloc(sizeof *facet);
     facet->used = time_msec();
-    hmap_insert(&ofproto->facets, &facet->hmap_node, hash);
+    cmap_insert(&ofproto->facets, &facet->cmap_node, hash);
     list_push_back(&rule->facets, &facet->list_node);
     facet->rule = rule;
     facet->flow = *flow;
@@ -3639,7 +3726,7 @@ facet_remove(struct facet *facet)
                         &facet->subfacets) {
         subfacet_destroy__(subfacet);
     }
-    hmap_remove(&ofproto->facets, &facet->hmap_node);
+    cmap_remove(&ofproto->facets, &facet->cmap_node);
     list_remove(&facet->list_node);
     facet_free(facet);
 }
@@ -3785,7 +3872,7 @@ facet_find(struct ofproto_dpif *ofproto,
 {
     struct facet *facet;
 
-    HMAP_FOR_EACH_WITH_HASH (facet, hmap_node, hash, &ofproto->facets) {
+    CMAP_FOR_EACH_WITH_HASH (facet, cmap_node, hash, &ofproto->facets) {
         if (flow_equal(flow, &facet->flow)) {
             return facet;
         }
@@ -3896,9 +3983,7 @@ facet_check_consistency(struct facet *facet)
     ofpbuf_use_stub(&odp_actions, odp_actions_stub, sizeof odp_actions_stub);
     LIST_FOR_EACH (subfacet, list_node, &facet->subfacets) {
         enum subfacet_path want_path;
-        struct odputil_keybuf keybuf;
         struct action_xlate_ctx ctx;
-        struct ofpbuf key;
         struct ds s;
 
         action_xlate_ctx_init(&ctx, ofproto, &facet->flow,
@@ -3934,8 +4019,7 @@ facet_check_consistency(struct facet *facet)
         }
 
         ds_init(&s);
-        subfacet_get_key(subfacet, &keybuf, &key);
-        odp_flow_key_format(key.data, key.size, &s);
+        odp_flow_key_format(subfacet->key, subfacet->key_len, &s);
 
         ds_put_cstr(&s, ": inconsistency in subfacet");
         if (want_path != subfacet->path) {
@@ -4150,17 +4234,14 @@ flow_push_stats(struct rule_dpif *rule,
 
 static struct subfacet *
 subfacet_find__(struct ofproto_dpif *ofproto,
-                const struct nlattr *key, size_t key_len, uint32_t key_hash,
-                const struct flow *flow)
+                const struct nlattr *key, size_t key_len, uint32_t key_hash)
 {
     struct subfacet *subfacet;
 
-    HMAP_FOR_EACH_WITH_HASH (subfacet, hmap_node, key_hash,
+    CMAP_FOR_EACH_WITH_HASH (subfacet, cmap_node, key_hash,
                              &ofproto->subfacets) {
-        if (subfacet->key
-            ? (subfacet->key_len == key_len
-               && !memcmp(key, subfacet->key, key_len))
-            : flow_equal(flow, &subfacet->facet->flow)) {
+        if (subfacet->key_len == key_len
+            && !memcmp(key, subfacet->key, key_len)) {
             return subfacet;
         }
     }
@@ -4170,20 +4251,21 @@ subfacet_find__(struct ofproto_dpif *ofproto,
 
 /* Searches 'facet' (within 'ofproto') for a subfacet with the specified
  * 'key_fitness', 'key', and 'key_len'.  Returns the existing subfacet if
- * there is one, otherwise creates and returns a new subfacet.
+ * there is one, otherwise creates and returns a new subfacet.  'key_hash' must
+ * be odp_flow_key_hash(key, key_len).
  *
  * If the returned subfacet is new, then subfacet->actions will be NULL, in
  * which case the caller must populate the actions with
  * subfacet_make_actions(). */
 static struct subfacet *
 subfacet_create(struct facet *facet, enum odp_key_fitness key_fitness,
-                const struct nlattr *key, size_t key_len, ovs_be16 initial_tci)
+                const struct nlattr *key, size_t key_len, uint32_t key_hash,
+                ovs_be16 initial_tci)
 {
     struct ofproto_dpif *ofproto = ofproto_dpif_cast(facet->rule->up.ofproto);
-    uint32_t key_hash = odp_flow_key_hash(key, key_len);
     struct subfacet *subfacet;
 
-    subfacet = subfacet_find__(ofproto, key, key_len, key_hash, &facet->flow);
+    subfacet = subfacet_find__(ofproto, key, key_len, key_hash);
     if (subfacet) {
         if (subfacet->facet == facet) {
             return subfacet;
@@ -4197,17 +4279,12 @@ subfacet_create(struct facet *facet, enum odp_key_fitness key_fitness,
     subfacet = (list_is_empty(&facet->subfacets)
                 ? &facet->one_subfacet
                 : xmalloc(sizeof *subfacet));
-    hmap_insert(&ofproto->subfacets, &subfacet->hmap_node, key_hash);
+    cmap_insert(&ofproto->subfacets, &subfacet->cmap_node, key_hash);
     list_push_back(&facet->subfacets, &subfacet->list_node);
     subfacet->facet = facet;
     subfacet->key_fitness = key_fitness;
-    if (key_fitness != ODP_FIT_PERFECT) {
-        subfacet->key = xmemdup(key, key_len);
-        subfacet->key_len = key_len;
-    } else {
-        subfacet->key = NULL;
-        subfacet->key_len = 0;
-    }
+    subfacet->key = xmemdup(key, key_len);
+    subfacet->key_len = key_len;
     subfacet->used = time_msec();
     subfacet->dp_packet_count = 0;
     subfacet->dp_byte_count = 0;
@@ -4222,22 +4299,14 @@ subfacet_create(struct facet *facet, enum odp_key_fitness key_fitness,
     return subfacet;
 }
 
-/* Searches 'ofproto' for a subfacet with the given 'key', 'key_len', and
- * 'flow'.  Returns the subfacet if one exists, otherwise NULL. */
+/* Searches 'ofproto' for a subfacet with the given 'key' and 'key_len'.
+ * Returns the subfacet if one exists, otherwise NULL. */
 static struct subfacet *
 subfacet_find(struct ofproto_dpif *ofproto,
               const struct nlattr *key, size_t key_len)
 {
-    uint32_t key_hash = odp_flow_key_hash(key, key_len);
-    enum odp_key_fitness fitness;
-    struct flow flow;
-
-    fitness = odp_flow_key_to_flow(key, key_len, &flow);
-    if (fitness == ODP_FIT_ERROR) {
-        return NULL;
-    }
-
-    return subfacet_find__(ofproto, key, key_len, key_hash, &flow);
+    return subfacet_find__(ofproto, key, key_len,
+                           odp_flow_key_hash(key, key_len));
 }
 
 /* Uninstalls 'subfacet' from the datapath, if it is installed, removes it from
@@ -4249,7 +4318,7 @@ subfacet_destroy__(struct subfacet *subfacet)
     struct ofproto_dpif *ofproto = ofproto_dpif_cast(facet->rule->up.ofproto);
 
     subfacet_uninstall(subfacet);
-    hmap_remove(&ofproto->subfacets, &subfacet->hmap_node);
+    cmap_remove(&ofproto->subfacets, &subfacet->cmap_node);
     list_remove(&subfacet->list_node);
     free(subfacet->key);
     free(subfacet->actions);
@@ -4273,21 +4342,6 @@ subfacet_destroy(struct subfacet *subfacet)
     }
 }
 
-/* Initializes 'key' with the sequence of OVS_KEY_ATTR_* Netlink attributes
- * that can be used to refer to 'subfacet'.  The caller must provide 'keybuf'
- * for use as temporary storage. */
-static void
-subfacet_get_key(struct subfacet *subfacet, struct odputil_keybuf *keybuf,
-                 struct ofpbuf *key)
-{
-    if (!subfacet->key) {
-        ofpbuf_use_stack(key, keybuf, sizeof *keybuf);
-        odp_flow_key_from_flow(key, &subfacet->facet->flow);
-    } else {
-        ofpbuf_use_const(key, subfacet->key, subfacet->key_len);
-    }
-}
-
 /* Composes the datapath actions for 'subfacet' based on its rule's actions.
  * Translates the actions into 'odp_actions', which the caller must have
  * initialized and is responsible for uninitializing. */
@@ -4336,9 +4390,7 @@ subfacet_install(struct subfacet *subfacet,
     struct ofproto_dpif *ofproto = ofproto_dpif_cast(facet->rule->up.ofproto);
     enum subfacet_path path = subfacet_want_path(slow);
     uint64_t slow_path_stub[128 / 8];
-    struct odputil_keybuf keybuf;
     enum dpif_flow_put_flags flags;
-    struct ofpbuf key;
     int ret;
 
     flags = DPIF_FP_CREATE | DPIF_FP_MODIFY;
@@ -4352,8 +4404,8 @@ subfacet_install(struct subfacet *subfacet,
                           &actions, &actions_len);
     }
 
-    subfacet_get_key(subfacet, &keybuf, &key);
-    ret = dpif_flow_put(ofproto->dpif, flags, key.data, key.size,
+    ret = dpif_flow_put(ofproto->dpif, flags,
+                        subfacet->key, subfacet->key_len,
                         actions, actions_len, stats);
 
     if (stats) {
@@ -4380,13 +4432,11 @@ subfacet_uninstall(struct subfacet *subfacet)
     if (subfacet->path != SF_NOT_INSTALLED) {
         struct rule_dpif *rule = subfacet->facet->rule;
         struct ofproto_dpif *ofproto = ofproto_dpif_cast(rule->up.ofproto);
-        struct odputil_keybuf keybuf;
         struct dpif_flow_stats stats;
-        struct ofpbuf key;
         int error;
 
-        subfacet_get_key(subfacet, &keybuf, &key);
-        error = dpif_flow_del(ofproto->dpif, key.data, key.size, &stats);
+        error = dpif_flow_del(ofproto->dpif, subfacet->key, subfacet->key_len,
+                              &stats);
         subfacet_reset_dp_stats(subfacet, &stats);
         if (!error) {
             subfacet_update_stats(subfacet, &stats);
@@ -4480,8 +4530,13 @@ static struct rule_dpif *
 rule_dpif_lookup__(struct ofproto_dpif *ofproto, const struct flow *flow,
                    uint8_t table_id)
 {
+    struct lookup_cache_entry *entry;
+    struct flow ofpc_normal_flow;
+    struct table_dpif *table;
     struct cls_rule *cls_rule;
     struct classifier *cls;
+    struct flow key;
+    uint32_t hash;
 
     if (table_id >= N_TABLES) {
         return NULL;
@@ -4492,14 +4547,81 @@ rule_dpif_lookup__(struct ofproto_dpif *ofproto, const struct flow *flow,
         && ofproto->up.frag_handling == OFPC_FRAG_NORMAL) {
         /* For OFPC_NORMAL frag_handling, we must pretend that transport ports
          * are unavailable. */
-        struct flow ofpc_normal_flow = *flow;
+        ofpc_normal_flow = *flow;
         ofpc_normal_flow.tp_src = htons(0);
         ofpc_normal_flow.tp_dst = htons(0);
-        cls_rule = classifier_lookup(cls, &ofpc_normal_flow);
-    } else {
+        flow = &ofpc_normal_flow;
+    }
+
+    if (hmap_count(&cls->tables) < 2) {
+        /* The classifier does a single hash lookup, no slower than the
+         * cache. */
         cls_rule = classifier_lookup(cls, flow);
+        return rule_dpif_cast(rule_from_cls_rule(cls_rule));
+    }
+
+    table = &ofproto->tables[table_id];
+    if (!table->lookup_masks_valid) {
+        struct cls_table *t;
+
+        memset(&table->lookup_masks, 0, sizeof table->lookup_masks);
+        HMAP_FOR_EACH (t, hmap_node, &cls->tables) {
+            flow_masks_or(&table->lookup_masks, &table->lookup_masks,
+                          &t->masks);
+        }
+        table->lookup_masks_valid = true;
+    }
+
+    flow_masks_and(&key, flow, &table->lookup_masks);
+    hash = flow_hash(&key, table->basis);
+    HMAP_FOR_EACH_WITH_HASH (entry, hmap_node, hash, &table->lookup_cache) {
+        if (flow_equal(&entry->flow, &key)) {
+            COVERAGE_INC(ofproto_dpif_lookup_cache_hit);
+            return entry->rule;
+        }
+    }
+
+    COVERAGE_INC(ofproto_dpif_lookup_cache_miss);
+    if (hmap_count(&table->lookup_cache) >= LOOKUP_CACHE_MAX) {
+        lookup_cache_flush(table);
     }
-    return rule_dpif_cast(rule_from_cls_rule(cls_rule));
+    cls_rule = classifier_lookup(cls, flow);
+    entry = xmalloc(sizeof *entry);
+    entry->flow = key;
+    entry->rule = rule_dpif_cast(rule_from_cls_rule(cls_rule));
+    hmap_insert(&table->lookup_cache, &entry->hmap_node, hash);
+    return entry->rule;
+}
+
+/* Flushes the lookup cache of the table that contains 'rule'.  This must be
+ * done before anything looks up flows in that table after 'rule' is added to
+ * it, removed from it, or modified. */
+static void
+rule_flush_lookup_cache(const struct rule_dpif *rule)
+{
+    struct ofproto_dpif *ofproto = ofproto_dpif_cast(rule->up.ofproto);
+
+    lookup_cache_flush(&ofproto->tables[rule->up.table_id]);
+}
+
+/* Removes all of the entries from 'table''s lookup cache. */
+static void
+lookup_cache_flush(struct table_dpif *table)
+{
+    if (!hmap_is_empty(&table->lookup_cache)) {
+        struct lookup_cache_entry *entry, *next;
+
+        HMAP_FOR_EACH_SAFE (entry, next, hmap_node, &table->lookup_cache) {
+            free(entry);
+        }
+
+        /* Also release the buckets, so that flushing an empty cache, as
+         * happens for each of a long series of flow table changes, stays
+         * cheap. */
+        hmap_destroy(&table->lookup_cache);
+        hmap_init(&table->lookup_cache);
+    }
+    table->lookup_masks_valid = false;
 }
 
 static void
@@ -4540,6 +4662,8 @@ rule_construct(struct rule *rule_)
     uint8_t table_id;
     enum ofperr error;
 
+    rule_flush_lookup_cache(rule);
+
     error = validate_actions(rule->up.actions, rule->up.n_actions,
                              &rule->up.cr.flow, ofproto->max_ports);
     if (error) {
@@ -4586,6 +4710,9 @@ rule_destruct(struct rule *rule_)
     struct rule_dpif *rule = rule_dpif_cast(rule_);
     struct facet *facet, *next_facet;
 
+    /* The cache might still map some flows to 'rule', which is no longer in
+     * its table, so flush it before revalidating 'rule''s facets. */
+    rule_flush_lookup_cache(rule);
     LIST_FOR_EACH_SAFE (facet, next_facet, list_node, &rule->facets) {
         facet_revalidate(facet);
     }
@@ -4634,6 +4761,7 @@ rule_execute(struct rule *rule_, const struct flow *flow,
                           rule, stats.tcp_flags, packet);
     ctx.resubmit_stats = &stats;
     xlate_actions(&ctx, rule->up.actions, rule->up.n_actions, &odp_actions);
+    learned_flows_flush(ofproto);
 
     execute_odp_actions(ofproto, flow, odp_actions.data,
                         odp_actions.size, packet);
@@ -4650,6 +4778,8 @@ rule_modify_actions(struct rule *rule_)
     struct ofproto_dpif *ofproto = ofproto_dpif_cast(rule->up.ofproto);
     enum ofperr error;
 
+    rule_flush_lookup_cache(rule);
+
     error = validate_actions(rule->up.actions, rule->up.n_actions,
                              &rule->up.cr.flow, ofproto->max_ports);
     if (error) {
@@ -4904,6 +5034,36 @@ compose_output_action(struct action_xlate_ctx *ctx, uint16_t ofp_port)
     compose_output_action__(ctx, ofp_port, true);
 }
 
+/* Looks up 'ctx->flow' in 'table_id', reusing the result of an identical
+ * earlier lookup in the same translation if there is one. */
+static struct rule_dpif *
+xlate_lookup(struct action_xlate_ctx *ctx, uint8_t table_id)
+{
+    struct rule_dpif *rule;
+    int i;
+
+    for (i = 0; i < ctx->n_memo; i++) {
+        if (ctx->memo[i].table_id == table_id
+            && flow_equal(&ctx->memo[i].flow, &ctx->flow)) {
+            COVERAGE_INC(ofproto_dpif_xlate_memo_hit);
+            return ctx->memo[i].rule;
+        }
+    }
+
+    rule = rule_dpif_lookup__(ctx->ofproto, &ctx->flow, table_id);
+
+    i = ctx->next_memo;
+    ctx->next_memo = (i + 1) % XLATE_MEMO_SIZE;
+    if (ctx->n_memo < XLATE_MEMO_SIZE) {
+        ctx->n_memo++;
+    }
+    ctx->memo[i].flow = ctx->flow;
+    ctx->memo[i].rule = rule;
+    ctx->memo[i].table_id = table_id;
+
+    return rule;
+}
+
 static void
 xlate_table_action(struct action_xlate_ctx *ctx,
                    uint16_t in_port, uint8_t table_id)
@@ -4920,7 +5080,7 @@ xlate_table_action(struct action_xlate_ctx *ctx,
         /* Look up a flow with 'in_port' as the input port. */
         old_in_port = ctx->flow.in_port;
         ctx->flow.in_port = in_port;
-        rule = rule_dpif_lookup__(ofproto, &ctx->flow, table_id);
+        rule = xlate_lookup(ctx, table_id);
 
         /* Tag the flow. */
         if (table_id > 0 && table_id < N_TABLES) {
@@ -5264,28 +5424,117 @@ static void
 xlate_learn_action(struct action_xlate_ctx *ctx,
                    const struct nx_action_learn *learn)
 {
-    static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(5, 1);
+    struct ofproto_dpif *ofproto = ctx->ofproto;
+    struct learned_flow *lf;
     struct ofputil_flow_mod fm;
-    int error;
+    uint32_t hash;
 
     learn_execute(learn, &ctx->flow, &fm);
 
-    error = ofproto_flow_mod(&ctx->ofproto->up, &fm);
-    if (error && !VLOG_DROP_WARN(&rl)) {
-        VLOG_WARN("learning action failed to modify flow table (%s)",
-                  ofperr_get_name(error));
+    /* If the same flow was already learned since the last flush, the newer
+     * flow_mod supersedes the older one. */
+    hash = cls_rule_hash(&fm.cr, fm.table_id);
+    HMAP_FOR_EACH_WITH_HASH (lf, hmap_node, hash, &ofproto->learned_flows) {
+        if (lf->fm.table_id == fm.table_id
+            && cls_rule_equal(&lf->fm.cr, &fm.cr)) {
+            COVERAGE_INC(ofproto_dpif_learn_coalesced);
+            free(lf->fm.actions);
+            lf->fm = fm;
+            return;
+        }
+    }
+
+    /* Usually the flow is already in the flow table, unchanged, so that all
+     * there is to do is to refresh it. */
+    if (ofproto_refresh_flow(&ofproto->up, &fm)) {
+        COVERAGE_INC(ofproto_dpif_learn_refreshed);
+        free(fm.actions);
+        return;
     }
 
-    free(fm.actions);
+    learned_flow_queue(ofproto, &fm, hash);
+}
+
+/* Queues 'fm', whose match hashes to 'hash', for execution by
+ * learned_flows_flush(), which takes ownership of 'fm->actions'. */
+static void
+learned_flow_queue(struct ofproto_dpif *ofproto,
+                   const struct ofputil_flow_mod *fm, uint32_t hash)
+{
+    struct learned_flow *lf = xmalloc(sizeof *lf);
+
+    lf->fm = *fm;
+    hmap_insert(&ofproto->learned_flows, &lf->hmap_node, hash);
+    list_push_back(&ofproto->learned_list, &lf->list_node);
 }
 
-/* Reduces '*timeout' to no more than 'max'.  A value of zero in either case
- * means "infinite". */
+/* Executes the flow_mods generated by "learn" actions since the last call, as
+ * a single batch, so that 'ofproto' revalidates its facets only once for all
+ * of them. */
 static void
-reduce_timeout(uint16_t max, uint16_t *timeout)
+learned_flows_flush(struct ofproto_dpif *ofproto)
 {
-    if (max && (!*timeout || *timeout > max)) {
-        *timeout = max;
+    static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(5, 1);
+    struct ofputil_flow_mod *fms;
+    struct learned_flow *lf;
+    size_t n, i;
+
+    if (hmap_is_empty(&ofproto->learned_flows)) {
+        return;
+    }
+
+    n = hmap_count(&ofproto->learned_flows);
+    fms = xmalloc(n * sizeof *fms);
+    i = 0;
+    LIST_FOR_EACH (lf, list_node, &ofproto->learned_list) {
+        fms[i++] = lf->fm;
+        lf->fm.actions = NULL;
+    }
+    learned_flows_clear(ofproto);
+
+    /* Skip past any flow_mod that fails, so that one bad flow does not keep
+     * the others from being learned. */
+    for (i = 0; i < n; ) {
+        size_t n_done;
+        int error;
+
+        error = ofproto_flow_mods(&ofproto->up, &fms[i], n - i, &n_done);
+        i += n_done;
+        if (error == OFPROTO_POSTPONE) {
+            /* Other flow table operations are still in progress.  Keep the
+             * rest of the flow_mods queued to try again later. */
+            for (; i < n; i++) {
+                learned_flow_queue(ofproto, &fms[i],
+                                   cls_rule_hash(&fms[i].cr, fms[i].table_id));
+                fms[i].actions = NULL;
+            }
+        } else if (error) {
+            if (!VLOG_DROP_WARN(&rl)) {
+                VLOG_WARN("learning action failed to modify flow table (%s)",
+                          ofperr_get_name(error));
+            }
+            i++;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        free(fms[i].actions);
+    }
+    free(fms);
+}
+
+/* Discards the flow_mods generated by "learn" actions since the last call to
+ * learned_flows_flush(). */
+static void
+learned_flows_clear(struct ofproto_dpif *ofproto)
+{
+    struct learned_flow *lf, *next;
+
+    LIST_FOR_EACH_SAFE (lf, next, list_node, &ofproto->learned_list) {
+        hmap_remove(&ofproto->learned_flows, &lf->hmap_node);
+        list_remove(&lf->list_node);
+        free(lf->fm.actions);
+        free(lf);
     }
 }
 
@@ -5296,8 +5545,8 @@ xlate_fin_timeout(struct action_xlate_ctx *ctx,
     if (ctx->tcp_flags & (TCP_FIN | TCP_RST) && ctx->rule) {
         struct rule_dpif *rule = ctx->rule;
 
-        reduce_timeout(ntohs(naft->fin_idle_timeout), &rule->up.idle_timeout);
-        reduce_timeout(ntohs(naft->fin_hard_timeout), &rule->up.hard_timeout);
+        ofproto_rule_reduce_timeouts(&rule->up, ntohs(naft->fin_idle_timeout),
+                                     ntohs(naft->fin_hard_timeout));
     }
 }
 
@@ -5581,6 +5830,8 @@ xlate_actions(struct action_xlate_ctx *ctx,
     ctx->mirrors = 0;
     ctx->recurse = 0;
     ctx->max_resubmit_trigger = false;
+    ctx->n_memo = 0;
+    ctx->next_memo = 0;
     ctx->orig_skb_priority = ctx->flow.skb_priority;
     ctx->table_id = 0;
     ctx->exit = false;
@@ -6299,6 +6550,7 @@ rule_invalidate(const struct rule_dpif *rule)
 {
     struct ofproto_dpif *ofproto = ofproto_dpif_cast(rule->up.ofproto);
 
+    rule_flush_lookup_cache(rule);
     table_update_taggable(ofproto, rule->up.table_id);
 
     if (!ofproto->need_revalidate) {
@@ -6319,6 +6571,11 @@ set_frag_handling(struct ofproto *ofproto_,
     struct ofproto_dpif *ofproto = ofproto_dpif_cast(ofproto_);
 
     if (frag_handling != OFPC_FRAG_REASM) {
+        int i;
+
+        for (i = 0; i < N_TABLES; i++) {
+            lookup_cache_flush(&ofproto->tables[i]);
+        }
         ofproto->need_revalidate = true;
         return true;
     } else {
@@ -6362,6 +6619,7 @@ packet_out(struct ofproto *ofproto_, struct ofpbuf *packet,
         ofpbuf_use_stub(&odp_actions,
                         odp_actions_stub, sizeof odp_actions_stub);
         xlate_actions(&ctx, ofp_actions, n_ofp_actions, &odp_actions);
+        learned_flows_flush(ofproto);
         dpif_execute(ofproto->dpif, key.data, key.size,
                      odp_actions.data, odp_actions.size, packet);
         ofpbuf_uninit(&odp_actions);
@@ -6428,7 +6686,7 @@ send_netflow_active_timeouts(struct ofproto_dpif *ofproto)
 {
     struct facet *facet;
 
-    HMAP_FOR_EACH (facet, hmap_node, &ofproto->facets) {
+    CMAP_FOR_EACH (facet, cmap_node, &ofproto->facets) {
         send_active_timeout(ofproto, facet);
     }
 }
@@ -6484,7 +6742,7 @@ ofproto_unixctl_fdb_show(struct unixctl_conn *conn, int argc OVS_UNUSED,
     }
 
     ds_put_cstr(&ds, " port  VLAN  MAC                Age\n");
-    LIST_FOR_EACH (e, lru_node, &ofproto->ml->lrus) {
+    MAC_LEARNING_FOR_EACH (e, ofproto->ml) {
         struct ofbundle *bundle = e->port.p;
         ds_put_format(&ds, "%5d  %4d  "ETH_ADDR_FMT"  %3d\n",
                       ofbundle_get_a_port(bundle)->odp_port,
@@ -6728,6 +6986,7 @@ ofproto_trace(struct ofproto_dpif *ofproto, const struct flow *flow,
         trace.ctx.resubmit_hook = trace_resubmit;
         xlate_actions(&trace.ctx, rule->up.actions, rule->up.n_actions,
                       &odp_actions);
+        learned_flows_flush(ofproto);
 
         ds_put_char(ds, '\n');
         trace_format_flow(ds, 0, "Final flow", &trace);
@@ -6808,7 +7067,7 @@ ofproto_dpif_self_check__(struct ofproto_dpif *ofproto, struct ds *reply)
     int errors;
 
     errors = 0;
-    HMAP_FOR_EACH (facet, hmap_node, &ofproto->facets) {
+    CMAP_FOR_EACH (facet, cmap_node, &ofproto->facets) {
         if (!facet_check_consistency(facet)) {
             errors++;
         }
@@ -7118,5 +7377,6 @@ const struct ofproto_class ofproto_dpif_class = {
     is_mirror_output_bundle,
     forward_bpdu_changed,
     set_mac_idle_time,
+    set_mac_table_size,
     set_realdev,
 };
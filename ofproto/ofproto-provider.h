@@ -27,6 +27,7 @@
 #include "ofp-errors.h"
 #include "ofp-util.h"
 #include "shash.h"
+#include "timer-wheel.h"
 #include "timeval.h"
 
 struct ofputil_flow_mod;
@@ -73,6 +74,16 @@ struct ofproto {
     struct list pending;        /* List of "struct ofopgroup"s. */
     unsigned int n_pending;     /* list_size(&pending). */
     struct hmap deletions;      /* All OFOPERATION_DELETE "ofoperation"s. */
+    struct ofopgroup *batch;    /* Group for a batch of flow_mods, if any. */
+
+    /* In-progress flow and aggregate statistics requests. */
+    struct list flow_dumps;     /* Contains "struct flow_dump"s. */
+
+    /* Contains each "struct rule" that has a hard or idle timeout, keyed on
+     * the earliest time, in seconds, at which it might expire.  This is
+     * updated lazily when a rule is used or modified, so it may be earlier
+     * than the rule's 'expires' time, but never later. */
+    struct timer_wheel expirations;
 
     /* Linux VLAN device support (e.g. "eth0.10" for VLAN 10.)
      *
@@ -117,6 +128,11 @@ struct oftable {
     struct classifier cls;      /* Contains "struct rule"s. */
     char *name;                 /* Table name exposed via OpenFlow, or NULL. */
 
+    /* Contains "struct rule"s, in the order that they were inserted.  Unlike
+     * 'cls', this has a stable order, so that a flow statistics request can
+     * walk the table a few rules at a time even as rules come and go. */
+    struct list rules;
+
     /* Maximum number of flows or UINT_MAX if there is no limit besides any
      * limit imposed by resource limitations. */
     unsigned int max_flows;
@@ -142,6 +158,16 @@ struct oftable {
     uint32_t eviction_group_id_basis;
     struct hmap eviction_groups_by_id;
     struct heap eviction_groups_by_size;
+
+    /* Contains "struct rule"s, indexed by 'flow_cookie', so that flow_mod and
+     * flow stats requests that match a single cookie exactly need not visit
+     * every rule in the table. */
+    struct hmap cookies;
+
+    /* Contains a "struct rule_out_port" for each port to which each rule in
+     * the table outputs, indexed by port, so that requests that specify an
+     * out_port need not look at the actions of every rule in the table. */
+    struct hmap out_ports;
 };
 
 /* Assigns TABLE to each oftable, in turn, in OFPROTO.
@@ -160,16 +186,21 @@ struct rule {
     struct list ofproto_node;    /* Owned by ofproto base code. */
     struct ofproto *ofproto;     /* The ofproto that contains this rule. */
     struct cls_rule cr;          /* In owning ofproto's classifier. */
+    struct list table_node;      /* In owning oftable's "rules" list. */
 
     struct ofoperation *pending; /* Operation now in progress, if nonnull. */
 
     ovs_be64 flow_cookie;        /* Controller-issued identifier. */
+    struct hmap_node cookie_node; /* In owning oftable's "cookies". */
 
     long long int created;       /* Creation time. */
     long long int modified;      /* Time of last modification. */
     long long int used;          /* Last use; time created if never used. */
     uint16_t hard_timeout;       /* In seconds from ->modified. */
     uint16_t idle_timeout;       /* In seconds from ->used. */
+    long long int expires;       /* Time of hard or idle expiration, or
+                                  * LLONG_MAX if never or not in an oftable. */
+    struct timer_wheel_node expiry_node; /* In ofproto's "expirations". */
     uint8_t table_id;            /* Index in ofproto's 'tables' array. */
     bool send_flow_removed;      /* Send a flow removed message? */
 
@@ -180,6 +211,11 @@ struct rule {
 
     union ofp_action *actions;   /* OpenFlow actions. */
     int n_actions;               /* Number of elements in actions[]. */
+
+    /* Distinct ports to which 'actions' output, each in the owning oftable's
+     * "out_ports" index.  Owned by ofproto base code. */
+    struct rule_out_port *out_ports;
+    size_t n_out_ports;
 };
 
 static inline struct rule *
@@ -189,6 +225,9 @@ rule_from_cls_rule(const struct cls_rule *cls_rule)
 }
 
 void ofproto_rule_update_used(struct rule *, long long int used);
+void ofproto_rule_reduce_timeouts(struct rule *, uint16_t idle_timeout,
+                                  uint16_t hard_timeout);
+void ofproto_collect_expired_rules(struct ofproto *, struct list *rules);
 void ofproto_rule_expire(struct rule *, uint8_t reason);
 void ofproto_rule_destroy(struct rule *);
 
@@ -380,6 +419,8 @@ struct ofproto_class {
      *
      *   - Call ofproto_rule_expire() for each OpenFlow flow that has reached
      *     its hard_timeout or idle_timeout, to expire the flow.
+     *     ofproto_collect_expired_rules() finds these flows without visiting
+     *     the flows that have not expired.
      *
      * Returns 0 if successful, otherwise a positive errno value. */
     int (*run)(struct ofproto *ofproto);
@@ -1150,6 +1191,10 @@ struct ofproto_class {
      * in seconds. */
     void (*set_mac_idle_time)(struct ofproto *ofproto, unsigned int idle_time);
 
+    /* Sets the maximum number of MAC learning entries for the OFPP_NORMAL
+     * action to 'mac_table_size'. */
+    void (*set_mac_table_size)(struct ofproto *ofproto, size_t mac_table_size);
+
 /* Linux VLAN device support (e.g. "eth0.10" for VLAN 10.)
  *
  * This is deprecated.  It is only for compatibility with broken device drivers
@@ -1188,6 +1233,9 @@ enum { OFPROTO_POSTPONE = 1 << 16 };
 BUILD_ASSERT_DECL(OFPROTO_POSTPONE < OFPERR_OFS);
 
 int ofproto_flow_mod(struct ofproto *, const struct ofputil_flow_mod *);
+int ofproto_flow_mods(struct ofproto *, const struct ofputil_flow_mod *,
+                      size_t n, size_t *n_done);
+bool ofproto_refresh_flow(struct ofproto *, const struct ofputil_flow_mod *);
 void ofproto_add_flow(struct ofproto *, const struct cls_rule *,
                       const union ofp_action *, size_t n_actions);
 bool ofproto_delete_flow(struct ofproto *, const struct cls_rule *);
@@ -41,7 +41,6 @@
 #include "openflow/openflow.h"
 #include "packets.h"
 #include "pinsched.h"
-#include "pktbuf.h"
 #include "poll-loop.h"
 #include "random.h"
 #include "shash.h"
@@ -55,6 +54,7 @@
 VLOG_DEFINE_THIS_MODULE(ofproto);
 
 COVERAGE_DEFINE(ofproto_error);
+COVERAGE_DEFINE(ofproto_expiry_reschedule);
 COVERAGE_DEFINE(ofproto_flush);
 COVERAGE_DEFINE(ofproto_no_packet_in);
 COVERAGE_DEFINE(ofproto_packet_out);
@@ -140,9 +140,21 @@ static void oftable_enable_eviction(struct oftable *,
                                     size_t n_fields);
 
 static void oftable_remove_rule(struct rule *);
+static void oftable_set_rule_cookie(struct rule *, ovs_be64 new_cookie);
+static void oftable_set_rule_actions(struct rule *,
+                                     union ofp_action *, size_t n_actions);
 static struct rule *oftable_replace_rule(struct rule *);
 static void oftable_substitute_rule(struct rule *old, struct rule *new);
 
+/* Returns the hash of 'cookie' in an oftable's "cookies" index. */
+static uint32_t
+hash_cookie(ovs_be64 cookie)
+{
+    uint64_t c = ntohll(cookie);
+
+    return hash_2words(c >> 32, c);
+}
+
 /* A set of rules within a single OpenFlow table (oftable) that have the same
  * values for the oftable's eviction_fields.  A rule to be evicted, when one is
  * needed, is taken from the eviction group that contains the greatest number
@@ -165,9 +177,66 @@ struct eviction_group {
     struct heap rules;          /* Contains "struct rule"s. */
 };
 
+/* One of the ports to which a rule's actions output, as a member of its
+ * oftable's "out_ports" index.  A rule in an oftable has one of these for each
+ * distinct port to which it outputs, in its 'out_ports' array. */
+struct rule_out_port {
+    struct hmap_node hmap_node; /* In oftable's "out_ports". */
+    struct rule *rule;          /* Rule whose actions output to 'port'. */
+    uint16_t port;              /* OpenFlow port number. */
+};
+
+/* An OpenFlow flow or aggregate statistics request in progress.
+ *
+ * A statistics request that might match every rule in a large flow table is
+ * carried out a few rules at a time, by walking each oftable's "rules" list,
+ * so that it neither builds replies for every rule in memory at once nor
+ * stalls the main loop.  Each call to flow_dump_run() visits at most
+ * FLOW_DUMP_MAX_RULES rules and queues replies only while the requesting
+ * ofconn has room for them.  Removing a rule from an oftable advances any
+ * flow_dump that was about to visit it, so every rule that exists for the
+ * whole duration of a request is reported exactly once.
+ *
+ * As with ofopgroups, if list_is_empty(ofconn_node) then the connection that
+ * made the request has dropped and 'ofconn' must not be used. */
+struct flow_dump {
+    struct ofproto *ofproto;    /* Owning ofproto. */
+    struct list ofproto_node;   /* In ofproto's "flow_dumps" list. */
+    struct list ofconn_node;    /* In ofconn's list of pending dumps. */
+    struct ofconn *ofconn;      /* ofconn for replies (but see note above). */
+    struct ofp_stats_msg *request; /* Original request. */
+
+    /* Position. */
+    struct ofputil_flow_stats_request fsr; /* Rules to report. */
+    struct oftable *table;      /* Table being walked, NULL when done. */
+    struct rule *next;          /* Next rule to visit in 'table', if any. */
+
+    /* Results. */
+    struct list replies;        /* Flow stats replies not yet sent. */
+    struct ofputil_aggregate_stats stats; /* Aggregate stats so far. */
+    bool unknown_packets;       /* Some rule had unknown packet count? */
+    bool unknown_bytes;         /* Some rule had unknown byte count? */
+};
+
+/* Maximum number of rules that a flow_dump visits in one flow_dump_run(). */
+#define FLOW_DUMP_MAX_RULES 1000
+
+static void flow_dump_destroy(struct flow_dump *);
+static bool flow_dump_run(struct flow_dump *);
+static void flow_dumps_forget_rule(struct ofproto *, struct rule *);
+
+/* Maximum number of rules that ofproto_evict() evicts in one pass. */
+#define EVICT_MAX_RULES 1000
+
 static struct rule *choose_rule_to_evict(struct oftable *);
-static void ofproto_evict(struct ofproto *);
+static bool ofproto_evict(struct ofproto *);
 static uint32_t rule_eviction_priority(struct rule *);
+static void eviction_group_add_rule(struct rule *);
+static void eviction_group_remove_rule(struct rule *);
+
+static void rule_schedule_expiration(struct rule *);
+static void rule_unschedule_expiration(struct rule *);
+static void rule_update_expiration(struct rule *);
 
 /* ofport. */
 static void ofport_destroy__(struct ofport *);
@@ -187,6 +256,10 @@ static bool rule_is_hidden(const struct rule *);
 static enum ofperr add_flow(struct ofproto *, struct ofconn *,
                             const struct ofputil_flow_mod *,
                             const struct ofp_header *);
+static enum ofperr handle_flow_mods__(struct ofproto *, struct ofconn *,
+                                      const struct ofputil_flow_mod *,
+                                      size_t n, const struct ofp_header *,
+                                      size_t *n_done);
 static void delete_flow__(struct rule *, struct ofopgroup *);
 static bool handle_openflow(struct ofconn *, struct ofpbuf *);
 static enum ofperr handle_flow_mod__(struct ofproto *, struct ofconn *,
@@ -386,6 +459,9 @@ ofproto_create(const char *datapath_name, const char *datapath_type,
     list_init(&ofproto->pending);
     ofproto->n_pending = 0;
     hmap_init(&ofproto->deletions);
+    ofproto->batch = NULL;
+    list_init(&ofproto->flow_dumps);
+    timer_wheel_init(&ofproto->expirations, time_msec() / 1000);
     ofproto->vlan_bitmap = NULL;
     ofproto->vlans_changed = false;
     ofproto->min_mtu = INT_MAX;
@@ -515,6 +591,16 @@ ofproto_set_mac_idle_time(struct ofproto *ofproto, unsigned idle_time)
     }
 }
 
+/* Sets the maximum number of MAC learning entries for the OFPP_NORMAL action
+ * on 'ofproto' to 'mac_table_size'. */
+void
+ofproto_set_mac_table_size(struct ofproto *ofproto, size_t mac_table_size)
+{
+    if (ofproto->ofproto_class->set_mac_table_size) {
+        ofproto->ofproto_class->set_mac_table_size(ofproto, mac_table_size);
+    }
+}
+
 void
 ofproto_set_desc(struct ofproto *p,
                  const char *mfr_desc, const char *hw_desc,
@@ -951,12 +1037,16 @@ ofproto_flush__(struct ofproto *ofproto)
 static void
 ofproto_destroy__(struct ofproto *ofproto)
 {
+    struct flow_dump *dump, *next_dump;
     struct oftable *table;
 
     assert(list_is_empty(&ofproto->pending));
     assert(!ofproto->n_pending);
 
     connmgr_destroy(ofproto->connmgr);
+    LIST_FOR_EACH_SAFE (dump, next_dump, ofproto_node, &ofproto->flow_dumps) {
+        flow_dump_destroy(dump);
+    }
 
     hmap_remove(&all_ofprotos, &ofproto->hmap_node);
     free(ofproto->name);
@@ -1028,6 +1118,7 @@ process_port_change(struct ofproto *ofproto, int error, char *devname)
 int
 ofproto_run(struct ofproto *p)
 {
+    struct flow_dump *dump, *next_dump;
     struct sset changed_netdevs;
     const char *changed_netdev;
     struct ofport *ofport;
@@ -1072,8 +1163,8 @@ ofproto_run(struct ofproto *p)
 
     case S_EVICT:
         connmgr_run(p->connmgr, NULL);
-        ofproto_evict(p);
-        if (list_is_empty(&p->pending) && hmap_is_empty(&p->deletions)) {
+        if (!ofproto_evict(p)
+            && list_is_empty(&p->pending) && hmap_is_empty(&p->deletions)) {
             p->state = S_OPENFLOW;
         }
         break;
@@ -1091,6 +1182,15 @@ ofproto_run(struct ofproto *p)
         NOT_REACHED();
     }
 
+    LIST_FOR_EACH_SAFE (dump, next_dump, ofproto_node, &p->flow_dumps) {
+        if (list_is_empty(&dump->ofconn_node) || flow_dump_run(dump)) {
+            flow_dump_destroy(dump);
+
+            /* Requests postponed behind the dump may now proceed. */
+            connmgr_retry(p->connmgr);
+        }
+    }
+
     return error;
 }
 
@@ -1116,6 +1216,7 @@ ofproto_run_fast(struct ofproto *p)
 void
 ofproto_wait(struct ofproto *p)
 {
+    struct flow_dump *dump;
     struct ofport *ofport;
 
     p->ofproto_class->wait(p);
@@ -1142,6 +1243,17 @@ ofproto_wait(struct ofproto *p)
         }
         break;
     }
+
+    LIST_FOR_EACH (dump, ofproto_node, &p->flow_dumps) {
+        /* A dump that is waiting for its connection to drain will be woken
+         * by the connection, and one that is waiting for an operation on a
+         * rule to complete will be woken when it completes. */
+        if (list_is_empty(&dump->ofconn_node)
+            || ((!dump->next || !dump->next->pending)
+                && ofconn_has_reply_room(dump->ofconn))) {
+            poll_immediate_wake();
+        }
+    }
 }
 
 bool
@@ -1373,6 +1485,62 @@ ofproto_flow_mod(struct ofproto *ofproto, const struct ofputil_flow_mod *fm)
     return handle_flow_mod__(ofproto, NULL, fm, NULL);
 }
 
+/* Executes the 'n' flow modifications in 'fms', in order, as a batch: the
+ * operations that they initiate all belong to a single group, so that the
+ * ofproto implementation processes them together and revalidates its
+ * datapath flows only once.
+ *
+ * Returns 0 if every flow_mod succeeds.  If one fails, returns its OFPERR_*
+ * error code without executing the rest, leaving the ones before it in
+ * effect.  Returns OFPROTO_POSTPONE, without executing any of them, if the
+ * batch cannot be initiated now but may be retried later.  In any case, if
+ * 'n_done' is nonnull, stores the number of flow_mods that were executed
+ * successfully in '*n_done'. */
+int
+ofproto_flow_mods(struct ofproto *ofproto, const struct ofputil_flow_mod *fms,
+                  size_t n, size_t *n_done)
+{
+    return handle_flow_mods__(ofproto, NULL, fms, n, NULL, n_done);
+}
+
+/* If executing 'fm', an OFPFC_MODIFY_STRICT flow_mod, would only update the
+ * modification time of an existing rule, because the rule already has the
+ * actions and cookie that 'fm' specifies, then updates that time directly,
+ * without the overhead of a flow table operation, and returns true.
+ * Otherwise, returns false without doing anything, and the caller should
+ * execute 'fm' in the ordinary way.
+ *
+ * This is a helper function for the "learn" action, which usually relearns a
+ * flow that it learned before. */
+bool
+ofproto_refresh_flow(struct ofproto *ofproto,
+                     const struct ofputil_flow_mod *fm)
+{
+    struct rule *rule;
+
+    if (fm->command != OFPFC_MODIFY_STRICT
+        || fm->table_id >= ofproto->n_tables) {
+        return false;
+    }
+
+    rule = rule_from_cls_rule(classifier_find_rule_exactly(
+                                  &ofproto->tables[fm->table_id].cls,
+                                  &fm->cr));
+    if (!rule
+        || rule->pending
+        || !rule_is_modifiable(rule)
+        || (fm->new_cookie != htonll(UINT64_MAX)
+            && fm->new_cookie != rule->flow_cookie)
+        || !ofputil_actions_equal(fm->actions, fm->n_actions,
+                                  rule->actions, rule->n_actions)) {
+        return false;
+    }
+
+    rule->modified = time_msec();
+    rule_update_expiration(rule);
+    return true;
+}
+
 /* Searches for a rule with matching criteria exactly equal to 'target' in
  * ofproto's table 0 and, if it finds one, deletes it.
  *
@@ -1844,14 +2012,13 @@ ofproto_rule_destroy(struct rule *rule)
 static bool
 rule_has_out_port(const struct rule *rule, uint16_t out_port)
 {
-    const union ofp_action *oa;
-    size_t left;
+    size_t i;
 
     if (out_port == OFPP_NONE) {
         return true;
     }
-    OFPUTIL_ACTION_FOR_EACH_UNSAFE (oa, left, rule->actions, rule->n_actions) {
-        if (action_outputs_to_port(oa, htons(out_port))) {
+    for (i = 0; i < rule->n_out_ports; i++) {
+        if (rule->out_ports[i].port == out_port) {
             return true;
         }
     }
@@ -1921,7 +2088,7 @@ handle_features_request(struct ofconn *ofconn, const struct ofp_header *oh)
     assert(features.actions & OFPUTIL_A_OUTPUT); /* sanity check */
 
     features.datapath_id = ofproto->datapath_id;
-    features.n_buffers = pktbuf_capacity();
+    features.n_buffers = ofconn_get_n_buffers(ofconn);
     features.n_tables = ofproto->n_tables;
     features.capabilities = (OFPUTIL_C_FLOW_STATS | OFPUTIL_C_TABLE_STATS |
                              OFPUTIL_C_PORT_STATS | OFPUTIL_C_QUEUE_STATS);
@@ -2309,6 +2476,26 @@ next_matching_table(struct ofproto *ofproto,
          (TABLE) != NULL;                                         \
          (TABLE) = next_matching_table(OFPROTO, TABLE, TABLE_ID))
 
+/* Adds 'rule', which matches the flow criteria of a request, to 'rules' if it
+ * also meets the request's other criteria: it must not be hidden, it must
+ * output to 'out_port' (unless 'out_port' is OFPP_NONE), and its cookie must
+ * match 'cookie' in the bits set in 'cookie_mask'.
+ *
+ * Returns OFPROTO_POSTPONE if 'rule' has an operation pending, otherwise 0. */
+static enum ofperr
+collect_rule(struct rule *rule, ovs_be64 cookie, ovs_be64 cookie_mask,
+             uint16_t out_port, struct list *rules)
+{
+    if (rule->pending) {
+        return OFPROTO_POSTPONE;
+    }
+    if (!rule_is_hidden(rule) && rule_has_out_port(rule, out_port)
+        && !((rule->flow_cookie ^ cookie) & cookie_mask)) {
+        list_push_back(rules, &rule->ofproto_node);
+    }
+    return 0;
+}
+
 /* Searches 'ofproto' for rules in table 'table_id' (or in all tables, if
  * 'table_id' is 0xff) that match 'match' in the "loose" way required for
  * OpenFlow OFPFC_MODIFY and OFPFC_DELETE requests and puts them on list
@@ -2339,14 +2526,44 @@ collect_rules_loose(struct ofproto *ofproto, uint8_t table_id,
         struct cls_cursor cursor;
         struct rule *rule;
 
-        cls_cursor_init(&cursor, &table->cls, match);
-        CLS_CURSOR_FOR_EACH (rule, cr, &cursor) {
-            if (rule->pending) {
-                return OFPROTO_POSTPONE;
+        if (cookie_mask == htonll(UINT64_MAX)) {
+            /* Only rules with exactly 'cookie' can match, so visit just those
+             * instead of every rule in the table. */
+            HMAP_FOR_EACH_WITH_HASH (rule, cookie_node, hash_cookie(cookie),
+                                     &table->cookies) {
+                if (rule->flow_cookie == cookie
+                    && cls_rule_is_loose_match(&rule->cr, match)) {
+                    error = collect_rule(rule, cookie, cookie_mask, out_port,
+                                         rules);
+                    if (error) {
+                        return error;
+                    }
+                }
             }
-            if (!rule_is_hidden(rule) && rule_has_out_port(rule, out_port)
-                    && !((rule->flow_cookie ^ cookie) & cookie_mask)) {
-                list_push_back(rules, &rule->ofproto_node);
+        } else if (out_port != OFPP_NONE) {
+            struct rule_out_port *rop;
+
+            /* Similarly, visit only the rules that output to 'out_port'. */
+            HMAP_FOR_EACH_WITH_HASH (rop, hmap_node, hash_int(out_port, 0),
+                                     &table->out_ports) {
+                rule = rop->rule;
+                if (rop->port == out_port
+                    && cls_rule_is_loose_match(&rule->cr, match)) {
+                    error = collect_rule(rule, cookie, cookie_mask, out_port,
+                                         rules);
+                    if (error) {
+                        return error;
+                    }
+                }
+            }
+        } else {
+            cls_cursor_init(&cursor, &table->cls, match);
+            CLS_CURSOR_FOR_EACH (rule, cr, &cursor) {
+                error = collect_rule(rule, cookie, cookie_mask, out_port,
+                                     rules);
+                if (error) {
+                    return error;
+                }
             }
         }
     }
@@ -2385,12 +2602,9 @@ collect_rules_strict(struct ofproto *ofproto, uint8_t table_id,
         rule = rule_from_cls_rule(classifier_find_rule_exactly(&table->cls,
                                                                match));
         if (rule) {
-            if (rule->pending) {
-                return OFPROTO_POSTPONE;
-            }
-            if (!rule_is_hidden(rule) && rule_has_out_port(rule, out_port)
-                    && !((rule->flow_cookie ^ cookie) & cookie_mask)) {
-                list_push_back(rules, &rule->ofproto_node);
+            error = collect_rule(rule, cookie, cookie_mask, out_port, rules);
+            if (error) {
+                return error;
             }
         }
     }
@@ -2407,31 +2621,33 @@ age_secs(long long int age_ms)
             : (unsigned int) age_ms / 1000);
 }
 
-static enum ofperr
-handle_flow_stats_request(struct ofconn *ofconn,
-                          const struct ofp_stats_msg *osm)
+/* Appends the statistics for 'rule' to 'dump''s replies. */
+static void
+flow_dump_add_rule(struct flow_dump *dump, struct rule *rule)
 {
-    struct ofproto *ofproto = ofconn_get_ofproto(ofconn);
-    struct ofputil_flow_stats_request fsr;
-    struct list replies;
-    struct list rules;
-    struct rule *rule;
-    enum ofperr error;
+    struct ofproto *ofproto = dump->ofproto;
 
-    error = ofputil_decode_flow_stats_request(&fsr, &osm->header);
-    if (error) {
-        return error;
-    }
+    if (dump->fsr.aggregate) {
+        uint64_t packet_count;
+        uint64_t byte_count;
 
-    error = collect_rules_loose(ofproto, fsr.table_id, &fsr.match,
-                                fsr.cookie, fsr.cookie_mask,
-                                fsr.out_port, &rules);
-    if (error) {
-        return error;
-    }
+        ofproto->ofproto_class->rule_get_stats(rule, &packet_count,
+                                               &byte_count);
 
-    ofputil_start_stats_reply(osm, &replies);
-    LIST_FOR_EACH (rule, ofproto_node, &rules) {
+        if (packet_count == UINT64_MAX) {
+            dump->unknown_packets = true;
+        } else {
+            dump->stats.packet_count += packet_count;
+        }
+
+        if (byte_count == UINT64_MAX) {
+            dump->unknown_bytes = true;
+        } else {
+            dump->stats.byte_count += byte_count;
+        }
+
+        dump->stats.flow_count++;
+    } else {
         long long int now = time_msec();
         struct ofputil_flow_stats fs;
 
@@ -2448,13 +2664,209 @@ handle_flow_stats_request(struct ofconn *ofconn,
                                                &fs.byte_count);
         fs.actions = rule->actions;
         fs.n_actions = rule->n_actions;
-        ofputil_append_flow_stats_reply(&fs, &replies);
+        ofputil_append_flow_stats_reply(&fs, &dump->replies);
     }
-    ofconn_send_replies(ofconn, &replies);
+}
+
+/* Returns the first rule in 'table', or NULL if 'table' is NULL or empty. */
+static struct rule *
+flow_dump_first_rule(const struct oftable *table)
+{
+    return (table && !list_is_empty(&table->rules)
+            ? CONTAINER_OF(list_front(&table->rules), struct rule, table_node)
+            : NULL);
+}
+
+/* Returns the rule that follows 'rule' in its oftable, or NULL if 'rule' is
+ * the last one. */
+static struct rule *
+flow_dump_next_rule(const struct rule *rule)
+{
+    const struct oftable *table = &rule->ofproto->tables[rule->table_id];
+
+    return (rule->table_node.next != &table->rules
+            ? CONTAINER_OF(rule->table_node.next, struct rule, table_node)
+            : NULL);
+}
+
+/* Returns true if 'dump' should report 'rule'. */
+static bool
+flow_dump_wants_rule(const struct flow_dump *dump, const struct rule *rule)
+{
+    const struct ofputil_flow_stats_request *fsr = &dump->fsr;
+
+    return (!rule_is_hidden(rule)
+            && cls_rule_is_loose_match(&rule->cr, &fsr->match)
+            && rule_has_out_port(rule, fsr->out_port)
+            && !((rule->flow_cookie ^ fsr->cookie) & fsr->cookie_mask));
+}
+
+/* Starts a flow dump for 'fsr', which was decoded from 'request' received on
+ * 'ofconn'. */
+static struct flow_dump *
+flow_dump_create(struct ofconn *ofconn, const struct ofp_stats_msg *request,
+                 const struct ofputil_flow_stats_request *fsr)
+{
+    struct ofproto *ofproto = ofconn_get_ofproto(ofconn);
+    struct flow_dump *dump;
+
+    dump = xzalloc(sizeof *dump);
+    dump->ofproto = ofproto;
+    list_push_back(&ofproto->flow_dumps, &dump->ofproto_node);
+    dump->ofconn = ofconn;
+    ofconn_add_dump(ofconn, &dump->ofconn_node);
+    dump->request = xmemdup(request, ntohs(request->header.length));
+
+    dump->fsr = *fsr;
+    dump->table = first_matching_table(ofproto, fsr->table_id);
+    dump->next = flow_dump_first_rule(dump->table);
+
+    ofputil_start_stats_reply(dump->request, &dump->replies);
+
+    return dump;
+}
+
+static void
+flow_dump_destroy(struct flow_dump *dump)
+{
+    list_remove(&dump->ofproto_node);
+    list_remove(&dump->ofconn_node);
+    ofpbuf_list_delete(&dump->replies);
+    free(dump->request);
+    free(dump);
+}
+
+/* Visits up to FLOW_DUMP_MAX_RULES more rules for 'dump' and sends the
+ * replies that are complete.  Returns true if 'dump' is finished, in which
+ * case all of its replies have been sent and the caller should destroy it,
+ * false if it has more to do. */
+static bool
+flow_dump_run(struct flow_dump *dump)
+{
+    struct ofproto *ofproto = dump->ofproto;
+    struct ofconn *ofconn = dump->ofconn;
+    int n;
+
+    for (n = 0; dump->table && n < FLOW_DUMP_MAX_RULES; n++) {
+        struct rule *rule = dump->next;
+
+        if (!rule) {
+            dump->table = next_matching_table(ofproto, dump->table,
+                                              dump->fsr.table_id);
+            dump->next = flow_dump_first_rule(dump->table);
+            continue;
+        }
+
+        if (flow_dump_wants_rule(dump, rule)) {
+            if (rule->pending
+                || (!dump->fsr.aggregate && !ofconn_has_reply_room(ofconn))) {
+                break;
+            }
+            flow_dump_add_rule(dump, rule);
+        }
+        dump->next = flow_dump_next_rule(rule);
+    }
+
+    if (dump->table) {
+        /* Send the replies that are complete, that is, all but the last. */
+        while (list_front(&dump->replies) != list_back(&dump->replies)) {
+            struct ofpbuf *reply;
+
+            reply = ofpbuf_from_list(list_pop_front(&dump->replies));
+            ofconn_send_reply(ofconn, reply);
+        }
+        return false;
+    }
+
+    if (dump->fsr.aggregate) {
+        if (dump->unknown_packets) {
+            dump->stats.packet_count = UINT64_MAX;
+        }
+        if (dump->unknown_bytes) {
+            dump->stats.byte_count = UINT64_MAX;
+        }
+        ofconn_send_reply(ofconn, ofputil_encode_aggregate_stats_reply(
+                              &dump->stats, dump->request));
+    } else {
+        ofconn_send_replies(ofconn, &dump->replies);
+    }
+    return true;
+}
 
+/* Advances any of 'ofproto''s flow dumps that would visit 'rule' next, because
+ * 'rule' is being removed from its oftable. */
+static void
+flow_dumps_forget_rule(struct ofproto *ofproto, struct rule *rule)
+{
+    struct flow_dump *dump;
+
+    LIST_FOR_EACH (dump, ofproto_node, &ofproto->flow_dumps) {
+        if (dump->next == rule) {
+            dump->next = flow_dump_next_rule(rule);
+        }
+    }
+}
+
+/* Handles a flow or aggregate statistics request 'osm' received on 'ofconn'.
+ *
+ * Requests that select rules by exact cookie or by output port look up the
+ * rules they need in the oftables' indexes and are answered at once.  Others
+ * walk the flow tables in the background, with flow_dump_run(). */
+static enum ofperr
+handle_flow_dump_request(struct ofconn *ofconn,
+                         const struct ofp_stats_msg *osm)
+{
+    struct ofproto *ofproto = ofconn_get_ofproto(ofconn);
+    struct ofputil_flow_stats_request fsr;
+    struct flow_dump *dump;
+    enum ofperr error;
+
+    if (ofconn_has_pending_dumps(ofconn)) {
+        return OFPROTO_POSTPONE;
+    }
+
+    error = ofputil_decode_flow_stats_request(&fsr, &osm->header);
+    if (error) {
+        return error;
+    }
+
+    error = check_table_id(ofproto, fsr.table_id);
+    if (error) {
+        return error;
+    }
+
+    dump = flow_dump_create(ofconn, osm, &fsr);
+    if (fsr.cookie_mask == htonll(UINT64_MAX) || fsr.out_port != OFPP_NONE) {
+        struct list rules;
+        struct rule *rule;
+
+        error = collect_rules_loose(ofproto, fsr.table_id, &fsr.match,
+                                    fsr.cookie, fsr.cookie_mask,
+                                    fsr.out_port, &rules);
+        if (error) {
+            flow_dump_destroy(dump);
+            return error;
+        }
+
+        LIST_FOR_EACH (rule, ofproto_node, &rules) {
+            flow_dump_add_rule(dump, rule);
+        }
+        dump->table = NULL;
+    }
+
+    if (flow_dump_run(dump)) {
+        flow_dump_destroy(dump);
+    }
     return 0;
 }
 
+static enum ofperr
+handle_flow_stats_request(struct ofconn *ofconn,
+                          const struct ofp_stats_msg *osm)
+{
+    return handle_flow_dump_request(ofconn, osm);
+}
+
 static void
 flow_stats_ds(struct rule *rule, struct ds *results)
 {
@@ -2557,61 +2969,7 @@ static enum ofperr
 handle_aggregate_stats_request(struct ofconn *ofconn,
                                const struct ofp_stats_msg *osm)
 {
-    struct ofproto *ofproto = ofconn_get_ofproto(ofconn);
-    struct ofputil_flow_stats_request request;
-    struct ofputil_aggregate_stats stats;
-    bool unknown_packets, unknown_bytes;
-    struct ofpbuf *reply;
-    struct list rules;
-    struct rule *rule;
-    enum ofperr error;
-
-    error = ofputil_decode_flow_stats_request(&request, &osm->header);
-    if (error) {
-        return error;
-    }
-
-    error = collect_rules_loose(ofproto, request.table_id, &request.match,
-                                request.cookie, request.cookie_mask,
-                                request.out_port, &rules);
-    if (error) {
-        return error;
-    }
-
-    memset(&stats, 0, sizeof stats);
-    unknown_packets = unknown_bytes = false;
-    LIST_FOR_EACH (rule, ofproto_node, &rules) {
-        uint64_t packet_count;
-        uint64_t byte_count;
-
-        ofproto->ofproto_class->rule_get_stats(rule, &packet_count,
-                                               &byte_count);
-
-        if (packet_count == UINT64_MAX) {
-            unknown_packets = true;
-        } else {
-            stats.packet_count += packet_count;
-        }
-
-        if (byte_count == UINT64_MAX) {
-            unknown_bytes = true;
-        } else {
-            stats.byte_count += byte_count;
-        }
-
-        stats.flow_count++;
-    }
-    if (unknown_packets) {
-        stats.packet_count = UINT64_MAX;
-    }
-    if (unknown_bytes) {
-        stats.byte_count = UINT64_MAX;
-    }
-
-    reply = ofputil_encode_aggregate_stats_reply(&stats, osm);
-    ofconn_send_reply(ofconn, reply);
-
-    return 0;
+    return handle_flow_dump_request(ofconn, osm);
 }
 
 struct queue_stats_cbdata {
@@ -2793,8 +3151,11 @@ add_flow(struct ofproto *ofproto, struct ofconn *ofconn,
     rule->send_flow_removed = (fm->flags & OFPFF_SEND_FLOW_REM) != 0;
     rule->actions = ofputil_actions_clone(fm->actions, fm->n_actions);
     rule->n_actions = fm->n_actions;
+    rule->out_ports = NULL;
+    rule->n_out_ports = 0;
     rule->evictable = true;
     rule->eviction_group = NULL;
+    rule->expires = LLONG_MAX;
 
     /* Insert new rule. */
     victim = oftable_replace_rule(rule);
@@ -2879,14 +3240,16 @@ modify_flows__(struct ofproto *ofproto, struct ofconn *ofconn,
             ofoperation_create(group, rule, OFOPERATION_MODIFY);
             rule->pending->actions = rule->actions;
             rule->pending->n_actions = rule->n_actions;
-            rule->actions = ofputil_actions_clone(fm->actions, fm->n_actions);
-            rule->n_actions = fm->n_actions;
+            oftable_set_rule_actions(rule, ofputil_actions_clone(
+                                         fm->actions, fm->n_actions),
+                                     fm->n_actions);
             ofproto->ofproto_class->rule_modify_actions(rule);
         } else {
             rule->modified = time_msec();
+            rule_update_expiration(rule);
         }
         if (fm->new_cookie != htonll(UINT64_MAX)) {
-            rule->flow_cookie = fm->new_cookie;
+            oftable_set_rule_cookie(rule, fm->new_cookie);
         }
     }
     ofopgroup_submit(group);
@@ -3041,12 +3404,75 @@ void
 ofproto_rule_update_used(struct rule *rule, long long int used)
 {
     if (used > rule->used) {
-        struct eviction_group *evg = rule->eviction_group;
-
         rule->used = used;
-        if (evg) {
-            heap_change(&evg->rules, &rule->evg_node,
-                        rule_eviction_priority(rule));
+        if (rule->idle_timeout) {
+            rule_update_expiration(rule);
+        }
+    }
+}
+
+/* Reduces 'rule''s idle timeout to 'idle_timeout' and its hard timeout to
+ * 'hard_timeout', in seconds, for each of these that is nonzero and either
+ * less than the rule's current timeout or replacing no timeout at all.
+ * 'rule' must be in its oftable. */
+void
+ofproto_rule_reduce_timeouts(struct rule *rule,
+                             uint16_t idle_timeout, uint16_t hard_timeout)
+{
+    bool changed = false;
+
+    if (idle_timeout
+        && (!rule->idle_timeout || rule->idle_timeout > idle_timeout)) {
+        rule->idle_timeout = idle_timeout;
+        changed = true;
+    }
+    if (hard_timeout
+        && (!rule->hard_timeout || rule->hard_timeout > hard_timeout)) {
+        rule->hard_timeout = hard_timeout;
+        changed = true;
+    }
+
+    if (changed) {
+        /* 'rule' might not have had any timeouts before, in which case it is
+         * not yet in an eviction group either. */
+        eviction_group_remove_rule(rule);
+        rule_unschedule_expiration(rule);
+        rule_schedule_expiration(rule);
+        eviction_group_add_rule(rule);
+    }
+}
+
+/* Appends to 'rules', through their 'ofproto_node' members, each rule in
+ * 'ofproto' whose hard or idle timeout has passed.  The rules remain in
+ * 'ofproto' (and will be collected again by the next call) until the caller
+ * expires them, e.g. with ofproto_rule_expire().
+ *
+ * This takes time proportional to the number of rules whose deadlines in the
+ * "expirations" wheel have passed, not to the number of rules in 'ofproto'.
+ * Most of those rules have expired; the rest have been used since they were
+ * last scheduled and get new deadlines. */
+void
+ofproto_collect_expired_rules(struct ofproto *ofproto, struct list *rules)
+{
+    long long int now = time_msec();
+    struct list expired;
+
+    list_init(&expired);
+    timer_wheel_advance(&ofproto->expirations, now / 1000, &expired);
+    while (!list_is_empty(&expired)) {
+        struct rule *rule;
+
+        rule = CONTAINER_OF(list_pop_front(&expired),
+                            struct rule, expiry_node.list_node);
+
+        /* Put 'rule' back in the wheel: at its real deadline, if it has been
+         * used or modified since it was last scheduled, otherwise in the next
+         * second in case the caller does not expire it after all. */
+        rule_schedule_expiration(rule);
+        if (now > rule->expires) {
+            list_push_back(rules, &rule->ofproto_node);
+        } else {
+            COVERAGE_INC(ofproto_expiry_reschedule);
         }
     }
 }
@@ -3136,6 +3562,132 @@ handle_flow_mod__(struct ofproto *ofproto, struct ofconn *ofconn,
     }
 }
 
+/* Implements ofproto_flow_mods() and NXT_FLOW_MOD_BATCH.  'request' is the
+ * NXT_FLOW_MOD_BATCH message, if any. */
+static enum ofperr
+handle_flow_mods__(struct ofproto *ofproto, struct ofconn *ofconn,
+                   const struct ofputil_flow_mod *fms, size_t n,
+                   const struct ofp_header *request, size_t *n_done)
+{
+    struct ofopgroup *group;
+    int error;
+    size_t i;
+
+    if (n_done) {
+        *n_done = 0;
+    }
+
+    /* Wait for all other flow table operations to complete, so that a flow
+     * can only be busy because of an operation that this batch initiated. */
+    if (!list_is_empty(&ofproto->pending)) {
+        return OFPROTO_POSTPONE;
+    }
+
+    group = ofopgroup_create(ofproto, ofconn, request, UINT32_MAX);
+    ofproto->batch = group;
+    error = 0;
+    for (i = 0; i < n; i++) {
+        error = handle_flow_mod__(ofproto, ofconn, &fms[i], request);
+        if (error) {
+            if (error == OFPROTO_POSTPONE) {
+                /* Retrying the whole batch would repeat the flow_mods that
+                 * have already been executed. */
+                error = OFPERR_NXFMFC_BATCH_CONFLICT;
+            }
+            break;
+        }
+    }
+    ofproto->batch = NULL;
+    ofopgroup_submit(group);
+
+    if (n_done) {
+        *n_done = i;
+    }
+    return error;
+}
+
+/* Sends an error reply to 'ofconn' for 'msg', a flow_mod within the
+ * NXT_FLOW_MOD_BATCH message 'batch'.  The reply has the batch's xid, so that
+ * the controller can match it to the batch, but its data is from 'msg', so
+ * that the controller can tell which flow_mod failed. */
+static void
+send_flow_mod_batch_error(struct ofconn *ofconn,
+                          const struct ofp_header *batch,
+                          const struct ofp_header *msg, enum ofperr error)
+{
+    struct ofp_header *copy;
+
+    copy = xmemdup(msg, MIN(ntohs(msg->length), 64));
+    copy->xid = batch->xid;
+    ofconn_send_error(ofconn, copy, error);
+    free(copy);
+}
+
+static enum ofperr
+handle_flow_mod_batch(struct ofconn *ofconn, const struct ofp_header *oh)
+{
+    enum ofputil_protocol protocol = ofconn_get_protocol(ofconn);
+    const struct ofp_header **msgs;
+    struct ofputil_flow_mod *fms;
+    size_t n_fms, allocated_fms;
+    size_t n_done;
+    int error;
+    struct ofpbuf b;
+
+    error = reject_slave_controller(ofconn);
+    if (error) {
+        return error;
+    }
+
+    /* Decode all of the flow_mods before executing any of them. */
+    ofpbuf_use_const(&b, oh, ntohs(oh->length));
+    ofpbuf_pull(&b, sizeof(struct nx_flow_mod_batch));
+    msgs = NULL;
+    fms = NULL;
+    n_fms = allocated_fms = 0;
+    while (b.size > 0) {
+        const struct ofp_header *msg;
+        struct ofputil_flow_mod *fm;
+
+        error = ofputil_pull_flow_mod_from_batch(&b, &msg);
+        if (error) {
+            goto exit;
+        }
+
+        if (n_fms >= allocated_fms) {
+            fms = x2nrealloc(fms, &allocated_fms, sizeof *fms);
+            msgs = xrealloc(msgs, allocated_fms * sizeof *msgs);
+        }
+        fm = &fms[n_fms];
+        msgs[n_fms++] = msg;
+
+        error = ofputil_decode_flow_mod(fm, msg, protocol);
+        if (!error && fm->flags & OFPFF_EMERG) {
+            /* See handle_flow_mod(). */
+            error = OFPERR_OFPFMFC_ALL_TABLES_FULL;
+        } else if (!error && fm->buffer_id != UINT32_MAX) {
+            error = OFPERR_NXBRC_BAD_BATCH_MSG;
+        }
+        if (error) {
+            send_flow_mod_batch_error(ofconn, oh, msg, error);
+            error = 0;
+            goto exit;
+        }
+    }
+
+    error = handle_flow_mods__(ofconn_get_ofproto(ofconn), ofconn,
+                               fms, n_fms, oh, &n_done);
+    if (error && error != OFPROTO_POSTPONE) {
+        send_flow_mod_batch_error(ofconn, oh, msgs[n_done], error);
+        error = 0;
+    }
+
+exit:
+    free(msgs);
+    free(fms);
+    return error;
+}
+
 static enum ofperr
 handle_role_request(struct ofconn *ofconn, const struct ofp_header *oh)
 {
@@ -3266,7 +3818,8 @@ handle_barrier_request(struct ofconn *ofconn, const struct ofp_header *oh)
 {
     struct ofpbuf *buf;
 
-    if (ofconn_has_pending_opgroups(ofconn)) {
+    if (ofconn_has_pending_opgroups(ofconn)
+        || ofconn_has_pending_dumps(ofconn)) {
         return OFPROTO_POSTPONE;
     }
 
@@ -3336,6 +3889,9 @@ handle_openflow__(struct ofconn *ofconn, const struct ofpbuf *msg)
     case OFPUTIL_NXT_FLOW_MOD:
         return handle_flow_mod(ofconn, oh);
 
+    case OFPUTIL_NXT_FLOW_MOD_BATCH:
+        return handle_flow_mod_batch(ofconn, oh);
+
     case OFPUTIL_NXT_FLOW_AGE:
         /* Nothing to do. */
         return 0;
@@ -3443,7 +3999,14 @@ static struct ofopgroup *
 ofopgroup_create(struct ofproto *ofproto, struct ofconn *ofconn,
                  const struct ofp_header *request, uint32_t buffer_id)
 {
-    struct ofopgroup *group = ofopgroup_create_unattached(ofproto);
+    struct ofopgroup *group;
+
+    if (ofproto->batch) {
+        /* All of the flow_mods in a batch share the batch's group. */
+        return ofproto->batch;
+    }
+
+    group = ofopgroup_create_unattached(ofproto);
     if (ofconn) {
         size_t request_len = ntohs(request->length);
 
@@ -3466,6 +4029,11 @@ ofopgroup_create(struct ofproto *ofproto, struct ofconn *ofconn,
 static void
 ofopgroup_submit(struct ofopgroup *group)
 {
+    if (group == group->ofproto->batch) {
+        /* handle_flow_mods__() submits the batch's group at the end. */
+        return;
+    }
+
     if (list_is_empty(&group->ops)) {
         ofopgroup_destroy(group);
     } else {
@@ -3630,10 +4198,11 @@ ofoperation_complete(struct ofoperation *op, enum ofperr error)
     case OFOPERATION_MODIFY:
         if (!error) {
             rule->modified = time_msec();
+            rule_update_expiration(rule);
         } else {
+            oftable_set_rule_cookie(rule, op->flow_cookie);
             free(rule->actions);
-            rule->actions = op->actions;
-            rule->n_actions = op->n_actions;
+            oftable_set_rule_actions(rule, op->actions, op->n_actions);
             op->actions = NULL;
         }
         break;
@@ -3721,15 +4290,20 @@ choose_rule_to_evict(struct oftable *table)
 
 /* Searches 'ofproto' for tables that have more flows than their configured
  * maximum and that have flow eviction enabled, and evicts as many flows as
- * necessary and currently feasible from them.
+ * necessary and currently feasible from them, up to EVICT_MAX_RULES flows in
+ * all.  The evictions are submitted as a single ofopgroup.
+ *
+ * Returns true if it stopped because it reached EVICT_MAX_RULES, in which
+ * case the caller should call it again later, false otherwise.
  *
  * This triggers only when an OpenFlow table has N flows in it and then the
  * client configures a maximum number of flows less than N. */
-static void
+static bool
 ofproto_evict(struct ofproto *ofproto)
 {
     struct ofopgroup *group;
     struct oftable *table;
+    size_t n_evicted = 0;
 
     group = ofopgroup_create_unattached(ofproto);
     OFPROTO_FOR_EACH_TABLE (table, ofproto) {
@@ -3737,6 +4311,11 @@ ofproto_evict(struct ofproto *ofproto)
                && table->eviction_fields) {
             struct rule *rule;
 
+            if (n_evicted >= EVICT_MAX_RULES) {
+                ofopgroup_submit(group);
+                return true;
+            }
+
             rule = choose_rule_to_evict(table);
             if (!rule || rule->pending) {
                 break;
@@ -3745,9 +4324,11 @@ ofproto_evict(struct ofproto *ofproto)
             ofoperation_create(group, rule, OFOPERATION_DELETE);
             oftable_remove_rule(rule);
             ofproto->ofproto_class->rule_destruct(rule);
+            n_evicted++;
         }
     }
     ofopgroup_submit(group);
+    return false;
 }
 
 /* Eviction groups. */
@@ -3873,19 +4454,9 @@ eviction_group_find(struct oftable *table, uint32_t id)
 static uint32_t
 rule_eviction_priority(struct rule *rule)
 {
-    long long int hard_expiration;
-    long long int idle_expiration;
-    long long int expiration;
+    long long int expiration = rule->expires;
     uint32_t expiration_offset;
 
-    /* Calculate time of expiration. */
-    hard_expiration = (rule->hard_timeout
-                       ? rule->modified + rule->hard_timeout * 1000
-                       : LLONG_MAX);
-    idle_expiration = (rule->idle_timeout
-                       ? rule->used + rule->idle_timeout * 1000
-                       : LLONG_MAX);
-    expiration = MIN(hard_expiration, idle_expiration);
     if (expiration == LLONG_MAX) {
         return 0;
     }
@@ -3901,6 +4472,74 @@ rule_eviction_priority(struct rule *rule)
     return UINT32_MAX - expiration_offset;
 }
 
+/* Rule expiration. */
+
+/* Returns the time at which 'rule' expires, according to its hard and idle
+ * timeouts and its current 'modified' and 'used' times, or LLONG_MAX if it
+ * has no timeouts. */
+static long long int
+rule_expiration(const struct rule *rule)
+{
+    long long int hard_expiration;
+    long long int idle_expiration;
+
+    hard_expiration = (rule->hard_timeout
+                       ? rule->modified + rule->hard_timeout * 1000
+                       : LLONG_MAX);
+    idle_expiration = (rule->idle_timeout
+                       ? rule->used + rule->idle_timeout * 1000
+                       : LLONG_MAX);
+    return MIN(hard_expiration, idle_expiration);
+}
+
+/* Sets 'rule''s 'expires' time and, if it has one, adds 'rule' to its
+ * ofproto's "expirations" wheel.  The caller must ensure that 'rule' is not
+ * already in the wheel. */
+static void
+rule_schedule_expiration(struct rule *rule)
+{
+    rule->expires = rule_expiration(rule);
+    if (rule->expires != LLONG_MAX) {
+        /* A rule expires only once the time is past 'expires', so it falls due
+         * in the second after the one that contains 'expires'. */
+        timer_wheel_insert(&rule->ofproto->expirations, &rule->expiry_node,
+                           rule->expires / 1000 + 1);
+    }
+}
+
+/* Removes 'rule' from its ofproto's "expirations" wheel, if it is there. */
+static void
+rule_unschedule_expiration(struct rule *rule)
+{
+    if (rule->expires != LLONG_MAX) {
+        timer_wheel_remove(&rule->ofproto->expirations, &rule->expiry_node);
+        rule->expires = LLONG_MAX;
+    }
+}
+
+/* Updates 'rule''s 'expires' time, and its position in its eviction group,
+ * following a change to its 'used' or 'modified' time.  Does nothing if 'rule'
+ * has no timeouts or is not in an oftable.
+ *
+ * 'used' and 'modified' only move forward, so this can only make 'rule'
+ * expire later.  Its deadline in the "expirations" wheel is left alone, to be
+ * corrected by ofproto_collect_expired_rules() if and when the wheel reaches
+ * it.  Thus, a rule that is used constantly moves in the wheel only once per
+ * idle timeout period, instead of once per statistics update. */
+static void
+rule_update_expiration(struct rule *rule)
+{
+    if (rule->expires != LLONG_MAX) {
+        struct eviction_group *evg = rule->eviction_group;
+
+        rule->expires = rule_expiration(rule);
+        if (evg) {
+            heap_change(&evg->rules, &rule->evg_node,
+                        rule_eviction_priority(rule));
+        }
+    }
+}
+
 /* Adds 'rule' to an appropriate eviction group for its oftable's
  * configuration.  Does nothing if 'rule''s oftable doesn't have eviction
  * enabled, or if 'rule' is a permanent rule (one that will never expire on its
@@ -3935,6 +4574,9 @@ oftable_init(struct oftable *table)
     memset(table, 0, sizeof *table);
     classifier_init(&table->cls);
     table->max_flows = UINT_MAX;
+    list_init(&table->rules);
+    hmap_init(&table->cookies);
+    hmap_init(&table->out_ports);
 }
 
 /* Destroys 'table', including its classifier and eviction groups.
@@ -3946,6 +4588,8 @@ oftable_destroy(struct oftable *table)
     assert(classifier_is_empty(&table->cls));
     oftable_disable_eviction(table);
     classifier_destroy(&table->cls);
+    hmap_destroy(&table->cookies);
+    hmap_destroy(&table->out_ports);
     free(table->name);
 }
 
@@ -4029,6 +4673,53 @@ oftable_enable_eviction(struct oftable *table,
     }
 }
 
+/* Adds an entry to 'table''s "out_ports" index for each distinct port to which
+ * 'rule''s actions output. */
+static void
+oftable_index_out_ports(struct oftable *table, struct rule *rule)
+{
+    const union ofp_action *oa;
+    size_t allocated = 0;
+    size_t left;
+    size_t i;
+
+    rule->out_ports = NULL;
+    rule->n_out_ports = 0;
+    OFPUTIL_ACTION_FOR_EACH_UNSAFE (oa, left, rule->actions, rule->n_actions) {
+        uint16_t port = action_output_port(oa);
+
+        if (port != OFPP_NONE && !rule_has_out_port(rule, port)) {
+            if (rule->n_out_ports >= allocated) {
+                rule->out_ports = x2nrealloc(rule->out_ports, &allocated,
+                                             sizeof *rule->out_ports);
+            }
+            rule->out_ports[rule->n_out_ports++].port = port;
+        }
+    }
+
+    /* Insert only once the array has stopped moving. */
+    for (i = 0; i < rule->n_out_ports; i++) {
+        struct rule_out_port *rop = &rule->out_ports[i];
+
+        rop->rule = rule;
+        hmap_insert(&table->out_ports, &rop->hmap_node, hash_int(rop->port, 0));
+    }
+}
+
+/* Removes 'rule''s entries from 'table''s "out_ports" index. */
+static void
+oftable_unindex_out_ports(struct oftable *table, struct rule *rule)
+{
+    size_t i;
+
+    for (i = 0; i < rule->n_out_ports; i++) {
+        hmap_remove(&table->out_ports, &rule->out_ports[i].hmap_node);
+    }
+    free(rule->out_ports);
+    rule->out_ports = NULL;
+    rule->n_out_ports = 0;
+}
+
 /* Removes 'rule' from the oftable that contains it. */
 static void
 oftable_remove_rule(struct rule *rule)
@@ -4037,7 +4728,12 @@ oftable_remove_rule(struct rule *rule)
     struct oftable *table = &ofproto->tables[rule->table_id];
 
     classifier_remove(&table->cls, &rule->cr);
+    flow_dumps_forget_rule(ofproto, rule);
+    list_remove(&rule->table_node);
+    hmap_remove(&table->cookies, &rule->cookie_node);
+    oftable_unindex_out_ports(table, rule);
     eviction_group_remove_rule(rule);
+    rule_unschedule_expiration(rule);
 }
 
 /* Inserts 'rule' into its oftable.  Removes any existing rule from 'rule''s
@@ -4052,12 +4748,53 @@ oftable_replace_rule(struct rule *rule)
 
     victim = rule_from_cls_rule(classifier_replace(&table->cls, &rule->cr));
     if (victim) {
+        flow_dumps_forget_rule(ofproto, victim);
+        list_remove(&victim->table_node);
+        hmap_remove(&table->cookies, &victim->cookie_node);
+        oftable_unindex_out_ports(table, victim);
         eviction_group_remove_rule(victim);
+        rule_unschedule_expiration(victim);
     }
+    list_push_back(&table->rules, &rule->table_node);
+    hmap_insert(&table->cookies, &rule->cookie_node,
+                hash_cookie(rule->flow_cookie));
+    oftable_index_out_ports(table, rule);
+    rule_schedule_expiration(rule);
     eviction_group_add_rule(rule);
     return victim;
 }
 
+/* Replaces the actions of 'rule', which must be in its oftable, by the
+ * 'n_actions' actions in 'actions', keeping the oftable's out_port index
+ * up-to-date.  Takes ownership of 'actions'.  The caller is responsible for
+ * the old actions. */
+static void
+oftable_set_rule_actions(struct rule *rule,
+                         union ofp_action *actions, size_t n_actions)
+{
+    struct oftable *table = &rule->ofproto->tables[rule->table_id];
+
+    oftable_unindex_out_ports(table, rule);
+    rule->actions = actions;
+    rule->n_actions = n_actions;
+    oftable_index_out_ports(table, rule);
+}
+
+/* Changes the cookie of 'rule', which must be in its oftable, to
+ * 'new_cookie', keeping the oftable's cookie index up-to-date. */
+static void
+oftable_set_rule_cookie(struct rule *rule, ovs_be64 new_cookie)
+{
+    if (new_cookie != rule->flow_cookie) {
+        struct oftable *table = &rule->ofproto->tables[rule->table_id];
+
+        hmap_remove(&table->cookies, &rule->cookie_node);
+        rule->flow_cookie = new_cookie;
+        hmap_insert(&table->cookies, &rule->cookie_node,
+                    hash_cookie(new_cookie));
+    }
+}
+
 /* Removes 'old' from its oftable then, if 'new' is nonnull, inserts 'new'. */
 static void
 oftable_substitute_rule(struct rule *old, struct rule *new)
@@ -4100,6 +4837,26 @@ ofproto_unixctl_list(struct unixctl_conn *conn, int argc OVS_UNUSED,
     ds_destroy(&results);
 }
 
+static void
+ofproto_unixctl_packet_in_stats(struct unixctl_conn *conn,
+                                int argc OVS_UNUSED, const char *argv[],
+                                void *aux OVS_UNUSED)
+{
+    struct ofproto *ofproto;
+    struct ds results;
+
+    ofproto = ofproto_lookup(argv[1]);
+    if (!ofproto) {
+        unixctl_command_reply_error(conn, "no such bridge");
+        return;
+    }
+
+    ds_init(&results);
+    connmgr_format_packet_in_stats(ofproto->connmgr, &results);
+    unixctl_command_reply(conn, ds_cstr(&results));
+    ds_destroy(&results);
+}
+
 static void
 ofproto_unixctl_init(void)
 {
@@ -4111,6 +4868,8 @@ ofproto_unixctl_init(void)
 
     unixctl_command_register("ofproto/list", "", 0, 0,
                              ofproto_unixctl_list, NULL);
+    unixctl_command_register("ofproto/packet-in-stats", "bridge", 1, 1,
+                             ofproto_unixctl_packet_in_stats, NULL);
 }
 
 /* Linux VLAN device support (e.g. "eth0.10" for VLAN 10.)
@@ -25,6 +25,7 @@
 #include "cfm.h"
 #include "flow.h"
 #include "netflow.h"
+#include "pinsched.h"
 #include "sset.h"
 #include "stp.h"
 #include "tag.h"
@@ -46,8 +47,8 @@ struct ofproto_controller_info {
     bool is_connected;
     enum nx_role role;
     struct {
-        const char *keys[4];
-        const char *values[4];
+        const char *keys[6];
+        const char *values[6];
         size_t n;
     } pairs;
 };
@@ -129,6 +130,12 @@ struct ofproto_controller {
     int rate_limit;             /* Max packet-in rate in packets per second. */
     int burst_limit;            /* Limit on accumulating packet credits. */
 
+    /* OpenFlow packet-in scheduling, used only if 'rate_limit' is nonzero. */
+    int packet_in_queue_depth;  /* Max packets queued per class (0: none). */
+    struct pinsched_weight *pin_weights; /* Weights for packet-in classes. */
+    size_t n_pin_weights;
+    int n_packet_buffers;       /* Number of packet buffers (0: default). */
+
     uint8_t dscp;               /* DSCP value for controller connection. */
 };
 
@@ -212,6 +219,7 @@ void ofproto_set_in_band_queue(struct ofproto *, int queue_id);
 void ofproto_set_flow_eviction_threshold(struct ofproto *, unsigned threshold);
 void ofproto_set_forward_bpdu(struct ofproto *, bool forward_bpdu);
 void ofproto_set_mac_idle_time(struct ofproto *, unsigned idle_time);
+void ofproto_set_mac_table_size(struct ofproto *, size_t mac_table_size);
 void ofproto_set_desc(struct ofproto *,
                       const char *mfr_desc, const char *hw_desc,
                       const char *sw_desc, const char *serial_desc,
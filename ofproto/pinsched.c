@@ -19,34 +19,64 @@
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include "dynamic-string.h"
 #include "hash.h"
 #include "hmap.h"
+#include "ofp-util.h"
 #include "ofpbuf.h"
 #include "openflow/openflow.h"
 #include "poll-loop.h"
-#include "random.h"
 #include "rconn.h"
 #include "timeval.h"
 #include "vconn.h"
 
+/* Number of bytes added to a queue's deficit, per unit of weight, each time
+ * deficit round robin passes over it. */
+#define PINSCHED_QUANTUM 1500
+
+/* Maximum number of empty queues kept, to retain their statistics. */
+#define PINSCHED_MAX_IDLE 64
+
+/* A queue for one class of packet-ins. */
 struct pinqueue {
     struct hmap_node node;      /* In struct pinsched's 'queues' hmap. */
+    struct list list_node;      /* In struct pinsched's 'active' or 'idle'. */
     uint16_t port_no;           /* Port number. */
+    uint8_t table_id;           /* OpenFlow table ID. */
+    uint8_t reason;             /* OFPR_* reason. */
+    unsigned int weight;        /* Deficit round robin weight. */
+
     struct list packets;        /* Contains "struct ofpbuf"s. */
     int n;                      /* Number of packets in 'packets'. */
+    unsigned int n_bytes;       /* Number of bytes in 'packets'. */
+    unsigned int deficit;       /* Deficit round robin credit, in bytes. */
+
+    /* Statistics. */
+    unsigned long long int n_sent;    /* # passed to the callback. */
+    unsigned long long int n_dropped; /* # dropped due to queue overflow. */
 };
 
 struct pinsched {
     /* Client-supplied parameters. */
     int rate_limit;           /* Packets added to bucket per second. */
     int burst_limit;          /* Maximum token bucket size, in packets. */
-
-    /* One queue per physical port. */
+    int queue_depth;          /* Maximum packets in one queue. */
+    struct pinsched_weight *weights; /* Weights for classes of packet-ins. */
+    size_t n_weights;
+
+    /* One queue per class of packet-ins that has needed queuing.  A queue
+     * that becomes empty moves to 'idle', to keep its statistics, until more
+     * than PINSCHED_MAX_IDLE queues are idle.  Then the queue that has been
+     * idle longest is freed. */
     struct hmap queues;         /* Contains "struct pinqueue"s. */
+    struct list active;         /* Nonempty queues, in round-robin order. */
+    struct list idle;           /* Empty queues, least recently used first. */
+    size_t n_idle;              /* Number of queues in 'idle'. */
     int n_queued;               /* Sum over queues[*].n. */
-    struct pinqueue *next_txq;  /* Next pinqueue check in round-robin. */
 
     /* Token bucket.
      *
@@ -57,24 +87,66 @@ struct pinsched {
     long long int last_fill;    /* Time at which we last added tokens. */
     int tokens;                 /* Current number of tokens. */
 
-    /* Transmission queue. */
-    int n_txq;                  /* No. of packets waiting in rconn for tx. */
-
     /* Statistics reporting. */
     unsigned long long n_normal;        /* # txed w/o rate limit queuing. */
     unsigned long long n_limited;       /* # queued for rate limiting. */
     unsigned long long n_queue_dropped; /* # dropped due to queue overflow. */
 };
 
+static unsigned int
+pinsched_lookup_weight(const struct pinsched *ps,
+                       enum pinsched_weight_type type, unsigned int id)
+{
+    size_t i;
+
+    for (i = 0; i < ps->n_weights; i++) {
+        const struct pinsched_weight *w = &ps->weights[i];
+        if (w->type == type && w->id == id) {
+            return w->weight;
+        }
+    }
+    return 1;
+}
+
+/* Sets 'q''s weight to the product of the weights that apply to it, limited
+ * so that a quantum for the weight fits in an unsigned int.  The product is
+ * limited after each step, since three 32-bit weights could overflow even a
+ * 64-bit product. */
 static void
-advance_txq(struct pinsched *ps)
+pinqueue_update_weight(const struct pinsched *ps, struct pinqueue *q)
 {
-    struct hmap_node *next;
+    const unsigned long long int max = UINT_MAX / PINSCHED_QUANTUM;
+    unsigned long long int weight;
+
+    weight = pinsched_lookup_weight(ps, PINSCHED_REASON, q->reason);
+    weight = MIN(weight * pinsched_lookup_weight(ps, PINSCHED_TABLE,
+                                                 q->table_id), max);
+    weight = MIN(weight * pinsched_lookup_weight(ps, PINSCHED_PORT,
+                                                 q->port_no), max);
+    q->weight = weight;
+}
 
-    next = (ps->next_txq
-            ? hmap_next(&ps->queues, &ps->next_txq->node)
-            : hmap_first(&ps->queues));
-    ps->next_txq = next ? CONTAINER_OF(next, struct pinqueue, node) : NULL;
+static void
+pinqueue_destroy(struct pinsched *ps, struct pinqueue *q)
+{
+    hmap_remove(&ps->queues, &q->node);
+    list_remove(&q->list_node);
+    ofpbuf_list_delete(&q->packets);
+    free(q);
+}
+
+/* Moves 'q', which must be empty, to the back of the idle queues in 'ps', and
+ * frees the front idle queue if there are too many. */
+static void
+pinqueue_make_idle(struct pinsched *ps, struct pinqueue *q)
+{
+    q->deficit = 0;
+    list_push_back(&ps->idle, &q->list_node);
+    if (++ps->n_idle > PINSCHED_MAX_IDLE) {
+        pinqueue_destroy(ps, CONTAINER_OF(list_front(&ps->idle),
+                                          struct pinqueue, list_node));
+        ps->n_idle--;
+    }
 }
 
 static struct ofpbuf *
@@ -82,91 +154,108 @@ dequeue_packet(struct pinsched *ps, struct pinqueue *q)
 {
     struct ofpbuf *packet = ofpbuf_from_list(list_pop_front(&q->packets));
     q->n--;
+    q->n_bytes -= packet->size;
     ps->n_queued--;
+    if (!q->n) {
+        list_remove(&q->list_node);
+        pinqueue_make_idle(ps, q);
+    }
     return packet;
 }
 
-/* Destroys 'q' and removes it from 'ps''s set of queues.
- * (The caller must ensure that 'q' is empty.) */
 static void
-pinqueue_destroy(struct pinsched *ps, struct pinqueue *q)
+enqueue_packet(struct pinsched *ps, struct pinqueue *q, struct ofpbuf *packet)
 {
-    hmap_remove(&ps->queues, &q->node);
-    free(q);
+    if (!q->n) {
+        list_remove(&q->list_node);
+        ps->n_idle--;
+        list_push_back(&ps->active, &q->list_node);
+    }
+    list_push_back(&q->packets, &packet->list_node);
+    q->n++;
+    q->n_bytes += packet->size;
+    ps->n_queued++;
 }
 
+/* Returns the queue in 'ps' for the given class of packet-ins, creating it if
+ * necessary.  An empty queue is moved to the back of 'ps->idle', so that it
+ * is not the next idle queue to be freed. */
 static struct pinqueue *
-pinqueue_get(struct pinsched *ps, uint16_t port_no)
+pinqueue_get(struct pinsched *ps, uint16_t port_no, uint8_t table_id,
+             uint8_t reason)
 {
-    uint32_t hash = hash_int(port_no, 0);
+    uint32_t hash = hash_int(port_no | (table_id << 16) | (reason << 24), 0);
     struct pinqueue *q;
 
     HMAP_FOR_EACH_IN_BUCKET (q, node, hash, &ps->queues) {
-        if (port_no == q->port_no) {
+        if (port_no == q->port_no && table_id == q->table_id
+            && reason == q->reason) {
+            if (!q->n) {
+                list_remove(&q->list_node);
+                list_push_back(&ps->idle, &q->list_node);
+            }
             return q;
         }
     }
 
-    q = xmalloc(sizeof *q);
+    q = xzalloc(sizeof *q);
     hmap_insert(&ps->queues, &q->node, hash);
     q->port_no = port_no;
+    q->table_id = table_id;
+    q->reason = reason;
     list_init(&q->packets);
-    q->n = 0;
+    pinqueue_update_weight(ps, q);
+    pinqueue_make_idle(ps, q);
     return q;
 }
 
-/* Drop a packet from the longest queue in 'ps'. */
+/* Drops a packet from the queue in 'ps' that has the largest backlog relative
+ * to its weight. */
 static void
 drop_packet(struct pinsched *ps)
 {
-    struct pinqueue *longest;   /* Queue currently selected as longest. */
-    int n_longest = 0;          /* # of queues of same length as 'longest'. */
+    struct pinqueue *worst = NULL;
     struct pinqueue *q;
 
     ps->n_queue_dropped++;
 
-    longest = NULL;
-    HMAP_FOR_EACH (q, node, &ps->queues) {
-        if (!longest || longest->n < q->n) {
-            longest = q;
-            n_longest = 1;
-        } else if (longest->n == q->n) {
-            n_longest++;
-
-            /* Randomly select one of the longest queues, with a uniform
-             * distribution (Knuth algorithm 3.4.2R). */
-            if (!random_range(n_longest)) {
-                longest = q;
-            }
+    LIST_FOR_EACH (q, list_node, &ps->active) {
+        if (!worst
+            || ((unsigned long long int) q->n_bytes * worst->weight
+                > (unsigned long long int) worst->n_bytes * q->weight)) {
+            worst = q;
         }
     }
 
-    /* FIXME: do we want to pop the tail instead? */
-    ofpbuf_delete(dequeue_packet(ps, longest));
-    if (longest->n == 0) {
-        pinqueue_destroy(ps, longest);
-    }
+    worst->n_dropped++;
+    ofpbuf_delete(dequeue_packet(ps, worst));
 }
 
-/* Remove and return the next packet to transmit (in round-robin order). */
+/* Removes and returns the next packet to transmit, in deficit round robin
+ * order.  'ps' must have at least one queued packet. */
 static struct ofpbuf *
 get_tx_packet(struct pinsched *ps)
 {
-    struct ofpbuf *packet;
-    struct pinqueue *q;
-
-    if (!ps->next_txq) {
-        advance_txq(ps);
-    }
+    for (;;) {
+        struct pinqueue *q = CONTAINER_OF(list_front(&ps->active),
+                                          struct pinqueue, list_node);
+        struct ofpbuf *head = ofpbuf_from_list(list_front(&q->packets));
+
+        if (q->deficit >= head->size) {
+            q->deficit -= head->size;
+            q->n_sent++;
+            return dequeue_packet(ps, q);
+        }
 
-    q = ps->next_txq;
-    packet = dequeue_packet(ps, q);
-    advance_txq(ps);
-    if (q->n == 0) {
-        pinqueue_destroy(ps, q);
+        /* Give 'q' its quantum for the next round and move on.  The deficit
+         * saturates rather than wrapping around, since its leftover from the
+         * last round plus a quantum for the largest weight can exceed
+         * UINT_MAX. */
+        q->deficit += MIN(q->weight * PINSCHED_QUANTUM,
+                          UINT_MAX - q->deficit);
+        list_remove(&q->list_node);
+        list_push_back(&ps->active, &q->list_node);
     }
-
-    return packet;
 }
 
 /* Add tokens to the bucket based on elapsed time. */
@@ -195,9 +284,14 @@ get_token(struct pinsched *ps)
     }
 }
 
+/* Sends 'packet', a packet-in received on 'port_no' and sent to the controller
+ * from 'table_id' for OFPR_* 'reason', by passing it to 'cb' either now or
+ * from a later call to pinsched_run(), or drops it if too many packet-ins are
+ * already queued. */
 void
-pinsched_send(struct pinsched *ps, uint16_t port_no,
-              struct ofpbuf *packet, pinsched_tx_cb *cb, void *aux)
+pinsched_send(struct pinsched *ps, uint16_t port_no, uint8_t table_id,
+              uint8_t reason, struct ofpbuf *packet,
+              pinsched_tx_cb *cb, void *aux)
 {
     if (!ps) {
         cb(packet, aux);
@@ -207,23 +301,28 @@ pinsched_send(struct pinsched *ps, uint16_t port_no,
         ps->n_normal++;
         cb(packet, aux);
     } else {
-        /* Otherwise queue it up for the periodic callback to drain out. */
-        struct pinqueue *q;
-
-        /* We might be called with a buffer obtained from dpif_recv() that has
-         * much more allocated space than actual content most of the time.
-         * Since we're going to store the packet for some time, free up that
-         * otherwise wasted space. */
-        ofpbuf_trim(packet);
+        struct pinqueue *q = pinqueue_get(ps, port_no, table_id, reason);
 
-        if (ps->n_queued >= ps->burst_limit) {
-            drop_packet(ps);
+        if (q->n >= ps->queue_depth) {
+            /* This class of packet-ins already has a full queue. */
+            ps->n_queue_dropped++;
+            q->n_dropped++;
+            ofpbuf_delete(packet);
+        } else {
+            /* Otherwise queue it up for the periodic callback to drain out.
+             *
+             * We might be called with a buffer obtained from dpif_recv() that
+             * has much more allocated space than actual content most of the
+             * time.  Since we're going to store the packet for some time, free
+             * up that otherwise wasted space. */
+            ofpbuf_trim(packet);
+
+            if (ps->n_queued >= ps->burst_limit) {
+                drop_packet(ps);
+            }
+            enqueue_packet(ps, q, packet);
+            ps->n_limited++;
         }
-        q = pinqueue_get(ps, port_no);
-        list_push_back(&q->packets, &packet->list_node);
-        q->n++;
-        ps->n_queued++;
-        ps->n_limited++;
     }
 }
 
@@ -265,15 +364,19 @@ pinsched_create(int rate_limit, int burst_limit)
 
     ps = xzalloc(sizeof *ps);
     hmap_init(&ps->queues);
+    list_init(&ps->active);
+    list_init(&ps->idle);
+    ps->n_idle = 0;
     ps->n_queued = 0;
-    ps->next_txq = NULL;
+    ps->weights = NULL;
+    ps->n_weights = 0;
     ps->last_fill = time_msec();
     ps->tokens = rate_limit * 100;
-    ps->n_txq = 0;
     ps->n_normal = 0;
     ps->n_limited = 0;
     ps->n_queue_dropped = 0;
     pinsched_set_limits(ps, rate_limit, burst_limit);
+    pinsched_set_queue_depth(ps, 0);
 
     return ps;
 }
@@ -285,15 +388,28 @@ pinsched_destroy(struct pinsched *ps)
         struct pinqueue *q, *next;
 
         HMAP_FOR_EACH_SAFE (q, next, node, &ps->queues) {
-            hmap_remove(&ps->queues, &q->node);
-            ofpbuf_list_delete(&q->packets);
-            free(q);
+            pinqueue_destroy(ps, q);
         }
         hmap_destroy(&ps->queues);
+        free(ps->weights);
         free(ps);
     }
 }
 
+/* Discards all of the packets queued in 'ps', if 'ps' is nonnull.  Does not
+ * reset the configuration or statistics of 'ps'. */
+void
+pinsched_flush(struct pinsched *ps)
+{
+    if (ps) {
+        while (ps->n_queued) {
+            struct pinqueue *q = CONTAINER_OF(list_front(&ps->active),
+                                              struct pinqueue, list_node);
+            ofpbuf_delete(dequeue_packet(ps, q));
+        }
+    }
+}
+
 void
 pinsched_get_limits(const struct pinsched *ps,
                     int *rate_limit, int *burst_limit)
@@ -321,10 +437,110 @@ pinsched_set_limits(struct pinsched *ps, int rate_limit, int burst_limit)
     }
 }
 
+/* Limits each of the queues in 'ps' to 'queue_depth' packets.  If
+ * 'queue_depth' is 0 or negative, then queues are limited only by the total
+ * number of packets that 'ps' may queue (its burst limit). */
+void
+pinsched_set_queue_depth(struct pinsched *ps, int queue_depth)
+{
+    ps->queue_depth = queue_depth > 0 ? queue_depth : INT_MAX;
+}
+
+/* Replaces the scheduling weights in 'ps' by the 'n' weights in 'weights'.
+ * Classes of packet-ins not mentioned in 'weights' have weight 1. */
+void
+pinsched_set_weights(struct pinsched *ps,
+                     const struct pinsched_weight *weights, size_t n)
+{
+    struct pinqueue *q;
+
+    free(ps->weights);
+    ps->weights = n ? xmemdup(weights, n * sizeof *weights) : NULL;
+    ps->n_weights = n;
+
+    HMAP_FOR_EACH (q, node, &ps->queues) {
+        pinqueue_update_weight(ps, q);
+    }
+}
+
 /* Returns the number of packets scheduled to be sent eventually by 'ps'.
  * Returns 0 if 'ps' is null. */
 unsigned int
 pinsched_count_txqlen(const struct pinsched *ps)
 {
-    return ps ? ps->n_txq : 0;
+    return ps ? ps->n_queued : 0;
+}
+
+static int
+compare_pinqueues(const void *a_, const void *b_)
+{
+    const struct pinqueue *const *ap = a_;
+    const struct pinqueue *const *bp = b_;
+    const struct pinqueue *a = *ap;
+    const struct pinqueue *b = *bp;
+
+    return (a->reason != b->reason ? (a->reason < b->reason ? -1 : 1)
+            : a->table_id != b->table_id ? (a->table_id < b->table_id ? -1 : 1)
+            : a->port_no != b->port_no ? (a->port_no < b->port_no ? -1 : 1)
+            : 0);
+}
+
+/* Appends a human-readable description of 'ps''s configuration and per-class
+ * statistics to 'ds'. */
+void
+pinsched_format_stats(const struct pinsched *ps, struct ds *ds)
+{
+    const struct pinqueue **queues;
+    const struct pinqueue *q;
+    size_t n, i;
+
+    ds_put_format(ds, "rate_limit=%d burst_limit=%d", ps->rate_limit,
+                  ps->burst_limit);
+    if (ps->queue_depth != INT_MAX) {
+        ds_put_format(ds, " queue_depth=%d", ps->queue_depth);
+    }
+    ds_put_format(ds, " queued=%d normal=%llu limited=%llu dropped=%llu\n",
+                  ps->n_queued, ps->n_normal, ps->n_limited,
+                  ps->n_queue_dropped);
+    for (i = 0; i < ps->n_weights; i++) {
+        const struct pinsched_weight *w = &ps->weights[i];
+
+        if (!i) {
+            ds_put_cstr(ds, "  weights:");
+        }
+        switch (w->type) {
+        case PINSCHED_REASON:
+            ds_put_format(ds, " reason=%s",
+                          ofputil_packet_in_reason_to_string(w->id));
+            break;
+        case PINSCHED_TABLE:
+            ds_put_format(ds, " table=%u", w->id);
+            break;
+        case PINSCHED_PORT:
+            ds_put_format(ds, " in_port=%u", w->id);
+            break;
+        }
+        ds_put_format(ds, ":%u", w->weight);
+        if (i == ps->n_weights - 1) {
+            ds_put_char(ds, '\n');
+        }
+    }
+
+    n = 0;
+    queues = xmalloc(hmap_count(&ps->queues) * sizeof *queues);
+    HMAP_FOR_EACH (q, node, &ps->queues) {
+        queues[n++] = q;
+    }
+    qsort(queues, n, sizeof *queues, compare_pinqueues);
+
+    for (i = 0; i < n; i++) {
+        q = queues[i];
+        ds_put_format(ds, "  reason=%s table=%"PRIu8" in_port=%"PRIu16
+                      " weight=%u: queued=%d (%u bytes) sent=%llu"
+                      " dropped=%llu\n",
+                      ofputil_packet_in_reason_to_string(q->reason),
+                      q->table_id, q->port_no, q->weight, q->n, q->n_bytes,
+                      q->n_sent, q->n_dropped);
+    }
+    free(queues);
 }
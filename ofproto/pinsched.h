@@ -15,23 +15,51 @@
  */
 
 #ifndef PINSCHED_H
-#define PINSCHED_H_H 1
+#define PINSCHED_H 1
 
+#include <stddef.h>
 #include <stdint.h>
 
+struct ds;
 struct ofpbuf;
 
+/* Packet-in scheduling weights.
+ *
+ * A pinsched keeps a separate queue for each combination of packet-in reason,
+ * OpenFlow table, and input port, and serves the queues with deficit round
+ * robin.  The weight of a queue is the product of the weights for its reason,
+ * its table, and its port, each of which defaults to 1.  A queue with weight
+ * N receives N times the bandwidth, in bytes, of a queue with weight 1 when
+ * both are backlogged. */
+enum pinsched_weight_type {
+    PINSCHED_REASON,            /* 'id' is an OFPR_* packet-in reason. */
+    PINSCHED_TABLE,             /* 'id' is an OpenFlow table ID. */
+    PINSCHED_PORT               /* 'id' is an OpenFlow port number. */
+};
+
+struct pinsched_weight {
+    enum pinsched_weight_type type;
+    unsigned int id;
+    unsigned int weight;        /* Must be at least 1. */
+};
+
 typedef void pinsched_tx_cb(struct ofpbuf *, void *aux);
 struct pinsched *pinsched_create(int rate_limit, int burst_limit);
 void pinsched_get_limits(const struct pinsched *,
                          int *rate_limit, int *burst_limit);
 void pinsched_set_limits(struct pinsched *, int rate_limit, int burst_limit);
+void pinsched_set_queue_depth(struct pinsched *, int queue_depth);
+void pinsched_set_weights(struct pinsched *,
+                          const struct pinsched_weight *, size_t n);
 void pinsched_destroy(struct pinsched *);
-void pinsched_send(struct pinsched *, uint16_t port_no, struct ofpbuf *,
+void pinsched_flush(struct pinsched *);
+void pinsched_send(struct pinsched *, uint16_t port_no, uint8_t table_id,
+                   uint8_t reason, struct ofpbuf *,
                    pinsched_tx_cb *, void *aux);
 void pinsched_run(struct pinsched *, pinsched_tx_cb *, void *aux);
 void pinsched_wait(struct pinsched *);
 
 unsigned int pinsched_count_txqlen(const struct pinsched *);
+void pinsched_format_stats(const struct pinsched *, struct ds *);
 
 #endif /* pinsched.h */
@@ -16,11 +16,15 @@
 
 #include <config.h>
 #include "pktbuf.h"
+#include <assert.h>
 #include <inttypes.h>
 #include <stdlib.h>
 #include "coverage.h"
+#include "dynamic-string.h"
+#include "list.h"
 #include "ofp-util.h"
 #include "ofpbuf.h"
+#include "poll-loop.h"
 #include "timeval.h"
 #include "util.h"
 #include "vconn.h"
@@ -29,6 +33,8 @@
 VLOG_DEFINE_THIS_MODULE(pktbuf);
 
 COVERAGE_DEFINE(pktbuf_buffer_unknown);
+COVERAGE_DEFINE(pktbuf_expired);
+COVERAGE_DEFINE(pktbuf_full);
 COVERAGE_DEFINE(pktbuf_null_cookie);
 COVERAGE_DEFINE(pktbuf_retrieved);
 COVERAGE_DEFINE(pktbuf_reuse_error);
@@ -37,95 +43,289 @@ COVERAGE_DEFINE(pktbuf_reuse_error);
  * into a buffer number (low bits) and a cookie (high bits).  The buffer number
  * is an index into an array of buffers.  The cookie distinguishes between
  * different packets that have occupied a single buffer.  Thus, the more
- * buffers we have, the lower-quality the cookie... */
-#define PKTBUF_BITS     8
-#define PKTBUF_MASK     (PKTBUF_CNT - 1)
-#define PKTBUF_CNT      (1u << PKTBUF_BITS)
+ * buffers we have, the lower-quality the cookie...
+ *
+ * The number of bits in the buffer number depends on the capacity of the
+ * pktbuf, so that the cookie has between 12 and 24 bits.
+ *
+ * PKTBUF_NULL_ID refers to no buffer.  Its low 8 bits are 0 and the rest are
+ * 1, so with at most 24 bits of cookie, its cookie is all-1-bits whatever the
+ * capacity.  That cookie is never assigned to a buffered packet, so
+ * PKTBUF_NULL_ID cannot be mistaken for a real ID.  (Its buffer number is
+ * not all-1-bits: it is 0 for the minimum capacity.) */
+#define PKTBUF_NULL_ID  0xffffff00
 
-#define COOKIE_BITS     (32 - PKTBUF_BITS)
-#define COOKIE_MAX      ((1u << COOKIE_BITS) - 1)
+/* How long a buffered packet is kept before it may be discarded. */
+#define PKTBUF_TTL_MSECS 5000
 
-#define OVERWRITE_MSECS 5000
+/* A reference-counted packet shared among the pktbufs of all the OpenFlow
+ * connections that are sent the same packet-in. */
+struct pktbuf_data {
+    struct ofpbuf *buffer;
+    unsigned int ref_cnt;
+};
 
 struct packet {
-    struct ofpbuf *buffer;
+    struct list list_node;      /* In struct pktbuf's 'free' or 'used'. */
+    struct pktbuf_data *data;   /* Buffered packet, or NULL if free. */
     uint32_t cookie;
     long long int timeout;
     uint16_t in_port;
 };
 
 struct pktbuf {
-    struct packet packets[PKTBUF_CNT];
-    unsigned int buffer_idx;
-    unsigned int null_idx;
+    struct packet *packets;     /* Array of 1 << 'bits' buffers. */
+    int bits;                   /* Number of bits in buffer numbers. */
+    uint32_t cookie;            /* Cookie for the next saved packet. */
+
+    /* Free buffers are reused in FIFO order, so that a stale buffer id keeps
+     * its own cookie for as long as possible.  Since every packet is kept for
+     * the same time, 'used' is in order of increasing 'timeout'. */
+    struct list free;           /* Buffers with null 'data'. */
+    struct list used;           /* Buffers with nonnull 'data'. */
+    unsigned int n_used;        /* Number of elements in 'used'. */
+
+    /* Statistics. */
+    unsigned long long int n_saved;     /* Packets saved. */
+    unsigned long long int n_shared;    /* Saves that shared another's copy. */
+    unsigned long long int n_retrieved; /* Packets retrieved. */
+    unsigned long long int n_expired;   /* Packets discarded unretrieved. */
+    unsigned long long int n_full;      /* Saves that failed, all in use. */
+    unsigned long long int n_reused;    /* Retrievals of an emptied buffer. */
+    unsigned long long int n_unknown;   /* Retrievals with a stale cookie. */
 };
 
+static uint32_t
+pktbuf_cookie_max(const struct pktbuf *pb)
+{
+    return (1u << (32 - pb->bits)) - 1;
+}
+
+/* Returns the number of packets that 'pb' can hold.  Returns
+ * PKTBUF_DEFAULT_CNT if 'pb' is null, since that is the number that a
+ * connection without buffers has always reported to its controller. */
 int
-pktbuf_capacity(void)
+pktbuf_capacity(const struct pktbuf *pb)
+{
+    return pb ? 1u << pb->bits : PKTBUF_DEFAULT_CNT;
+}
+
+static void
+pktbuf_init_buffers(struct pktbuf *pb, int bits)
+{
+    size_t n = 1u << bits;
+    size_t i;
+
+    pb->bits = bits;
+    pb->packets = xzalloc(n * sizeof *pb->packets);
+    list_init(&pb->free);
+    list_init(&pb->used);
+    for (i = 0; i < n; i++) {
+        list_push_back(&pb->free, &pb->packets[i].list_node);
+    }
+    pb->n_used = 0;
+
+    /* Don't use maximum cookie value since PKTBUF_NULL_ID uses it. */
+    pb->cookie %= pktbuf_cookie_max(pb);
+}
+
+static int
+pktbuf_capacity_to_bits(int capacity)
 {
-    return PKTBUF_CNT;
+    capacity = MAX(capacity, PKTBUF_MIN_CNT);
+    capacity = MIN(capacity, PKTBUF_MAX_CNT);
+    return log_2_ceil(capacity);
 }
 
+/* Creates and returns a new pktbuf that can hold 'capacity' packets, rounded
+ * up to a power of 2 and limited to the range PKTBUF_MIN_CNT to
+ * PKTBUF_MAX_CNT. */
 struct pktbuf *
-pktbuf_create(void)
+pktbuf_create(int capacity)
 {
-    return xzalloc(sizeof *pktbuf_create());
+    struct pktbuf *pb = xzalloc(sizeof *pb);
+
+    pktbuf_init_buffers(pb, pktbuf_capacity_to_bits(capacity));
+    return pb;
 }
 
 void
 pktbuf_destroy(struct pktbuf *pb)
 {
     if (pb) {
-        size_t i;
+        pktbuf_flush(pb);
+        free(pb->packets);
+        free(pb);
+    }
+}
+
+/* Changes the number of packets that 'pb' can hold to 'capacity', rounded as
+ * in pktbuf_create().  If this changes the capacity of 'pb', discards the
+ * packets that it holds. */
+void
+pktbuf_set_capacity(struct pktbuf *pb, int capacity)
+{
+    int bits = pktbuf_capacity_to_bits(capacity);
+
+    if (bits != pb->bits) {
+        pktbuf_flush(pb);
+        free(pb->packets);
+        pktbuf_init_buffers(pb, bits);
+    }
+}
+
+static void
+pktbuf_free_packet(struct pktbuf *pb, struct packet *p)
+{
+    pktbuf_data_unref(p->data);
+    p->data = NULL;
+    list_remove(&p->list_node);
+    list_push_back(&pb->free, &p->list_node);
+    pb->n_used--;
+}
+
+static struct packet *
+pktbuf_oldest(const struct pktbuf *pb)
+{
+    return (list_is_empty(&pb->used) ? NULL
+            : CONTAINER_OF(list_front(&pb->used), struct packet, list_node));
+}
+
+/* Discards all of the packets buffered in 'pb'.  Buffer ids that 'pb'
+ * previously returned remain invalid, and its statistics are retained. */
+void
+pktbuf_flush(struct pktbuf *pb)
+{
+    struct packet *p;
+
+    while ((p = pktbuf_oldest(pb)) != NULL) {
+        pktbuf_free_packet(pb, p);
+    }
+}
+
+/* Discards the packets in 'pb' that have been buffered for longer than
+ * PKTBUF_TTL_MSECS. */
+void
+pktbuf_run(struct pktbuf *pb)
+{
+    long long int now = time_msec();
+    struct packet *p;
+
+    while ((p = pktbuf_oldest(pb)) != NULL && p->timeout <= now) {
+        COVERAGE_INC(pktbuf_expired);
+        pktbuf_free_packet(pb, p);
+        pb->n_expired++;
+    }
+}
+
+void
+pktbuf_wait(const struct pktbuf *pb)
+{
+    const struct packet *p = pktbuf_oldest(pb);
+
+    if (p) {
+        poll_timer_wait_until(p->timeout);
+    }
+}
+
+/* Creates and returns a copy of the 'buffer_size' bytes in 'buffer', for
+ * passing to pktbuf_save() on any number of pktbufs.  The caller must
+ * eventually release its reference with pktbuf_data_unref(). */
+struct pktbuf_data *
+pktbuf_data_create(const void *buffer, size_t buffer_size)
+{
+    struct pktbuf_data *data = xmalloc(sizeof *data);
+
+    data->buffer = ofpbuf_clone_data_with_headroom(
+        buffer, buffer_size, sizeof(struct ofp_packet_in));
+    data->ref_cnt = 1;
+    return data;
+}
 
-        for (i = 0; i < PKTBUF_CNT; i++) {
-            ofpbuf_delete(pb->packets[i].buffer);
+void
+pktbuf_data_unref(struct pktbuf_data *data)
+{
+    if (data) {
+        assert(data->ref_cnt > 0);
+        if (!--data->ref_cnt) {
+            ofpbuf_delete(data->buffer);
+            free(data);
         }
-        free(pb);
     }
 }
 
+/* Passes ownership of 'data''s packet to the caller, which must free it with
+ * ofpbuf_delete(), and releases a reference to 'data'.  The packet is copied
+ * only if another reference to 'data' remains. */
+static struct ofpbuf *
+pktbuf_data_steal(struct pktbuf_data *data)
+{
+    struct ofpbuf *buffer;
+
+    if (data->ref_cnt == 1) {
+        buffer = data->buffer;
+        free(data);
+    } else {
+        buffer = ofpbuf_clone_with_headroom(data->buffer,
+                                            sizeof(struct ofp_packet_in));
+        data->ref_cnt--;
+    }
+    return buffer;
+}
+
 static unsigned int
-make_id(unsigned int buffer_idx, unsigned int cookie)
+make_id(const struct pktbuf *pb, unsigned int buffer_idx, unsigned int cookie)
 {
-    return buffer_idx | (cookie << PKTBUF_BITS);
+    return buffer_idx | (cookie << pb->bits);
+}
+
+static struct packet *
+id_to_packet(const struct pktbuf *pb, uint32_t id)
+{
+    return &pb->packets[id & ((1u << pb->bits) - 1)];
 }
 
 /* Attempts to allocate an OpenFlow packet buffer id within 'pb'.  The packet
- * buffer will store a copy of 'buffer_size' bytes in 'buffer' and the port
- * number 'in_port', which should be the OpenFlow port number on which 'buffer'
- * was received.
+ * buffer will store a reference to 'data', a packet created with
+ * pktbuf_data_create(), and the port number 'in_port', which should be the
+ * OpenFlow port number on which 'data' was received.
  *
  * If successful, returns the packet buffer id (a number other than
  * UINT32_MAX).  pktbuf_retrieve() can later be used to retrieve the buffer and
  * its input port number (buffers do expire after a time, so this is not
  * guaranteed to be true forever).  On failure, returns UINT32_MAX.
  *
- * The caller retains ownership of 'buffer'. */
+ * The caller retains its own reference to 'data'. */
 uint32_t
-pktbuf_save(struct pktbuf *pb, const void *buffer, size_t buffer_size,
-            uint16_t in_port)
+pktbuf_save(struct pktbuf *pb, struct pktbuf_data *data, uint16_t in_port)
 {
-    struct packet *p = &pb->packets[pb->buffer_idx];
-    pb->buffer_idx = (pb->buffer_idx + 1) & PKTBUF_MASK;
-    if (p->buffer) {
-        if (time_msec() < p->timeout) {
+    struct packet *p;
+
+    if (list_is_empty(&pb->free)) {
+        pktbuf_run(pb);
+        if (list_is_empty(&pb->free)) {
+            COVERAGE_INC(pktbuf_full);
+            pb->n_full++;
             return UINT32_MAX;
         }
-        ofpbuf_delete(p->buffer);
     }
 
-    /* Don't use maximum cookie value since all-1-bits ID is special. */
-    if (++p->cookie >= COOKIE_MAX) {
-        p->cookie = 0;
-    }
-    p->buffer = ofpbuf_clone_data_with_headroom(buffer, buffer_size,
-                                                sizeof(struct ofp_packet_in));
-
+    p = CONTAINER_OF(list_pop_front(&pb->free), struct packet, list_node);
+    list_push_back(&pb->used, &p->list_node);
+    pb->n_used++;
 
-    p->timeout = time_msec() + OVERWRITE_MSECS;
+    p->cookie = pb->cookie;
+    if (++pb->cookie >= pktbuf_cookie_max(pb)) {
+        pb->cookie = 0;
+    }
+    p->data = data;
+    if (data->ref_cnt++ > 1) {
+        pb->n_shared++;
+    }
+    p->timeout = time_msec() + PKTBUF_TTL_MSECS;
     p->in_port = in_port;
-    return make_id(p - pb->packets, p->cookie);
+    pb->n_saved++;
+    return make_id(pb, p - pb->packets, p->cookie);
 }
 
 /*
@@ -151,7 +351,7 @@ pktbuf_save(struct pktbuf *pb, const void *buffer, size_t buffer_size,
 uint32_t
 pktbuf_get_null(void)
 {
-    return make_id(0, COOKIE_MAX);
+    return PKTBUF_NULL_ID;
 }
 
 /* Attempts to retrieve a saved packet with the given 'id' from 'pb'.  Returns
@@ -188,32 +388,35 @@ pktbuf_retrieve(struct pktbuf *pb, uint32_t id, struct ofpbuf **bufferp,
         return OFPERR_OFPBRC_BUFFER_UNKNOWN;
     }
 
-    p = &pb->packets[id & PKTBUF_MASK];
-    if (p->cookie == id >> PKTBUF_BITS) {
-        struct ofpbuf *buffer = p->buffer;
-        if (buffer) {
-            *bufferp = buffer;
-            if (in_port) {
-                *in_port = p->in_port;
-            }
-            p->buffer = NULL;
-            COVERAGE_INC(pktbuf_retrieved);
-            return 0;
-        } else {
-            COVERAGE_INC(pktbuf_reuse_error);
-            VLOG_WARN_RL(&rl, "attempt to reuse buffer %08"PRIx32, id);
-            error = OFPERR_OFPBRC_BUFFER_EMPTY;
+    p = id_to_packet(pb, id);
+    if (p->cookie == id >> pb->bits && p->data) {
+        *bufferp = pktbuf_data_steal(p->data);
+        if (in_port) {
+            *in_port = p->in_port;
         }
-    } else if (id >> PKTBUF_BITS != COOKIE_MAX) {
-        COVERAGE_INC(pktbuf_buffer_unknown);
-        VLOG_WARN_RL(&rl, "cookie mismatch: %08"PRIx32" != %08"PRIx32,
-                     id, (id & PKTBUF_MASK) | (p->cookie << PKTBUF_BITS));
-        error = OFPERR_OFPBRC_BUFFER_UNKNOWN;
-    } else {
+        p->data = NULL;
+        list_remove(&p->list_node);
+        list_push_back(&pb->free, &p->list_node);
+        pb->n_used--;
+        pb->n_retrieved++;
+        COVERAGE_INC(pktbuf_retrieved);
+        return 0;
+    } else if (id == PKTBUF_NULL_ID) {
         COVERAGE_INC(pktbuf_null_cookie);
         VLOG_INFO_RL(&rl, "Received null cookie %08"PRIx32" (this is normal "
                      "if the switch was recently in fail-open mode)", id);
         error = 0;
+    } else if (p->cookie == id >> pb->bits) {
+        COVERAGE_INC(pktbuf_reuse_error);
+        VLOG_WARN_RL(&rl, "attempt to reuse buffer %08"PRIx32, id);
+        pb->n_reused++;
+        error = OFPERR_OFPBRC_BUFFER_EMPTY;
+    } else {
+        COVERAGE_INC(pktbuf_buffer_unknown);
+        VLOG_WARN_RL(&rl, "cookie mismatch: %08"PRIx32" != %08"PRIx32,
+                     id, make_id(pb, p - pb->packets, p->cookie));
+        pb->n_unknown++;
+        error = OFPERR_OFPBRC_BUFFER_UNKNOWN;
     }
 error:
     *bufferp = NULL;
@@ -226,10 +429,9 @@ error:
 void
 pktbuf_discard(struct pktbuf *pb, uint32_t id)
 {
-    struct packet *p = &pb->packets[id & PKTBUF_MASK];
-    if (p->cookie == id >> PKTBUF_BITS) {
-        ofpbuf_delete(p->buffer);
-        p->buffer = NULL;
+    struct packet *p = id_to_packet(pb, id);
+    if (p->cookie == id >> pb->bits && p->data) {
+        pktbuf_free_packet(pb, p);
     }
 }
 
@@ -238,17 +440,17 @@ pktbuf_discard(struct pktbuf *pb, uint32_t id)
 unsigned int
 pktbuf_count_packets(const struct pktbuf *pb)
 {
-    int n = 0;
-
-    if (pb) {
-        int i;
-
-        for (i = 0; i < PKTBUF_CNT; i++) {
-            if (pb->packets[i].buffer) {
-                n++;
-            }
-        }
-    }
+    return pb ? pb->n_used : 0;
+}
 
-    return n;
+/* Appends a human-readable description of 'pb''s capacity and statistics to
+ * 'ds'. */
+void
+pktbuf_format_stats(const struct pktbuf *pb, struct ds *ds)
+{
+    ds_put_format(ds, "capacity=%d in_use=%u saved=%llu shared=%llu "
+                  "retrieved=%llu expired=%llu full=%llu reused=%llu "
+                  "unknown=%llu\n", pktbuf_capacity(pb), pb->n_used,
+                  pb->n_saved, pb->n_shared, pb->n_retrieved, pb->n_expired,
+                  pb->n_full, pb->n_reused, pb->n_unknown);
 }
@@ -22,20 +22,36 @@
 
 #include "ofp-errors.h"
 
+struct ds;
 struct pktbuf;
+struct pktbuf_data;
 struct ofpbuf;
 
-int pktbuf_capacity(void);
+/* Default, minimum, and maximum number of packets that a pktbuf holds. */
+#define PKTBUF_DEFAULT_CNT 256
+#define PKTBUF_MIN_CNT 256
+#define PKTBUF_MAX_CNT (1u << 20)
 
-struct pktbuf *pktbuf_create(void);
+int pktbuf_capacity(const struct pktbuf *);
+
+struct pktbuf *pktbuf_create(int capacity);
 void pktbuf_destroy(struct pktbuf *);
-uint32_t pktbuf_save(struct pktbuf *, const void *buffer, size_t buffer_size,
-                     uint16_t in_port);
+void pktbuf_set_capacity(struct pktbuf *, int capacity);
+void pktbuf_flush(struct pktbuf *);
+
+void pktbuf_run(struct pktbuf *);
+void pktbuf_wait(const struct pktbuf *);
+
+struct pktbuf_data *pktbuf_data_create(const void *buffer, size_t buffer_size);
+void pktbuf_data_unref(struct pktbuf_data *);
+
+uint32_t pktbuf_save(struct pktbuf *, struct pktbuf_data *, uint16_t in_port);
 uint32_t pktbuf_get_null(void);
 enum ofperr pktbuf_retrieve(struct pktbuf *, uint32_t id,
                             struct ofpbuf **bufferp, uint16_t *in_port);
 void pktbuf_discard(struct pktbuf *, uint32_t id);
 
 unsigned int pktbuf_count_packets(const struct pktbuf *);
+void pktbuf_format_stats(const struct pktbuf *, struct ds *);
 
 #endif /* pktbuf.h */
@@ -9,6 +9,7 @@ TESTSUITE_AT = \
 	tests/ovsdb-macros.at \
 	tests/library.at \
 	tests/heap.at \
+	tests/mac-learning.at \
 	tests/bundle.at \
 	tests/classifier.at \
 	tests/check-structs.at \
@@ -107,14 +108,17 @@ lcov_wrappers = \
 	tests/lcov/test-jsonrpc \
 	tests/lcov/test-list \
 	tests/lcov/test-lockfile \
+	tests/lcov/test-mac-learning \
 	tests/lcov/test-multipath \
 	tests/lcov/test-odp \
+	tests/lcov/test-ofpbuf \
 	tests/lcov/test-ovsdb \
 	tests/lcov/test-packets \
 	tests/lcov/test-random \
 	tests/lcov/test-reconnect \
 	tests/lcov/test-sha1 \
 	tests/lcov/test-stp \
+	tests/lcov/test-timer-wheel \
 	tests/lcov/test-timeval \
 	tests/lcov/test-type-props \
 	tests/lcov/test-unix-socket \
@@ -165,14 +169,17 @@ valgrind_wrappers = \
 	tests/valgrind/test-jsonrpc \
 	tests/valgrind/test-list \
 	tests/valgrind/test-lockfile \
+	tests/valgrind/test-mac-learning \
 	tests/valgrind/test-multipath \
 	tests/valgrind/test-odp \
+	tests/valgrind/test-ofpbuf \
 	tests/valgrind/test-ovsdb \
 	tests/valgrind/test-packets \
 	tests/valgrind/test-random \
 	tests/valgrind/test-reconnect \
 	tests/valgrind/test-sha1 \
 	tests/valgrind/test-stp \
+	tests/valgrind/test-timer-wheel \
 	tests/valgrind/test-timeval \
 	tests/valgrind/test-type-props \
 	tests/valgrind/test-unix-socket \
@@ -224,15 +231,24 @@ tests_test_aes128_SOURCES = tests/test-aes128.c
 tests_test_aes128_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
 
 noinst_PROGRAMS += tests/test-bundle
-tests_test_bundle_SOURCES = tests/test-bundle.c
+tests_test_bundle_SOURCES = \
+	tests/benchmark.c \
+	tests/benchmark.h \
+	tests/test-bundle.c
 tests_test_bundle_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
 
 noinst_PROGRAMS += tests/test-classifier
-tests_test_classifier_SOURCES = tests/test-classifier.c
+tests_test_classifier_SOURCES = \
+	tests/benchmark.c \
+	tests/benchmark.h \
+	tests/test-classifier.c
 tests_test_classifier_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
 
 noinst_PROGRAMS += tests/test-csum
-tests_test_csum_SOURCES = tests/test-csum.c
+tests_test_csum_SOURCES = \
+	tests/benchmark.c \
+	tests/benchmark.h \
+	tests/test-csum.c
 tests_test_csum_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
 
 noinst_PROGRAMS += tests/test-file_name
@@ -240,12 +256,18 @@ tests_test_file_name_SOURCES = tests/test-file_name.c
 tests_test_file_name_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
 
 noinst_PROGRAMS += tests/test-flows
-tests_test_flows_SOURCES = tests/test-flows.c
+tests_test_flows_SOURCES = \
+	tests/benchmark.c \
+	tests/benchmark.h \
+	tests/test-flows.c
 tests_test_flows_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
 dist_check_SCRIPTS = tests/flowgen.pl
 
 noinst_PROGRAMS += tests/test-hash
-tests_test_hash_SOURCES = tests/test-hash.c
+tests_test_hash_SOURCES = \
+	tests/benchmark.c \
+	tests/benchmark.h \
+	tests/test-hash.c
 tests_test_hash_LDADD = lib/libopenvswitch.a
 
 noinst_PROGRAMS += tests/test-heap
@@ -253,7 +275,10 @@ tests_test_heap_SOURCES = tests/test-heap.c
 tests_test_heap_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
 
 noinst_PROGRAMS += tests/test-hmap
-tests_test_hmap_SOURCES = tests/test-hmap.c
+tests_test_hmap_SOURCES = \
+	tests/benchmark.c \
+	tests/benchmark.h \
+	tests/test-hmap.c
 tests_test_hmap_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
 
 noinst_PROGRAMS += tests/test-json
@@ -272,10 +297,24 @@ noinst_PROGRAMS += tests/test-lockfile
 tests_test_lockfile_SOURCES = tests/test-lockfile.c
 tests_test_lockfile_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
 
+noinst_PROGRAMS += tests/test-mac-learning
+tests_test_mac_learning_SOURCES = \
+	tests/benchmark.c \
+	tests/benchmark.h \
+	tests/test-mac-learning.c
+tests_test_mac_learning_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
+
 noinst_PROGRAMS += tests/test-multipath
-tests_test_multipath_SOURCES = tests/test-multipath.c
+tests_test_multipath_SOURCES = \
+	tests/benchmark.c \
+	tests/benchmark.h \
+	tests/test-multipath.c
 tests_test_multipath_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
 
+noinst_PROGRAMS += tests/test-ofpbuf
+tests_test_ofpbuf_SOURCES = tests/test-ofpbuf.c
+tests_test_ofpbuf_LDADD = lib/libopenvswitch.a
+
 noinst_PROGRAMS += tests/test-packets
 tests_test_packets_SOURCES = tests/test-packets.c
 tests_test_packets_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
@@ -288,6 +327,10 @@ noinst_PROGRAMS += tests/test-stp
 tests_test_stp_SOURCES = tests/test-stp.c
 tests_test_stp_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
 
+noinst_PROGRAMS += tests/test-timer-wheel
+tests_test_timer_wheel_SOURCES = tests/test-timer-wheel.c
+tests_test_timer_wheel_LDADD = lib/libopenvswitch.a
+
 noinst_PROGRAMS += tests/test-netflow
 tests_test_netflow_SOURCES = tests/test-netflow.c
 tests_test_netflow_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
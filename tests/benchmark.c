@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2012 Nicira, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <config.h>
+#include "benchmark.h"
+#include <stdio.h>
+#include <sys/time.h>
+#include "timeval.h"
+
+/* Returns the number of microseconds that have passed since 'start', which
+ * the caller obtained from xgettimeofday(). */
+long long int
+elapsed_usec(const struct timeval *start)
+{
+    struct timeval end;
+
+    xgettimeofday(&end);
+    return ((end.tv_sec - start->tv_sec) * 1000000LL
+            + (end.tv_usec - start->tv_usec));
+}
+
+/* Prints that 'name' did 'n' operations, each described by 'unit' (e.g.
+ * "lookups"), in 'usec' microseconds, and the resulting rate. */
+void
+print_rate(const char *name, unsigned int n, const char *unit,
+           long long int usec)
+{
+    printf("%-22s %10u %s in %8lld us (%.1f M%s/s)\n",
+           name, n, unit, usec, usec ? (double) n / usec : 0.0, unit);
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2012 Nicira, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H 1
+
+/* Helpers for the "benchmark" commands of the test programs. */
+
+struct timeval;
+
+long long int elapsed_usec(const struct timeval *start);
+void print_rate(const char *name, unsigned int n, const char *unit,
+                long long int usec);
+
+#endif /* benchmark.h */
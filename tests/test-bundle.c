@@ -1,4 +1,4 @@
-/* Copyright (c) 2011 Nicira, Inc.
+/* Copyright (c) 2011, 2012 Nicira, Inc.
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -19,11 +19,14 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
 
+#include "benchmark.h"
 #include "flow.h"
 #include "ofpbuf.h"
 #include "random.h"
-
+#include "timeval.h"
 #include "util.h"
 
 #define N_FLOWS  50000
@@ -39,6 +42,7 @@ struct slave {
 struct slave_group {
     size_t n_slaves;
     struct slave slaves[MAX_SLAVES];
+    size_t n_calls;             /* Number of calls to slave_enabled_cb(). */
 };
 
 static struct slave *
@@ -58,9 +62,11 @@ slave_lookup(struct slave_group *sg, uint16_t slave_id)
 static bool
 slave_enabled_cb(uint16_t slave_id, void *aux)
 {
+    struct slave_group *sg = aux;
     struct slave *slave;
 
-    slave = slave_lookup(aux, slave_id);
+    sg->n_calls++;
+    slave = slave_lookup(sg, slave_id);
     return slave ? slave->enabled : false;
 }
 
@@ -97,41 +103,34 @@ mask_str(uint8_t mask, size_t n_bits)
     return str;
 }
 
-int
-main(int argc, char *argv[])
+static void
+init_slave_group(struct slave_group *sg, const struct nx_action_bundle *nab)
 {
-    bool ok = true;
-    struct nx_action_bundle *nab;
-    struct flow *flows;
-    size_t i, n_permute, old_n_enabled;
-    struct slave_group sg;
-    int old_active;
-
-    set_program_name(argv[0]);
-    random_init();
-
-    if (argc != 2) {
-        ovs_fatal(0, "usage: %s bundle_action", program_name);
-    }
-
-    nab = parse_bundle_actions(argv[1]);
+    size_t i;
 
-    /* Generate 'slaves' array. */
-    sg.n_slaves = 0;
+    sg->n_slaves = 0;
+    sg->n_calls = 0;
     for (i = 0; i < ntohs(nab->n_slaves); i++) {
         uint16_t slave_id = bundle_get_slave(nab, i);
 
-        if (slave_lookup(&sg, slave_id)) {
+        if (slave_lookup(sg, slave_id)) {
             ovs_fatal(0, "Redundant slaves are not supported. ");
         }
 
-        sg.slaves[sg.n_slaves].slave_id = slave_id;
-        sg.n_slaves++;
+        sg->slaves[sg->n_slaves].slave_id = slave_id;
+        sg->slaves[sg->n_slaves].enabled = true;
+        sg->n_slaves++;
     }
+}
+
+static struct flow *
+generate_flows(const struct nx_action_bundle *nab, size_t n)
+{
+    struct flow *flows;
+    size_t i;
 
-    /* Generate flows. */
-    flows = xmalloc(N_FLOWS * sizeof *flows);
-    for (i = 0; i < N_FLOWS; i++) {
+    flows = xmalloc(n * sizeof *flows);
+    for (i = 0; i < n; i++) {
         random_bytes(&flows[i], sizeof flows[i]);
         flows[i].regs[0] = OFPP_NONE;
     }
@@ -139,6 +138,81 @@ main(int argc, char *argv[])
     if (bundle_check(nab, 1024, flows)) {
         ovs_fatal(0, "Bundle action fails to check.");
     }
+    return flows;
+}
+
+/* Measures the rate at which bundle_execute() chooses slaves for 'n' flows,
+ * first with every slave enabled, then with the first slave disabled. */
+static void
+benchmark(const struct nx_action_bundle *nab, unsigned int n)
+{
+    struct slave_group sg;
+    struct flow *flows;
+    int pass;
+
+    init_slave_group(&sg, nab);
+    flows = generate_flows(nab, n);
+    for (pass = 0; pass < 2; pass++) {
+        struct timeval start;
+        long long int usec;
+        uint16_t sum;
+        unsigned int i;
+
+        if (pass && sg.n_slaves) {
+            sg.slaves[0].enabled = false;
+        }
+
+        sum = 0;
+        sg.n_calls = 0;
+        xgettimeofday(&start);
+        for (i = 0; i < n; i++) {
+            sum += bundle_execute(nab, &flows[i], slave_enabled_cb, &sg);
+        }
+        usec = elapsed_usec(&start);
+
+        printf("%s: %u flows in %lld us (%.1f Mflows/s), "
+               "%.2f callbacks per flow\n",
+               pass ? "first slave disabled" : "all slaves enabled",
+               n, usec, usec ? (double) n / usec : 0.0,
+               n ? (double) sg.n_calls / n : 0.0);
+
+        /* Keep the compiler from discarding the results. */
+        if (sum == 1) {
+            printf("\n");
+        }
+    }
+    free(flows);
+}
+
+int
+main(int argc, char *argv[])
+{
+    bool ok = true;
+    struct nx_action_bundle *nab;
+    struct flow *flows;
+    size_t i, n_permute, old_n_enabled;
+    struct slave_group sg;
+    int old_active;
+
+    set_program_name(argv[0]);
+    random_init();
+
+    if (argc >= 3 && !strcmp(argv[1], "benchmark")) {
+        nab = parse_bundle_actions(argv[2]);
+        benchmark(nab, argc > 3 ? atoi(argv[3]) : 1000000);
+        free(nab);
+        return 0;
+    }
+
+    if (argc != 2) {
+        ovs_fatal(0, "usage: %s bundle_action\n"
+                  "       %s benchmark bundle_action [n_flows]",
+                  program_name, program_name);
+    }
+
+    nab = parse_bundle_actions(argv[1]);
+    init_slave_group(&sg, nab);
+    flows = generate_flows(nab, N_FLOWS);
 
     /* Cycles through each possible liveness permutation for the given
      * n_slaves.  The initial state is equivalent to all slaves down, so we
@@ -183,6 +257,7 @@ main(int argc, char *argv[])
         }
 
         changed = 0;
+        sg.n_calls = 0;
         for (j = 0; j < N_FLOWS; j++) {
             struct flow *flow = &flows[j];
             uint16_t old_slave_id, ofp_port;
@@ -204,6 +279,16 @@ main(int argc, char *argv[])
             }
         }
 
+        /* With every slave enabled, each choice should need to ask about just
+         * one slave.  (Each flow is looked up twice above.) */
+        if (sg.n_slaves && n_enabled == sg.n_slaves
+            && sg.n_calls != 2 * N_FLOWS) {
+            fprintf(stderr, "%s: %zu calls to slave_enabled_cb() for %d "
+                    "flows with every slave enabled\n",
+                    mask_str(mask, sg.n_slaves), sg.n_calls, 2 * N_FLOWS);
+            ok = false;
+        }
+
         if (nab->algorithm == htons(NX_BD_ALG_ACTIVE_BACKUP)) {
             perfect = active == old_active ? 0.0 : 1.0;
         } else {
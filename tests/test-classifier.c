@@ -29,11 +29,15 @@
 #include "classifier.h"
 #include <errno.h>
 #include <limits.h>
+#include <stdio.h>
+#include "benchmark.h"
 #include "byte-order.h"
 #include "command-line.h"
 #include "flow.h"
 #include "ofp-util.h"
 #include "packets.h"
+#include "random.h"
+#include "timeval.h"
 #include "unaligned.h"
 
 #undef NDEBUG
@@ -898,6 +902,214 @@ test_many_rules_in_five_tables(int argc OVS_UNUSED, char *argv[] OVS_UNUSED)
     test_many_rules_in_n_tables(5);
 }
 
+/* Miniflow tests. */
+
+/* Fills 'flow' with random data, with about half of its 32-bit words zero. */
+static void
+random_sparse_flow(struct flow *flow)
+{
+    uint32_t *flow_u32 = (uint32_t *) flow;
+    unsigned int i;
+
+    random_bytes(flow, sizeof *flow);
+    for (i = 0; i < FLOW_U32S; i++) {
+        if (random_range(2)) {
+            flow_u32[i] = 0;
+        }
+    }
+    memset(flow->reserved, 0, sizeof flow->reserved);
+}
+
+/* Returns the hash_words() of the words of 'flow' for which 'masks' is
+ * nonzero, each ANDed with its mask. */
+static uint32_t
+hash_masked_words(const struct flow *flow, const struct flow *masks,
+                  uint32_t basis)
+{
+    const uint32_t *flow_u32 = (const uint32_t *) flow;
+    const uint32_t *masks_u32 = (const uint32_t *) masks;
+    uint32_t words[FLOW_U32S];
+    unsigned int i;
+    size_t n;
+
+    n = 0;
+    for (i = 0; i < FLOW_U32S; i++) {
+        if (masks_u32[i]) {
+            words[n++] = flow_u32[i] & masks_u32[i];
+        }
+    }
+    return hash_words(words, n, basis);
+}
+
+static void
+test_miniflow(int argc OVS_UNUSED, char *argv[] OVS_UNUSED)
+{
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        const uint32_t *flow_u32;
+        struct test_rule *rule;
+        struct miniflow mf, mf2;
+        struct minimask mask;
+        struct flow flow, flow2, masks, masks2;
+        unsigned int ofs;
+
+        /* Convert to and from a miniflow. */
+        random_sparse_flow(&flow);
+        flow_u32 = (const uint32_t *) &flow;
+        miniflow_init(&mf, &flow);
+        miniflow_expand(&mf, &flow2);
+        assert(!memcmp(&flow, &flow2, sizeof flow));
+        assert(miniflow_equal_flow(&mf, &flow));
+        for (ofs = 0; ofs < FLOW_U32S; ofs++) {
+            assert(miniflow_get(&mf, ofs) == flow_u32[ofs]);
+        }
+
+        /* Clone, compare, and hash. */
+        miniflow_clone(&mf2, &mf);
+        assert(miniflow_equal(&mf, &mf2));
+        assert(miniflow_hash(&mf, 0) == miniflow_hash(&mf2, 0));
+        miniflow_destroy(&mf2);
+
+        /* A change in any word makes the flows differ. */
+        ofs = random_range(FLOW_U32S);
+        ((uint32_t *) &flow2)[ofs] ^= 1u << random_range(32);
+        assert(!miniflow_equal_flow(&mf, &flow2));
+        miniflow_init(&mf2, &flow2);
+        assert(!miniflow_equal(&mf, &mf2));
+        miniflow_destroy(&mf2);
+
+        /* Masked hashing and comparison agree with flow_zero_wildcards(). */
+        rule = make_rule(random_range(1u << CLS_N_FIELDS), 0,
+                         random_range(1u << CLS_N_FIELDS));
+        minimask_init(&mask, &rule->cls_rule.wc);
+        flow_wildcards_get_masks(&rule->cls_rule.wc, &masks);
+        minimask_expand(&mask, &masks2);
+        assert(!memcmp(&masks, &masks2, sizeof masks));
+
+        flow2 = flow;
+        flow_zero_wildcards(&flow2, &rule->cls_rule.wc);
+        assert(flow_equal_in_minimask(&flow, &flow2, &mask));
+        assert(flow_equal_in_masks(&flow, &flow2, &masks));
+        assert(flow_hash_in_minimask(&flow, &mask, 0)
+               == flow_hash_in_minimask(&flow2, &mask, 0));
+        assert(flow_hash_in_minimask(&flow, &mask, i)
+               == hash_masked_words(&flow, &masks, i));
+        cls_rule_zero_wildcarded_fields(&rule->cls_rule);
+        assert(flow_equal_in_minimask(&flow, &rule->cls_rule.flow, &mask)
+               == flow_equal(&flow2, &rule->cls_rule.flow));
+        assert(flow_equal_in_masks(&flow, &rule->cls_rule.flow, &masks)
+               == flow_equal(&flow2, &rule->cls_rule.flow));
+
+        /* Changing wildcarded bits changes neither. */
+        for (ofs = 0; ofs < FLOW_U32S; ofs++) {
+            uint32_t *masks_u32 = (uint32_t *) &masks;
+            uint32_t *flow2_u32 = (uint32_t *) &flow2;
+            const uint32_t *rule_u32
+                = (const uint32_t *) &rule->cls_rule.flow;
+
+            flow2_u32[ofs] = ((rule_u32[ofs] & masks_u32[ofs])
+                              | (random_uint32() & ~masks_u32[ofs]));
+        }
+        assert(flow_equal_in_minimask(&flow2, &rule->cls_rule.flow, &mask));
+        assert(flow_equal_in_masks(&flow2, &rule->cls_rule.flow, &masks));
+        assert(flow_hash_in_minimask(&flow2, &mask, 0)
+               == flow_hash_in_minimask(&rule->cls_rule.flow, &mask, 0));
+
+        minimask_destroy(&mask);
+        miniflow_destroy(&mf);
+        free(rule);
+    }
+}
+
+/* Benchmark. */
+
+/* "benchmark [N_LOOKUPS]": measures the per-table work of a classifier lookup
+ * (masking, hashing, and comparing a flow against a rule) done field by field
+ * with flow_zero_wildcards(), flow_hash(), and flow_equal(), against the
+ * word-wise flow_hash_in_minimask() and flow_equal_in_masks(), and then times
+ * classifier_lookup() itself. */
+static void
+test_benchmark(int argc, char *argv[])
+{
+    enum { N_TABLES = 16 };
+    unsigned int n_lookups = argc > 1 ? atoi(argv[1]) : 1000000;
+    struct test_rule *rules[N_TABLES];
+    struct minimask masks[N_TABLES];
+    struct flow mask_flows[N_TABLES];
+    struct classifier cls;
+    struct timeval start;
+    struct flow *flows;
+    unsigned int i;
+    uint32_t hash;
+    int n_equal, n_equal2;
+
+    flows = xmalloc(n_lookups * sizeof *flows);
+    for (i = 0; i < n_lookups; i++) {
+        struct test_rule *rule;
+
+        rule = make_rule(0, 0, random_range(1u << CLS_N_FIELDS));
+        flows[i] = rule->cls_rule.flow;
+        free(rule);
+    }
+
+    classifier_init(&cls);
+    for (i = 0; i < N_TABLES; i++) {
+        rules[i] = make_rule(random_range(1u << CLS_N_FIELDS) | 1, i + 1,
+                             random_range(1u << CLS_N_FIELDS));
+        cls_rule_zero_wildcarded_fields(&rules[i]->cls_rule);
+        classifier_insert(&cls, &rules[i]->cls_rule);
+        minimask_init(&masks[i], &rules[i]->cls_rule.wc);
+        flow_wildcards_get_masks(&rules[i]->cls_rule.wc, &mask_flows[i]);
+    }
+
+    hash = 0;
+    n_equal = 0;
+    xgettimeofday(&start);
+    for (i = 0; i < n_lookups; i++) {
+        const struct cls_rule *rule = &rules[i % N_TABLES]->cls_rule;
+        struct flow f = flows[i];
+
+        flow_zero_wildcards(&f, &rule->wc);
+        hash += flow_hash(&f, 0);
+        n_equal += flow_equal(&f, &rule->flow);
+    }
+    print_rate("field-wise", n_lookups, "lookups", elapsed_usec(&start));
+
+    n_equal2 = 0;
+    xgettimeofday(&start);
+    for (i = 0; i < n_lookups; i++) {
+        unsigned int idx = i % N_TABLES;
+        const struct flow *f = &flows[i];
+
+        hash += flow_hash_in_minimask(f, &masks[idx], 0);
+        n_equal2 += flow_equal_in_masks(f, &rules[idx]->cls_rule.flow,
+                                        &mask_flows[idx]);
+    }
+    print_rate("word-wise", n_lookups, "lookups", elapsed_usec(&start));
+    assert(n_equal == n_equal2);
+
+    n_equal = 0;
+    xgettimeofday(&start);
+    for (i = 0; i < n_lookups; i++) {
+        n_equal += classifier_lookup(&cls, &flows[i]) != NULL;
+    }
+    print_rate("classifier", n_lookups, "lookups", elapsed_usec(&start));
+
+    for (i = 0; i < N_TABLES; i++) {
+        classifier_remove(&cls, &rules[i]->cls_rule);
+        minimask_destroy(&masks[i]);
+        free(rules[i]);
+    }
+    classifier_destroy(&cls);
+    free(flows);
+
+    /* Keep the compiler from discarding the hashes. */
+    if (hash == 1) {
+        printf("\n");
+    }
+}
+
 static const struct command commands[] = {
     {"empty", 0, 0, test_empty},
     {"destroy-null", 0, 0, test_destroy_null},
@@ -907,6 +1119,8 @@ static const struct command commands[] = {
     {"many-rules-in-one-table", 0, 0, test_many_rules_in_one_table},
     {"many-rules-in-two-tables", 0, 0, test_many_rules_in_two_tables},
     {"many-rules-in-five-tables", 0, 0, test_many_rules_in_five_tables},
+    {"miniflow", 0, 0, test_miniflow},
+    {"benchmark", 0, 1, test_benchmark},
     {NULL, 0, 0, NULL},
 };
 
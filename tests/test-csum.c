@@ -21,7 +21,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
+#include "benchmark.h"
 #include "random.h"
+#include "timeval.h"
 #include "unaligned.h"
 #include "util.h"
 
@@ -133,12 +136,166 @@ test_rfc1624(void)
     mark('#');
 }
 
+/* Returns the IP checksum of the 'n' bytes at 'data_', computed 16 bits at a
+ * time, as csum() used to, for comparison against csum(). */
+static ovs_be16
+reference_csum(const void *data_, size_t n)
+{
+    const uint8_t *data = data_;
+    uint32_t partial = 0;
+
+    for (; n > 1; n -= 2, data += 2) {
+        partial += get_unaligned_u16((const uint16_t *) data);
+        partial = (partial & 0xffff) + (partial >> 16);
+    }
+    if (n) {
+        partial += *data;
+    }
+    return csum_finish(partial);
+}
+
+/* Checks csum() and csum_continue() against reference_csum() for every length
+ * up to 300 bytes at every alignment, for random data and for all-1s data,
+ * which produces the most carries. */
+static void
+test_csum_lengths(void)
+{
+    uint8_t data[300 + 8];
+    int pass;
+
+    for (pass = 0; pass < 2; pass++) {
+        size_t ofs, n;
+
+        if (!pass) {
+            random_bytes(data, sizeof data);
+        } else {
+            memset(data, 0xff, sizeof data);
+        }
+
+        for (ofs = 0; ofs < 8; ofs++) {
+            const uint8_t *p = &data[ofs];
+
+            for (n = 0; n <= 300; n++) {
+                ovs_be16 expected = reference_csum(p, n);
+                size_t split = (n / 2) & ~1;
+                uint32_t partial;
+
+                assert(csum(p, n) == expected);
+
+                partial = csum_continue(0, p, split);
+                partial = csum_continue(partial, p + split, n - split);
+                assert(csum_finish(partial) == expected);
+            }
+            mark('.');
+        }
+    }
+    mark('#');
+}
+
+/* Checks that changing several fields at once and updating the checksum with
+ * csum_delta16(), csum_delta32(), csum_delta128(), and a single
+ * recalc_csum_delta() gives the same result as recomputing it. */
+static void
+test_csum_delta(void)
+{
+    int i;
+
+    for (i = 0; i < 32; i++) {
+        union {
+            ovs_be32 u32[16];
+            ovs_be16 u16[32];
+        } data;
+        ovs_be32 new_u128[4];
+        ovs_be16 new_u16;
+        ovs_be32 new_u32;
+        ovs_be16 old_csum;
+        uint32_t delta;
+        int j;
+
+        for (j = 0; j < ARRAY_SIZE(data.u32); j++) {
+            data.u32[j] = (OVS_FORCE ovs_be32) random_uint32();
+        }
+        old_csum = csum(&data, sizeof data);
+
+        new_u16 = (OVS_FORCE ovs_be16) random_uint32();
+        delta = csum_delta16(0, data.u16[1], new_u16);
+        data.u16[1] = new_u16;
+
+        new_u32 = (OVS_FORCE ovs_be32) random_uint32();
+        delta = csum_delta32(delta, data.u32[3], new_u32);
+        data.u32[3] = new_u32;
+
+        for (j = 0; j < 4; j++) {
+            new_u128[j] = (OVS_FORCE ovs_be32) random_uint32();
+        }
+        delta = csum_delta128(delta, &data.u32[8], new_u128);
+        memcpy(&data.u32[8], new_u128, sizeof new_u128);
+
+        assert(csum(&data, sizeof data) == recalc_csum_delta(old_csum, delta));
+        mark('.');
+    }
+
+    /* Fields that do not change do not change the checksum. */
+    assert(recalc_csum_delta(htons(0x1234),
+                             csum_delta32(0, htonl(0x56789abc),
+                                          htonl(0x56789abc)))
+           == htons(0x1234));
+    mark('#');
+}
+
+/* Compares the throughput of csum() against 16-bit-at-a-time checksumming
+ * for 'n' checksums of 'size'-byte packets. */
+static void
+benchmark(unsigned int n, size_t size)
+{
+    struct timeval start;
+    long long int usec;
+    uint8_t *data;
+    ovs_be16 sum;
+    unsigned int i;
+
+    data = xmalloc(size);
+    random_bytes(data, size);
+
+    sum = 0;
+    xgettimeofday(&start);
+    for (i = 0; i < n; i++) {
+        data[0] = i;
+        sum += reference_csum(data, size);
+    }
+    usec = elapsed_usec(&start);
+    printf("%-16s %u x %zu bytes in %8lld us (%.1f MB/s)\n", "16-bit", n, size,
+           usec, usec ? (double) n * size / usec : 0.0);
+
+    xgettimeofday(&start);
+    for (i = 0; i < n; i++) {
+        data[0] = i;
+        sum += csum(data, size);
+    }
+    usec = elapsed_usec(&start);
+    printf("%-16s %u x %zu bytes in %8lld us (%.1f MB/s)\n", "csum", n, size,
+           usec, usec ? (double) n * size / usec : 0.0);
+
+    free(data);
+
+    /* Keep the compiler from discarding the checksums. */
+    if (sum == 1) {
+        printf("\n");
+    }
+}
+
 int
-main(void)
+main(int argc, char *argv[])
 {
     const struct test_case *tc;
     int i;
 
+    if (argc > 1 && !strcmp(argv[1], "benchmark")) {
+        benchmark(argc > 2 ? atoi(argv[2]) : 1000000,
+                  argc > 3 ? atoi(argv[3]) : 1500);
+        return 0;
+    }
+
     for (tc = test_cases; tc < &test_cases[ARRAY_SIZE(test_cases)]; tc++) {
         const void *data = tc->data;
         const ovs_be16 *data16 = (OVS_FORCE const ovs_be16 *) data;
@@ -236,6 +393,9 @@ main(void)
     }
     mark('#');
 
+    test_csum_lengths();
+    test_csum_delta();
+
     putchar('\n');
 
     return 0;
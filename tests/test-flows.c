@@ -19,12 +19,15 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
+#include "benchmark.h"
 #include "classifier.h"
 #include "openflow/openflow.h"
 #include "timeval.h"
 #include "ofpbuf.h"
 #include "ofp-print.h"
 #include "ofp-util.h"
+#include "packets.h"
 #include "pcap.h"
 #include "util.h"
 #include "vlog.h"
@@ -32,8 +35,147 @@
 #undef NDEBUG
 #include <assert.h>
 
+/* Clears the fields of 'flow' that flow_extract_depth() does not extract
+ * when parsing no deeper than 'depth'. */
+static void
+flow_clear_below(struct flow *flow, enum flow_parse_depth depth)
+{
+    if (depth < FLOW_PARSE_L4) {
+        flow->tp_src = flow->tp_dst = htons(0);
+        if (flow->dl_type == htons(ETH_TYPE_IPV6)) {
+            memset(&flow->nd_target, 0, sizeof flow->nd_target);
+            memset(flow->arp_sha, 0, sizeof flow->arp_sha);
+            memset(flow->arp_tha, 0, sizeof flow->arp_tha);
+        }
+    }
+    if (depth < FLOW_PARSE_L3) {
+        memset(&flow->ipv6_src, 0, sizeof flow->ipv6_src);
+        memset(&flow->ipv6_dst, 0, sizeof flow->ipv6_dst);
+        flow->ipv6_label = htonl(0);
+        flow->nw_src = flow->nw_dst = htonl(0);
+        flow->nw_proto = flow->nw_tos = flow->nw_ttl = flow->nw_frag = 0;
+        memset(flow->arp_sha, 0, sizeof flow->arp_sha);
+        memset(flow->arp_tha, 0, sizeof flow->arp_tha);
+    }
+}
+
+/* Checks that extracting 'packet' to each parse depth yields 'flow', as
+ * extracted to full depth, with the deeper fields cleared.  Returns the
+ * number of mismatches. */
+static int
+check_parse_depths(struct ofpbuf *packet, const struct flow *flow)
+{
+    void *l3 = packet->l3, *l4 = packet->l4, *l7 = packet->l7;
+    int errors = 0;
+    int depth;
+
+    for (depth = FLOW_PARSE_L2; depth < FLOW_PARSE_L4; depth++) {
+        struct flow expected, extracted;
+
+        expected = *flow;
+        flow_clear_below(&expected, depth);
+        flow_extract_depth(packet, 0, 0, 1, depth, &extracted);
+        if (!flow_equal(&expected, &extracted)
+            || packet->l3 != l3
+            || packet->l4 != (depth >= FLOW_PARSE_L3 ? l4 : NULL)
+            || packet->l7) {
+            char *exp_s = flow_to_string(&expected);
+            char *got_s = flow_to_string(&extracted);
+
+            printf("mismatch at parse depth %d.\n", depth);
+            printf("Expected flow:\n%s\n", exp_s);
+            printf("Actually extracted flow:\n%s\n", got_s);
+            free(exp_s);
+            free(got_s);
+            errors++;
+        }
+    }
+
+    /* Restore the header pointers for the caller. */
+    packet->l3 = l3;
+    packet->l4 = l4;
+    packet->l7 = l7;
+    return errors;
+}
+
+/* "benchmark FILE [N_PASSES]": reads all of the packets in pcap file FILE
+ * into memory, then reports how many packets per second flow_extract_depth()
+ * extracts at each parse depth, over N_PASSES passes through the packets. */
+static void
+benchmark(int argc, char *argv[])
+{
+    static const char *depth_names[] = { "l2", "l3", "l4" };
+    int n_passes = argc > 3 ? atoi(argv[3]) : 100;
+    struct ofpbuf **packets;
+    size_t n_packets, allocated;
+    FILE *pcap;
+    int depth;
+
+    if (argc < 3) {
+        ovs_fatal(0, "usage: %s benchmark FILE [N_PASSES]", argv[0]);
+    }
+
+    pcap = pcap_open(argv[2], "rb");
+    if (!pcap) {
+        ovs_fatal(0, "%s: could not open pcap file", argv[2]);
+    }
+
+    packets = NULL;
+    n_packets = allocated = 0;
+    for (;;) {
+        struct ofpbuf *packet;
+        int retval;
+
+        retval = pcap_read(pcap, &packet);
+        if (retval == EOF) {
+            break;
+        } else if (retval) {
+            ovs_fatal(retval, "%s: error reading pcap file", argv[2]);
+        }
+
+        if (n_packets >= allocated) {
+            packets = x2nrealloc(packets, &allocated, sizeof *packets);
+        }
+        packets[n_packets++] = packet;
+    }
+    fclose(pcap);
+    if (!n_packets) {
+        ovs_fatal(0, "%s: pcap file contains no packets", argv[2]);
+    }
+
+    for (depth = FLOW_PARSE_L2; depth <= FLOW_PARSE_L4; depth++) {
+        struct timeval start;
+        long long int usec;
+        int pass;
+
+        xgettimeofday(&start);
+        for (pass = 0; pass < n_passes; pass++) {
+            size_t i;
+
+            for (i = 0; i < n_packets; i++) {
+                struct flow flow;
+
+                if (i + 1 < n_packets) {
+                    OVS_PREFETCH(packets[i + 1]->data);
+                }
+                flow_extract_depth(packets[i], 0, 0, 1, depth, &flow);
+            }
+        }
+        usec = elapsed_usec(&start);
+
+        printf("%s: %zu packets x %d passes in %lld us (%.2f Mpps)\n",
+               depth_names[depth], n_packets, n_passes, usec,
+               usec ? (double) n_packets * n_passes / usec : 0.0);
+    }
+
+    while (n_packets > 0) {
+        ofpbuf_delete(packets[--n_packets]);
+    }
+    free(packets);
+}
+
 int
-main(int argc OVS_UNUSED, char *argv[])
+main(int argc, char *argv[])
 {
     struct ofp10_match expected_match;
     FILE *flows, *pcap;
@@ -42,6 +184,11 @@ main(int argc OVS_UNUSED, char *argv[])
 
     set_program_name(argv[0]);
 
+    if (argc > 1 && !strcmp(argv[1], "benchmark")) {
+        benchmark(argc, argv);
+        return 0;
+    }
+
     flows = stdin;
     pcap = fdopen(3, "rb");
     if (!pcap) {
@@ -69,6 +216,7 @@ main(int argc OVS_UNUSED, char *argv[])
         }
 
         flow_extract(packet, 0, 0, 1, &flow);
+        errors += check_parse_depths(packet, &flow);
         cls_rule_init_exact(&flow, 0, &rule);
         ofputil_cls_rule_to_ofp10_match(&rule, &extracted_match);
 
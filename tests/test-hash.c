@@ -19,7 +19,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
+#include "benchmark.h"
+#include "flow.h"
 #include "hash.h"
+#include "packets.h"
+#include "random.h"
+#include "timeval.h"
+#include "util.h"
 
 #undef NDEBUG
 #include <assert.h>
@@ -76,11 +83,272 @@ check_word_hash(uint32_t (*hash)(uint32_t), const char *name,
     }
 }
 
+static uint32_t
+mix(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x21f0aaad;
+    x ^= x >> 15;
+    x *= 0xd35a2d97;
+    x ^= x >> 15;
+    return x;
+}
+
+/* Returns the hash that hash_bytes() (if 'pad' is 8) or hash_words() (if 'pad'
+ * is 4) should produce for the 'n' bytes at 'p', computing the CRC32-C one bit
+ * at a time over 'p' padded with zeros to a multiple of 'pad' bytes. */
+static uint32_t
+reference_hash(const void *p_, size_t n, size_t pad, uint32_t basis)
+{
+    const uint8_t *p = p_;
+    size_t padded = ROUND_UP(n, pad);
+    uint32_t crc = 0;
+    size_t i;
+    int k;
+
+    for (i = 0; i < padded; i++) {
+        crc ^= i < n ? p[i] : 0;
+        for (k = 0; k < 8; k++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+        }
+    }
+
+    return mix(crc ^ n ^ mix(basis));
+}
+
+/* Checks that hash_bytes() and hash_words() give the same results as the
+ * bitwise reference implementation, whether or not they use the "crc32"
+ * instruction, for inputs of every length up to 64 bytes at every
+ * alignment. */
+static void
+check_crc_hash(void)
+{
+    uint32_t buf[32];
+    int n, ofs;
+
+    random_bytes(buf, sizeof buf);
+    for (n = 0; n <= 64; n++) {
+        for (ofs = 0; ofs < 8; ofs++) {
+            const uint8_t *p = (const uint8_t *) buf + ofs;
+            uint32_t basis = random_uint32();
+            uint32_t expected = reference_hash(p, n, 8, basis);
+
+            assert(hash_bytes(p, n, basis) == expected);
+            assert(hash_bytes_portable(p, n, basis) == expected);
+        }
+        if (n % 4 == 0) {
+            uint32_t expected = reference_hash(buf, n, 4, n);
+
+            assert(hash_words(buf, n / 4, n) == expected);
+            assert(hash_words_portable(buf, n / 4, n) == expected);
+        }
+    }
+}
+
+/* Checks hash_bytes_lookup3() against the test vectors published with
+ * lookup3's hashlittle(), which it matches on little-endian machines. */
+static void
+check_lookup3_hash(void)
+{
+#ifndef WORDS_BIGENDIAN
+    static const char s[] = "Four score and seven years ago";
+
+    assert(hash_bytes_lookup3("", 0, 0) == 0xdeadbeef);
+    assert(hash_bytes_lookup3("", 0, 0xdeadbeef) == 0xbd5b7dde);
+    assert(hash_bytes_lookup3(s, strlen(s), 0) == 0x17770551);
+    assert(hash_bytes_lookup3(s, strlen(s), 1) == 0xcd628161);
+#endif
+}
+
+/* The Bob Jenkins lookup3 hash_words() that the CRC-based hash replaced, kept
+ * here to compare against. */
+static uint32_t
+lookup3_hash_words(const uint32_t *p, size_t n, uint32_t basis)
+{
+    uint32_t a, b, c;
+
+    a = b = c = 0xdeadbeef + (((uint32_t) n) << 2) + basis;
+
+    while (n > 3) {
+        a += p[0];
+        b += p[1];
+        c += p[2];
+        hash_mix(&a, &b, &c);
+        n -= 3;
+        p += 3;
+    }
+
+    switch (n) {
+    case 3:
+        c += p[2];
+        /* fall through */
+    case 2:
+        b += p[1];
+        /* fall through */
+    case 1:
+        a += p[0];
+        hash_final(&a, &b, &c);
+        /* fall through */
+    case 0:
+        break;
+    }
+    return c;
+}
+
+/* Returns the number of distinct values among the low 'bits' bits of the
+ * 'n' hashes in 'hashes'. */
+static unsigned int
+count_buckets(const uint32_t *hashes, unsigned int n, int bits)
+{
+    size_t n_buckets = (size_t) 1 << bits;
+    uint8_t *used = xzalloc(n_buckets);
+    unsigned int n_used = 0;
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        uint32_t bucket = hashes[i] & (n_buckets - 1);
+        if (!used[bucket]) {
+            used[bucket] = 1;
+            n_used++;
+        }
+    }
+    free(used);
+    return n_used;
+}
+
+/* Compares the throughput of hashing a whole flow byte-wise and word-wise
+ * against hashing only the words of the flow selected by a mask, as the
+ * classifier does for each of its tables, and compares the CRC-based hash,
+ * with and without the "crc32" instruction, against lookup3.
+ *
+ * For hash quality, also reports how many distinct values the low 16 bits
+ * take for 65536 flows that differ only in a few bits of their transport
+ * ports, which a perfect hash would spread over about 41427 values. */
+static void
+benchmark(unsigned int n)
+{
+    struct flow_wildcards wc;
+    struct minimask mask;
+    struct flow *flows;
+    struct timeval start;
+    uint32_t *hashes;
+    uint32_t hash;
+    unsigned int i;
+
+    flows = xmalloc(n * sizeof *flows);
+    random_bytes(flows, n * sizeof *flows);
+    for (i = 0; i < n; i++) {
+        memset(flows[i].reserved, 0, sizeof flows[i].reserved);
+    }
+
+    /* Match on Ethernet addresses, IPv4 addresses, and transport ports. */
+    flow_wildcards_init_catchall(&wc);
+    wc.wildcards &= ~(FWW_DL_TYPE | FWW_NW_PROTO);
+    memset(wc.dl_src_mask, 0xff, ETH_ADDR_LEN);
+    memset(wc.dl_dst_mask, 0xff, ETH_ADDR_LEN);
+    wc.nw_src_mask = wc.nw_dst_mask = htonl(UINT32_MAX);
+    wc.tp_src_mask = wc.tp_dst_mask = htons(UINT16_MAX);
+    minimask_init(&mask, &wc);
+
+    printf("crc32 instruction: %s\n", hash_has_crc32_insn() ? "yes" : "no");
+
+    hash = 0;
+    xgettimeofday(&start);
+    for (i = 0; i < n; i++) {
+        hash += hash_bytes(&flows[i], sizeof flows[i], 0);
+    }
+    print_rate("hash_bytes", n, "hashes", elapsed_usec(&start));
+
+    xgettimeofday(&start);
+    for (i = 0; i < n; i++) {
+        hash += hash_bytes_portable(&flows[i], sizeof flows[i], 0);
+    }
+    print_rate("hash_bytes_portable", n, "hashes", elapsed_usec(&start));
+
+    xgettimeofday(&start);
+    for (i = 0; i < n; i++) {
+        hash += hash_words((const uint32_t *) &flows[i],
+                           sizeof flows[i] / 4, 0);
+    }
+    print_rate("hash_words", n, "hashes", elapsed_usec(&start));
+
+    xgettimeofday(&start);
+    for (i = 0; i < n; i++) {
+        hash += hash_words_portable((const uint32_t *) &flows[i],
+                                    sizeof flows[i] / 4, 0);
+    }
+    print_rate("hash_words_portable", n, "hashes", elapsed_usec(&start));
+
+    xgettimeofday(&start);
+    for (i = 0; i < n; i++) {
+        hash += lookup3_hash_words((const uint32_t *) &flows[i],
+                                   sizeof flows[i] / 4, 0);
+    }
+    print_rate("lookup3", n, "hashes", elapsed_usec(&start));
+
+    xgettimeofday(&start);
+    for (i = 0; i < n; i++) {
+        hash += flow_hash(&flows[i], 0);
+    }
+    print_rate("flow_hash", n, "hashes", elapsed_usec(&start));
+
+    xgettimeofday(&start);
+    for (i = 0; i < n; i++) {
+        struct flow f = flows[i];
+
+        flow_zero_wildcards(&f, &wc);
+        hash += flow_hash(&f, 0);
+    }
+    print_rate("flow_zero_wildcards", n, "hashes", elapsed_usec(&start));
+
+    xgettimeofday(&start);
+    for (i = 0; i < n; i++) {
+        hash += flow_hash_in_minimask(&flows[i], &mask, 0);
+    }
+    print_rate("flow_hash_in_minimask", n, "hashes", elapsed_usec(&start));
+
+    hashes = xmalloc(65536 * sizeof *hashes);
+    for (i = 0; i < 65536; i++) {
+        struct flow f = flows[0];
+
+        f.tp_src = htons(i >> 8);
+        f.tp_dst = htons(i & 0xff);
+        hashes[i] = flow_hash(&f, 0);
+    }
+    printf("flow_hash low 16 bits: %u distinct values\n",
+           count_buckets(hashes, 65536, 16));
+    for (i = 0; i < 65536; i++) {
+        uint32_t words[sizeof(struct flow) / 4];
+        struct flow f = flows[0];
+
+        f.tp_src = htons(i >> 8);
+        f.tp_dst = htons(i & 0xff);
+        memcpy(words, &f, sizeof words);
+        hashes[i] = lookup3_hash_words(words, ARRAY_SIZE(words), 0);
+    }
+    printf("lookup3 low 16 bits: %u distinct values\n",
+           count_buckets(hashes, 65536, 16));
+    free(hashes);
+
+    minimask_destroy(&mask);
+    free(flows);
+
+    /* Keep the compiler from discarding the hashes. */
+    if (hash == 1) {
+        printf("\n");
+    }
+}
+
 int
-main(void)
+main(int argc, char *argv[])
 {
     int i, j;
 
+    if (argc > 1 && !strcmp(argv[1], "benchmark")) {
+        benchmark(argc > 2 ? atoi(argv[2]) : 1000000);
+        return 0;
+    }
+
     /* Check that all hashes computed with hash_words with one 1-bit (or no
      * 1-bits) set within a single 32-bit word have different values in all
      * 11-bit consecutive runs.
@@ -151,5 +419,8 @@ main(void)
      */
     check_word_hash(hash_int_cb, "hash_int", 14);
 
+    check_crc_hash();
+    check_lookup3_hash();
+
     return 0;
 }
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2008, 2009, 2010 Nicira, Inc.
+ * Copyright (c) 2008, 2009, 2010, 2012 Nicira, Inc.
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -15,12 +15,19 @@
  */
 
 /* A non-exhaustive test for some of the functions and macros declared in
- * hmap.h. */
+ * hmap.h and cmap.h. */
 
 #include <config.h>
 #include "hmap.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
+#include "benchmark.h"
+#include "cmap.h"
 #include "hash.h"
+#include "random.h"
+#include "timeval.h"
 #include "util.h"
 
 #undef NDEBUG
@@ -271,6 +278,264 @@ test_hmap_for_each_safe(hash_func *hash)
     }
 }
 
+/* Tests insertion, removal, and iteration in an hmap large enough that it
+ * expands incrementally, checking its contents periodically while old buckets
+ * are still being migrated. */
+static void
+test_hmap_incremental(hash_func *hash)
+{
+    enum { N_ELEMS = 9000 };
+
+    /* With a constant hash, every lookup scans every node. */
+    size_t check_interval = hash == constant_hash ? 3001 : 97;
+    struct element *elements;
+    bool migrated = false;
+    struct hmap hmap;
+    size_t n, i;
+    int *values;
+
+    elements = xmalloc(N_ELEMS * sizeof *elements);
+    values = xmalloc(N_ELEMS * sizeof *values);
+    hmap_init(&hmap);
+    n = 0;
+    for (i = 0; i < N_ELEMS; i++) {
+        elements[i].value = i;
+        hmap_insert(&hmap, &elements[i].node, hash(i));
+        values[n++] = i;
+
+        /* Remove every third element again, in random order. */
+        if (i % 3 == 2) {
+            size_t j = random_range(n);
+
+            hmap_remove(&hmap, &elements[values[j]].node);
+            values[j] = values[--n];
+        }
+
+        if (hmap.old_buckets) {
+            migrated = true;
+            if (i % check_interval == 0) {
+                uint32_t bucket = 0, offset = 0;
+                size_t count = 0;
+
+                check_hmap(&hmap, values, n, hash);
+                while (hmap_at_position(&hmap, &bucket, &offset)) {
+                    count++;
+                }
+                assert(count == n);
+                assert(hmap_contains(&hmap, hmap_random_node(&hmap)));
+            }
+        }
+    }
+    assert(migrated);
+    check_hmap(&hmap, values, n, hash);
+
+    hmap_destroy(&hmap);
+    free(elements);
+    free(values);
+}
+
+/* cmap tests. */
+
+/* Sample cmap element. */
+struct cmap_element {
+    int value;
+    struct cmap_node node;
+};
+
+/* Verifies that 'cmap' contains exactly the 'n' values in 'values'. */
+static void
+check_cmap(struct cmap *cmap, const int values[], size_t n,
+           hash_func *hash)
+{
+    int *sort_values, *cmap_values;
+    struct cmap_element *e;
+    size_t i;
+
+    /* Check that all the values are there in iteration. */
+    sort_values = xmalloc(sizeof *sort_values * n);
+    cmap_values = xmalloc(sizeof *sort_values * n);
+
+    i = 0;
+    CMAP_FOR_EACH (e, node, cmap) {
+        assert(i < n);
+        cmap_values[i++] = e->value;
+    }
+    assert(i == n);
+
+    memcpy(sort_values, values, sizeof *sort_values * n);
+    qsort(sort_values, n, sizeof *sort_values, compare_ints);
+    qsort(cmap_values, n, sizeof *cmap_values, compare_ints);
+
+    for (i = 0; i < n; i++) {
+        assert(sort_values[i] == cmap_values[i]);
+    }
+
+    free(cmap_values);
+    free(sort_values);
+
+    /* Check that all the values are there in lookup. */
+    for (i = 0; i < n; i++) {
+        size_t count = 0;
+
+        CMAP_FOR_EACH_WITH_HASH (e, node, hash(values[i]), cmap) {
+            count += e->value == values[i];
+        }
+        assert(count == 1);
+    }
+
+    /* Check counters. */
+    assert(cmap_is_empty(cmap) == !n);
+    assert(cmap_count(cmap) == n);
+}
+
+/* Tests basic cmap insertion and deletion. */
+static void
+test_cmap_insert_delete(hash_func *hash)
+{
+    enum { N_ELEMS = 100 };
+
+    struct cmap_element elements[N_ELEMS];
+    int values[N_ELEMS];
+    struct cmap cmap;
+    size_t i;
+
+    cmap_init(&cmap);
+    for (i = 0; i < N_ELEMS; i++) {
+        elements[i].value = i;
+        cmap_insert(&cmap, &elements[i].node, hash(i));
+        values[i] = i;
+        check_cmap(&cmap, values, i + 1, hash);
+    }
+    shuffle(values, N_ELEMS);
+    for (i = 0; i < N_ELEMS; i++) {
+        cmap_remove(&cmap, &elements[values[i]].node);
+        assert(!cmap_contains(&cmap, &elements[values[i]].node));
+        check_cmap(&cmap, values + (i + 1), N_ELEMS - (i + 1), hash);
+    }
+    cmap_destroy(&cmap);
+}
+
+/* Tests cmap_shrink() as nodes are removed. */
+static void
+test_cmap_shrink(hash_func *hash)
+{
+    enum { N_ELEMS = 64 };
+
+    struct cmap_element elements[N_ELEMS];
+    int values[N_ELEMS];
+    struct cmap cmap;
+    size_t i;
+
+    cmap_init(&cmap);
+    for (i = 0; i < N_ELEMS; i++) {
+        elements[i].value = i;
+        cmap_insert(&cmap, &elements[i].node, hash(i));
+        values[i] = i;
+    }
+    shuffle(values, N_ELEMS);
+    for (i = 0; i < N_ELEMS; i++) {
+        cmap_remove(&cmap, &elements[values[i]].node);
+        cmap_shrink(&cmap);
+        check_cmap(&cmap, values + (i + 1), N_ELEMS - (i + 1), hash);
+    }
+    cmap_destroy(&cmap);
+}
+
+/* Tests that CMAP_FOR_EACH_SAFE properly allows for deletion of the current
+ * element of a cmap.  */
+static void
+test_cmap_for_each_safe(hash_func *hash)
+{
+    enum { MAX_ELEMS = 10 };
+    size_t n;
+    unsigned long int pattern;
+
+    for (n = 0; n <= MAX_ELEMS; n++) {
+        for (pattern = 0; pattern < 1ul << n; pattern++) {
+            struct cmap_element elements[MAX_ELEMS];
+            int values[MAX_ELEMS];
+            struct cmap cmap;
+            struct cmap_element *e, *next;
+            size_t n_remaining;
+            int i;
+
+            cmap_init(&cmap);
+            for (i = 0; i < n; i++) {
+                elements[i].value = i;
+                cmap_insert(&cmap, &elements[i].node, hash(i));
+                values[i] = i;
+            }
+
+            i = 0;
+            n_remaining = n;
+            CMAP_FOR_EACH_SAFE (e, next, node, &cmap) {
+                assert(i < n);
+                if (pattern & (1ul << e->value)) {
+                    size_t j;
+                    cmap_remove(&cmap, &e->node);
+                    for (j = 0; ; j++) {
+                        assert(j < n_remaining);
+                        if (values[j] == e->value) {
+                            values[j] = values[--n_remaining];
+                            break;
+                        }
+                    }
+                }
+                check_cmap(&cmap, values, n_remaining, hash);
+                i++;
+            }
+            assert(i == n);
+
+            cmap_destroy(&cmap);
+        }
+    }
+}
+
+/* Tests a cmap that grows through several incremental migrations while
+ * nodes are also being removed, checking its contents after every
+ * operation so that lookups and iteration are exercised while a migration is
+ * in progress. */
+static void
+test_cmap_growth(hash_func *hash)
+{
+    /* With a constant hash, every lookup scans every node. */
+    size_t n_elems = hash == constant_hash ? 200 : 1000;
+    struct cmap_element *elements;
+    struct cmap_element *e;
+    struct cmap cmap;
+    size_t n, i;
+    int *values;
+
+    elements = xmalloc(n_elems * sizeof *elements);
+    values = xmalloc(n_elems * sizeof *values);
+    cmap_init(&cmap);
+    n = 0;
+    for (i = 0; i < n_elems; i++) {
+        elements[i].value = i;
+        cmap_insert(&cmap, &elements[i].node, hash(i));
+        values[n++] = i;
+
+        /* Remove every third element again, in random order. */
+        if (i % 3 == 2) {
+            size_t j = random_range(n);
+
+            cmap_remove(&cmap, &elements[values[j]].node);
+            values[j] = values[--n];
+        }
+        check_cmap(&cmap, values, n, hash);
+    }
+
+    /* cmap_random_node() only returns nodes in 'cmap'. */
+    for (i = 0; i < 100; i++) {
+        e = CONTAINER_OF(cmap_random_node(&cmap), struct cmap_element, node);
+        assert(cmap_contains(&cmap, &e->node));
+    }
+
+    cmap_destroy(&cmap);
+    free(elements);
+    free(values);
+}
+
 static void
 run_test(void (*function)(hash_func *))
 {
@@ -284,12 +549,219 @@ run_test(void (*function)(hash_func *))
     }
 }
 
+/* Benchmark. */
+
+/* "benchmark [N_ELEMS [N_LOOKUPS]]": compares insertion, successful and
+ * unsuccessful lookup, iteration, and removal throughput of an hmap and a
+ * cmap that contain the same individually allocated elements. */
+static void
+benchmark(unsigned int n_elems, unsigned int n_lookups)
+{
+    struct element **hmap_elems, *he, *hnext;
+    struct cmap_element **cmap_elems, *ce, *cnext;
+    struct timeval start;
+    struct hmap hmap;
+    struct cmap cmap;
+    unsigned int i;
+    int *keys;
+    int found;
+
+    keys = xmalloc(n_lookups * sizeof *keys);
+    for (i = 0; i < n_lookups; i++) {
+        keys[i] = random_range(n_elems);
+    }
+
+    /* Allocate the two kinds of elements interleaved, so that neither kind
+     * is laid out more compactly in memory than the other. */
+    hmap_elems = xmalloc(n_elems * sizeof *hmap_elems);
+    cmap_elems = xmalloc(n_elems * sizeof *cmap_elems);
+    for (i = 0; i < n_elems; i++) {
+        hmap_elems[i] = xmalloc(sizeof *hmap_elems[i]);
+        hmap_elems[i]->value = i;
+        cmap_elems[i] = xmalloc(sizeof *cmap_elems[i]);
+        cmap_elems[i]->value = i;
+    }
+
+    /* hmap. */
+    hmap_init(&hmap);
+    xgettimeofday(&start);
+    for (i = 0; i < n_elems; i++) {
+        hmap_insert(&hmap, &hmap_elems[i]->node, good_hash(i));
+    }
+    print_rate("hmap insert", n_elems, "ops", elapsed_usec(&start));
+
+    found = 0;
+    xgettimeofday(&start);
+    for (i = 0; i < n_lookups; i++) {
+        HMAP_FOR_EACH_WITH_HASH (he, node, good_hash(keys[i]), &hmap) {
+            if (he->value == keys[i]) {
+                found++;
+                break;
+            }
+        }
+    }
+    print_rate("hmap lookup", n_lookups, "ops", elapsed_usec(&start));
+    assert(found == n_lookups);
+
+    found = 0;
+    xgettimeofday(&start);
+    for (i = 0; i < n_lookups; i++) {
+        int key = keys[i] + n_elems;
+
+        HMAP_FOR_EACH_WITH_HASH (he, node, good_hash(key), &hmap) {
+            if (he->value == key) {
+                found++;
+                break;
+            }
+        }
+    }
+    print_rate("hmap miss", n_lookups, "ops", elapsed_usec(&start));
+    assert(!found);
+
+    found = 0;
+    xgettimeofday(&start);
+    HMAP_FOR_EACH (he, node, &hmap) {
+        found++;
+    }
+    print_rate("hmap iterate", n_elems, "ops", elapsed_usec(&start));
+    assert(found == n_elems);
+
+    xgettimeofday(&start);
+    HMAP_FOR_EACH_SAFE (he, hnext, node, &hmap) {
+        hmap_remove(&hmap, &he->node);
+    }
+    print_rate("hmap remove", n_elems, "ops", elapsed_usec(&start));
+    hmap_destroy(&hmap);
+
+    /* cmap. */
+    cmap_init(&cmap);
+    xgettimeofday(&start);
+    for (i = 0; i < n_elems; i++) {
+        cmap_insert(&cmap, &cmap_elems[i]->node, good_hash(i));
+    }
+    print_rate("cmap insert", n_elems, "ops", elapsed_usec(&start));
+
+    found = 0;
+    xgettimeofday(&start);
+    for (i = 0; i < n_lookups; i++) {
+        CMAP_FOR_EACH_WITH_HASH (ce, node, good_hash(keys[i]), &cmap) {
+            if (ce->value == keys[i]) {
+                found++;
+                break;
+            }
+        }
+    }
+    print_rate("cmap lookup", n_lookups, "ops", elapsed_usec(&start));
+    assert(found == n_lookups);
+
+    found = 0;
+    xgettimeofday(&start);
+    for (i = 0; i < n_lookups; i++) {
+        int key = keys[i] + n_elems;
+
+        CMAP_FOR_EACH_WITH_HASH (ce, node, good_hash(key), &cmap) {
+            if (ce->value == key) {
+                found++;
+                break;
+            }
+        }
+    }
+    print_rate("cmap miss", n_lookups, "ops", elapsed_usec(&start));
+    assert(!found);
+
+    found = 0;
+    xgettimeofday(&start);
+    CMAP_FOR_EACH (ce, node, &cmap) {
+        found++;
+    }
+    print_rate("cmap iterate", n_elems, "ops", elapsed_usec(&start));
+    assert(found == n_elems);
+
+    xgettimeofday(&start);
+    CMAP_FOR_EACH_SAFE (ce, cnext, node, &cmap) {
+        cmap_remove(&cmap, &ce->node);
+    }
+    print_rate("cmap remove", n_elems, "ops", elapsed_usec(&start));
+    cmap_destroy(&cmap);
+
+    for (i = 0; i < n_elems; i++) {
+        free(hmap_elems[i]);
+        free(cmap_elems[i]);
+    }
+    free(hmap_elems);
+    free(cmap_elems);
+    free(keys);
+}
+
+/* "latency [N_ELEMS]": compares the worst-case latency of a single
+ * hmap_insert(), which expands large maps incrementally, against inserting
+ * the same elements and rehashing all of them at once whenever the map
+ * needs to expand, as hmap_insert() used to. */
+static void
+latency_benchmark(unsigned int n_elems)
+{
+    struct element *elements;
+    int incremental;
+
+    elements = xmalloc(n_elems * sizeof *elements);
+    for (incremental = 0; incremental < 2; incremental++) {
+        long long int total, worst;
+        struct timeval start;
+        struct hmap hmap;
+        unsigned int i;
+
+        hmap_init(&hmap);
+        total = worst = 0;
+        for (i = 0; i < n_elems; i++) {
+            long long int usec;
+
+            elements[i].value = i;
+            xgettimeofday(&start);
+            if (incremental) {
+                hmap_insert(&hmap, &elements[i].node, good_hash(i));
+            } else {
+                hmap_insert_fast(&hmap, &elements[i].node, good_hash(i));
+                if (hmap.n / 2 > hmap.mask) {
+                    hmap_reserve(&hmap, hmap.n);
+                }
+            }
+            usec = elapsed_usec(&start);
+            total += usec;
+            worst = MAX(worst, usec);
+        }
+        printf("%-11s %10u inserts in %8lld us, worst case %6lld us\n",
+               incremental ? "incremental" : "all-at-once", n_elems, total,
+               worst);
+        hmap_destroy(&hmap);
+    }
+    free(elements);
+}
+
 int
-main(void)
+main(int argc, char *argv[])
 {
+    if (argc > 1 && !strcmp(argv[1], "benchmark")) {
+        unsigned int n_elems = argc > 2 ? atoi(argv[2]) : 1000000;
+        unsigned int n_lookups = argc > 3 ? atoi(argv[3]) : 10000000;
+
+        assert(n_elems > 0);
+        benchmark(n_elems, n_lookups);
+        return 0;
+    } else if (argc > 1 && !strcmp(argv[1], "latency")) {
+        latency_benchmark(argc > 2 ? atoi(argv[2]) : 1000000);
+        return 0;
+    }
+
     run_test(test_hmap_insert_delete);
     run_test(test_hmap_for_each_safe);
     run_test(test_hmap_reserve_shrink);
+    run_test(test_hmap_incremental);
+    printf("\n");
+
+    run_test(test_cmap_insert_delete);
+    run_test(test_cmap_for_each_safe);
+    run_test(test_cmap_shrink);
+    run_test(test_cmap_growth);
     printf("\n");
     return 0;
 }
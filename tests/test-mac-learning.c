@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2012 Nicira, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* A test for for functions and macros declared in mac-learning.h. */
+
+#include <config.h>
+#include "mac-learning.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "benchmark.h"
+#include "command-line.h"
+#include "hash.h"
+#include "hmap.h"
+#include "random.h"
+#include "tag.h"
+#include "util.h"
+
+#undef NDEBUG
+#include <assert.h>
+
+/* Fills in 'mac' with a distinct unicast MAC address derived from 'i'. */
+static void
+make_mac(uint32_t i, uint8_t mac[ETH_ADDR_LEN])
+{
+    mac[0] = 0x50;
+    mac[1] = 0x54;
+    mac[2] = i >> 24;
+    mac[3] = i >> 16;
+    mac[4] = i >> 8;
+    mac[5] = i;
+}
+
+static uint16_t
+make_vlan(uint32_t i)
+{
+    return i % 7;
+}
+
+/* Inserts the 'n' entries numbered 'start' onward into 'ml', setting each
+ * one's port to its number. */
+static void
+insert_range(struct mac_learning *ml, uint32_t start, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = start; i < start + n; i++) {
+        uint8_t mac[ETH_ADDR_LEN];
+        struct mac_entry *e;
+
+        make_mac(i, mac);
+        e = mac_learning_insert(ml, mac, make_vlan(i));
+        if (mac_entry_is_new(e)) {
+            mac_learning_changed(ml, e);
+        }
+        e->port.i = i;
+    }
+}
+
+static struct mac_entry *
+lookup(const struct mac_learning *ml, uint32_t i)
+{
+    uint8_t mac[ETH_ADDR_LEN];
+
+    make_mac(i, mac);
+    return mac_learning_lookup(ml, mac, make_vlan(i), NULL);
+}
+
+/* Verifies that 'ml' contains exactly the 'n' entries in 'ports', in
+ * least-recently-used order. */
+static void
+check_ml(const struct mac_learning *ml, const int ports[], size_t n)
+{
+    struct mac_entry *e;
+    size_t i;
+
+    assert(mac_learning_count(ml) == n);
+
+    i = 0;
+    MAC_LEARNING_FOR_EACH (e, ml) {
+        assert(i < n);
+        assert(e->port.i == ports[i]);
+        assert(lookup(ml, ports[i]) == e);
+        i++;
+    }
+    assert(i == n);
+}
+
+static void
+test_mac_learning_insert_lookup(int argc OVS_UNUSED, char *argv[] OVS_UNUSED)
+{
+    enum { N = 5000 };
+    struct mac_learning *ml;
+    int ports[N];
+    int i;
+
+    ml = mac_learning_create(MAC_ENTRY_DEFAULT_IDLE_TIME);
+    mac_learning_set_max_entries(ml, N);
+    for (i = 0; i < N; i++) {
+        insert_range(ml, i, 1);
+        ports[i] = i;
+    }
+    check_ml(ml, ports, N);
+    assert(!lookup(ml, N));
+
+    /* Refreshing an entry makes it the most recently used. */
+    insert_range(ml, 0, 1);
+    memmove(ports, ports + 1, (N - 1) * sizeof *ports);
+    ports[N - 1] = 0;
+    check_ml(ml, ports, N);
+
+    mac_learning_flush(ml, NULL);
+    check_ml(ml, NULL, 0);
+    assert(!lookup(ml, 0));
+
+    mac_learning_destroy(ml);
+}
+
+static void
+test_mac_learning_expire(int argc OVS_UNUSED, char *argv[] OVS_UNUSED)
+{
+    enum { N = 1000 };
+    struct mac_learning *ml;
+    int ports[N];
+    int round;
+
+    ml = mac_learning_create(MAC_ENTRY_DEFAULT_IDLE_TIME);
+    mac_learning_set_max_entries(ml, N);
+    for (round = 0; round < 10; round++) {
+        struct mac_entry *e, *next;
+        size_t n;
+
+        /* Insert entries, then expire a random subset of them, to exercise
+         * deletion with probing and tombstones. */
+        insert_range(ml, round * N, N / 2);
+        n = 0;
+        MAC_LEARNING_FOR_EACH_SAFE (e, next, ml) {
+            if (random_range(3)) {
+                ports[n++] = e->port.i;
+            } else {
+                mac_learning_expire(ml, e);
+                assert(!lookup(ml, e->port.i));
+            }
+        }
+        check_ml(ml, ports, n);
+    }
+    mac_learning_destroy(ml);
+}
+
+static void
+test_mac_learning_max_entries(int argc OVS_UNUSED, char *argv[] OVS_UNUSED)
+{
+    struct mac_learning *ml;
+    struct tag_set tags;
+    int ports[100];
+    int i;
+
+    ml = mac_learning_create(MAC_ENTRY_DEFAULT_IDLE_TIME);
+    mac_learning_set_max_entries(ml, 100);
+
+    /* Inserting beyond the maximum evicts the least recently used entry. */
+    insert_range(ml, 0, 150);
+    for (i = 0; i < 100; i++) {
+        ports[i] = 50 + i;
+    }
+    check_ml(ml, ports, 100);
+
+    /* Reducing the maximum evicts entries on the next run. */
+    tag_set_init(&tags);
+    mac_learning_set_max_entries(ml, 10);
+    check_ml(ml, ports, 100);
+    mac_learning_run(ml, &tags);
+    check_ml(ml, ports + 90, 10);
+    assert(!tag_set_is_empty(&tags));
+
+    mac_learning_destroy(ml);
+}
+
+static void
+test_mac_learning_idle_time(int argc OVS_UNUSED, char *argv[] OVS_UNUSED)
+{
+    struct mac_learning *ml;
+    struct mac_entry *e;
+    int ports[100];
+    int i;
+
+    ml = mac_learning_create(MAC_ENTRY_DEFAULT_IDLE_TIME);
+    insert_range(ml, 0, 100);
+    for (i = 0; i < 100; i++) {
+        ports[i] = i;
+    }
+
+    /* Changing the idle time keeps the entries and their order. */
+    mac_learning_set_idle_time(ml, 60);
+    check_ml(ml, ports, 100);
+    MAC_LEARNING_FOR_EACH (e, ml) {
+        assert(mac_entry_age(ml, e) <= 1);
+    }
+    mac_learning_set_idle_time(ml, 3600);
+    check_ml(ml, ports, 100);
+
+    /* Nothing has expired yet. */
+    mac_learning_run(ml, NULL);
+    check_ml(ml, ports, 100);
+
+    mac_learning_destroy(ml);
+}
+
+/* Benchmark. */
+
+/* A MAC learning table implemented the way that mac-learning.c used to: a
+ * chained hmap of individually allocated entries. */
+struct chained_entry {
+    struct hmap_node hmap_node;
+    uint8_t mac[ETH_ADDR_LEN];
+    uint16_t vlan;
+    int port;
+};
+
+static uint32_t
+chained_hash(const uint8_t mac[ETH_ADDR_LEN], uint16_t vlan)
+{
+    return hash_bytes(mac, ETH_ADDR_LEN, vlan);
+}
+
+static struct chained_entry *
+chained_lookup(const struct hmap *table, const uint8_t mac[ETH_ADDR_LEN],
+               uint16_t vlan)
+{
+    struct chained_entry *e;
+
+    HMAP_FOR_EACH_WITH_HASH (e, hmap_node, chained_hash(mac, vlan), table) {
+        if (e->vlan == vlan && eth_addr_equals(e->mac, mac)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/* "benchmark [N_ENTRIES [N_LOOKUPS]]": compares lookup throughput of the MAC
+ * learning table against a chained hmap of individually allocated entries. */
+static void
+test_mac_learning_benchmark(int argc, char *argv[])
+{
+    unsigned int n_entries = argc > 1 ? atoi(argv[1]) : 100000;
+    unsigned int n_lookups = argc > 2 ? atoi(argv[2]) : 10000000;
+    struct chained_entry *e, *next;
+    struct mac_learning *ml;
+    struct timeval start;
+    struct hmap table;
+    uint32_t *keys;
+    unsigned int i;
+    int found;
+
+    assert(n_entries > 0);
+    keys = xmalloc(n_lookups * sizeof *keys);
+    for (i = 0; i < n_lookups; i++) {
+        keys[i] = random_range(n_entries);
+    }
+
+    ml = mac_learning_create(MAC_ENTRY_DEFAULT_IDLE_TIME);
+    mac_learning_set_max_entries(ml, n_entries);
+    insert_range(ml, 0, n_entries);
+
+    hmap_init(&table);
+    for (i = 0; i < n_entries; i++) {
+        e = xmalloc(sizeof *e);
+        make_mac(i, e->mac);
+        e->vlan = make_vlan(i);
+        e->port = i;
+        hmap_insert(&table, &e->hmap_node, chained_hash(e->mac, e->vlan));
+    }
+
+    found = 0;
+    xgettimeofday(&start);
+    for (i = 0; i < n_lookups; i++) {
+        uint8_t mac[ETH_ADDR_LEN];
+
+        make_mac(keys[i], mac);
+        found += chained_lookup(&table, mac, make_vlan(keys[i])) != NULL;
+    }
+    print_rate("chained", n_lookups, "lookups", elapsed_usec(&start));
+    assert(found == n_lookups);
+
+    found = 0;
+    xgettimeofday(&start);
+    for (i = 0; i < n_lookups; i++) {
+        found += lookup(ml, keys[i]) != NULL;
+    }
+    print_rate("mac-table", n_lookups, "lookups", elapsed_usec(&start));
+    assert(found == n_lookups);
+
+    HMAP_FOR_EACH_SAFE (e, next, hmap_node, &table) {
+        hmap_remove(&table, &e->hmap_node);
+        free(e);
+    }
+    hmap_destroy(&table);
+    mac_learning_destroy(ml);
+    free(keys);
+}
+
+static const struct command commands[] = {
+    { "insert-lookup", 0, 0, test_mac_learning_insert_lookup, },
+    { "expire", 0, 0, test_mac_learning_expire, },
+    { "max-entries", 0, 0, test_mac_learning_max_entries, },
+    { "idle-time", 0, 0, test_mac_learning_idle_time, },
+    { "benchmark", 0, 2, test_mac_learning_benchmark, },
+    { NULL, 0, 0, NULL, },
+};
+
+int
+main(int argc, char *argv[])
+{
+    set_program_name(argv[0]);
+
+    run_command(argc - 1, argv + 1, commands);
+
+    return 0;
+}
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2010 Nicira, Inc.
+ * Copyright (c) 2010, 2012 Nicira, Inc.
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -23,11 +23,51 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
 
+#include "benchmark.h"
 #include "flow.h"
 #include "random.h"
+#include "timeval.h"
 #include "util.h"
 
+/* Measures the rate at which 'mp' chooses among 2, 16, and 64 links for 'n'
+ * flows. */
+static void
+benchmark(struct nx_action_multipath *mp, unsigned int n)
+{
+    static const int n_links[] = { 2, 16, 64 };
+    struct flow *flows;
+    size_t i;
+
+    flows = xmalloc(n * sizeof *flows);
+    random_bytes(flows, n * sizeof *flows);
+    for (i = 0; i < ARRAY_SIZE(n_links); i++) {
+        struct timeval start;
+        long long int usec;
+        uint32_t sum;
+        unsigned int j;
+
+        mp->max_link = htons(n_links[i] - 1);
+        sum = 0;
+        xgettimeofday(&start);
+        for (j = 0; j < n; j++) {
+            multipath_execute(mp, &flows[j]);
+            sum += flows[j].regs[0];
+        }
+        usec = elapsed_usec(&start);
+        printf("%2d links: %u flows in %lld us (%.1f Mflows/s)\n",
+               n_links[i], n, usec, usec ? (double) n / usec : 0.0);
+
+        /* Keep the compiler from discarding the results. */
+        if (sum == 1) {
+            printf("\n");
+        }
+    }
+    free(flows);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -39,8 +79,16 @@ main(int argc, char *argv[])
     set_program_name(argv[0]);
     random_init();
 
+    if (argc >= 3 && !strcmp(argv[1], "benchmark")) {
+        multipath_parse(&mp, argv[2]);
+        benchmark(&mp, argc > 3 ? atoi(argv[3]) : 1000000);
+        return 0;
+    }
+
     if (argc != 2) {
-        ovs_fatal(0, "usage: %s multipath_action", program_name);
+        ovs_fatal(0, "usage: %s multipath_action\n"
+                  "       %s benchmark multipath_action [n_flows]",
+                  program_name, program_name);
     }
 
     multipath_parse(&mp, argv[1]);
@@ -91,6 +139,14 @@ main(int argc, char *argv[])
                "stddev/expected=%.4f\n",
                n, n + 1, disruption, perfect, distribution);
 
+        /* For a uniform distribution, stddev/expected should be about
+         * sqrt(n / N_FLOWS), which is at most about .03. */
+        if (distribution > .1) {
+            fprintf(stderr, "%d links: stddev/expected=%.4f > .1\n",
+                    n, distribution);
+            ok = false;
+        }
+
         switch (ntohs(mp.algorithm)) {
         case NX_MP_ALG_MODULO_N:
             if (disruption < (n < 2 ? .25 : .5)) {
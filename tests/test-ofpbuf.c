@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2012 Nicira, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* A test for the ofpbuf pool. */
+
+#include <config.h>
+#include "ofpbuf.h"
+#include <stdlib.h>
+#include <string.h>
+#include "simap.h"
+#include "util.h"
+
+#undef NDEBUG
+#include <assert.h>
+
+/* Appends 'n' bytes numbered from 'start' onward to 'b'. */
+static void
+put_pattern(struct ofpbuf *b, size_t start, size_t n)
+{
+    size_t i;
+
+    for (i = start; i < start + n; i++) {
+        uint8_t byte = i;
+        ofpbuf_put(b, &byte, 1);
+    }
+}
+
+/* Asserts that 'b' contains exactly the 'n' bytes numbered from 0. */
+static void
+check_pattern(const struct ofpbuf *b, size_t n)
+{
+    const uint8_t *data = b->data;
+    size_t i;
+
+    assert(b->size == n);
+    for (i = 0; i < n; i++) {
+        assert(data[i] == (uint8_t) i);
+    }
+}
+
+/* A freed buffer's memory is handed out again to the next buffer in the same
+ * size class. */
+static void
+test_reuse(void)
+{
+    struct ofpbuf *a, *b;
+    size_t allocated;
+    void *base;
+
+    a = ofpbuf_new(100);
+    assert(a->source == OFPBUF_POOL);
+    assert(a->allocated >= 100);
+    allocated = a->allocated;
+    base = a->base;
+    ofpbuf_delete(a);
+
+    b = ofpbuf_new(allocated);
+    assert(b->base == base);
+    ofpbuf_delete(b);
+}
+
+/* Growing a pool-backed buffer keeps its data and headroom, across size
+ * classes and beyond the largest one. */
+static void
+test_grow(void)
+{
+    struct ofpbuf *b;
+
+    b = ofpbuf_new_with_headroom(10, 16);
+    put_pattern(b, 0, 100000);
+    check_pattern(b, 100000);
+    assert(ofpbuf_headroom(b) == 16);
+    assert(b->source == OFPBUF_MALLOC);
+    ofpbuf_delete(b);
+
+    b = ofpbuf_new(0);
+    put_pattern(b, 0, 1000);
+    assert(b->source == OFPBUF_POOL);
+    ofpbuf_push_zeros(b, 100);
+    ofpbuf_pull(b, 100);
+    check_pattern(b, 1000);
+    ofpbuf_trim(b);
+    check_pattern(b, 1000);
+    ofpbuf_delete(b);
+}
+
+/* Trimming a pool-backed buffer moves it to a smaller size class if its data
+ * fits one, and otherwise leaves it alone. */
+static void
+test_trim(void)
+{
+    struct ofpbuf *b;
+    void *base;
+
+    b = ofpbuf_new(1000);
+    assert(b->source == OFPBUF_POOL);
+    put_pattern(b, 0, 900);
+    base = b->base;
+    ofpbuf_trim(b);
+    assert(b->base == base);
+    check_pattern(b, 900);
+
+    b->size = 100;
+    ofpbuf_trim(b);
+    assert(b->source == OFPBUF_POOL);
+    assert(b->allocated < 1000);
+    check_pattern(b, 100);
+    ofpbuf_delete(b);
+}
+
+/* A stub that outgrows its stack space moves into the pool, and the memory
+ * that ofpbuf_get_uninit_pointer() and ofpbuf_steal_data() return may be
+ * passed to free(). */
+static void
+test_stub_and_steal(void)
+{
+    uint64_t stub[64 / 8];
+    struct ofpbuf b;
+    void *p;
+
+    ofpbuf_use_stub(&b, stub, sizeof stub);
+    put_pattern(&b, 0, 64);
+    assert(b.source == OFPBUF_STUB);
+    put_pattern(&b, 64, 64);
+    assert(b.source == OFPBUF_POOL);
+    check_pattern(&b, 128);
+    free(ofpbuf_get_uninit_pointer(&b));
+
+    ofpbuf_init(&b, 64);
+    put_pattern(&b, 0, 64);
+    p = ofpbuf_steal_data(&b);
+    assert(!memcmp(p, "\0\1\2\3", 4));
+    free(p);
+    ofpbuf_uninit(&b);
+}
+
+static void
+test_memory_usage(void)
+{
+    struct simap usage;
+
+    simap_init(&usage);
+    ofpbuf_get_memory_usage(&usage);
+    assert(simap_get(&usage, "ofpbuf-pool-hit-pct") <= 100);
+    simap_destroy(&usage);
+}
+
+int
+main(void)
+{
+    test_reuse();
+    test_grow();
+    test_trim();
+    test_stub_and_steal();
+    test_memory_usage();
+    return 0;
+}
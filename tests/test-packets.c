@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2011 Nicira, Inc.
+ * Copyright (c) 2011, 2012 Nicira, Inc.
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -16,9 +16,13 @@
 
 #include <config.h>
 #include "packets.h"
+#include <netinet/ip6.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "csum.h"
+#include "flow.h"
+#include "ofpbuf.h"
 
 #undef NDEBUG
 #include <assert.h>
@@ -152,6 +156,123 @@ test_ipv6_masking(void)
     assert(ipv6_count_cidr_bits(&dest) == 128);
 }
 
+/* Returns the sum of the IPv4 or IPv6 pseudo-header for the transport header
+ * in 'packet', whose l[34] markers must be set, and of the transport header
+ * and payload themselves.  The transport checksum is correct if the result,
+ * passed to csum_finish(), is 0. */
+static uint32_t
+l4_csum_partial(const struct ofpbuf *packet, uint8_t proto, bool ipv6)
+{
+    size_t l4_len = (char *) ofpbuf_tail(packet) - (char *) packet->l4;
+    uint32_t partial;
+
+    if (ipv6) {
+        const struct ip6_hdr *nh = packet->l3;
+
+        partial = csum_continue(0, &nh->ip6_src, sizeof nh->ip6_src);
+        partial = csum_continue(partial, &nh->ip6_dst, sizeof nh->ip6_dst);
+    } else {
+        const struct ip_header *nh = packet->l3;
+
+        partial = csum_add32(0, nh->ip_src);
+        partial = csum_add32(partial, nh->ip_dst);
+    }
+    partial = csum_add16(partial, htons(proto));
+    partial = csum_add16(partial, htons(l4_len));
+    return csum_continue(partial, packet->l4, l4_len);
+}
+
+/* Composes a TCP packet over IPv4 or IPv6 with correct checksums into
+ * 'packet' and extracts its flow into 'flow'. */
+static void
+compose_tcp_packet(struct ofpbuf *packet, bool ipv6, struct flow *flow)
+{
+    static const uint8_t eth_dst[ETH_ADDR_LEN] = { 0x50, 0x54, 0, 0, 0, 7 };
+    static const uint8_t eth_src[ETH_ADDR_LEN] = { 0x50, 0x54, 0, 0, 0, 5 };
+    struct tcp_header *th;
+
+    if (ipv6) {
+        struct ip6_hdr *nh;
+
+        nh = eth_compose(packet, eth_dst, eth_src, ETH_TYPE_IPV6, sizeof *nh);
+        memset(nh, 0, sizeof *nh);
+        nh->ip6_flow = htonl(0x60012345);
+        nh->ip6_plen = htons(TCP_HEADER_LEN + 4);
+        nh->ip6_nxt = IPPROTO_TCP;
+        nh->ip6_hlim = 64;
+        random_bytes(&nh->ip6_src, sizeof nh->ip6_src);
+        random_bytes(&nh->ip6_dst, sizeof nh->ip6_dst);
+    } else {
+        struct ip_header *nh;
+
+        nh = eth_compose(packet, eth_dst, eth_src, ETH_TYPE_IP, sizeof *nh);
+        memset(nh, 0, sizeof *nh);
+        nh->ip_ihl_ver = IP_IHL_VER(5, IP_VERSION);
+        nh->ip_tot_len = htons(IP_HEADER_LEN + TCP_HEADER_LEN + 4);
+        nh->ip_ttl = 64;
+        nh->ip_proto = IPPROTO_TCP;
+        nh->ip_src = htonl(0xc0a80001);
+        nh->ip_dst = htonl(0xc0a80002);
+        nh->ip_csum = csum(nh, sizeof *nh);
+    }
+
+    th = ofpbuf_put_zeros(packet, TCP_HEADER_LEN);
+    th->tcp_src = htons(8);
+    th->tcp_dst = htons(9);
+    th->tcp_ctl = TCP_CTL(0, 5);
+    random_bytes(ofpbuf_put_uninit(packet, 4), 4);
+
+    flow_extract(packet, 0, 0, 1, flow);
+    th->tcp_csum = csum_finish(l4_csum_partial(packet, IPPROTO_TCP, ipv6));
+    assert(!csum_finish(l4_csum_partial(packet, IPPROTO_TCP, ipv6)));
+}
+
+/* Checks that packet_set_ipv4(), packet_set_ipv6(), and packet_set_tcp_port()
+ * rewrite headers and keep the IP and TCP checksums correct. */
+static void
+test_packet_set(void)
+{
+    int i;
+
+    for (i = 0; i < 32; i++) {
+        struct ofpbuf packet;
+        struct flow flow;
+
+        /* IPv4. */
+        ofpbuf_init(&packet, 0);
+        compose_tcp_packet(&packet, false, &flow);
+        packet_set_ipv4(&packet, htonl(random_uint32()),
+                        htonl(random_uint32()), random_uint32(),
+                        random_uint32());
+        packet_set_tcp_port(&packet, htons(random_uint32()),
+                            htons(random_uint32()));
+        assert(!csum(packet.l3, IP_HEADER_LEN));
+        assert(!csum_finish(l4_csum_partial(&packet, IPPROTO_TCP, false)));
+        ofpbuf_uninit(&packet);
+
+        /* IPv6. */
+        ofpbuf_init(&packet, 0);
+        compose_tcp_packet(&packet, true, &flow);
+        {
+            ovs_be32 src[4], dst[4];
+            struct ip6_hdr *nh = packet.l3;
+
+            random_bytes(src, sizeof src);
+            random_bytes(dst, sizeof dst);
+            packet_set_ipv6(&packet, IPPROTO_TCP, src, dst, 0x5a,
+                            htonl(0xabcde), 17);
+            assert(!memcmp(&nh->ip6_src, src, sizeof src));
+            assert(!memcmp(&nh->ip6_dst, dst, sizeof dst));
+            assert(nh->ip6_flow == htonl(0x65aabcde));
+            assert(nh->ip6_hlim == 17);
+        }
+        packet_set_tcp_port(&packet, htons(random_uint32()),
+                            htons(random_uint32()));
+        assert(!csum_finish(l4_csum_partial(&packet, IPPROTO_TCP, true)));
+        ofpbuf_uninit(&packet);
+    }
+}
+
 int
 main(void)
 {
@@ -159,6 +280,7 @@ main(void)
     test_ipv6_static_masks();
     test_ipv6_cidr();
     test_ipv6_masking();
+    test_packet_set();
 
     return 0;
 }
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2012 Nicira, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* A test for the timer wheel. */
+
+#include <config.h>
+#include "timer-wheel.h"
+#include <stdlib.h>
+#include "random.h"
+#include "util.h"
+
+#undef NDEBUG
+#include <assert.h>
+
+struct element {
+    struct timer_wheel_node node;
+    enum { WAITING, REMOVED, EXPIRED } state;
+};
+
+#define N_ELEMS 1000
+
+/* Deadlines range past the top level of the wheel, to exercise the overflow
+ * list too. */
+#define MAX_DELAY (1 << (TW_BITS * TW_LEVELS + 1))
+
+/* Advances 'tw' to 'now' and checks that exactly the elements in 'elems'
+ * that have not been removed and whose deadlines are at or before 'now' have
+ * expired. */
+static void
+advance_and_check(struct timer_wheel *tw, struct element elems[],
+                  long long int now)
+{
+    struct list expired;
+    size_t n_waiting;
+    size_t i;
+
+    list_init(&expired);
+    timer_wheel_advance(tw, now, &expired);
+    while (!list_is_empty(&expired)) {
+        struct element *e;
+
+        e = CONTAINER_OF(list_pop_front(&expired), struct element,
+                         node.list_node);
+        assert(e->state == WAITING);
+        assert(e->node.when <= now);
+        e->state = EXPIRED;
+    }
+
+    n_waiting = 0;
+    for (i = 0; i < N_ELEMS; i++) {
+        if (elems[i].state == WAITING) {
+            assert(elems[i].node.when > now);
+            n_waiting++;
+        }
+    }
+    assert(timer_wheel_count(tw) == n_waiting);
+}
+
+/* Inserts elements with random deadlines, removes some of them, and then
+ * advances the wheel in steps of random size until every element expires. */
+static void
+test_random(long long int start)
+{
+    static struct element elems[N_ELEMS];
+    struct timer_wheel tw;
+    size_t n_reinserted;
+    long long int now;
+    size_t i;
+
+    timer_wheel_init(&tw, start);
+    for (i = 0; i < N_ELEMS; i++) {
+        /* A few of the deadlines have already passed. */
+        long long int when = start + random_range(MAX_DELAY) - 10;
+
+        elems[i].state = WAITING;
+        timer_wheel_insert(&tw, &elems[i].node, when);
+    }
+    for (i = 0; i < N_ELEMS; i += 7) {
+        timer_wheel_remove(&tw, &elems[i].node);
+        elems[i].state = REMOVED;
+    }
+    assert(timer_wheel_count(&tw) == N_ELEMS - (N_ELEMS + 6) / 7);
+
+    now = start;
+    n_reinserted = 0;
+    while (!timer_wheel_is_empty(&tw)) {
+        /* Mostly small steps, with an occasional long one. */
+        now += random_range(10) ? random_range(100) : random_range(100000);
+        advance_and_check(&tw, elems, now);
+
+        /* Keep inserting for a while as time passes. */
+        i = random_range(N_ELEMS);
+        if (elems[i].state != WAITING && n_reinserted < N_ELEMS) {
+            n_reinserted++;
+            elems[i].state = WAITING;
+            timer_wheel_insert(&tw, &elems[i].node,
+                               now + random_range(MAX_DELAY / 4));
+        }
+    }
+    for (i = 0; i < N_ELEMS; i++) {
+        assert(elems[i].state != WAITING);
+    }
+}
+
+/* Deadlines exactly on the boundaries of higher level slots. */
+static void
+test_boundaries(void)
+{
+    static struct element elems[N_ELEMS];
+    struct timer_wheel tw;
+    long long int now;
+    size_t i;
+
+    timer_wheel_init(&tw, 1);
+    for (i = 0; i < N_ELEMS; i++) {
+        int level = i % (TW_LEVELS + 1);
+        long long int when = (long long int) (i / (TW_LEVELS + 1) + 1)
+                             << (TW_BITS * level);
+
+        elems[i].state = WAITING;
+        timer_wheel_insert(&tw, &elems[i].node, when + i % 3 - 1);
+    }
+
+    for (now = 1; !timer_wheel_is_empty(&tw); now += 1 + now / 8) {
+        advance_and_check(&tw, elems, now);
+    }
+}
+
+int
+main(void)
+{
+    random_init();
+
+    test_random(0);
+    test_random(1234567);
+    test_boundaries();
+    return 0;
+}
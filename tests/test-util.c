@@ -45,6 +45,22 @@ check_ctz(uint32_t x, int n)
     }
 }
 
+static void
+check_popcount(uint32_t x)
+{
+    int n, i;
+
+    n = 0;
+    for (i = 0; i < 32; i++) {
+        n += (x & (1u << i)) != 0;
+    }
+    if (popcount(x) != n) {
+        fprintf(stderr, "popcount(%#"PRIx32") is %d but should be %d\n",
+                x, popcount(x), n);
+        abort();
+    }
+}
+
 /* Returns the sum of the squares of the first 'n' positive integers. */
 static unsigned int
 sum_of_squares(int n)
@@ -251,6 +267,14 @@ main(void)
      * (log_2_floor(0) is undefined.) */
     check_ctz(0, 32);
 
+    /* Check popcount() on some extremes and some random values. */
+    check_popcount(0);
+    check_popcount(UINT32_MAX);
+    for (n = 0; n < 32; n++) {
+        check_popcount(1u << n);
+        check_popcount(random_uint32());
+    }
+
     check_bitwise_copy();
 
     check_bitwise_zero();
@@ -27,6 +27,7 @@
 #include <sys/fcntl.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 
 #include "byte-order.h"
 #include "classifier.h"
@@ -35,6 +36,7 @@
 #include "compiler.h"
 #include "dirs.h"
 #include "dynamic-string.h"
+#include "fatal-signal.h"
 #include "netlink.h"
 #include "nx-match.h"
 #include "odp-util.h"
@@ -49,6 +51,7 @@
 #include "packets.h"
 #include "poll-loop.h"
 #include "random.h"
+#include "socket-util.h"
 #include "stream-ssl.h"
 #include "timeval.h"
 #include "unixctl.h"
@@ -67,6 +70,15 @@ static bool strict;
  * (to reset flow counters). */
 static bool readd;
 
+/* --bundle: If true, send the flow_mods for add-flows, mod-flows, del-flows,
+ * and replace-flows packed into NXT_FLOW_MOD_BATCH messages, so that the
+ * switch applies them together. */
+static bool bundle;
+
+/* --jobs: Number of processes that parse a large flow file, or 0 to use one
+ * per CPU. */
+static int n_jobs;
+
 /* -F, --flow-format: Allowed protocols.  By default, any protocol is
  * allowed. */
 static enum ofputil_protocol allowed_protocols = OFPUTIL_P_ANY;
@@ -105,6 +117,8 @@ parse_options(int argc, char *argv[])
         OPT_STRICT = UCHAR_MAX + 1,
         OPT_READD,
         OPT_TIMESTAMP,
+        OPT_BUNDLE,
+        OPT_JOBS,
         DAEMON_OPTION_ENUMS,
         VLOG_OPTION_ENUMS
     };
@@ -112,6 +126,8 @@ parse_options(int argc, char *argv[])
         {"timeout", required_argument, NULL, 't'},
         {"strict", no_argument, NULL, OPT_STRICT},
         {"readd", no_argument, NULL, OPT_READD},
+        {"bundle", no_argument, NULL, OPT_BUNDLE},
+        {"jobs", required_argument, NULL, OPT_JOBS},
         {"flow-format", required_argument, NULL, 'F'},
         {"packet-in-format", required_argument, NULL, 'P'},
         {"more", no_argument, NULL, 'm'},
@@ -183,6 +199,17 @@ parse_options(int argc, char *argv[])
             timestamp = true;
             break;
 
+        case OPT_BUNDLE:
+            bundle = true;
+            break;
+
+        case OPT_JOBS:
+            n_jobs = atoi(optarg);
+            if (n_jobs < 0) {
+                ovs_fatal(0, "value %s on --jobs is negative", optarg);
+            }
+            break;
+
         DAEMON_OPTION_HANDLERS
         VLOG_OPTION_HANDLERS
         STREAM_SSL_OPTION_HANDLERS
@@ -239,6 +266,8 @@ usage(void)
     printf("\nOther options:\n"
            "  --strict                    use strict match for flow commands\n"
            "  --readd                     replace flows that haven't changed\n"
+           "  --bundle                    send flow_mods as NXT_FLOW_MOD_BATCH\n"
+           "  --jobs=N                    parse large flow files in N processes\n"
            "  -F, --flow-format=FORMAT    force particular flow format\n"
            "  -P, --packet-in-format=FRMT force particular packet in format\n"
            "  -m, --more                  be more verbose printing OpenFlow\n"
@@ -453,6 +482,30 @@ transact_noreply(struct vconn *vconn, struct ofpbuf *request)
     transact_multiple_noreply(vconn, &requests);
 }
 
+/* Sends the flow_mods in 'requests' and waits for them to succeed or fail, as
+ * transact_multiple_noreply() does.  With --bundle, first packs them into as
+ * few NXT_FLOW_MOD_BATCH messages as possible.
+ *
+ * Destroys all of the 'requests'. */
+static void
+transact_flow_mods(struct vconn *vconn, struct list *requests)
+{
+    if (bundle) {
+        struct ofpbuf *request, *next;
+        struct list batches;
+
+        list_init(&batches);
+        LIST_FOR_EACH_SAFE (request, next, list_node, requests) {
+            list_remove(&request->list_node);
+            update_openflow_length(request);
+            ofputil_append_flow_mod_to_batch(&batches, request);
+        }
+        transact_multiple_noreply(vconn, &batches);
+    } else {
+        transact_multiple_noreply(vconn, requests);
+    }
+}
+
 static void
 fetch_switch_config(struct vconn *vconn, struct ofp_switch_config *config_)
 {
@@ -852,29 +905,389 @@ static void
 do_flow_mod__(const char *remote, struct ofputil_flow_mod *fms, size_t n_fms)
 {
     enum ofputil_protocol protocol;
+    struct list requests;
     struct vconn *vconn;
     size_t i;
 
     protocol = open_vconn_for_flow_mod(remote, fms, n_fms, &vconn);
 
+    list_init(&requests);
     for (i = 0; i < n_fms; i++) {
         struct ofputil_flow_mod *fm = &fms[i];
 
-        transact_noreply(vconn, ofputil_encode_flow_mod(fm, protocol));
+        list_push_back(&requests,
+                       &ofputil_encode_flow_mod(fm, protocol)->list_node);
         free(fm->actions);
     }
+    transact_flow_mods(vconn, &requests);
     vconn_close(vconn);
 }
 
+/* Parsing flow files.
+ *
+ * A large flow file is split into as many ranges of lines as there are
+ * --jobs, each of which is parsed by a child process.  Each child passes the
+ * flow_mods that it parses back to the parent through a pipe, as raw "struct
+ * ofputil_flow_mod"s each followed by its actions, which is safe because the
+ * child is a copy of the parent.  The parent reads from all of the pipes at
+ * once, so that no child waits for the parent, and passes the flow_mods along
+ * in the order that they appear in the file. */
+
+/* Flow files smaller than this are always parsed by a single process, and each
+ * child process parses at least half this much of a larger file. */
+#define PARALLEL_PARSE_MIN_BYTES (1024 * 1024)
+
+/* One child process parsing a range of lines in a flow file. */
+struct parse_job {
+    pid_t pid;                  /* Child process. */
+    int fd;                     /* Read end of pipe from child, or -1. */
+    struct ofpbuf output;       /* Data read from 'fd' but not yet used. */
+};
+
+/* Returns true if 'line', just read from a flow file, contains a flow, after
+ * deleting any comment from it.  (This is what ds_get_preprocessed_line()
+ * does for each line that it reads.) */
+static bool
+preprocess_flow_line(struct ds *line)
+{
+    char *s = ds_cstr(line);
+    char *comment;
+
+    comment = strchr(s, '#');
+    if (comment) {
+        *comment = '\0';
+    }
+    return s[strspn(s, " \t\n")] != '\0';
+}
+
+/* Returns the offset of the first line in 'stream' that starts at or after
+ * 'offset'. */
+static off_t
+find_line_start(FILE *stream, off_t offset)
+{
+    int c;
+
+    if (!offset) {
+        return 0;
+    }
+
+    if (fseeko(stream, offset - 1, SEEK_SET)) {
+        ovs_fatal(errno, "seek failed");
+    }
+    do {
+        c = getc(stream);
+    } while (c != '\n' && c != EOF);
+    return ftello(stream);
+}
+
+/* Runs in a child process.  Parses the lines in 'file_name' that begin at
+ * offsets 'start' up to 'end' with 'parse', writing the results to 'fd'. */
+static void
+parse_flow_file_range(const char *file_name, off_t start, off_t end,
+                      uint16_t command,
+                      void (*parse)(struct ofputil_flow_mod *, const char *,
+                                    uint16_t command),
+                      int fd)
+{
+    struct ofpbuf buf;
+    FILE *stream;
+    struct ds s;
+
+    /* Open the file again, because the stream inherited from the parent
+     * shares its file offset with the parent's and the other children's. */
+    stream = fopen(file_name, "r");
+    if (stream == NULL || fseeko(stream, start, SEEK_SET)) {
+        ovs_fatal(errno, "%s: open", file_name);
+    }
+
+    ofpbuf_init(&buf, 65536);
+    ds_init(&s);
+    while (ftello(stream) < end && !ds_get_line(&s, stream)) {
+        struct ofputil_flow_mod fm;
+
+        if (!preprocess_flow_line(&s)) {
+            continue;
+        }
+
+        parse(&fm, ds_cstr(&s), command);
+        ofpbuf_put(&buf, &fm, sizeof fm);
+        ofpbuf_put(&buf, fm.actions, fm.n_actions * sizeof *fm.actions);
+        free(fm.actions);
+
+        if (buf.size >= 65536 || ftello(stream) >= end) {
+            size_t bytes_written;
+            int error;
+
+            error = write_fully(fd, buf.data, buf.size, &bytes_written);
+            if (error) {
+                ovs_fatal(error, "write to parent process failed");
+            }
+            ofpbuf_clear(&buf);
+        }
+    }
+    if (buf.size) {
+        size_t bytes_written;
+        int error;
+
+        error = write_fully(fd, buf.data, buf.size, &bytes_written);
+        if (error) {
+            ovs_fatal(error, "write to parent process failed");
+        }
+    }
+    ds_destroy(&s);
+    ofpbuf_uninit(&buf);
+    fclose(stream);
+}
+
+/* Reads as much as possible from 'job''s pipe without blocking. */
+static void
+parse_job_read(struct parse_job *job)
+{
+    for (;;) {
+        struct ofpbuf *b = &job->output;
+        ssize_t retval;
+
+        if (ofpbuf_headroom(b) > b->size) {
+            memmove(b->base, b->data, b->size);
+            b->data = b->base;
+        }
+        ofpbuf_prealloc_tailroom(b, 65536);
+
+        retval = read(job->fd, ofpbuf_tail(b), ofpbuf_tailroom(b));
+        if (retval > 0) {
+            b->size += retval;
+        } else if (!retval) {
+            close(job->fd);
+            job->fd = -1;
+            return;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return;
+        } else if (errno != EINTR) {
+            ovs_fatal(errno, "read from parser process failed");
+        }
+    }
+}
+
+/* If 'b' begins with a complete flow_mod written by parse_flow_file_range(),
+ * removes it from 'b', stores it in '*fm', and returns true.  Otherwise,
+ * returns false. */
+static bool
+parse_job_pull(struct ofpbuf *b, struct ofputil_flow_mod *fm)
+{
+    size_t actions_len;
+
+    if (b->size < sizeof *fm) {
+        return false;
+    }
+    memcpy(fm, b->data, sizeof *fm);
+    actions_len = fm->n_actions * sizeof *fm->actions;
+    if (b->size < sizeof *fm + actions_len) {
+        return false;
+    }
+
+    ofpbuf_pull(b, sizeof *fm);
+    fm->actions = (actions_len
+                   ? xmemdup(ofpbuf_pull(b, actions_len), actions_len)
+                   : NULL);
+    return true;
+}
+
+/* Parses the 'size' bytes of flows in 'file_name', whose open stream is
+ * 'stream', in 'n' child processes.  See parse_flow_file() for the other
+ * parameters. */
+static void
+parse_flow_file_parallel(const char *file_name, FILE *stream, off_t size,
+                         size_t n, uint16_t command,
+                         void (*parse)(struct ofputil_flow_mod *,
+                                       const char *, uint16_t command),
+                         void (*cb)(struct ofputil_flow_mod *, void *aux),
+                         void *aux)
+{
+    struct parse_job *jobs;
+    off_t start;
+    size_t i;
+
+    jobs = xmalloc(n * sizeof *jobs);
+    start = 0;
+    for (i = 0; i < n; i++) {
+        struct parse_job *job = &jobs[i];
+        off_t end;
+        int fds[2];
+        int error;
+
+        end = i < n - 1 ? find_line_start(stream, size / n * (i + 1)) : size;
+        end = MAX(end, start);
+
+        xpipe(fds);
+        fflush(stdout);
+        fflush(stderr);
+        job->pid = fork();
+        if (job->pid < 0) {
+            ovs_fatal(errno, "fork failed");
+        } else if (!job->pid) {
+            size_t j;
+
+            /* Don't let the child run the parent's exit hooks, which could
+             * unlink files that the parent still uses. */
+            fatal_signal_fork();
+            time_postfork();
+            close(fds[0]);
+            for (j = 0; j < i; j++) {
+                close(jobs[j].fd);
+            }
+            parse_flow_file_range(file_name, start, end, command, parse,
+                                  fds[1]);
+            close(fds[1]);
+
+            /* Use _exit() so that stdio buffers inherited from the parent are
+             * not flushed a second time. */
+            _exit(EXIT_SUCCESS);
+        }
+
+        close(fds[1]);
+        error = set_nonblocking(fds[0]);
+        if (error) {
+            ovs_fatal(error, "set_nonblocking failed");
+        }
+        job->fd = fds[0];
+        ofpbuf_init(&job->output, 65536);
+        start = end;
+    }
+
+    i = 0;
+    while (i < n) {
+        struct ofputil_flow_mod fm;
+        size_t j;
+
+        for (j = i; j < n; j++) {
+            if (jobs[j].fd >= 0) {
+                parse_job_read(&jobs[j]);
+            }
+        }
+
+        /* Pass along flow_mods from the first unfinished job, then move on to
+         * the next job if this one is done. */
+        for (; i < n; i++) {
+            struct parse_job *job = &jobs[i];
+            int status;
+
+            while (parse_job_pull(&job->output, &fm)) {
+                cb(&fm, aux);
+            }
+            if (job->fd >= 0) {
+                break;
+            }
+
+            if (waitpid(job->pid, &status, 0) < 0) {
+                ovs_fatal(errno, "waitpid failed");
+            } else if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+                /* The child has already reported the problem. */
+                exit(EXIT_FAILURE);
+            } else if (job->output.size) {
+                ovs_fatal(0, "parser process sent truncated output");
+            }
+            ofpbuf_uninit(&job->output);
+        }
+
+        if (i < n) {
+            for (j = i; j < n; j++) {
+                if (jobs[j].fd >= 0) {
+                    poll_fd_wait(jobs[j].fd, POLLIN);
+                }
+            }
+            poll_block();
+        }
+    }
+    free(jobs);
+}
+
+/* Parses each line in 'file_name' (or stdin, if 'file_name' is "-") that
+ * contains a flow, with 'parse', which must parse its string argument into a
+ * flow_mod for 'command' or exit with an error.  Passes each flow_mod, in the
+ * order in which they appear in the file, to 'cb' along with 'aux'.  'cb' owns
+ * the flow_mod's actions.
+ *
+ * A large regular file is parsed in several processes at once, per --jobs. */
+static void
+parse_flow_file(const char *file_name, uint16_t command,
+                void (*parse)(struct ofputil_flow_mod *, const char *,
+                              uint16_t command),
+                void (*cb)(struct ofputil_flow_mod *, void *aux), void *aux)
+{
+    struct stat st;
+    FILE *stream;
+    size_t n;
+
+    stream = !strcmp(file_name, "-") ? stdin : fopen(file_name, "r");
+    if (stream == NULL) {
+        ovs_fatal(errno, "%s: open", file_name);
+    }
+
+    n = 1;
+    if (stream != stdin && !fstat(fileno(stream), &st)
+        && S_ISREG(st.st_mode) && st.st_size >= PARALLEL_PARSE_MIN_BYTES) {
+        long int n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        n = n_jobs ? n_jobs : MAX(n_cpus, 1);
+        n = MIN(n, st.st_size / (PARALLEL_PARSE_MIN_BYTES / 2));
+    }
+
+    if (n > 1) {
+        parse_flow_file_parallel(file_name, stream, st.st_size, n, command,
+                                 parse, cb, aux);
+    } else {
+        struct ds s;
+
+        ds_init(&s);
+        while (!ds_get_preprocessed_line(&s, stream)) {
+            struct ofputil_flow_mod fm;
+
+            parse(&fm, ds_cstr(&s), command);
+            cb(&fm, aux);
+        }
+        ds_destroy(&s);
+    }
+
+    if (stream != stdin) {
+        fclose(stream);
+    }
+}
+
+/* An array of flow_mods. */
+struct flow_mod_array {
+    struct ofputil_flow_mod *fms;
+    size_t n_fms, allocated_fms;
+};
+
+static void
+parse_flow_mod_line(struct ofputil_flow_mod *fm, const char *string,
+                    uint16_t command)
+{
+    parse_ofp_flow_mod_str(fm, string, command, false);
+}
+
+static void
+append_flow_mod(struct ofputil_flow_mod *fm, void *fma_)
+{
+    struct flow_mod_array *fma = fma_;
+
+    if (fma->n_fms >= fma->allocated_fms) {
+        fma->fms = x2nrealloc(fma->fms, &fma->allocated_fms,
+                              sizeof *fma->fms);
+    }
+    fma->fms[fma->n_fms++] = *fm;
+}
+
 static void
 do_flow_mod_file(int argc OVS_UNUSED, char *argv[], uint16_t command)
 {
-    struct ofputil_flow_mod *fms = NULL;
-    size_t n_fms = 0;
+    struct flow_mod_array fma;
 
-    parse_ofp_flow_mod_file(argv[2], command, &fms, &n_fms);
-    do_flow_mod__(argv[1], fms, n_fms);
-    free(fms);
+    memset(&fma, 0, sizeof fma);
+    parse_flow_file(argv[2], command, parse_flow_mod_line,
+                    append_flow_mod, &fma);
+    do_flow_mod__(argv[1], fma.fms, fma.n_fms);
+    free(fma.fms);
 }
 
 static void
@@ -1589,48 +2002,54 @@ fte_insert(struct classifier *cls, const struct cls_rule *rule,
     }
 }
 
-/* Reads the flows in 'filename' as flow table entries in 'cls' for the version
- * with the specified 'index'.  Returns the flow formats able to represent the
- * flows that were read. */
-static enum ofputil_protocol
-read_flows_from_file(const char *filename, struct classifier *cls, int index)
-{
+/* Context for read_flows_from_file(). */
+struct read_flows_aux {
+    struct classifier *cls;
+    int index;
     enum ofputil_protocol usable_protocols;
-    struct ds s;
-    FILE *file;
+};
 
-    file = !strcmp(filename, "-") ? stdin : fopen(filename, "r");
-    if (file == NULL) {
-        ovs_fatal(errno, "%s: open", filename);
-    }
+static void
+parse_flow_line(struct ofputil_flow_mod *fm, const char *string,
+                uint16_t command)
+{
+    parse_ofp_str(fm, command, string, true);
+}
 
-    ds_init(&s);
-    usable_protocols = OFPUTIL_P_ANY;
-    while (!ds_get_preprocessed_line(&s, file)) {
-        struct fte_version *version;
-        struct ofputil_flow_mod fm;
+static void
+insert_flow_version(struct ofputil_flow_mod *fm, void *aux_)
+{
+    struct read_flows_aux *aux = aux_;
+    struct fte_version *version;
 
-        parse_ofp_str(&fm, OFPFC_ADD, ds_cstr(&s), true);
+    version = xmalloc(sizeof *version);
+    version->cookie = fm->new_cookie;
+    version->idle_timeout = fm->idle_timeout;
+    version->hard_timeout = fm->hard_timeout;
+    version->flags = fm->flags & (OFPFF_SEND_FLOW_REM | OFPFF_EMERG);
+    version->actions = fm->actions;
+    version->n_actions = fm->n_actions;
 
-        version = xmalloc(sizeof *version);
-        version->cookie = fm.new_cookie;
-        version->idle_timeout = fm.idle_timeout;
-        version->hard_timeout = fm.hard_timeout;
-        version->flags = fm.flags & (OFPFF_SEND_FLOW_REM | OFPFF_EMERG);
-        version->actions = fm.actions;
-        version->n_actions = fm.n_actions;
+    aux->usable_protocols &= ofputil_usable_protocols(&fm->cr);
 
-        usable_protocols &= ofputil_usable_protocols(&fm.cr);
+    fte_insert(aux->cls, &fm->cr, version, aux->index);
+}
 
-        fte_insert(cls, &fm.cr, version, index);
-    }
-    ds_destroy(&s);
+/* Reads the flows in 'filename' as flow table entries in 'cls' for the version
+ * with the specified 'index'.  Returns the flow formats able to represent the
+ * flows that were read. */
+static enum ofputil_protocol
+read_flows_from_file(const char *filename, struct classifier *cls, int index)
+{
+    struct read_flows_aux aux;
 
-    if (file != stdin) {
-        fclose(file);
-    }
+    aux.cls = cls;
+    aux.index = index;
+    aux.usable_protocols = OFPUTIL_P_ANY;
+    parse_flow_file(filename, OFPFC_ADD, parse_flow_line,
+                    insert_flow_version, &aux);
 
-    return usable_protocols;
+    return aux.usable_protocols;
 }
 
 /* Reads the OpenFlow flow table from 'vconn', which has currently active flow
@@ -1790,7 +2209,7 @@ do_replace_flows(int argc OVS_UNUSED, char *argv[])
             fte_make_flow_mod(fte, FILE_IDX, OFPFC_ADD, protocol, &requests);
         }
     }
-    transact_multiple_noreply(vconn, &requests);
+    transact_flow_mods(vconn, &requests);
     vconn_close(vconn);
 
     fte_free_all(&cls);
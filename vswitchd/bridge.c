@@ -36,6 +36,7 @@
 #include "meta-flow.h"
 #include "netdev.h"
 #include "ofp-print.h"
+#include "ofp-util.h"
 #include "ofpbuf.h"
 #include "ofproto/ofproto.h"
 #include "poll-loop.h"
@@ -186,6 +187,7 @@ static void bridge_configure_flow_eviction_threshold(struct bridge *);
 static void bridge_configure_netflow(struct bridge *);
 static void bridge_configure_forward_bpdu(struct bridge *);
 static void bridge_configure_mac_idle_time(struct bridge *);
+static void bridge_configure_mac_table(struct bridge *);
 static void bridge_configure_sflow(struct bridge *, int *sflow_bridge_number);
 static void bridge_configure_stp(struct bridge *);
 static void bridge_configure_tables(struct bridge *);
@@ -540,6 +542,7 @@ bridge_reconfigure_continue(const struct ovsrec_open_vswitch *ovs_cfg)
         bridge_configure_flow_eviction_threshold(br);
         bridge_configure_forward_bpdu(br);
         bridge_configure_mac_idle_time(br);
+        bridge_configure_mac_table(br);
         bridge_configure_remotes(br, managers, n_managers);
         bridge_configure_netflow(br);
         bridge_configure_sflow(br, &sflow_bridge_number);
@@ -1464,6 +1467,21 @@ bridge_configure_mac_idle_time(struct bridge *br)
     ofproto_set_mac_idle_time(br->ofproto, idle_time);
 }
 
+/* Set MAC learning table size for 'br'. */
+static void
+bridge_configure_mac_table(struct bridge *br)
+{
+    const char *mac_table_size_str;
+    int mac_table_size;
+
+    mac_table_size_str = ovsrec_bridge_get_other_config_value(
+        br->cfg, "mac-table-size", NULL);
+    mac_table_size = (mac_table_size_str && atoi(mac_table_size_str) > 0
+                      ? atoi(mac_table_size_str)
+                      : MAC_DEFAULT_MAX);
+    ofproto_set_mac_table_size(br->ofproto, mac_table_size);
+}
+
 static void
 bridge_pick_local_hw_addr(struct bridge *br, uint8_t ea[ETH_ADDR_LEN],
                           struct iface **hw_addr_iface)
@@ -2585,9 +2603,63 @@ bridge_ofproto_controller_for_mgmt(const struct bridge *br,
     oc->band = OFPROTO_OUT_OF_BAND;
     oc->rate_limit = 0;
     oc->burst_limit = 0;
+    oc->packet_in_queue_depth = 0;
+    oc->pin_weights = NULL;
+    oc->n_pin_weights = 0;
+    oc->n_packet_buffers = 0;
     oc->enable_async_msgs = true;
 }
 
+/* Parses the "packet-in-weight-*" keys in 'c''s other_config into 'oc'.  The
+ * caller must eventually free 'oc->pin_weights'. */
+static void
+bridge_ofproto_controller_pin_weights(const struct ovsrec_controller *c,
+                                      struct ofproto_controller *oc)
+{
+    static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(1, 5);
+    size_t i;
+
+    oc->pin_weights = xmalloc(c->n_other_config * sizeof *oc->pin_weights);
+    oc->n_pin_weights = 0;
+    for (i = 0; i < c->n_other_config; i++) {
+        const char *key = c->key_other_config[i];
+        struct pinsched_weight *w = &oc->pin_weights[oc->n_pin_weights];
+        enum ofp_packet_in_reason reason;
+        unsigned int id;
+        int weight;
+
+        if (strncmp(key, "packet-in-weight-", 17)) {
+            continue;
+        }
+        key += 17;
+
+        if (!strncmp(key, "reason-", 7)
+            && ofputil_packet_in_reason_from_string(key + 7, &reason)) {
+            w->type = PINSCHED_REASON;
+            w->id = reason;
+        } else if (sscanf(key, "table-%u", &id) == 1 && id <= UINT8_MAX) {
+            w->type = PINSCHED_TABLE;
+            w->id = id;
+        } else if (sscanf(key, "port-%u", &id) == 1 && id <= UINT16_MAX) {
+            w->type = PINSCHED_PORT;
+            w->id = id;
+        } else {
+            VLOG_WARN_RL(&rl, "controller %s: unknown other_config key "
+                         "packet-in-weight-%s", c->target, key);
+            continue;
+        }
+
+        weight = atoi(c->value_other_config[i]);
+        if (weight < 1) {
+            VLOG_WARN_RL(&rl, "controller %s: packet-in-weight-%s must be a "
+                         "positive integer", c->target, key);
+            continue;
+        }
+        w->weight = weight;
+        oc->n_pin_weights++;
+    }
+}
+
 /* Converts ovsrec_controller 'c' into an ofproto_controller in 'oc'.  */
 static void
 bridge_ofproto_controller_from_ovsrec(const struct ovsrec_controller *c,
@@ -2603,6 +2675,13 @@ bridge_ofproto_controller_from_ovsrec(const struct ovsrec_controller *c,
     oc->rate_limit = c->controller_rate_limit ? *c->controller_rate_limit : 0;
     oc->burst_limit = (c->controller_burst_limit
                        ? *c->controller_burst_limit : 0);
+    config_str = ovsrec_controller_get_other_config_value(
+        c, "packet-in-queue-depth", NULL);
+    oc->packet_in_queue_depth = config_str ? MAX(atoi(config_str), 0) : 0;
+    bridge_ofproto_controller_pin_weights(c, oc);
+    config_str = ovsrec_controller_get_other_config_value(
+        c, "packet-buffers", NULL);
+    oc->n_packet_buffers = config_str ? MAX(atoi(config_str), 0) : 0;
     oc->enable_async_msgs = (!c->enable_async_messages
                              || *c->enable_async_messages);
     config_str = ovsrec_controller_get_other_config_value(c, "dscp", NULL);
@@ -2763,6 +2842,9 @@ bridge_configure_remotes(struct bridge *br,
 
     ofproto_set_controllers(br->ofproto, ocs, n_ocs);
     free(ocs[0].target); /* From bridge_ofproto_controller_for_mgmt(). */
+    for (i = 0; i < n_ocs; i++) {
+        free(ocs[i].pin_weights);
+    }
     free(ocs);
 
     /* Set the fail-mode. */
@@ -3087,6 +3169,21 @@ port_configure_bond(struct port *port, struct bond_settings *s,
     if (s->rebalance_interval && s->rebalance_interval < 1000) {
         s->rebalance_interval = 1000;
     }
+    s->rebalance_max_shifts = MAX(0, atoi(
+        ovsrec_port_get_other_config_value(port->cfg,
+                                           "bond-rebalance-max-shifts",
+                                           "64")));
+
+    s->n_hashes = atoi(ovsrec_port_get_other_config_value(port->cfg,
+                                                          "bond-hashes",
+                                                          "256"));
+    if (!IS_POW2(s->n_hashes)
+        || s->n_hashes < BOND_MIN_HASHES || s->n_hashes > BOND_MAX_HASHES) {
+        VLOG_WARN("port %s: bond-hashes must be a power of 2 between %d and "
+                  "%d, defaulting to %d", port->name, BOND_MIN_HASHES,
+                  BOND_MAX_HASHES, BOND_DEFAULT_HASHES);
+        s->n_hashes = BOND_DEFAULT_HASHES;
+    }
 
     s->fake_iface = port->cfg->bond_fake_iface;
 
@@ -36,6 +36,7 @@
 #include "leak-checker.h"
 #include "memory.h"
 #include "netdev.h"
+#include "ofpbuf.h"
 #include "openflow/openflow.h"
 #include "ovsdb-idl.h"
 #include "poll-loop.h"
@@ -101,6 +102,7 @@ main(int argc, char *argv[])
 
             simap_init(&usage);
             bridge_get_memory_usage(&usage);
+            ofpbuf_get_memory_usage(&usage);
             memory_report(&usage);
             simap_destroy(&usage);
         }